@@ -105,6 +105,24 @@ typedef struct rpc_client {
 
 		/* the ioctl() of rpc */
 		 bool(*cl_control) (struct rpc_client *, u_int, void *);
+
+		/* call several, completing each by cc_process_cb;
+		 * NULL: cl_call each */
+		int (*cl_callv) (struct clnt_req **, int);
+
+		/* connection for a new request, ref+1; NULL: this one */
+		struct rpc_client *(*cl_pick) (struct rpc_client *);
+
+		/* retransmit timeout (us), doubled by backoff;
+		 * 0 or NULL: send once per attempt */
+		u_int (*cl_rto) (struct rpc_client *, bool);
+
+		/* round trip (us) of a call sent once */
+		void (*cl_rtt) (struct rpc_client *, u_int);
+
+		/* receive on the calling thread until cc_process_cb or the
+		 * deadline; EAGAIN or NULL: wait for cc_process_cb */
+		int (*cl_wait) (struct clnt_req *, const struct timespec *);
 	} *cl_ops;
 
 	char *cl_netid;		/* network token */
@@ -121,8 +139,14 @@ typedef struct rpc_client {
 
 #define CLNT_REQ_FLAG_NONE	0x0000
 #define CLNT_REQ_FLAG_EXPIRING	0x0001
+#define CLNT_REQ_FLAG_SLOT	0x0002	/* holds a call slot */
 #define CLNT_REQ_FLAG_BACKSYNC	0x0004
 #define CLNT_REQ_FLAG_ACKSYNC	0x0008
+#define CLNT_REQ_FLAG_SLOTQ	0x0010	/* waiting for a call slot */
+#define CLNT_REQ_FLAG_SLOTWAIT	0x0020	/* ... in CLNT_CALL_WAIT() */
+#define CLNT_REQ_FLAG_SENT	0x0040	/* given to the transport */
+#define CLNT_REQ_FLAG_WAKEUP	0x0080	/* CLNT_CALL_WAIT() completed */
+#define CLNT_REQ_FLAG_DIRECT	0x0100	/* ... will receive in cl_wait */
 
 /*
  * RPC context.  Intended to enable efficient multiplexing of calls
@@ -150,6 +174,10 @@ struct clnt_req {
 	uint32_t cc_xid;
 	uint32_t cc_refs;
 	uint16_t cc_flags;
+	TAILQ_ENTRY(clnt_req) cc_slotq;
+	struct timespec cc_sent;	/* given a slot */
+	struct clnt_cq *cc_cq;
+	struct poolq_entry cc_cqe;
 };
 
 /*
@@ -267,6 +295,43 @@ struct rpc_timers {
 #define CLSET_SVC_ADDR  16	/* get server's address (netbuf) */
 #define CLSET_PUSH_TIMOD 17	/* push timod if not already present */
 #define CLSET_POP_TIMOD  18	/* pop timod */
+#define CLGET_RTT  19		/* get retransmit estimator (struct clnt_rtt) */
+#define CLSET_RTT  20		/* enable, seed or reset retransmit estimator */
+#define CLGET_SLOTS  21		/* get call slots (struct clnt_slots) */
+#define CLSET_SLOTS  22		/* set call slot bounds */
+
+/*
+ * Datagram retransmit estimator (Jacobson/Karn), in microseconds.
+ * Calls are sent once per attempt until CLSET_RTT sets rto_min and
+ * rto_max (eg, 200000 and 60000000); a zero rto_max turns it off again.
+ * srtt is zero until the first sample; CLSET_RTT with a zero srtt
+ * restarts from the initial timeout.  The counters are read-only.
+ */
+struct clnt_rtt {
+	uint32_t srtt;		/* smoothed round trip */
+	uint32_t rttvar;	/* round trip variation */
+	uint32_t rto;		/* retransmit timeout */
+	uint32_t rto_min;
+	uint32_t rto_max;
+	uint32_t samples;
+	uint32_t retransmits;
+};
+
+/*
+ * CLGET_SLOTS, CLSET_SLOTS: calls outstanding on the connection.
+ * Unlimited (all zero) unless svc_init_params clnt_slots_max or
+ * CLSET_SLOTS sets bounds.  Calls beyond the limit wait in order for
+ * a slot.  The limit starts at min, and adapts between min and max to
+ * the reply latency.  CLSET_SLOTS sets min and max; the others are
+ * read-only.
+ */
+struct clnt_slots {
+	u_int limit;
+	u_int min;
+	u_int max;
+	u_int used;
+	u_int waiting;
+};
 
 /* Protect a CLIENT with a CLNT_REF for each call or request.
  */
@@ -483,7 +548,20 @@ extern CLIENT *clnt_tli_ncreate(const int, const struct netconfig *,
 #define CLNT_CREATE_FLAG_SVCXPRT	0x40000000
 #define CLNT_CREATE_FLAG_XPRT_DOREG	SVC_CREATE_FLAG_XPRT_DOREG
 #define CLNT_CREATE_FLAG_XPRT_NOREG	SVC_CREATE_FLAG_XPRT_NOREG
+#define CLNT_CREATE_FLAG_TLS		SVC_CREATE_FLAG_TLS
+#define CLNT_CREATE_FLAG_RECONNECT	0x01000000
+#define CLNT_CREATE_FLAG_DIRECT		0x00800000
 
+/*
+ * CLNT_CREATE_FLAG_RECONNECT: when its connection fails, the handle
+ * connects again to raddr (backing off), then resends the calls still
+ * awaiting replies, with their xids.  These fail only at their timeouts.
+ *
+ * CLNT_CREATE_FLAG_DIRECT: a CLNT_CALL_WAIT() alone on its connection
+ * receives its reply on the calling thread, rather than being woken by
+ * the event channel.  Records that arrive meanwhile (eg, replies to
+ * calls made by other threads) are dispatched on that thread too.
+ */
 extern CLIENT *clnt_vc_ncreatef(const int, const struct netbuf *,
 				const rpcprog_t, const rpcvers_t,
 				const u_int, const u_int, const uint32_t);
@@ -509,6 +587,39 @@ extern CLIENT *clnt_vc_ncreate_svc(const SVCXPRT *, const rpcprog_t,
  *      const uint32_t flags;                   -- flags
  */
 
+/*
+ * Client handle over several connections to the same server (nconnect).
+ * clnt_req_setup() moves each request (cc_clnt) to the connection with
+ * the fewest outstanding, carrying over cl_u1 and cl_u2.  Failed
+ * connections are replaced in the background.
+ */
+extern CLIENT *clnt_nconn_ncreatef(const struct netbuf *, const rpcprog_t,
+				   const rpcvers_t, const u_int, const u_int,
+				   const u_int, const uint32_t);
+/*
+ * const struct netbuf *svcaddr;  -- servers address
+ * const rpcprog_t program;  -- program number
+ * const rpcvers_t version;  -- version number
+ * const u_int sendsz;   -- buffer send size
+ * const u_int recvsz;   -- buffer recv size
+ * const u_int nconn;   -- connections, 0 => 1
+ * const uint32_t flags;   -- as clnt_vc_ncreatef, e.g. TLS
+ */
+
+/*
+ * Low level clnt create routine for same host shared memory rings.
+ */
+extern CLIENT *clnt_shm_ncreatef(const int, const rpcprog_t, const rpcvers_t,
+				 const u_int, const u_int, const uint32_t);
+/*
+ * const int fd;    -- connected AF_LOCAL stream socket (svc_shm_ncreatef)
+ * const rpcprog_t program;  -- program number
+ * const rpcvers_t version;  -- version number
+ * const u_int sendsz;   -- call ring size, 0 => default
+ * const u_int recvsz;   -- reply ring size, 0 => default
+ * const uint32_t flags;   -- CLNT_CREATE_FLAG_CLOSE closes fd
+ */
+
 /*
  * Low level clnt create routine for connectionless transports, e.g. udp.
  */
@@ -584,6 +695,26 @@ enum clnt_stat clnt_req_setup(struct clnt_req *, struct timespec);
 enum clnt_stat clnt_req_wait_reply(struct clnt_req *);
 int clnt_req_release(struct clnt_req *);
 
+/*
+ * Client completion queue
+ *
+ * clnt_req_submit() sends a vector of requests, each filled and set up
+ * as for CLNT_CALL_BACK().  Consecutive requests on the same connection
+ * are encoded together and written at once.  Every request is completed
+ * on the queue exactly once, with its reply or error in cc_error.
+ *
+ * The descriptor from clnt_cq_fd() is readable while completions are
+ * queued; clnt_cq_dequeue() takes up to max of them without waiting.
+ * The caller still holds its reference on each dequeued request.
+ */
+struct clnt_cq;
+
+struct clnt_cq *clnt_cq_create(void);
+void clnt_cq_destroy(struct clnt_cq *);
+int clnt_cq_fd(struct clnt_cq *);
+int clnt_cq_dequeue(struct clnt_cq *, struct clnt_req **, int);
+int clnt_req_submit(struct clnt_cq *, struct clnt_req **, int);
+
 __END_DECLS
 /*
  * Used by rpc_perror() and rpc_sperror()
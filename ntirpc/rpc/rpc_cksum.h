@@ -45,8 +45,38 @@
 #ifndef RPC_CKSUM_H
 #define RPC_CKSUM_H
 
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/cdefs.h>
+#include <sys/types.h>
+
+/* request checksum algorithms (SVCSET_XP_CHECKSUM) */
+enum rpc_cksum_type {
+	RPC_CKSUM_CITYHASH = 0,	/* CityHash64, default */
+	RPC_CKSUM_CRC32C,	/* crc32c, hardware where available */
+	RPC_CKSUM_CRC32C_SW,	/* crc32c, table-driven */
+};
+
+/* or'd with the type: crc32c over the arguments of each call, after its
+ * verifier, summed as they are received (CityHash64 selects the hardware
+ * crc32c).  RPCSEC_GSS arguments are summed once they are unwrapped.
+ */
+#define RPC_CKSUM_FULL		0x80
+#define RPC_CKSUM_TYPE(t)	((t) & ~RPC_CKSUM_FULL)
+
+__BEGIN_DECLS
 /* table-driven, software crc32c */
 uint32_t calculate_crc32c(uint32_t crc32c, const unsigned char *buffer,
 			  unsigned int length);
 
+/* crc32c, using the SSE4.2 or ARMv8 crc32c instructions when the CPU
+ * has them (chosen on first use), otherwise calculate_crc32c().
+ * Like calculate_crc32c(), no pre or post inversion.
+ */
+extern uint32_t rpc_crc32c(uint32_t, const void *, size_t);
+extern const char *rpc_crc32c_impl(void);
+
+extern uint64_t rpc_cksum(enum rpc_cksum_type, const void *, size_t);
+__END_DECLS
+
 #endif				/* RPC_CKSUM_H */
@@ -0,0 +1,68 @@
+/*
+ * Copyright (c) 2018 Red Hat, Inc. and/or its affiliates.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR `AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/**
+ * @file rpc_tls.h
+ * @brief RPC-over-TLS (RFC 9289)
+ *
+ * @section DESCRIPTION
+ *
+ * Built with USE_TLS.  A client created with CLNT_CREATE_FLAG_TLS sends
+ * the AUTH_TLS probe, and a listener created with SVC_CREATE_FLAG_TLS
+ * answers it with STARTTLS.  The TLS 1.3 handshake is done by OpenSSL,
+ * which installs the session keys in kernel TLS, so the transport sends
+ * and receives plain RPC records on the encrypted socket.
+ *
+ * Clients verify the server's certificate, against ca_file or the system
+ * trust store, and its name: server_name, else the address connected to.
+ *
+ * The server does not require TLS; SVCGET_XP_TLS tells whether it is in
+ * use on a connection.
+ */
+
+#ifndef TIRPC_RPC_TLS_H
+#define TIRPC_RPC_TLS_H
+
+#include <rpc/types.h>
+
+typedef struct rpc_tls_params {
+	const char *cert_file;	/* PEM chain, required to serve */
+	const char *key_file;	/* PEM private key */
+	const char *ca_file;	/* trust anchors, or NULL for the system's */
+	u_int timeout;		/* probe and handshake, seconds, default 10 */
+	const char *server_name;	/* clients verify, else the address */
+	u_int flags;
+} rpc_tls_params;
+
+/* rpc_tls_params flags */
+#define RPC_TLS_FLAG_NONE	0x0000
+#define RPC_TLS_FLAG_NO_VERIFY	0x0001	/* clients accept any server */
+
+__BEGIN_DECLS
+extern bool rpc_tls_init(rpc_tls_params *);
+extern void rpc_tls_shutdown(void);
+__END_DECLS
+
+#endif				/* TIRPC_RPC_TLS_H */
@@ -49,6 +49,7 @@
  * success = rpcb_gettime(host, timep)
  * uaddr = rpcb_taddr2uaddr(nconf, taddr);
  * taddr = rpcb_uaddr2uaddr(nconf, uaddr);
+ * rpcb_cache_stats(&stats);
  */
 
 #ifndef _RPC_RPCB_CLNT_H
@@ -60,6 +61,17 @@
 #include <rpc/types.h>
 #include <rpc/rpcb_prot.h>
 
+/* addresses found with rpcbind, see svc_init_params rpcb_cache_* */
+struct rpcb_cache_stats {
+	uint64_t hits;
+	uint64_t negative_hits;	/* failed lookup repeated */
+	uint64_t misses;	/* asked rpcbind */
+	uint64_t refreshes;	/* asked rpcbind before expiry */
+	uint64_t expired;	/* over ttl */
+	uint64_t evicted;	/* over rpcb_cache_max */
+	uint64_t entries;
+};
+
 __BEGIN_DECLS
 extern bool rpcb_set(const rpcprog_t, const rpcvers_t,
 		     const struct netconfig *,
@@ -79,5 +91,6 @@ extern bool rpcb_getaddr(const rpcprog_t, const rpcvers_t,
 extern bool rpcb_gettime(const char *, time_t *);
 extern char *rpcb_taddr2uaddr(struct netconfig *, struct netbuf *);
 extern struct netbuf *rpcb_uaddr2taddr(struct netconfig *, char *);
+extern void rpcb_cache_stats(struct rpcb_cache_stats *);
 __END_DECLS
 #endif				/* !_RPC_RPCB_CLNT_H */
@@ -103,6 +103,10 @@ enum xprt_stat {
 #define SVCSET_XP_FLAGS         8
 #define SVCGET_XP_FREE_USER_DATA        15
 #define SVCSET_XP_FREE_USER_DATA        16
+#define SVCGET_XP_CHECKSUM      17	/* enum rpc_cksum_type */
+#define SVCSET_XP_CHECKSUM      18
+#define SVCGET_XP_TLS           19	/* bool, kernel TLS in use */
+#define SVCSET_XP_QUIESCE       20	/* idle, release receive buffers */
 
 /*
  * Operations for rpc_control().
@@ -117,6 +121,20 @@ enum xprt_stat {
 typedef enum xprt_stat (*svc_xprt_fun_t) (SVCXPRT *);
 typedef enum xprt_stat (*svc_xprt_xdr_fun_t) (SVCXPRT *, XDR *);
 
+/* Header-split receive hint: passed the leading bytes of a record,
+ * returns the record offset of its bulk opaque data (0 for none).
+ * The offset must be XDR aligned.
+ */
+typedef u_int (*svc_xprt_split_fun_t) (SVCXPRT *, const uint8_t *, u_int);
+
+/* Streaming dispatch hint: passed the leading bytes of a large record,
+ * returns the bytes (RPC header and program prefix) needed before the
+ * record is dispatched, or 0 to wait for the whole record.  Called again
+ * as more arrives, while the returned length has not been received.
+ * Decoding past the received data waits for it.
+ */
+typedef u_int (*svc_xprt_stream_fun_t) (SVCXPRT *, const uint8_t *, u_int);
+
 typedef struct svc_init_params {
 	svc_xprt_fun_t disconnect_cb;
 	svc_xprt_xdr_fun_t request_cb;
@@ -133,6 +151,21 @@ typedef struct svc_init_params {
 	u_int gss_max_gc;
 	uint32_t channels;
 	int32_t idle_timeout;
+	svc_xprt_split_fun_t split_cb;	/* optional, enables header-split */
+	u_int split_hdr_size;	/* bytes passed to split_cb */
+	u_int split_bsize;	/* bulk buffer size, multiple of pagesize */
+	u_int split_pool_max;	/* bulk buffers retained for reuse */
+	svc_xprt_stream_fun_t stream_cb;	/* optional, streaming dispatch */
+	u_int stream_min;	/* smallest record passed to stream_cb */
+	u_int ioq_coalesce_max;	/* replies per send, 1 disables coalescing */
+	u_int ioq_coalesce_window;	/* usec to wait for more replies */
+	int32_t idle_quiesce;	/* seconds idle before SVCSET_XP_QUIESCE */
+	u_int clnt_slots_min;	/* client calls per connection, initial */
+	u_int clnt_slots_max;	/* ... adaptive limit, 0 unlimited */
+	u_int clnt_cache_max;	/* rpc_call() handles kept, process-wide */
+	u_int rpcb_cache_max;	/* rpcbind addresses kept, process-wide */
+	u_int rpcb_cache_ttl;	/* seconds, refreshed in the last quarter */
+	u_int rpcb_cache_neg_ttl;	/* seconds "not found" is kept */
 } svc_init_params;
 
 /* Svc param flags */
@@ -189,7 +222,9 @@ typedef enum xprt_type {
 	XPRT_RDMA,
 	XPRT_RDMA_RENDEZVOUS,
 	XPRT_VSOCK,
-	XPRT_VSOCK_RENDEZVOUS
+	XPRT_VSOCK_RENDEZVOUS,
+	XPRT_SHM,
+	XPRT_SHM_RENDEZVOUS
 } xprt_type_t;
 
 struct SVCAUTH;			/* forward decl. */
@@ -225,6 +260,9 @@ struct svc_xprt {
 
 		/* free client user data */
 		svc_xprt_fun_t xp_free_user_data;
+
+		/* optional wakeup of waiters, by SVC_DESTROY() */
+		void (*xp_destroying) (SVCXPRT *);
 	} *xp_ops;
 
 	/* handle incoming connections (per xp_fd) */
@@ -234,16 +272,36 @@ struct svc_xprt {
 	}  xp_dispatch;
 	SVCXPRT *xp_parent;
 
-	char *xp_tp;		/* transport provider device name */
-	char *xp_netid;		/* network token */
-
 	void *xp_p1;		/* private: for use by svc ops */
 	void *xp_p2;		/* private: for use by svc ops */
 	void *xp_p3;		/* private: for use by svc lib */
 	void *xp_u1;		/* client user data */
 	void *xp_u2;		/* client user data */
 
-	struct rpc_address xp_local;	/* local address, length, port */
+	int xp_fd;
+	int xp_ifindex;		/* interface index */
+	int xp_si_type;		/* si type */
+	int xp_type;		/* xprt type */
+	uint8_t xp_cksum;	/* xp_checksum algorithm, inherited */
+
+	char *xp_tp;		/* transport provider device name */
+	char *xp_netid;		/* network token */
+
+	/* Above are read on every event and request, and set only while
+	 * creating the transport.  Below, written by every SVC_REF() and
+	 * SVC_RELEASE() from any thread, on their own cache line.
+	 * See svc_xprt.c for the layout checks.
+	 */
+	uint32_t xp_refs	/* handle reference count */
+		__attribute__ ((aligned(CACHE_LINE_SIZE)));
+	uint16_t xp_flags;	/* flags */
+
+	/* serialize private data */
+	mutex_t xp_lock;
+
+	/* read per request by some programs, set once */
+	struct rpc_address xp_local	/* local address, length, port */
+		__attribute__ ((aligned(CACHE_LINE_SIZE)));
 	struct rpc_address xp_remote;	/* remote address, length, port */
 
 #if defined(HAVE_BLKIN)
@@ -253,16 +311,6 @@ struct svc_xprt {
 		struct blkin_endpoint endp;
 	} blkin;
 #endif
-	/* serialize private data */
-	mutex_t xp_lock;
-
-	int xp_fd;
-	int xp_ifindex;		/* interface index */
-	int xp_si_type;		/* si type */
-	int xp_type;		/* xprt type */
-
-	uint32_t xp_refs;	/* handle reference count */
-	uint16_t xp_flags;	/* flags */
 };
 
 /* Service record used by exported search routines */
@@ -315,6 +363,7 @@ struct svc_req {
 	struct blkin_trace bl_trace;
 #endif
 	uint32_t rq_refs;
+	void *rq_drc;		/* duplicate request cache entry */
 };
 
 /*
@@ -437,6 +486,9 @@ static inline void svc_destroy_it(SVCXPRT *xprt,
 		return;
 	}
 
+	if (xprt->xp_ops->xp_destroying)
+		xprt->xp_ops->xp_destroying(xprt);
+
 	svc_release_it(xprt, SVC_RELEASE_FLAG_NONE, tag, line);
 }
 #define SVC_DESTROY(xprt)						\
@@ -454,6 +506,20 @@ extern struct work_pool svc_work_pool;
 
 bool svc_init(struct svc_init_params *);
 __END_DECLS
+/*
+ * Service output statistics (optional).
+ */
+struct svc_ioq_stats {
+	uint64_t replies;	/* records sent */
+	uint64_t sends;		/* send system calls */
+	uint64_t bytes;		/* bytes sent */
+	uint64_t coalesced;	/* records sent with an earlier record */
+};
+
+__BEGIN_DECLS
+extern void svc_ioq_stats(struct svc_ioq_stats *);
+__END_DECLS
+
 /*
  * Service shutdown (optional).
  */
@@ -614,6 +680,8 @@ __END_DECLS
 #define SVC_CREATE_FLAG_LISTEN		0x20000000
 #define SVC_CREATE_FLAG_XPRT_DOREG	0x80000000
 #define SVC_CREATE_FLAG_XPRT_NOREG	0x08000000
+#define SVC_CREATE_FLAG_TLS		0x04000000	/* see rpc_tls.h */
+#define SVC_CREATE_FLAG_UDP_GSO		0x02000000	/* UDP_GRO, UDP_SEGMENT */
 
 __BEGIN_DECLS
 
@@ -647,6 +715,18 @@ svc_dg_ncreate(const int fd, const u_int sendsize, const u_int recvsize)
 	return (svc_dg_ncreatef(fd, sendsize, recvsize, SVC_CREATE_FLAG_CLOSE));
 }
 
+/*
+ * Shared memory rings for same host clients, see svc_shm.c
+ */
+extern SVCXPRT *svc_shm_ncreatef(const int, const u_int, const u_int,
+				 const uint32_t);
+/*
+ *      const int fd;                           -- AF_LOCAL stream listener
+ *      const u_int sendsize;                   -- max reply ring size
+ *      const u_int recvsize;                   -- max call ring size
+ *      const uint32_t flags;                   -- flags
+ */
+
 /*
  * the routine takes any *open* connection
  */
@@ -0,0 +1,89 @@
+/*
+ * Copyright (c) 2018 Red Hat, Inc. and/or its affiliates.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR `AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/**
+ * @file svc_drc.h
+ * @brief Duplicate request cache
+ *
+ * @section DESCRIPTION
+ *
+ * Requests are keyed on client address, xid, program, version, procedure
+ * and rq_cksum (see SVC_CHECKSUM).  Replies are retained as encoded, and
+ * a retransmitted request is answered from the cache, without executing
+ * or encoding it again.
+ *
+ * Datagram requests are keyed on the client address and port.  Connected
+ * requests are keyed on the client address only, as retransmissions
+ * follow a reconnect from another port.
+ *
+ *  svc_drc_init -- init module (optional, otherwise nothing is cached)
+ *  svc_drc_start -- look up a decoded request, after SVC_CHECKSUM
+ *  svc_drc_release -- request freed without SVC_REPLY
+ *  svc_drc_stats -- counters
+ *  svc_drc_shutdown -- release all entries
+ */
+
+#ifndef TIRPC_SVC_DRC_H
+#define TIRPC_SVC_DRC_H
+
+#include <rpc/svc.h>
+
+typedef struct svc_drc_params {
+	u_int shards;		/* power of 2, default 16 */
+	size_t max_bytes;	/* entries and retained replies, allocated,
+				 * default 64 MiB */
+	u_int tcp_ttl;		/* seconds, default 600 */
+	u_int udp_ttl;		/* seconds, default 120 */
+	u_int in_progress_ttl;	/* seconds, default 300 */
+	u_int max_entries;	/* including in progress, default 65536 */
+} svc_drc_params;
+
+enum svc_drc_stat {
+	SVC_DRC_NEW,		/* execute; SVC_REPLY() retains the reply */
+	SVC_DRC_IN_PROGRESS,	/* original is executing; drop this one,
+				 * until in_progress_ttl */
+	SVC_DRC_REPLAYED,	/* retained reply was sent; done */
+};
+
+struct svc_drc_stats {
+	uint64_t hits;		/* replayed */
+	uint64_t misses;	/* new */
+	uint64_t in_progress;	/* dropped */
+	uint64_t evicted;	/* over max_bytes or max_entries */
+	uint64_t expired;	/* over ttl */
+	uint64_t entries;
+	uint64_t bytes;
+	uint64_t aged;		/* in progress, over in_progress_ttl */
+};
+
+__BEGIN_DECLS
+extern bool svc_drc_init(svc_drc_params *);
+extern enum svc_drc_stat svc_drc_start(struct svc_req *);
+extern void svc_drc_release(struct svc_req *);
+extern void svc_drc_stats(struct svc_drc_stats *);
+extern void svc_drc_shutdown(void);
+__END_DECLS
+
+#endif				/* TIRPC_SVC_DRC_H */
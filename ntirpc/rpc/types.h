@@ -232,6 +232,21 @@ mem_strdup_(const char *s, const char *file, int line, const char *function)
 
 #define mem_strdup(s) mem_strdup_((s), __FILE__, __LINE__, __func__)
 
+static inline void *
+mem_zalloc_aligned_(size_t align, size_t size, const char *file, int line,
+		    const char *function)
+{
+	void *t = __ntirpc_pkg_params.aligned_(align, size, file, line,
+					       function);
+
+	memset(t, 0, size);
+	return (t);
+}
+
+/* for structures with members aligned to CACHE_LINE_SIZE */
+#define mem_zalloc_aligned(align, size) \
+	mem_zalloc_aligned_((align), (size), __FILE__, __LINE__, __func__)
+
 #ifndef _MSC_VER
 #include <sys/time.h>
 #include <sys/param.h>
@@ -40,6 +40,7 @@
 #ifndef WORK_POOL_H
 #define WORK_POOL_H
 
+#include <misc/portable.h>
 #include <rpc/pool_queue.h>
 
 struct work_pool_params {
@@ -58,21 +59,30 @@ struct work_pool {
 	long timeout_ms;
 	uint32_t n_threads;
 	uint32_t worker_index;
+
+	/* entries not yet due, see work_pool_submit_delayed() */
+	struct poolq_head delayed;	/* in order of due time */
+	pthread_cond_t delayed_cond;
+	pthread_t delayed_pt;
+	bool delayed_started;
+	bool delayed_shutdown;
 };
 
 struct work_pool_entry;
 
 struct work_pool_thread {
+	/* handed work under pool->pqh.qmutex */
 	struct poolq_entry pqe;		/*** 1st ***/
-	TAILQ_ENTRY(work_pool_thread) wptq;
 	pthread_cond_t pqcond;
+	struct work_pool_entry *work;
 
+	/* set while starting */
+	TAILQ_ENTRY(work_pool_thread) wptq;
 	struct work_pool *pool;
-	struct work_pool_entry *work;
 	char worker_name[16];
 	pthread_t pt;
 	uint32_t worker_index;
-};
+} __attribute__ ((aligned(CACHE_LINE_SIZE)));
 
 typedef void (*work_pool_fun_t) (struct work_pool_entry *);
 
@@ -81,10 +91,13 @@ struct work_pool_entry {
 	struct work_pool_thread *wpt;
 	work_pool_fun_t fun;
 	void *arg;
+	struct timespec due;		/* work_pool_submit_delayed() */
 };
 
 int work_pool_init(struct work_pool *, const char *, struct work_pool_params *);
 int work_pool_submit(struct work_pool *, struct work_pool_entry *);
+int work_pool_submit_delayed(struct work_pool *, struct work_pool_entry *,
+			     uint32_t);
 int work_pool_shutdown(struct work_pool *);
 
 #endif				/* WORK_POOL_H */
@@ -186,7 +186,7 @@ typedef struct rpc_xdr {
 		void (*x_destroy)(struct rpc_xdr *);
 		bool (*x_control)(struct rpc_xdr *, int, void *);
 		/* new vector and refcounted interfaces */
-		bool (*x_getbufs)(struct rpc_xdr *, xdr_uio *, u_int);
+		bool (*x_getbufs)(struct rpc_xdr *, xdr_uio *, u_int, u_int);
 		bool (*x_putbufs)(struct rpc_xdr *, xdr_uio *, u_int);
 	} *x_ops;
 	void *x_public; /* users' data */
@@ -289,15 +289,43 @@ xdr_putlong(XDR *xdrs, const long *lp)
 #define XDR_GETLONG(xdrs, lp) xdr_getlong(xdrs, lp)
 #define XDR_PUTLONG(xdrs, lp) xdr_putlong(xdrs, lp)
 
-#define XDR_GETBYTES(xdrs, addr, len)   \
-	(*(xdrs)->x_ops->x_getbytes)(xdrs, addr, len)
-#define xdr_getbytes(xdrs, addr, len)			\
-	(*(xdrs)->x_ops->x_getbytes)(xdrs, addr, len)
+/*
+ * Byte sequences up to this length are copied inline when they fit
+ * within the current buffer; longer ones (or those crossing a buffer)
+ * use the stream operation.
+ */
+#define XDR_BYTES_INLINE_MAX (512)
+
+static inline bool
+xdr_getbytes(XDR *xdrs, char *addr, u_int len)
+{
+	uint8_t *future = xdrs->x_data + len;
+
+	if (len <= XDR_BYTES_INLINE_MAX
+	 && future <= xdrs->x_v.vio_tail) {
+		memcpy(addr, xdrs->x_data, len);
+		xdrs->x_data = future;
+		return (true);
+	}
+	return (*xdrs->x_ops->x_getbytes)(xdrs, addr, len);
+}
+
+static inline bool
+xdr_putbytes(XDR *xdrs, const char *addr, u_int len)
+{
+	uint8_t *future = xdrs->x_data + len;
+
+	if (len <= XDR_BYTES_INLINE_MAX
+	 && future <= xdrs->x_v.vio_wrap) {
+		memcpy(xdrs->x_data, addr, len);
+		xdrs->x_data = future;
+		return (true);
+	}
+	return (*xdrs->x_ops->x_putbytes)(xdrs, addr, len);
+}
 
-#define XDR_PUTBYTES(xdrs, addr, len)			\
-	(*(xdrs)->x_ops->x_putbytes)(xdrs, addr, len)
-#define xdr_putbytes(xdrs, addr, len)			\
-	(*(xdrs)->x_ops->x_putbytes)(xdrs, addr, len)
+#define XDR_GETBYTES(xdrs, addr, len) xdr_getbytes(xdrs, addr, len)
+#define XDR_PUTBYTES(xdrs, addr, len) xdr_putbytes(xdrs, addr, len)
 
 #define XDR_GETBUFS(xdrs, uio, len, flags)		\
 	(*(xdrs)->x_ops->x_getbufs)(xdrs, uio, len, flags)
@@ -472,6 +500,63 @@ xdr_putint32(XDR *xdrs, int32_t v)
 #define XDR_GETINT32(xdrs, int32p) xdr_getint32(xdrs, int32p)
 #define XDR_PUTINT32(xdrs, int32v) xdr_putint32(xdrs, int32v)
 
+/*
+ * 64-bit units are only 4-byte aligned in the stream.  Inline, they are
+ * one (unaligned) load or store and one byte swap.  Otherwise, they are
+ * two 32-bit units, which may be in different buffers.
+ */
+#if defined(__BYTE_ORDER__) && (__BYTE_ORDER__ == __ORDER_BIG_ENDIAN__)
+#define xdr_hton64(v) (v)
+#elif defined(__GNUC__)
+#define xdr_hton64(v) __builtin_bswap64(v)
+#else
+#define xdr_hton64(v) \
+	((((uint64_t)htonl((uint32_t)(v))) << 32) \
+	 | (uint64_t)htonl((uint32_t)((v) >> 32)))
+#endif
+#define xdr_ntoh64(v) xdr_hton64(v)
+
+static inline bool
+xdr_getuint64(XDR *xdrs, uint64_t *ip)
+{
+	uint8_t *future = xdrs->x_data + sizeof(uint64_t);
+	uint32_t u[2];
+
+	if (future <= xdrs->x_v.vio_tail) {
+		uint64_t v;
+
+		memcpy(&v, xdrs->x_data, sizeof(v));
+		*ip = xdr_ntoh64(v);
+		xdrs->x_data = future;
+		return (true);
+	}
+	if (!xdr_getuint32(xdrs, &u[0])
+	 || !xdr_getuint32(xdrs, &u[1]))
+		return (false);
+	*ip = ((uint64_t) u[0] << 32) | (uint64_t) u[1];
+	return (true);
+}
+
+static inline bool
+xdr_putuint64(XDR *xdrs, uint64_t v)
+{
+	uint8_t *future = xdrs->x_data + sizeof(uint64_t);
+
+	if (future <= xdrs->x_v.vio_wrap) {
+		uint64_t n = xdr_hton64(v);
+
+		memcpy(xdrs->x_data, &n, sizeof(n));
+		xdrs->x_data = future;
+		return (true);
+	}
+	if (!xdr_putuint32(xdrs, (uint32_t) (v >> 32)))
+		return (false);
+	return (xdr_putuint32(xdrs, (uint32_t) v));
+}
+
+#define XDR_GETUINT64(xdrs, uint64p) xdr_getuint64(xdrs, uint64p)
+#define XDR_PUTUINT64(xdrs, uint64v) xdr_putuint64(xdrs, uint64v)
+
 static inline bool
 xdr_getuint16(XDR *xdrs, uint16_t *ip)
 {
@@ -658,6 +743,86 @@ __BEGIN_DECLS
 /* XDR using memory buffers */
 extern void xdrmem_ncreate(XDR *, char *, u_int, enum xdr_op);
 
+/*
+ * Specialized entry points, for callers that know the stream is an
+ * xdrmem: the memory stream has a single buffer, so there is nothing
+ * to dispatch to at its end.  The bytes variants are also its x_ops.
+ */
+static inline bool
+xdrmem_getuint32(XDR *xdrs, uint32_t *ip)
+{
+	uint8_t *future = xdrs->x_data + sizeof(uint32_t);
+
+	if (future > xdrs->x_v.vio_tail)
+		return (false);
+	*ip = ntohl(*((uint32_t *) (xdrs->x_data)));
+	xdrs->x_data = future;
+	return (true);
+}
+
+static inline bool
+xdrmem_putuint32(XDR *xdrs, uint32_t v)
+{
+	uint8_t *future = xdrs->x_data + sizeof(uint32_t);
+
+	if (future > xdrs->x_v.vio_wrap)
+		return (false);
+	*((uint32_t *) (xdrs->x_data)) = htonl(v);
+	xdrs->x_data = future;
+	return (true);
+}
+
+static inline bool
+xdrmem_getuint64(XDR *xdrs, uint64_t *ip)
+{
+	uint8_t *future = xdrs->x_data + sizeof(uint64_t);
+	uint64_t v;
+
+	if (future > xdrs->x_v.vio_tail)
+		return (false);
+	memcpy(&v, xdrs->x_data, sizeof(v));
+	*ip = xdr_ntoh64(v);
+	xdrs->x_data = future;
+	return (true);
+}
+
+static inline bool
+xdrmem_putuint64(XDR *xdrs, uint64_t v)
+{
+	uint8_t *future = xdrs->x_data + sizeof(uint64_t);
+	uint64_t n = xdr_hton64(v);
+
+	if (future > xdrs->x_v.vio_wrap)
+		return (false);
+	memcpy(xdrs->x_data, &n, sizeof(n));
+	xdrs->x_data = future;
+	return (true);
+}
+
+static inline bool
+xdrmem_getbytes(XDR *xdrs, char *addr, u_int len)
+{
+	uint8_t *future = xdrs->x_data + len;
+
+	if (future > xdrs->x_v.vio_tail)
+		return (false);
+	memcpy(addr, xdrs->x_data, len);
+	xdrs->x_data = future;
+	return (true);
+}
+
+static inline bool
+xdrmem_putbytes(XDR *xdrs, const char *addr, u_int len)
+{
+	uint8_t *future = xdrs->x_data + len;
+
+	if (future > xdrs->x_v.vio_wrap)
+		return (false);
+	memcpy(xdrs->x_data, addr, len);
+	xdrs->x_data = future;
+	return (true);
+}
+
 /* intrinsic checksum (be careful) */
 extern uint64_t xdrmem_cksum(XDR *, u_int);
 
@@ -151,21 +151,11 @@ inline_xdr_u_long(XDR *xdrs, u_long *ulp)
 static inline bool
 xdr_uint64_t(XDR *xdrs, uint64_t *uint64_p)
 {
-	uint32_t u[2];
-
 	switch (xdrs->x_op) {
 	case XDR_ENCODE:
-		u[0] = (uint32_t) (*uint64_p >> 32) & 0xffffffff;
-		u[1] = (uint32_t) (*uint64_p) & 0xffffffff;
-		if (!XDR_PUTUINT32(xdrs, u[0]))
-			return (false);
-		return (XDR_PUTUINT32(xdrs, u[1]));
+		return (XDR_PUTUINT64(xdrs, *uint64_p));
 	case XDR_DECODE:
-		if (!XDR_GETUINT32(xdrs, &u[0])
-		 || !XDR_GETUINT32(xdrs, &u[1]))
-			return (false);
-		*uint64_p = (((uint64_t) u[0] << 32) | ((uint64_t) u[1]));
-		return (true);
+		return (XDR_GETUINT64(xdrs, uint64_p));
 	case XDR_FREE:
 		return (true);
 	}
@@ -432,9 +422,21 @@ xdr_opaque_decode(XDR *xdrs, char *cp, u_int cnt)
 		return (true);
 
 	/*
-	 * XDR_INLINE is just as likely to do a function call,
-	 * so don't bother with it here.
+	 * round byte count to full xdr units
 	 */
+	rndup = cnt & (BYTES_PER_XDR_UNIT - 1);
+
+	/*
+	 * data and padding in the current buffer: copy the data and
+	 * skip the padding in one step.
+	 */
+	if (cnt <= XDR_BYTES_INLINE_MAX
+	 && xdrs->x_data + RNDUP(cnt) <= xdrs->x_v.vio_tail) {
+		memcpy(cp, xdrs->x_data, cnt);
+		xdrs->x_data += RNDUP(cnt);
+		return (true);
+	}
+
 	if (!XDR_GETBYTES(xdrs, cp, cnt)) {
 		__warnx(TIRPC_DEBUG_FLAG_ERROR,
 			"%s:%u ERROR opaque",
@@ -442,11 +444,6 @@ xdr_opaque_decode(XDR *xdrs, char *cp, u_int cnt)
 		return (false);
 	}
 
-	/*
-	 * round byte count to full xdr units
-	 */
-	rndup = cnt & (BYTES_PER_XDR_UNIT - 1);
-
 	if (rndup > 0) {
 		uint32_t crud;
 
@@ -479,9 +476,24 @@ xdr_opaque_encode(XDR *xdrs, const char *cp, u_int cnt)
 		return (true);
 
 	/*
-	 * XDR_INLINE is just as likely to do a function call,
-	 * so don't bother with it here.
+	 * round byte count to full xdr units
+	 */
+	rndup = cnt & (BYTES_PER_XDR_UNIT - 1);
+
+	/*
+	 * data and padding in the current buffer: zero the last unit
+	 * first, then copy the data over it.
 	 */
+	if (cnt <= XDR_BYTES_INLINE_MAX
+	 && xdrs->x_data + RNDUP(cnt) <= xdrs->x_v.vio_wrap) {
+		if (rndup > 0)
+			memset(xdrs->x_data + cnt - rndup, 0,
+			       BYTES_PER_XDR_UNIT);
+		memcpy(xdrs->x_data, cp, cnt);
+		xdrs->x_data += RNDUP(cnt);
+		return (true);
+	}
+
 	if (!XDR_PUTBYTES(xdrs, cp, cnt)) {
 		__warnx(TIRPC_DEBUG_FLAG_ERROR,
 			"%s:%u ERROR opaque",
@@ -489,11 +501,6 @@ xdr_opaque_encode(XDR *xdrs, const char *cp, u_int cnt)
 		return (false);
 	}
 
-	/*
-	 * round byte count to full xdr units
-	 */
-	rndup = cnt & (BYTES_PER_XDR_UNIT - 1);
-
 	if (rndup > 0) {
 		uint32_t zero = 0;
 
@@ -29,6 +29,7 @@
 #include <stdint.h>
 #include <stdbool.h>
 #include <misc/opr.h>
+#include <misc/portable.h>
 #include <misc/queue.h>
 #include <rpc/pool_queue.h>
 #include <rpc/work_pool.h>
@@ -80,15 +81,22 @@ struct xdr_ioq_uv_head {
 };
 
 struct xdr_ioq {
+	/* the thread encoding or decoding */
 	XDR xdrs[1];
-	struct work_pool_entry ioq_wpe;
 	struct poolq_entry ioq_s;	/* segment of stream */
-	pthread_cond_t ioq_cond;
-
 	struct poolq_head *ioq_pool;
-	struct xdr_ioq_uv_head ioq_uv;	/* header/vectors */
-
 	uint64_t id;
+	uint32_t ioq_cksum;	/* received arguments, see RPC_CKSUM_FULL */
+	int32_t ioq_cksum_args;	/* their offset, 0 unknown, -1 not summed */
+
+	/* submitted by other threads */
+	struct work_pool_entry ioq_wpe
+		__attribute__ ((aligned(CACHE_LINE_SIZE)));
+
+	/* buffer queue lock, shared with a receiver while streaming */
+	struct xdr_ioq_uv_head ioq_uv	/* header/vectors */
+		__attribute__ ((aligned(CACHE_LINE_SIZE)));
+	pthread_cond_t ioq_cond;
 };
 
 #define _IOQ(p) (opr_containerof((p), struct xdr_ioq, ioq_s))
@@ -99,6 +107,9 @@ struct xdr_ioq {
 /* ioq_s.qflags */
 #define IOQ_FLAG_SEGMENT	0x0100
 #define IOQ_FLAG_WORKING	0x0200	/* (atomic) using ioq_wpe */
+#define IOQ_FLAG_STREAM		0x0400	/* receiving after dispatch */
+#define IOQ_FLAG_RELEASED	0x0800	/* destroyed while receiving */
+#define IOQ_FLAG_RECORDS	0x1000	/* output has its own record marks */
 /* uint32_t instructions */
 #define IOQ_FLAG_LOCKED		0x00010000
 #define IOQ_FLAG_UNLOCK		0x00020000
@@ -121,6 +132,7 @@ extern struct xdr_ioq *xdr_ioq_create(size_t min_bsize, size_t max_bsize,
 				      u_int uio_flags);
 extern void xdr_ioq_release(struct poolq_head *ioqh);
 extern void xdr_ioq_reset(struct xdr_ioq *xioq, u_int wh_pos);
+extern void xdr_ioq_truncate(struct xdr_ioq *xioq, u_int pos);
 extern void xdr_ioq_setup(struct xdr_ioq *xioq);
 
 extern void xdr_ioq_destroy(struct xdr_ioq *xioq, size_t qsize);
@@ -128,4 +140,149 @@ extern void xdr_ioq_destroy_pool(struct poolq_head *ioqh);
 
 extern const struct xdr_ops xdr_ioq_ops;
 
+extern bool xdr_ioq_getunit(XDR *, uint32_t *);
+extern bool xdr_ioq_putunit(XDR *, const uint32_t);
+extern bool xdr_ioq_getbytes(XDR *, char *, u_int);
+extern bool xdr_ioq_putbytes(XDR *, const char *, u_int);
+
+/*
+ * Specialized entry points, for callers that know the stream is an
+ * xdr_ioq: the same inline fast paths as xdr.h, with direct (rather
+ * than x_ops) calls at buffer boundaries.
+ */
+static inline bool
+xdr_ioq_getuint32(XDR *xdrs, uint32_t *ip)
+{
+	uint8_t *future = xdrs->x_data + sizeof(uint32_t);
+
+	if (future <= xdrs->x_v.vio_tail) {
+		*ip = ntohl(*((uint32_t *) (xdrs->x_data)));
+		xdrs->x_data = future;
+		return (true);
+	}
+	return (xdr_ioq_getunit(xdrs, ip));
+}
+
+static inline bool
+xdr_ioq_putuint32(XDR *xdrs, uint32_t v)
+{
+	uint8_t *future = xdrs->x_data + sizeof(uint32_t);
+
+	if (future <= xdrs->x_v.vio_wrap) {
+		*((uint32_t *) (xdrs->x_data)) = htonl(v);
+		xdrs->x_data = future;
+		return (true);
+	}
+	return (xdr_ioq_putunit(xdrs, v));
+}
+
+static inline bool
+xdr_ioq_getuint64(XDR *xdrs, uint64_t *ip)
+{
+	uint8_t *future = xdrs->x_data + sizeof(uint64_t);
+	uint32_t u[2];
+
+	if (future <= xdrs->x_v.vio_tail) {
+		uint64_t v;
+
+		memcpy(&v, xdrs->x_data, sizeof(v));
+		*ip = xdr_ntoh64(v);
+		xdrs->x_data = future;
+		return (true);
+	}
+	if (!xdr_ioq_getuint32(xdrs, &u[0])
+	 || !xdr_ioq_getuint32(xdrs, &u[1]))
+		return (false);
+	*ip = ((uint64_t) u[0] << 32) | (uint64_t) u[1];
+	return (true);
+}
+
+static inline bool
+xdr_ioq_putuint64(XDR *xdrs, uint64_t v)
+{
+	uint8_t *future = xdrs->x_data + sizeof(uint64_t);
+
+	if (future <= xdrs->x_v.vio_wrap) {
+		uint64_t n = xdr_hton64(v);
+
+		memcpy(xdrs->x_data, &n, sizeof(n));
+		xdrs->x_data = future;
+		return (true);
+	}
+	if (!xdr_ioq_putuint32(xdrs, (uint32_t) (v >> 32)))
+		return (false);
+	return (xdr_ioq_putuint32(xdrs, (uint32_t) v));
+}
+
+static inline bool
+xdr_ioq_getopaque(XDR *xdrs, char *addr, u_int len)
+{
+	uint8_t *future = xdrs->x_data + RNDUP(len);
+
+	if (len <= XDR_BYTES_INLINE_MAX
+	 && future <= xdrs->x_v.vio_tail) {
+		memcpy(addr, xdrs->x_data, len);
+		xdrs->x_data = future;
+		return (true);
+	}
+	if (!xdr_ioq_getbytes(xdrs, addr, len))
+		return (false);
+	if (len & (BYTES_PER_XDR_UNIT - 1)) {
+		uint32_t crud;
+
+		return (xdr_ioq_getbytes(xdrs, (char *)&crud,
+			BYTES_PER_XDR_UNIT - (len & (BYTES_PER_XDR_UNIT - 1))));
+	}
+	return (true);
+}
+
+static inline bool
+xdr_ioq_putopaque(XDR *xdrs, const char *addr, u_int len)
+{
+	uint8_t *future = xdrs->x_data + RNDUP(len);
+	u_int rndup = len & (BYTES_PER_XDR_UNIT - 1);
+
+	if (len <= XDR_BYTES_INLINE_MAX
+	 && future <= xdrs->x_v.vio_wrap) {
+		if (rndup > 0)
+			memset(xdrs->x_data + len - rndup, 0,
+			       BYTES_PER_XDR_UNIT);
+		memcpy(xdrs->x_data, addr, len);
+		xdrs->x_data = future;
+		return (true);
+	}
+	if (!xdr_ioq_putbytes(xdrs, addr, len))
+		return (false);
+	if (rndup > 0) {
+		uint32_t zero = 0;
+
+		return (xdr_ioq_putbytes(xdrs, (char *)&zero,
+					 BYTES_PER_XDR_UNIT - rndup));
+	}
+	return (true);
+}
+
+/*
+ * Per (prog, vers, proc) encoded size estimates, used to size the first
+ * output buffer.
+ */
+#define XDR_IOQ_SIZE_CALL	0
+#define XDR_IOQ_SIZE_REPLY	1
+
+struct xdr_ioq_size_stats {
+	uint64_t count;		/* messages encoded */
+	uint64_t allocated;	/* buffer bytes allocated */
+	uint64_t encoded;	/* bytes encoded */
+	uint64_t appended;	/* messages needing more than one buffer */
+};
+
+extern u_int xdr_ioq_size_estimate(rpcprog_t prog, rpcvers_t vers,
+				   rpcproc_t proc, u_int dir);
+extern struct xdr_ioq *xdr_ioq_size_create(rpcprog_t prog, rpcvers_t vers,
+					   rpcproc_t proc, u_int dir,
+					   size_t max_bsize, u_int uio_flags);
+extern void xdr_ioq_size_update(struct xdr_ioq *xioq, rpcprog_t prog,
+				rpcvers_t vers, rpcproc_t proc, u_int dir);
+extern void xdr_ioq_size_stats(struct xdr_ioq_size_stats *stats, u_int dir);
+
 #endif				/* XDR_IOQ_H */
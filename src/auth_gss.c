@@ -43,6 +43,7 @@
 #include <string.h>
 #include <errno.h>
 #include <rpc/types.h>
+#include <reentrant.h>
 #include <rpc/xdr_inline.h>
 #include <rpc/auth_inline.h>
 #include <rpc/rpc.h>
@@ -133,6 +134,7 @@ print_rpc_gss_sec(struct rpc_gss_sec *ptr)
 struct rpc_gss_data {
 	AUTH gd_auth;
 	mutex_t lock;
+	mutex_t call_lock;	/* serialize authgss_marshal() */
 	gss_buffer_desc gc_wire_verf;	/* save GSS_S_COMPLETE NULL RPC verfier
 					 * to process at end of context
 					 * negotiation*/
@@ -149,6 +151,20 @@ struct rpc_gss_data {
 /* retry timeout default to the moon and back */
 static const struct timespec to = { 3, 0 };
 
+/*
+ * Calls sharing the handle are encoded in parallel.  authgss_wrap() has
+ * to use the sequence number in the cred of its own call, and always
+ * follows authgss_marshal() on the calling thread, so it is kept there.
+ */
+static thread_key_t authgss_seq_key;
+static once_t authgss_seq_once = ONCE_INITIALIZER;
+
+static void
+authgss_seq_init(void)
+{
+	thr_keycreate(&authgss_seq_key, NULL);
+}
+
 AUTH *
 authgss_ncreate(CLIENT *clnt, gss_name_t name, struct rpc_gss_sec *sec)
 {
@@ -165,6 +181,8 @@ authgss_ncreate(CLIENT *clnt, gss_name_t name, struct rpc_gss_sec *sec)
 
 	/* XXX move to ctor */
 	mutex_init(&gd->lock, NULL);
+	mutex_init(&gd->call_lock, NULL);
+	thr_once(&authgss_seq_once, authgss_seq_init);
 	__warnx(TIRPC_DEBUG_FLAG_RPCSEC_GSS, "%s() name is %p", __func__, name);
 
 	if (name != GSS_C_NO_NAME) {
@@ -262,7 +280,7 @@ authgss_nextverf(AUTH *auth)
 }
 
 static bool
-authgss_marshal(AUTH *auth, XDR *xdrs)
+authgss_marshal_locked(AUTH *auth, XDR *xdrs)
 {
 	struct rpc_gss_data *gd = AUTH_PRIVATE(auth);
 	XDR tmpxdrs;
@@ -334,6 +352,24 @@ authgss_marshal(AUTH *auth, XDR *xdrs)
 	return (xdr_stat);
 }
 
+static bool
+authgss_marshal(AUTH *auth, XDR *xdrs)
+{
+	struct rpc_gss_data *gd = AUTH_PRIVATE(auth);
+	uint32_t seq;
+	bool xdr_stat;
+
+	/* the cred and checksum are built in the handle */
+	mutex_lock(&gd->call_lock);
+	xdr_stat = authgss_marshal_locked(auth, xdrs);
+	seq = gd->gc.gc_seq;
+	mutex_unlock(&gd->call_lock);
+
+	if (xdr_stat)
+		thr_setspecific(authgss_seq_key, (void *)(uintptr_t)seq);
+	return (xdr_stat);
+}
+
 static bool
 authgss_validate(AUTH *auth, struct opaque_auth *verf)
 {
@@ -619,15 +655,21 @@ bool
 authgss_wrap(AUTH *auth, XDR *xdrs, xdrproc_t xdr_func, void *xdr_ptr)
 {
 	struct rpc_gss_data *gd = AUTH_PRIVATE(auth);
+	uint32_t seq;
 
 	__warnx(TIRPC_DEBUG_FLAG_RPCSEC_GSS, "%s()", __func__);
 
 	if (!gd->established || gd->sec.svc == RPCSEC_GSS_SVC_NONE)
 		return ((*xdr_func) (xdrs, xdr_ptr));
 
+	/* set by authgss_marshal() of this call */
+	seq = (uintptr_t)thr_getspecific(authgss_seq_key);
+	if (!seq)
+		seq = gd->gc.gc_seq;
+
 	return (xdr_rpc_gss_wrap
 		(xdrs, xdr_func, xdr_ptr, gd->ctx, gd->sec.qop, gd->sec.svc,
-		 gd->gc.gc_seq));
+		 seq));
 }
 
 bool
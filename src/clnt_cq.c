@@ -0,0 +1,212 @@
+/*
+ * Copyright (c) 2018 Red Hat, Inc. and/or its affiliates.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR `AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/**
+ * @file clnt_cq.c
+ * @brief Batched asynchronous calls with a pollable completion queue
+ *
+ * @section DESCRIPTION
+ *
+ * Requests are completed by the thread handling the reply (or timeout),
+ * which appends them to the queue.  The eventfd is signalled when the
+ * queue becomes non-empty, and drained when a dequeue empties it, so a
+ * caller polling many queues sees only those with completions.
+ */
+
+#include "config.h"
+
+#include <sys/types.h>
+#include <sys/eventfd.h>
+#include <errno.h>
+#include <stdint.h>
+#include <unistd.h>
+
+#include <rpc/types.h>
+#include <misc/portable.h>
+#include <rpc/rpc.h>
+
+#include "rpc_com.h"
+#include "clnt_internal.h"
+
+struct clnt_cq {
+	struct poolq_head cq_qh;	/* completed requests */
+	int cq_fd;			/* eventfd, readable while queued */
+};
+
+#define CQE_REQ(p) (opr_containerof((p), struct clnt_req, cc_cqe))
+
+struct clnt_cq *
+clnt_cq_create(void)
+{
+	struct clnt_cq *cq = mem_zalloc(sizeof(struct clnt_cq));
+
+	cq->cq_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (cq->cq_fd < 0) {
+		__warnx(TIRPC_DEBUG_FLAG_ERROR,
+			"%s: eventfd failed (%d)",
+			__func__, errno);
+		mem_free(cq, sizeof(struct clnt_cq));
+		return (NULL);
+	}
+	poolq_head_setup(&cq->cq_qh);
+	return (cq);
+}
+
+/*
+ * Requests still queued are not released; the caller dequeues them first.
+ */
+void
+clnt_cq_destroy(struct clnt_cq *cq)
+{
+	if (cq->cq_qh.qcount) {
+		__warnx(TIRPC_DEBUG_FLAG_WARN,
+			"%s: %p %d completions not dequeued",
+			__func__, cq, cq->cq_qh.qcount);
+	}
+	close(cq->cq_fd);
+	poolq_head_destroy(&cq->cq_qh);
+	mem_free(cq, sizeof(struct clnt_cq));
+}
+
+int
+clnt_cq_fd(struct clnt_cq *cq)
+{
+	return (cq->cq_fd);
+}
+
+int
+clnt_cq_dequeue(struct clnt_cq *cq, struct clnt_req **ccv, int max)
+{
+	struct poolq_entry *have;
+	uint64_t count;
+	int n = 0;
+
+	mutex_lock(&cq->cq_qh.qmutex);
+	while (n < max && (have = TAILQ_FIRST(&cq->cq_qh.qh))) {
+		TAILQ_REMOVE(&cq->cq_qh.qh, have, q);
+		(cq->cq_qh.qcount)--;
+		ccv[n++] = CQE_REQ(have);
+	}
+	if (!cq->cq_qh.qcount) {
+		/* next completion signals again */
+		(void)read(cq->cq_fd, &count, sizeof(count));
+	}
+	mutex_unlock(&cq->cq_qh.qmutex);
+
+	return (n);
+}
+
+/*
+ * cc_process_cb for submitted requests
+ */
+static void
+clnt_cq_complete(struct clnt_req *cc)
+{
+	struct clnt_cq *cq = cc->cc_cq;
+	uint64_t one = 1;
+	bool signal;
+
+	mutex_lock(&cq->cq_qh.qmutex);
+	TAILQ_INSERT_TAIL(&cq->cq_qh.qh, &cc->cc_cqe, q);
+	signal = !(cq->cq_qh.qcount)++;
+	mutex_unlock(&cq->cq_qh.qmutex);
+
+	if (signal && write(cq->cq_fd, &one, sizeof(one)) < 0) {
+		__warnx(TIRPC_DEBUG_FLAG_ERROR,
+			"%s: %p eventfd write failed (%d)",
+			__func__, cq, errno);
+	}
+}
+
+/*
+ * Requests on one client.  Returns the number sent, or queued for a
+ * call slot (sent by clnt_req_slot_dispatch()).
+ */
+static int
+clnt_req_submit_clnt(struct clnt_req **ccv, int n)
+{
+	CLIENT *clnt = ccv[0]->cc_clnt;
+	enum clnt_stat stat;
+	int sent = 0;
+	int i;
+	int j;
+
+	/* before sending, as in clnt_req_callback() */
+	svc_rqst_expire_insertv(ccv, n);
+
+	if (clnt->cl_ops->cl_callv) {
+		/* each run of requests given a slot */
+		for (i = 0; i < n; i = j) {
+			for (j = i; j < n; j++) {
+				if (!clnt_req_slot_get(ccv[j],
+						       CLNT_REQ_FLAG_NONE))
+					break;
+			}
+			if (j > i)
+				sent += clnt->cl_ops->cl_callv(&ccv[i], j - i);
+			if (j < n) {
+				sent++;
+				j++;
+			}
+		}
+		return (sent);
+	}
+
+	for (i = 0; i < n; i++) {
+		if (!clnt_req_slot_get(ccv[i], CLNT_REQ_FLAG_NONE)) {
+			sent++;
+			continue;
+		}
+		stat = CLNT_CALL_ONCE(ccv[i]);
+		if (stat != RPC_SUCCESS) {
+			clnt_req_fail(ccv[i], stat);
+			continue;
+		}
+		sent++;
+	}
+	return (sent);
+}
+
+int
+clnt_req_submit(struct clnt_cq *cq, struct clnt_req **ccv, int n)
+{
+	int sent = 0;
+	int i;
+	int j;
+
+	for (i = 0; i < n; i++) {
+		ccv[i]->cc_cq = cq;
+		ccv[i]->cc_process_cb = clnt_cq_complete;
+	}
+
+	for (i = 0; i < n; i = j) {
+		for (j = i + 1; j < n; j++) {
+			if (ccv[j]->cc_clnt != ccv[i]->cc_clnt)
+				break;
+		}
+		sent += clnt_req_submit_clnt(&ccv[i], j - i);
+	}
+	return (sent);
+}
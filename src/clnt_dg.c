@@ -36,6 +36,7 @@
 #include "config.h"
 
 #include <sys/types.h>
+#include <sys/param.h>
 #include <sys/socket.h>
 #include <stdint.h>
 #include <sys/poll.h>
@@ -63,13 +64,35 @@
 static enum xprt_stat clnt_dg_rendezvous(SVCXPRT *xprt);
 static struct clnt_ops *clnt_dg_ops(void);
 
+/* initial retransmit timeout (us), per RFC 6298 */
+#define CLNT_DG_RTO_INIT	1000000
+
 struct cu_data {
 	struct cx_data cu_cx;
 	struct sockaddr_storage cu_raddr;	/* remote address */
 	int cu_rlen;
+	struct clnt_rtt cu_rtt;	/* for cu_raddr, under cl_lock; rto 0 off */
+	bool cu_owner;		/* created the xprt, destroys it */
 };
 #define CU_DATA(p) (opr_containerof((p), struct cu_data, cu_cx))
 
+static void
+clnt_dg_rtt_reset(struct clnt_rtt *rtt)
+{
+	rtt->srtt = 0;
+	rtt->rttvar = 0;
+	rtt->samples = 0;
+	rtt->rto = MAX(rtt->rto_min, MIN(CLNT_DG_RTO_INIT, rtt->rto_max));
+}
+
+static void
+clnt_dg_rtt_update(struct clnt_rtt *rtt)
+{
+	uint32_t rto = rtt->srtt + 4 * rtt->rttvar;
+
+	rtt->rto = MAX(rtt->rto_min, MIN(rto, rtt->rto_max));
+}
+
 static void
 clnt_dg_data_free(struct cu_data *cu)
 {
@@ -147,6 +170,12 @@ clnt_dg_ncreatef(const int fd,	/* open file descriptor */
 	su = su_data(xprt);
 
 	if (!su->su_dr.ev_p) {
+		/* new xprt: the initial reference belongs to the fd, and is
+		 * released by SVC_DESTROY() (also at svc_shutdown()).  Take
+		 * our own, so a call waiting on the handle outlives it.
+		 */
+		SVC_REF(xprt, SVC_REF_FLAG_NONE);
+		cu->cu_owner = true;
 		xprt->xp_dispatch.rendezvous_cb = clnt_dg_rendezvous;
 		svc_rqst_evchan_reg(__svc_params->ev_u.evchan.id, xprt,
 				    SVC_RQST_FLAG_CHAN_AFFINITY);
@@ -215,36 +244,30 @@ clnt_dg_call(struct clnt_req *cc)
 	SVCXPRT *xprt = &rec->xprt;
 	struct xdr_ioq *xioq;
 	XDR *xdrs;
-	u_int32_t *uint32p;
 	size_t outlen;
+	rpcprog_t prog = cx_prog(cx);
+	rpcvers_t vers = cx_vers(cx);
 
-	/* XXX Until gss_get_mic and gss_wrap can be replaced with
-	 * iov equivalents, replies with RPCSEC_GSS security must be
-	 * encoded in a contiguous buffer.
-	 *
-	 * Nb, we should probably use getpagesize() on Unix.  Need
-	 * an equivalent for Windows.
+	/* The datagram is sent from a single contiguous buffer, so the
+	 * first buffer (sized from earlier calls to this procedure) is
+	 * reallocated rather than appended when the estimate is short.
 	 */
-	xioq = xdr_ioq_create(RPC_MAXDATA_DEFAULT,
-			      __svc_params->ioq.send_max + RPC_MAXDATA_DEFAULT,
-			      (cc->cc_auth->ah_cred.oa_flavor == RPCSEC_GSS)
-			      ? UIO_FLAG_REALLOC | UIO_FLAG_FREE
-			      : UIO_FLAG_FREE);
+	xioq = xdr_ioq_size_create(prog, vers, cc->cc_proc, XDR_IOQ_SIZE_CALL,
+				   __svc_params->ioq.send_max
+				   + RPC_MAXDATA_DEFAULT,
+				   UIO_FLAG_REALLOC | UIO_FLAG_FREE);
 
+	/* cc_error is not reset: this may be a retransmission racing
+	 * the reply to an earlier one.
+	 */
 	xdrs = xioq->xdrs;
-	cc->cc_error.re_status = RPC_SUCCESS;
-
-	mutex_lock(&clnt->cl_lock);
-	uint32p = (u_int32_t *)&cx->cx_mcallc[0];
-	*uint32p = htonl(cc->cc_xid);
 
-	if ((!XDR_PUTBYTES(xdrs, cx->cx_mcallc, cx->cx_mpos))
+	if ((!cx_callhdr(cx, xdrs, cc->cc_xid))
 	    || (!XDR_PUTUINT32(xdrs, cc->cc_proc))
 	    || (!AUTH_MARSHALL(cc->cc_auth, xdrs))
 	    || (!AUTH_WRAP(cc->cc_auth, xdrs,
 			   cc->cc_call.proc, cc->cc_call.where))) {
 		/* error case */
-		mutex_unlock(&clnt->cl_lock);
 		__warnx(TIRPC_DEBUG_FLAG_CLNT_DG,
 			"%s: fd %d failed",
 			__func__, xprt->xp_fd);
@@ -252,7 +275,7 @@ clnt_dg_call(struct clnt_req *cc)
 		return (RPC_CANTENCODEARGS);
 	}
 	outlen = (size_t) XDR_GETPOS(xdrs);
-	mutex_unlock(&clnt->cl_lock);
+	xdr_ioq_size_update(xioq, prog, vers, cc->cc_proc, XDR_IOQ_SIZE_CALL);
 
 	if (sendto(xprt->xp_fd, xdrs->x_v.vio_head, outlen, 0,
 		   (struct sockaddr *)&cu->cu_raddr, cu->cu_rlen) != outlen) {
@@ -280,12 +303,50 @@ clnt_dg_abort(CLIENT *h)
 {
 }
 
+static u_int
+clnt_dg_rto(CLIENT *clnt, bool backoff)
+{
+	struct cu_data *cu = CU_DATA(CX_DATA(clnt));
+	u_int rto;
+
+	mutex_lock(&clnt->cl_lock);
+	if (backoff) {
+		cu->cu_rtt.rto = MIN(cu->cu_rtt.rto * 2, cu->cu_rtt.rto_max);
+		cu->cu_rtt.retransmits++;
+	}
+	rto = cu->cu_rtt.rto;
+	mutex_unlock(&clnt->cl_lock);
+
+	return (rto);
+}
+
+static void
+clnt_dg_rtt(CLIENT *clnt, u_int rtt)
+{
+	struct cu_data *cu = CU_DATA(CX_DATA(clnt));
+	struct clnt_rtt *r = &cu->cu_rtt;
+	u_int delta;
+
+	mutex_lock(&clnt->cl_lock);
+	if (!r->samples++) {
+		r->srtt = rtt;
+		r->rttvar = rtt / 2;
+	} else {
+		delta = (rtt > r->srtt) ? rtt - r->srtt : r->srtt - rtt;
+		r->rttvar = (3 * r->rttvar + delta) / 4;
+		r->srtt = (7 * r->srtt + rtt) / 8;
+	}
+	clnt_dg_rtt_update(r);
+	mutex_unlock(&clnt->cl_lock);
+}
+
 static bool
 clnt_dg_control(CLIENT *clnt, u_int request, void *info)
 {
 	struct cx_data *cx = CX_DATA(clnt);
 	struct cu_data *cu = CU_DATA(cx);
 	struct rpc_dplx_rec *rec = cx->cx_rec;
+	struct clnt_rtt *rtt;
 	struct netbuf *addr;
 	u_int32_t *uint32p;
 	bool rslt = true;
@@ -339,16 +400,16 @@ clnt_dg_control(CLIENT *clnt, u_int request, void *info)
 		}
 		(void)memcpy(&cu->cu_raddr, addr->buf, addr->len);
 		cu->cu_rlen = addr->len;
+		/* estimates were for the old destination */
+		clnt_dg_rtt_reset(&cu->cu_rtt);
 		break;
 
 	case CLGET_XID:
 		/*
-		 * use the knowledge that xid is the
-		 * first element in the call structure *.
+		 * the xid assigned by clnt_req_setup() most recently.
 		 * This will get the xid of the PREVIOUS call
 		 */
-		uint32p = (u_int32_t *)&cx->cx_mcallc[0];
-		*(u_int32_t *)info = ntohl(*uint32p);
+		*(u_int32_t *)info = rec->call_xid;
 		break;
 
 	case CLSET_XID:
@@ -369,7 +430,7 @@ clnt_dg_control(CLIENT *clnt, u_int request, void *info)
 
 	case CLSET_VERS:
 		uint32p = (u_int32_t *)&cx->cx_mcallc[4 * BYTES_PER_XDR_UNIT];
-		*uint32p = htonl(*(u_int32_t *)info);
+		atomic_store_uint32_t(uint32p, htonl(*(u_int32_t *)info));
 		break;
 
 	case CLGET_PROG:
@@ -384,7 +445,35 @@ clnt_dg_control(CLIENT *clnt, u_int request, void *info)
 
 	case CLSET_PROG:
 		uint32p = (u_int32_t *)&cx->cx_mcallc[3 * BYTES_PER_XDR_UNIT];
-		*uint32p = htonl(*(u_int32_t *)info);
+		atomic_store_uint32_t(uint32p, htonl(*(u_int32_t *)info));
+		break;
+
+	case CLGET_RTT:
+		*(struct clnt_rtt *)info = cu->cu_rtt;
+		break;
+
+	case CLSET_RTT:
+		rtt = (struct clnt_rtt *)info;
+		if (rtt->rto_max
+		 && (!rtt->rto_min || rtt->rto_min > rtt->rto_max)) {
+			rslt = false;
+			break;
+		}
+		cu->cu_rtt.rto_min = rtt->rto_max ? rtt->rto_min : 0;
+		cu->cu_rtt.rto_max = rtt->rto_max;
+		if (!rtt->srtt || !rtt->rto_max) {
+			clnt_dg_rtt_reset(&cu->cu_rtt);
+			break;
+		}
+		cu->cu_rtt.srtt = rtt->srtt;
+		cu->cu_rtt.rttvar = rtt->rttvar;
+		cu->cu_rtt.samples = 1;
+		clnt_dg_rtt_update(&cu->cu_rtt);
+		break;
+
+	case CLGET_SLOTS:
+	case CLSET_SLOTS:
+		rslt = clnt_req_slot_control(rec, request, info);
 		break;
 
 	default:
@@ -405,6 +494,9 @@ clnt_dg_destroy(CLIENT *clnt)
 	struct cx_data *cx = CX_DATA(clnt);
 
 	if (cx->cx_rec) {
+		/* once-only; already done at shutdown */
+		if (CU_DATA(cx)->cu_owner)
+			SVC_DESTROY(&cx->cx_rec->xprt);
 		SVC_RELEASE(&cx->cx_rec->xprt, SVC_RELEASE_FLAG_NONE);
 	}
 	clnt_dg_data_free(CU_DATA(cx));
@@ -424,6 +516,8 @@ clnt_dg_ops(void)
 	mutex_lock(&ops_lock);
 	if (ops.cl_call == NULL) {
 		ops.cl_call = clnt_dg_call;
+		ops.cl_rto = clnt_dg_rto;
+		ops.cl_rtt = clnt_dg_rtt;
 		ops.cl_abort = clnt_dg_abort;
 		ops.cl_freeres = clnt_dg_freeres;
 		ops.cl_destroy = clnt_dg_destroy;
@@ -48,6 +48,7 @@
 
 #include "rpc_com.h"
 #include "clnt_internal.h"
+#include "svc_internal.h"
 
 int __rpc_raise_fd(int);
 
@@ -134,14 +135,492 @@ clnt_ncreate_vers_timed(const char *hostname, rpcprog_t prog,
 	return (clnt);
 }
 
+/*
+ * After __rpcb_findaddr_timed(): cl is its rpcbind handle, or NULL.
+ * svcaddr is freed.
+ */
+static CLIENT *
+clnt_tp_addr_ncreate(const char *hostname, rpcprog_t prog, rpcvers_t vers,
+		     const struct netconfig *nconf, struct netbuf *svcaddr,
+		     CLIENT *cl)
+{
+	if (cl == NULL) {
+		/* no rpcbind handle (eg, address cached) */
+		cl = clnt_tli_ncreate(RPC_ANYFD, nconf, svcaddr, prog, vers, 0,
+				      0);
+	} else if (CLNT_SUCCESS(cl)) {
+		/* Reuse the CLIENT handle and change the appropriate fields */
+		if (CLNT_CONTROL(cl, CLSET_SVC_ADDR, (void *)svcaddr) == true) {
+			if (cl->cl_netid == NULL)
+				cl->cl_netid = mem_strdup(nconf->nc_netid);
+			if (cl->cl_tp == NULL)
+				cl->cl_tp = mem_strdup(nconf->nc_device);
+			(void)CLNT_CONTROL(cl, CLSET_PROG, (void *)&prog);
+			(void)CLNT_CONTROL(cl, CLSET_VERS, (void *)&vers);
+		} else {
+			CLNT_DESTROY(cl);
+			cl = clnt_tli_ncreate(RPC_ANYFD, nconf, svcaddr, prog,
+					      vers, 0, 0);
+		}
+	}
+	if (CLNT_FAILURE(cl)) {
+		/* perhaps restarted elsewhere, ask rpcbind next time */
+		__rpcb_cache_forget(prog, vers, nconf, hostname);
+	}
+	mem_free(svcaddr->buf, sizeof(*svcaddr->buf));
+	mem_free(svcaddr, sizeof(*svcaddr));
+	return (cl);
+}
+
+/*
+ * Several netids of a class (eg, tcp and tcp6 for a dual-stack host) are
+ * tried in parallel, "Happy Eyeballs" (RFC 8305): each attempt starts when
+ * those before it have failed, or CLNT_RACE_DELAY_MS after the one before,
+ * whichever is first.  The first handle created is returned; attempts not
+ * yet started are cancelled, and those still connecting destroy their
+ * handles when done.  The caller waits no longer than the timeout, when
+ * given.
+ *
+ * No pool thread waits for an attempt's turn (work_pool_submit_delayed()),
+ * nor on a connect, which is stepped like a reconnect (clnt_vc_conn_step()).
+ * Only the rpcbind query is a call waiting on its reply, bounded by the
+ * timeout.
+ */
+#define CLNT_RACE_DELAY_MS (250)
+#define CLNT_RACE_MAX (16)
+
+struct clnt_race_try {
+	struct work_pool_entry crt_wpe;
+	struct clnt_race *crt_race;
+	struct netconfig *crt_nconf;
+	struct netbuf *crt_addr;	/* connecting to */
+	struct clnt_vc_conn crt_cn;	/* in progress, or cn_fd -1 */
+	u_int crt_step_ms;		/* between steps, doubling */
+};
+
+struct clnt_race {
+	mutex_t cr_mtx;
+	cond_t cr_cv;
+	CLIENT *cr_clnt;		/* the first created */
+	struct rpc_err cr_error;	/* more specific than cr_last */
+	struct rpc_err cr_last;
+	struct timespec cr_start;	/* CLOCK_REALTIME_FAST */
+	struct timespec cr_due;		/* the next started, monotonic */
+	struct timeval cr_tv;
+	struct work_pool_entry cr_wpe;	/* starts the next when due */
+	struct clnt_race_try *cr_try[CLNT_RACE_MAX];
+	char *cr_host;
+	rpcprog_t cr_prog;
+	rpcvers_t cr_vers;
+	uint32_t cr_refs;
+	int cr_n;
+	int cr_next;			/* the next to start */
+	int cr_failed;
+	int cr_done;
+	bool cr_timed;
+	bool cr_cancel;
+};
+
+static void
+clnt_race_release(struct clnt_race *cr)
+{
+	if (atomic_dec_uint32_t(&cr->cr_refs))
+		return;
+
+	mutex_destroy(&cr->cr_mtx);
+	cond_destroy(&cr->cr_cv);
+	if (cr->cr_host)
+		mem_free(cr->cr_host, 0);
+	mem_free(cr, sizeof(*cr));
+}
+
+/*
+ * As clnt_ncreate_timed() formerly did in turn: remember an error more
+ * specific than ``Name to address translation failed'' or ``unknown
+ * host name''.
+ */
+static void
+clnt_race_error(struct clnt_race *cr, CLIENT *clnt)
+{
+	if (clnt->cl_error.re_status != RPC_N2AXLATEFAILURE
+	    && clnt->cl_error.re_status != RPC_UNKNOWNHOST)
+		cr->cr_error = clnt->cl_error;
+	cr->cr_last = clnt->cl_error;
+}
+
+/*
+ * Called with cr_mtx held.
+ */
+static void
+clnt_race_start(struct clnt_race *cr)
+{
+	struct clnt_race_try *crt = cr->cr_try[cr->cr_next++];
+
+	(void)clock_gettime(CLOCK_MONOTONIC_FAST, &cr->cr_due);
+	timespec_addms(&cr->cr_due, CLNT_RACE_DELAY_MS);
+	work_pool_submit(&svc_work_pool, &crt->crt_wpe);
+}
+
+/*
+ * Starts the next attempt when due, until none is left.
+ */
+static void
+clnt_race_timer(struct work_pool_entry *wpe)
+{
+	struct clnt_race *cr =
+		opr_containerof(wpe, struct clnt_race, cr_wpe);
+	struct timespec delay;
+	struct timespec now;
+
+	mutex_lock(&cr->cr_mtx);
+	if (!cr->cr_cancel && !cr->cr_clnt && cr->cr_next < cr->cr_n) {
+		(void)clock_gettime(CLOCK_MONOTONIC_FAST, &now);
+		if (timespeccmp(&now, &cr->cr_due, >=))
+			clnt_race_start(cr);
+		if (cr->cr_next < cr->cr_n) {
+			/* the one before may have started early, on failure */
+			delay = cr->cr_due;
+			timespecsub(&delay, &now);
+			mutex_unlock(&cr->cr_mtx);
+			work_pool_submit_delayed(&svc_work_pool, wpe,
+						 timespec_ms(&delay) * 1000);
+			return;
+		}
+	}
+	mutex_unlock(&cr->cr_mtx);
+	clnt_race_release(cr);
+}
+
+/*
+ * The address from rpcbind, then a connect started, for a connection
+ * oriented netid.  Returns the handle, or NULL when connecting.
+ */
+static CLIENT *
+clnt_race_lookup(struct clnt_race_try *crt)
+{
+	struct clnt_race *cr = crt->crt_race;
+	struct netconfig *nconf = crt->crt_nconf;
+	struct netbuf *svcaddr;
+	CLIENT *cl = NULL;
+	int one = 1;
+	int error;
+	int ms;
+	int fd;
+
+	__warnx(TIRPC_DEBUG_FLAG_CLNT, "%s: trying netid %s",
+		__func__, nconf->nc_netid);
+	svcaddr = __rpcb_findaddr_timed(cr->cr_prog, cr->cr_vers, nconf,
+					cr->cr_host, &cl,
+					cr->cr_timed ? &cr->cr_tv : NULL);
+	if (svcaddr == NULL) {
+		/* appropriate error number is set by rpcbind libraries */
+		return (cl);
+	}
+
+	if (nconf->nc_semantics != NC_TPI_COTS
+	 && nconf->nc_semantics != NC_TPI_COTS_ORD) {
+		return (clnt_tp_addr_ncreate(cr->cr_host, cr->cr_prog,
+					     cr->cr_vers, nconf, svcaddr, cl));
+	}
+
+	/* as clnt_tli_ncreate(), connected here */
+	if (cl)
+		CLNT_DESTROY(cl);
+	cl = NULL;
+
+	fd = __rpc_nconf2fd(nconf);
+	if (fd < 0) {
+		error = errno;
+		goto err;
+	}
+	if (fd < __rpc_minfd)
+		fd = __rpc_raise_fd(fd);
+	bindresvport(fd, NULL);
+	if (nconf->nc_semantics == NC_TPI_COTS_ORD
+	 && (!strcmp(nconf->nc_protofmly, "inet")
+	     || !strcmp(nconf->nc_protofmly, "inet6")))
+		(void) setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one,
+				  sizeof(one));
+
+	ms = CLNT_VC_CONNECT_MAX_MS;
+	if (cr->cr_timed)
+		ms = MIN(ms, cr->cr_tv.tv_sec * 1000
+			     + cr->cr_tv.tv_usec / 1000);
+	error = clnt_vc_conn_start(&crt->crt_cn, fd, svcaddr, cr->cr_prog,
+				   cr->cr_vers, 0, ms);
+	if (error) {
+		close(fd);
+		goto err;
+	}
+	crt->crt_addr = svcaddr;
+	crt->crt_step_ms = 1;
+	return (NULL);
+
+ err:
+	__rpcb_cache_forget(cr->cr_prog, cr->cr_vers, nconf, cr->cr_host);
+	mem_free(svcaddr->buf, sizeof(*svcaddr->buf));
+	mem_free(svcaddr, sizeof(*svcaddr));
+	cl = clnt_raw_ncreate(cr->cr_prog, cr->cr_vers);
+	cl->cl_error.re_status = RPC_SYSTEMERROR;
+	cl->cl_error.re_errno = error;
+	return (cl);
+}
+
+/*
+ * The next step of a connect in progress.  Returns the handle, or NULL
+ * while connecting.
+ */
+static CLIENT *
+clnt_race_connect(struct clnt_race_try *crt)
+{
+	struct clnt_race *cr = crt->crt_race;
+	struct netconfig *nconf = crt->crt_nconf;
+	struct rpc_err rpc_error;
+	CLIENT *cl;
+	int fd = crt->crt_cn.cn_fd;
+	int error;
+
+	error = clnt_vc_conn_step(&crt->crt_cn, &rpc_error);
+	if (error == EINPROGRESS)
+		return (NULL);
+
+	if (error) {
+		close(fd);
+		cl = clnt_raw_ncreate(cr->cr_prog, cr->cr_vers);
+		cl->cl_error = rpc_error;
+	} else {
+		cl = clnt_vc_ncreatef(fd, crt->crt_addr, cr->cr_prog,
+				      cr->cr_vers, 0, 0,
+				      CLNT_CREATE_FLAG_CONNECT
+				      | CLNT_CREATE_FLAG_CLOSE
+				      | CLNT_CREATE_FLAG_STARTED);
+		if (CLNT_SUCCESS(cl)) {
+			cl->cl_netid = mem_strdup(nconf->nc_netid);
+			cl->cl_tp = mem_strdup(nconf->nc_device);
+		} else if (!CX_DATA(cl)->cx_rec) {
+			/* not yet owned by a transport */
+			close(fd);
+		}
+	}
+	if (CLNT_FAILURE(cl)) {
+		/* perhaps restarted elsewhere, ask rpcbind next time */
+		__rpcb_cache_forget(cr->cr_prog, cr->cr_vers, nconf,
+				    cr->cr_host);
+	}
+	mem_free(crt->crt_addr->buf, sizeof(*crt->crt_addr->buf));
+	mem_free(crt->crt_addr, sizeof(*crt->crt_addr));
+	crt->crt_addr = NULL;
+	return (cl);
+}
+
+static void
+clnt_race_try_free(struct clnt_race_try *crt)
+{
+	freenetconfigent(crt->crt_nconf);
+	mem_free(crt, sizeof(*crt));
+}
+
+/*
+ * One step of an attempt: the rpcbind query and the connect started,
+ * then each check of the connect, after a doubling delay.
+ */
+static void
+clnt_race_task(struct work_pool_entry *wpe)
+{
+	struct clnt_race_try *crt =
+		opr_containerof(wpe, struct clnt_race_try, crt_wpe);
+	struct clnt_race *cr = crt->crt_race;
+	CLIENT *clnt = NULL;
+	bool cancel;
+	u_int ms;
+
+	mutex_lock(&cr->cr_mtx);
+	cancel = cr->cr_cancel || cr->cr_clnt;
+	mutex_unlock(&cr->cr_mtx);
+
+	if (cancel) {
+		__warnx(TIRPC_DEBUG_FLAG_CLNT, "%s: %s cancelled",
+			__func__, crt->crt_nconf->nc_netid);
+		if (crt->crt_addr) {
+			int fd = crt->crt_cn.cn_fd;
+
+			clnt_vc_conn_abort(&crt->crt_cn);
+			close(fd);
+			mem_free(crt->crt_addr->buf,
+				 sizeof(*crt->crt_addr->buf));
+			mem_free(crt->crt_addr, sizeof(*crt->crt_addr));
+		}
+		mutex_lock(&cr->cr_mtx);
+		goto done;
+	}
+
+	if (!crt->crt_addr)
+		clnt = clnt_race_lookup(crt);
+	if (!clnt && crt->crt_addr)
+		clnt = clnt_race_connect(crt);
+	if (!clnt) {
+		ms = crt->crt_step_ms;
+		crt->crt_step_ms = MIN(ms * 2, CLNT_VC_CONNECT_STEP_MS);
+		work_pool_submit_delayed(&svc_work_pool, wpe, ms * 1000);
+		return;
+	}
+
+	mutex_lock(&cr->cr_mtx);
+	if (CLNT_FAILURE(clnt)) {
+		clnt_race_error(cr, clnt);
+		cr->cr_failed++;
+		if (!cr->cr_cancel && !cr->cr_clnt && cr->cr_next < cr->cr_n)
+			clnt_race_start(cr);
+	} else if (!cr->cr_clnt && !cr->cr_cancel) {
+		cr->cr_clnt = clnt;
+		clnt = NULL;
+	}
+ done:
+	cr->cr_done++;
+	cond_broadcast(&cr->cr_cv);
+	mutex_unlock(&cr->cr_mtx);
+
+	if (clnt) {
+		/* failed, or lost the race */
+		CLNT_DESTROY(clnt);
+	}
+	clnt_race_try_free(crt);
+	clnt_race_release(cr);
+}
+
+/*
+ * No svc_init(), or shut down: in turn.
+ */
+static CLIENT *
+clnt_race_serial(const char *hostname, rpcprog_t prog, rpcvers_t vers,
+		 struct netconfig **nconfs, int n, const struct timeval *tp)
+{
+	struct clnt_race cr;
+	CLIENT *clnt = NULL;
+	int i;
+
+	memset(&cr, 0, sizeof(cr));
+	cr.cr_last.re_status = RPC_UNKNOWNPROTO;
+	for (i = 0; i < n; i++) {
+		if (!clnt) {
+			clnt = clnt_tp_ncreate_timed(hostname, prog, vers,
+						     nconfs[i], tp);
+			if (CLNT_FAILURE(clnt)) {
+				clnt_race_error(&cr, clnt);
+				CLNT_DESTROY(clnt);
+				clnt = NULL;
+			}
+		}
+		freenetconfigent(nconfs[i]);
+	}
+	if (!clnt) {
+		clnt = clnt_raw_ncreate(prog, vers);
+		clnt->cl_error = (cr.cr_error.re_status != RPC_SUCCESS)
+				 ? cr.cr_error : cr.cr_last;
+	}
+	return (clnt);
+}
+
+static CLIENT *
+clnt_race_ncreate(const char *hostname, rpcprog_t prog, rpcvers_t vers,
+		  struct netconfig **nconfs, int n, const struct timeval *tp)
+{
+	struct clnt_race *cr;
+	struct clnt_race_try *crt;
+	struct timespec deadline;
+	struct rpc_err error;
+	CLIENT *clnt;
+	bool timedout = false;
+	int next;
+	int i;
+
+	if (!svc_work_pool.params.thrd_max)
+		return (clnt_race_serial(hostname, prog, vers, nconfs, n, tp));
+
+	cr = mem_zalloc(sizeof(*cr));
+	mutex_init(&cr->cr_mtx, NULL);
+	cond_init(&cr->cr_cv, 0, NULL);
+	cr->cr_host = hostname ? mem_strdup(hostname) : NULL;
+	cr->cr_prog = prog;
+	cr->cr_vers = vers;
+	if (tp) {
+		cr->cr_tv = *tp;
+		cr->cr_timed = true;
+	}
+	cr->cr_last.re_status = RPC_UNKNOWNPROTO;
+	cr->cr_n = n;
+	/* each attempt, the timer, and here */
+	cr->cr_refs = n + 2;
+	(void)clock_gettime(CLOCK_REALTIME_FAST, &cr->cr_start);
+
+	for (i = 0; i < n; i++) {
+		crt = mem_zalloc(sizeof(*crt));
+		crt->crt_race = cr;
+		crt->crt_nconf = nconfs[i];
+		crt->crt_cn.cn_fd = -1;
+		crt->crt_wpe.fun = clnt_race_task;
+		cr->cr_try[i] = crt;
+	}
+
+	mutex_lock(&cr->cr_mtx);
+	clnt_race_start(cr);
+	mutex_unlock(&cr->cr_mtx);
+	cr->cr_wpe.fun = clnt_race_timer;
+	work_pool_submit_delayed(&svc_work_pool, &cr->cr_wpe,
+				 CLNT_RACE_DELAY_MS * 1000);
+
+	/* attempts still connecting are left to finish in the pool */
+	deadline = cr->cr_start;
+	if (tp) {
+		deadline.tv_sec += tp->tv_sec;
+		timespec_addms(&deadline, tp->tv_usec / 1000);
+	}
+
+	mutex_lock(&cr->cr_mtx);
+	while (!cr->cr_clnt && cr->cr_done < n) {
+		if (!tp)
+			cond_wait(&cr->cr_cv, &cr->cr_mtx);
+		else if (cond_timedwait(&cr->cr_cv, &cr->cr_mtx, &deadline)
+			 == ETIMEDOUT) {
+			timedout = true;
+			break;
+		}
+	}
+	clnt = cr->cr_clnt;
+	/* attempts left behind still write these */
+	error = (cr->cr_error.re_status != RPC_SUCCESS)
+		? cr->cr_error : cr->cr_last;
+	cr->cr_cancel = true;
+	next = cr->cr_next;
+	cr->cr_next = n;
+	cond_broadcast(&cr->cr_cv);
+	mutex_unlock(&cr->cr_mtx);
+
+	/* not started */
+	for (i = next; i < n; i++) {
+		clnt_race_try_free(cr->cr_try[i]);
+		clnt_race_release(cr);
+	}
+
+	if (!clnt) {
+		clnt = clnt_raw_ncreate(prog, vers);
+		if (timedout)
+			clnt->cl_error.re_status = RPC_TIMEDOUT;
+		else
+			clnt->cl_error = error;
+	}
+	clnt_race_release(cr);
+	return (clnt);
+}
+
 /*
  * Top level client creation routine.
  * Generic client creation: takes (servers name, program-number, nettype) and
  * returns client handle. Default options are set, which the user can
  * change using the rpc equivalent of _ioctl()'s.
  *
- * It tries for all the netids in that particular class of netid until
- * it succeeds.
+ * It tries all the netids in that particular class of netid, staggered
+ * (clnt_race_ncreate()), until one succeeds.
  * XXX The error message in the case of failure will be the one
  * pertaining to the last create error.
  *
@@ -152,12 +631,13 @@ CLIENT *
 clnt_ncreate_timed(const char *hostname, rpcprog_t prog, rpcvers_t vers,
 		   const char *netclass, const struct timeval *tp)
 {
+	struct netconfig *nconfs[CLNT_RACE_MAX];
 	struct netconfig *nconf;
 	CLIENT *clnt;
 	void *handle;
-	struct rpc_err save_cf_error;
 	char nettype_array[NETIDLEN];
 	char *nettype = &nettype_array[0];
+	int n = 0;
 
 	if (netclass == NULL)
 		nettype = NULL;
@@ -181,56 +661,32 @@ clnt_ncreate_timed(const char *hostname, rpcprog_t prog, rpcvers_t vers,
 		clnt->cl_error.re_status = RPC_UNKNOWNPROTO;
 		return (clnt);
 	}
-	save_cf_error.re_status = RPC_SUCCESS;
-
-	for (;;) {
-		nconf = __rpc_getconf(handle);
-		if (nconf == NULL) {
-			clnt = clnt_raw_ncreate(prog, vers);
-			clnt->cl_error.re_status = RPC_UNKNOWNPROTO;
-			break;
-		}
-		__warnx(TIRPC_DEBUG_FLAG_CLNT, "%s: trying netid %s",
-			__func__, nconf->nc_netid);
 
-		clnt = clnt_tp_ncreate_timed(hostname, prog, vers, nconf, tp);
-		if (CLNT_SUCCESS(clnt))
-			break;
-
-		if (clnt->cl_error.re_status != RPC_N2AXLATEFAILURE
-		    && clnt->cl_error.re_status != RPC_UNKNOWNHOST) {
-			/*
-			 * Since we didn't get a name-to-address
-			 * translation failure here, we remember
-			 * this particular error.  The object of
-			 * this is to enable us to return to the
-			 * caller a more-specific error than the
-			 * unhelpful ``Name to address translation
-			 * failed'' which might well occur if we
-			 * merely returned the last error (because
-			 * the local loopbacks are typically the
-			 * last ones in /etc/netconfig and the most
-			 * likely to be unable to translate a host
-			 * name).  We also check for a more
-			 * meaningful error than ``unknown host
-			 * name'' for the same reasons.
-			 */
-			save_cf_error = clnt->cl_error;
-			CLNT_DESTROY(clnt);
-			clnt = NULL;
-		}
-	}
-
-	/*
-	 * Attempt to return an error more specific than ``Name to address
-	 * translation failed'' or ``unknown host name''
-	 */
-	if ((clnt->cl_error.re_status == RPC_N2AXLATEFAILURE
-	     || clnt->cl_error.re_status == RPC_UNKNOWNHOST)
-	    && (save_cf_error.re_status != RPC_SUCCESS)) {
-		clnt->cl_error = save_cf_error;
+	/* copied, as the attempts may outlive the handle */
+	while (n < CLNT_RACE_MAX && (nconf = __rpc_getconf(handle))) {
+		nconfs[n] = getnetconfigent(nconf->nc_netid);
+		if (nconfs[n])
+			n++;
 	}
 	__rpc_endconf(handle);
+
+	switch (n) {
+	case 0:
+		clnt = clnt_raw_ncreate(prog, vers);
+		clnt->cl_error.re_status = RPC_UNKNOWNPROTO;
+		break;
+	case 1:
+		__warnx(TIRPC_DEBUG_FLAG_CLNT, "%s: trying netid %s",
+			__func__, nconfs[0]->nc_netid);
+		clnt = clnt_tp_ncreate_timed(hostname, prog, vers, nconfs[0],
+					     tp);
+		freenetconfigent(nconfs[0]);
+		break;
+	default:
+		/* nconfs are freed by the attempts */
+		clnt = clnt_race_ncreate(hostname, prog, vers, nconfs, n, tp);
+		break;
+	};
 	return (clnt);
 }
 
@@ -270,29 +726,8 @@ clnt_tp_ncreate_timed(const char *hostname, rpcprog_t prog,
 		/* appropriate error number is set by rpcbind libraries */
 		return (cl);
 	}
-	if (cl == NULL) {
-		/* __rpc_findaddr_timed failed? */
-		cl = clnt_tli_ncreate(RPC_ANYFD, nconf, svcaddr, prog, vers, 0,
-				      0);
-	}
-	if (CLNT_SUCCESS(cl)) {
-		/* Reuse the CLIENT handle and change the appropriate fields */
-		if (CLNT_CONTROL(cl, CLSET_SVC_ADDR, (void *)svcaddr) == true) {
-			if (cl->cl_netid == NULL)
-				cl->cl_netid = mem_strdup(nconf->nc_netid);
-			if (cl->cl_tp == NULL)
-				cl->cl_tp = mem_strdup(nconf->nc_device);
-			(void)CLNT_CONTROL(cl, CLSET_PROG, (void *)&prog);
-			(void)CLNT_CONTROL(cl, CLSET_VERS, (void *)&vers);
-		} else {
-			CLNT_DESTROY(cl);
-			cl = clnt_tli_ncreate(RPC_ANYFD, nconf, svcaddr, prog,
-					      vers, 0, 0);
-		}
-	}
-	mem_free(svcaddr->buf, sizeof(*svcaddr->buf));
-	mem_free(svcaddr, sizeof(*svcaddr));
-	return (cl);
+	return (clnt_tp_addr_ncreate(hostname, prog, vers, nconf, svcaddr,
+				     cl));
 }
 
 /*
@@ -416,12 +851,303 @@ clnt_req_xid_cmpf(const struct opr_rbtree_node *lhs,
 	return (1);
 }
 
+/*
+ * Call slots
+ *
+ * Off unless svc_init_params clnt_slots_max or CLSET_SLOTS sets bounds.
+ * Each connection then sends at most limit calls before their replies.
+ * Others wait in order of arrival, each holding a reference, and are
+ * sent (or woken) by clnt_req_slot_dispatch() as slots are released.
+ *
+ * The limit adapts to the least reply latency seen in each window of
+ * limit replies: halved when it doubles the smoothed least latency,
+ * otherwise doubled (below ssthresh) or increased by one.
+ */
+static inline void
+clnt_req_slot_init(struct rpc_dplx_rec *rec)
+{
+	rec->call_slots.min = __svc_params->clnt_slots.min;
+	rec->call_slots.max = __svc_params->clnt_slots.max;
+	rec->call_slots.limit = rec->call_slots.min;
+	rec->call_slots.ssthresh = rec->call_slots.max;
+}
+
+/*
+ * Returns true when the request may be sent now.  Otherwise it is
+ * queued, flagged with wait (for CLNT_CALL_WAIT) or not (sent by the
+ * dispatcher).
+ */
+bool
+clnt_req_slot_get(struct clnt_req *cc, uint16_t wait)
+{
+	struct cx_data *cx = CX_DATA(cc->cc_clnt);
+	struct rpc_dplx_rec *rec = cx->cx_rec;
+
+	/* clnt_raw, or off */
+	if (!rec || !(__svc_params->clnt_slots.max || rec->call_slots.max))
+		return (true);
+
+	rec = cx_rec_rli(cx);
+	if (unlikely(!rec->call_slots.limit))
+		clnt_req_slot_init(rec);
+	if (unlikely(!rec->call_slots.limit)) {
+		/* only CLSET_SLOTS turns it on for this connection */
+		rpc_dplx_rui(rec);
+		return (true);
+	}
+
+	if (rec->call_slots.used < rec->call_slots.limit
+	 && TAILQ_EMPTY(&rec->call_slots.waitq)) {
+		rec->call_slots.used++;
+		rpc_dplx_rui(rec);
+		(void)clock_gettime(CLOCK_MONOTONIC, &cc->cc_sent);
+		atomic_set_uint16_t_bits(&cc->cc_flags, CLNT_REQ_FLAG_SLOT);
+		return (true);
+	}
+
+	atomic_inc_uint32_t(&cc->cc_refs);	/* released by dispatch */
+	atomic_set_uint16_t_bits(&cc->cc_flags, CLNT_REQ_FLAG_SLOTQ | wait);
+	TAILQ_INSERT_TAIL(&rec->call_slots.waitq, cc, cc_slotq);
+	rec->call_slots.waiting++;
+	rpc_dplx_rui(rec);
+
+	__warnx(TIRPC_DEBUG_FLAG_CLNT_REQ,
+		"%s: %p fd %d xid %" PRIu32 " queued (%u used)",
+		__func__, &rec->xprt, rec->xprt.xp_fd, cc->cc_xid,
+		rec->call_slots.used);
+	return (false);
+}
+
+/*
+ * Grant free slots to waiting requests.  One thread at a time; another
+ * releasing a slot meanwhile leaves it to the loop here.
+ */
+static void
+clnt_req_slot_dispatch(struct rpc_dplx_rec *rec)
+{
+	struct clnt_req *cc;
+	enum clnt_stat stat;
+	uint16_t flags;
+
+	rpc_dplx_rli(rec);
+	if (rec->call_slots.dispatching) {
+		rpc_dplx_rui(rec);
+		return;
+	}
+	rec->call_slots.dispatching = true;
+
+	while (rec->call_slots.used < rec->call_slots.limit
+	       && (cc = TAILQ_FIRST(&rec->call_slots.waitq))) {
+		TAILQ_REMOVE(&rec->call_slots.waitq, cc, cc_slotq);
+		rec->call_slots.waiting--;
+
+		flags = atomic_fetch_uint16_t(&cc->cc_flags);
+		if (flags & (CLNT_REQ_FLAG_ACKSYNC | CLNT_REQ_FLAG_BACKSYNC)) {
+			/* expired while waiting */
+			atomic_clear_uint16_t_bits(&cc->cc_flags,
+						   CLNT_REQ_FLAG_SLOTQ);
+			rpc_dplx_rui(rec);
+			clnt_req_release(cc);
+			rpc_dplx_rli(rec);
+			continue;
+		}
+		rec->call_slots.used++;
+		(void)clock_gettime(CLOCK_MONOTONIC, &cc->cc_sent);
+		/* granted before dequeued, see clnt_req_slot_wait() */
+		atomic_set_uint16_t_bits(&cc->cc_flags, CLNT_REQ_FLAG_SLOT);
+		atomic_clear_uint16_t_bits(&cc->cc_flags, CLNT_REQ_FLAG_SLOTQ);
+		rpc_dplx_rui(rec);
+
+		if (flags & CLNT_REQ_FLAG_SLOTWAIT) {
+			mutex_lock(&cc->cc_we.mtx);
+			cond_signal(&cc->cc_we.cv);
+			mutex_unlock(&cc->cc_we.mtx);
+		} else {
+			stat = CLNT_CALL_ONCE(cc);
+			if (stat != RPC_SUCCESS)
+				clnt_req_fail(cc, stat);
+		}
+		clnt_req_release(cc);
+		rpc_dplx_rli(rec);
+	}
+
+	rec->call_slots.dispatching = false;
+	rpc_dplx_rui(rec);
+}
+
+/*
+ * Release the slot of a request, and grant it to the next waiting.
+ * Called under recv.lock, returns true to clnt_req_slot_dispatch()
+ * after unlocking.
+ */
+static inline bool
+clnt_req_slot_put(struct rpc_dplx_rec *rec, struct clnt_req *cc)
+{
+	if (!(atomic_postclear_uint16_t_bits(&cc->cc_flags, CLNT_REQ_FLAG_SLOT)
+	      & CLNT_REQ_FLAG_SLOT))
+		return (false);
+
+	rec->call_slots.used--;
+	return (!TAILQ_EMPTY(&rec->call_slots.waitq));
+}
+
+/*
+ * The transport is going away: fail the requests still waiting for a
+ * slot, rather than sending them as slots are released.  Those moved to
+ * a new connection (clnt_vc_replace()) have left already.
+ */
+void
+clnt_req_slot_drain(struct rpc_dplx_rec *rec)
+{
+	struct clnt_req *cc;
+	uint16_t flags;
+
+	rpc_dplx_rli(rec);
+	while ((cc = TAILQ_FIRST(&rec->call_slots.waitq))) {
+		TAILQ_REMOVE(&rec->call_slots.waitq, cc, cc_slotq);
+		rec->call_slots.waiting--;
+		flags = atomic_postclear_uint16_t_bits(&cc->cc_flags,
+						       CLNT_REQ_FLAG_SLOTQ);
+		rpc_dplx_rui(rec);
+
+		__warnx(TIRPC_DEBUG_FLAG_CLNT_REQ,
+			"%s: %p fd %d xid %" PRIu32 " drained",
+			__func__, &rec->xprt, rec->xprt.xp_fd, cc->cc_xid);
+
+		/* woken without a slot, see clnt_req_slot_wait() */
+		if (flags & CLNT_REQ_FLAG_SLOTWAIT) {
+			mutex_lock(&cc->cc_we.mtx);
+			cond_signal(&cc->cc_we.cv);
+			mutex_unlock(&cc->cc_we.mtx);
+		} else
+			clnt_req_fail(cc, RPC_CANTSEND);
+		clnt_req_release(cc);
+		rpc_dplx_rli(rec);
+	}
+	rpc_dplx_rui(rec);
+}
+
+/*
+ * Called under recv.lock with a reply to a request holding a slot.
+ */
+static inline void
+clnt_req_slot_sample(struct rpc_dplx_rec *rec, struct clnt_req *cc)
+{
+	struct timespec ts;
+	uint64_t ns;
+	u_int limit = rec->call_slots.limit;
+
+	(void)clock_gettime(CLOCK_MONOTONIC, &ts);
+	timespecsub(&ts, &cc->cc_sent);
+	ns = ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+
+	if (!rec->call_slots.replies++ || ns < rec->call_slots.win_min_ns)
+		rec->call_slots.win_min_ns = ns;
+	if (rec->call_slots.replies < limit)
+		return;
+
+	ns = rec->call_slots.win_min_ns;
+	rec->call_slots.replies = 0;
+
+	if (!rec->call_slots.base_ns || ns < rec->call_slots.base_ns) {
+		rec->call_slots.base_ns = ns;
+	} else if (ns > 2 * rec->call_slots.base_ns) {
+		/* queueing at the server (or on the way) */
+		limit /= 2;
+		if (limit < rec->call_slots.min)
+			limit = rec->call_slots.min;
+		rec->call_slots.ssthresh = limit;
+		rec->call_slots.base_ns += (ns - rec->call_slots.base_ns) / 8;
+		rec->call_slots.limit = limit;
+		return;
+	} else {
+		rec->call_slots.base_ns += (ns - rec->call_slots.base_ns) / 8;
+	}
+
+	if (limit < rec->call_slots.ssthresh)
+		limit *= 2;
+	else
+		limit++;
+	if (limit > rec->call_slots.max)
+		limit = rec->call_slots.max;
+	rec->call_slots.limit = limit;
+}
+
+/*
+ * CLGET_SLOTS, CLSET_SLOTS, for each transport's clnt_control under
+ * recv.lock.  A larger limit is used as slots are next released.
+ */
+bool
+clnt_req_slot_control(struct rpc_dplx_rec *rec, u_int request, void *info)
+{
+	struct clnt_slots *cs = (struct clnt_slots *)info;
+
+	if (!rec->call_slots.limit)
+		clnt_req_slot_init(rec);
+
+	switch (request) {
+	case CLGET_SLOTS:
+		cs->limit = rec->call_slots.limit;
+		cs->min = rec->call_slots.min;
+		cs->max = rec->call_slots.max;
+		cs->used = rec->call_slots.used;
+		cs->waiting = rec->call_slots.waiting;
+		return (true);
+	case CLSET_SLOTS:
+		if (!cs->min || cs->max < cs->min)
+			return (false);
+		rec->call_slots.min = cs->min;
+		rec->call_slots.max = cs->max;
+		if (rec->call_slots.limit < cs->min)
+			rec->call_slots.limit = cs->min;
+		if (rec->call_slots.limit > cs->max)
+			rec->call_slots.limit = cs->max;
+		rec->call_slots.ssthresh = cs->max;
+		return (true);
+	default:
+		break;
+	};
+	return (false);
+}
+
+/*
+ * Requests moved to a new connection (clnt_vc_replace()), both recv
+ * locked.  Those waiting keep their places.
+ */
+void
+clnt_req_slot_move(struct rpc_dplx_rec *from, struct rpc_dplx_rec *to)
+{
+	TAILQ_CONCAT(&to->call_slots.waitq, &from->call_slots.waitq,
+		     cc_slotq);
+	to->call_slots.used = from->call_slots.used;
+	to->call_slots.limit = from->call_slots.limit;
+	to->call_slots.min = from->call_slots.min;
+	to->call_slots.max = from->call_slots.max;
+	to->call_slots.ssthresh = from->call_slots.ssthresh;
+	to->call_slots.waiting = from->call_slots.waiting;
+	to->call_slots.base_ns = from->call_slots.base_ns;
+
+	from->call_slots.used = 0;
+	from->call_slots.waiting = 0;
+}
+
 enum clnt_stat
 clnt_req_callback(struct clnt_req *cc)
 {
+	enum clnt_stat stat = RPC_SUCCESS;
+
 	svc_rqst_expire_insert(cc);
 
-	return CLNT_CALL_ONCE(cc);
+	/* a reconnected transport may send it again, and the reply
+	 * complete it, before this send returns (clnt_vc_replace())
+	 */
+	atomic_inc_uint32_t(&cc->cc_refs);
+	if (clnt_req_slot_get(cc, CLNT_REQ_FLAG_NONE))
+		stat = CLNT_CALL_ONCE(cc);
+	/* else sent by clnt_req_slot_dispatch() */
+	clnt_req_release(cc);
+
+	return (stat);
 }
 
 /*
@@ -431,6 +1157,7 @@ void
 clnt_req_callback_default(struct clnt_req *cc)
 {
 	mutex_lock(&cc->cc_we.mtx);
+	atomic_set_uint16_t_bits(&cc->cc_flags, CLNT_REQ_FLAG_WAKEUP);
 	cond_signal(&cc->cc_we.cv);
 	mutex_unlock(&cc->cc_we.mtx);
 }
@@ -439,11 +1166,11 @@ enum clnt_stat
 clnt_req_refresh(struct clnt_req *cc)
 {
 	struct cx_data *cx = CX_DATA(cc->cc_clnt);
-	struct rpc_dplx_rec *rec = cx->cx_rec;
+	struct rpc_dplx_rec *rec;
 	struct opr_rbtree_node *nv;
 
 	/* this lock protects both xid and rbtree */
-	rpc_dplx_rli(rec);
+	rec = cx_rec_rli(cx);
 	opr_rbtree_remove(&rec->call_replies, &cc->cc_dplx);
 	cc->cc_xid = ++(rec->call_xid);
 	nv = opr_rbtree_insert(&rec->call_replies, &cc->cc_dplx);
@@ -465,10 +1192,19 @@ void
 clnt_req_reset(struct clnt_req *cc)
 {
 	struct cx_data *cx = CX_DATA(cc->cc_clnt);
-
-	rpc_dplx_rli(cx->cx_rec);
-	opr_rbtree_remove(&cx->cx_rec->call_replies, &cc->cc_dplx);
-	rpc_dplx_rui(cx->cx_rec);
+	struct rpc_dplx_rec *rec = cx->cx_rec;
+	bool slot = false;
+
+	/* NULL when no connection was picked */
+	if (rec) {
+		rec = cx_rec_rli(cx);
+		opr_rbtree_remove(&rec->call_replies, &cc->cc_dplx);
+		/* no reply, or not yet processed */
+		slot = clnt_req_slot_put(rec, cc);
+		rpc_dplx_rui(rec);
+	}
+	if (slot)
+		clnt_req_slot_dispatch(rec);
 
 	if (atomic_postclear_uint16_t_bits(&cc->cc_flags,
 					   CLNT_REQ_FLAG_ACKSYNC |
@@ -483,9 +1219,10 @@ enum clnt_stat
 clnt_req_setup(struct clnt_req *cc, struct timespec timeout)
 {
 	CLIENT *clnt = cc->cc_clnt;
-	struct cx_data *cx = CX_DATA(clnt);
-	struct rpc_dplx_rec *rec = cx->cx_rec;
+	struct cx_data *cx;
+	struct rpc_dplx_rec *rec;
 	struct opr_rbtree_node *nv;
+	bool picked = false;
 
 	cc->cc_error.re_errno = 0;
 	cc->cc_error.re_status = RPC_SUCCESS;
@@ -494,6 +1231,25 @@ clnt_req_setup(struct clnt_req *cc, struct timespec timeout)
 	cc->cc_refreshes = 2;
 	cc->cc_timeout = timeout;
 
+	if (clnt->cl_ops->cl_pick) {
+		/* one of several connections, ref+1 */
+		CLIENT *pick = (*clnt->cl_ops->cl_pick)(clnt);
+
+		if (!pick) {
+			__warnx(TIRPC_DEBUG_FLAG_CLNT_REQ,
+				"%s: %p no connection",
+				__func__, clnt);
+			/* released by clnt_req_fini() */
+			CLNT_REF(clnt, CLNT_REF_FLAG_NONE);
+			cc->cc_error.re_status = RPC_CANTSEND;
+			return (RPC_CANTSEND);
+		}
+		cc->cc_clnt = clnt = pick;
+		picked = true;
+	}
+	cx = CX_DATA(clnt);
+	rec = cx->cx_rec;
+
 	if (timeout.tv_nsec < 0 || timeout.tv_nsec > 999999999
 	 || timeout.tv_sec < 0) {
 		__warnx(TIRPC_DEBUG_FLAG_ERROR,
@@ -510,7 +1266,7 @@ clnt_req_setup(struct clnt_req *cc, struct timespec timeout)
 	}
 
 	/* this lock protects both xid and rbtree */
-	rpc_dplx_rli(rec);
+	rec = cx_rec_rli(cx);
 	cc->cc_xid = ++(rec->call_xid);
 	nv = opr_rbtree_insert(&rec->call_replies, &cc->cc_dplx);
 	rpc_dplx_rui(rec);
@@ -522,7 +1278,8 @@ clnt_req_setup(struct clnt_req *cc, struct timespec timeout)
 		return (RPC_TLIERROR);
 	}
 
-	CLNT_REF(clnt, CLNT_REF_FLAG_NONE);
+	if (!picked)
+		CLNT_REF(clnt, CLNT_REF_FLAG_NONE);
 	return (RPC_SUCCESS);
 }
 
@@ -537,12 +1294,14 @@ clnt_req_process_reply(SVCXPRT *xprt, struct svc_req *req)
 	struct opr_rbtree_node *nv;
 	struct clnt_req *cc;
 	struct clnt_req cc_k;
+	uint16_t flags;
+	bool slot = false;
 
 	rpc_dplx_rli(rec);
 	cc_k.cc_xid = req->rq_msg.rm_xid;
 	nv = opr_rbtree_lookup(&rec->call_replies, &cc_k.cc_dplx);
-	rpc_dplx_rui(rec);
 	if (!nv) {
+		rpc_dplx_rui(rec);
 		__warnx(TIRPC_DEBUG_FLAG_ERROR,
 			"%s: %p fd %d lookup failed xid %" PRIu32,
 			__func__, &rec->xprt, rec->xprt.xp_fd, cc_k.cc_xid);
@@ -550,23 +1309,34 @@ clnt_req_process_reply(SVCXPRT *xprt, struct svc_req *req)
 	}
 	cc = opr_containerof(nv, struct clnt_req, cc_dplx);
 
-	/* order dependent */
-	if (atomic_postclear_uint16_t_bits(&cc->cc_flags,
-					   CLNT_REQ_FLAG_EXPIRING)
-	    & CLNT_REQ_FLAG_EXPIRING) {
-		svc_rqst_expire_remove(cc);
-		cc->cc_expire_ms = 0;	/* atomic barrier(s) */
-	}
-
-	if (atomic_postset_uint16_t_bits(&cc->cc_flags, CLNT_REQ_FLAG_ACKSYNC)
-	    & (CLNT_REQ_FLAG_ACKSYNC | CLNT_REQ_FLAG_BACKSYNC)) {
+	/* still recv locked, so a duplicate reply (eg, to a request sent
+	 * again by clnt_vc_replace()) cannot find it released
+	 */
+	flags = atomic_postset_uint16_t_bits(&cc->cc_flags,
+					     CLNT_REQ_FLAG_ACKSYNC);
+	if (flags & (CLNT_REQ_FLAG_ACKSYNC | CLNT_REQ_FLAG_BACKSYNC)) {
 		__warnx(TIRPC_DEBUG_FLAG_CLNT_REQ,
 			"%s: %p fd %d xid %" PRIu32 " ignored=%d",
 			__func__, xprt, xprt->xp_fd, cc->cc_xid,
 			cc->cc_error.re_status);
 		cc->cc_refreshes = 0;
+		rpc_dplx_rui(rec);
 		return SVC_STAT(xprt);
 	}
+	if (flags & CLNT_REQ_FLAG_SLOT) {
+		clnt_req_slot_sample(rec, cc);
+		slot = clnt_req_slot_put(rec, cc);
+	}
+	rpc_dplx_rui(rec);
+	if (slot)
+		clnt_req_slot_dispatch(rec);
+
+	if (atomic_postclear_uint16_t_bits(&cc->cc_flags,
+					   CLNT_REQ_FLAG_EXPIRING)
+	    & CLNT_REQ_FLAG_EXPIRING) {
+		svc_rqst_expire_remove(cc);
+		cc->cc_expire_ms = 0;	/* atomic barrier(s) */
+	}
 
 	_seterr_reply(&req->rq_msg, &(cc->cc_error));
 	if (cc->cc_error.re_status == RPC_SUCCESS) {
@@ -592,12 +1362,174 @@ clnt_req_process_reply(SVCXPRT *xprt, struct svc_req *req)
 	return SVC_STAT(xprt);
 }
 
+/*
+ * Complete a request that could not be sent, unless a reply or timeout
+ * has already completed it.
+ */
+void
+clnt_req_fail(struct clnt_req *cc, enum clnt_stat stat)
+{
+	/* order dependent */
+	if (atomic_postclear_uint16_t_bits(&cc->cc_flags,
+					   CLNT_REQ_FLAG_EXPIRING)
+	    & CLNT_REQ_FLAG_EXPIRING) {
+		svc_rqst_expire_remove(cc);
+		cc->cc_expire_ms = 0;	/* atomic barrier(s) */
+	}
+
+	if (atomic_postset_uint16_t_bits(&cc->cc_flags, CLNT_REQ_FLAG_ACKSYNC)
+	    & (CLNT_REQ_FLAG_ACKSYNC | CLNT_REQ_FLAG_BACKSYNC))
+		return;
+
+	cc->cc_error.re_status = stat;
+	(*cc->cc_process_cb)(cc);
+}
+
+/*
+ * Send again, with the same xid, each time the retransmit timeout
+ * expires before the deadline.  Only a call sent once gives a round
+ * trip sample (Karn); the backed off timeout stands until then.
+ *
+ * The waitq_entry is unlocked while sending, as the reply to an
+ * earlier send may be completed meanwhile.
+ */
+static int
+clnt_req_wait_rexmit(struct clnt_req *cc, const struct timespec *deadline,
+		     u_int rto)
+{
+	CLIENT *clnt = cc->cc_clnt;
+	struct rpc_dplx_rec *rec = CX_DATA(clnt)->cx_rec;
+	struct timespec sent;
+	struct timespec ts;
+	u_int sends = 1;
+	int code;
+
+	(void)clock_gettime(CLOCK_MONOTONIC, &sent);
+	for (;;) {
+		(void)clock_gettime(CLOCK_REALTIME_FAST, &ts);
+		timespec_addms(&ts, (rto + 999) / 1000);
+		if (!rto || timespeccmp(&ts, deadline, >))
+			ts = *deadline;	/* 0: turned off meanwhile */
+
+		code = 0;
+		while (!(atomic_fetch_uint16_t(&cc->cc_flags)
+			 & CLNT_REQ_FLAG_WAKEUP)) {
+			if (code == ETIMEDOUT)
+				break;
+			code = cond_timedwait(&cc->cc_we.cv, &cc->cc_we.mtx,
+					      &ts);
+		}
+		if (atomic_fetch_uint16_t(&cc->cc_flags)
+		    & CLNT_REQ_FLAG_WAKEUP) {
+			if (sends > 1)
+				return (0);
+			(void)clock_gettime(CLOCK_MONOTONIC, &ts);
+			timespecsub(&ts, &sent);
+			(*clnt->cl_ops->cl_rtt)(clnt,
+						ts.tv_sec * 1000000
+						+ ts.tv_nsec / 1000);
+			return (0);
+		}
+
+		if (!timespeccmp(&ts, deadline, <)
+		 || (rec->xprt.xp_flags & SVC_XPRT_FLAG_DESTROYED))
+			return (ETIMEDOUT);
+
+		rto = (*clnt->cl_ops->cl_rto)(clnt, true);
+		__warnx(TIRPC_DEBUG_FLAG_CLNT_REQ,
+			"%s: %p fd %d xid %" PRIu32 " retransmit (rto %u us)",
+			__func__, &rec->xprt, rec->xprt.xp_fd, cc->cc_xid,
+			rto);
+
+		/* an earlier send may still be answered */
+		mutex_unlock(&cc->cc_we.mtx);
+		(void)CLNT_CALL_ONCE(cc);
+		mutex_lock(&cc->cc_we.mtx);
+		sends++;
+	}
+}
+
+/*
+ * The transport may receive the reply on this thread (cl_wait), where
+ * clnt_req_callback_default() locks the waitq_entry, so it is unlocked
+ * meanwhile.
+ */
+static int
+clnt_req_wait_direct(struct clnt_req *cc, const struct timespec *deadline)
+{
+	int code;
+
+	mutex_unlock(&cc->cc_we.mtx);
+	code = (*cc->cc_clnt->cl_ops->cl_wait)(cc, deadline);
+	mutex_lock(&cc->cc_we.mtx);
+
+	while (!(atomic_fetch_uint16_t(&cc->cc_flags)
+		 & CLNT_REQ_FLAG_WAKEUP)) {
+		if (code == ETIMEDOUT)
+			return (ETIMEDOUT);
+		code = cond_timedwait(&cc->cc_we.cv, &cc->cc_we.mtx, deadline);
+	}
+	return (0);
+}
+
+/*
+ * Wait for clnt_req_slot_dispatch(), within the call timeout.  Returns
+ * EPIPE when clnt_req_slot_drain() took the request off the queue.
+ */
+static int
+clnt_req_slot_wait(struct clnt_req *cc)
+{
+	struct cx_data *cx = CX_DATA(cc->cc_clnt);
+	struct rpc_dplx_rec *rec;
+	struct timespec ts;
+	uint16_t flags;
+	int code = 0;
+
+	if (cc->cc_timeout.tv_sec + cc->cc_timeout.tv_nsec) {
+		(void)clock_gettime(CLOCK_REALTIME_FAST, &ts);
+		timespecadd(&ts, &cc->cc_timeout);
+	}
+
+	while ((flags = atomic_fetch_uint16_t(&cc->cc_flags))
+	       & CLNT_REQ_FLAG_SLOTQ) {
+		if (!(cc->cc_timeout.tv_sec + cc->cc_timeout.tv_nsec))
+			cond_wait(&cc->cc_we.cv, &cc->cc_we.mtx);
+		else if (cond_timedwait(&cc->cc_we.cv, &cc->cc_we.mtx, &ts)
+			 == ETIMEDOUT) {
+			code = ETIMEDOUT;
+			break;
+		}
+	}
+	if (!code)
+		return ((flags & CLNT_REQ_FLAG_SLOT) ? 0 : EPIPE);
+
+	rec = cx_rec_rli(cx);
+	if (!(atomic_postclear_uint16_t_bits(&cc->cc_flags,
+					     CLNT_REQ_FLAG_SLOTQ)
+	      & CLNT_REQ_FLAG_SLOTQ)) {
+		/* taken off meanwhile, the signal lost to the timeout */
+		rpc_dplx_rui(rec);
+		return ((atomic_fetch_uint16_t(&cc->cc_flags)
+			 & CLNT_REQ_FLAG_SLOT) ? 0 : EPIPE);
+	}
+	TAILQ_REMOVE(&rec->call_slots.waitq, cc, cc_slotq);
+	rec->call_slots.waiting--;
+	rpc_dplx_rui(rec);
+
+	__warnx(TIRPC_DEBUG_FLAG_CLNT_REQ,
+		"%s: %p fd %d xid %" PRIu32 " no slot",
+		__func__, &rec->xprt, rec->xprt.xp_fd, cc->cc_xid);
+	atomic_dec_uint32_t(&cc->cc_refs);	/* queued reference */
+	return (ETIMEDOUT);
+}
+
 enum clnt_stat
 clnt_req_wait_reply(struct clnt_req *cc)
 {
 	struct cx_data *cx = CX_DATA(cc->cc_clnt);
 	struct rpc_dplx_rec *rec = cx->cx_rec;
 	struct timespec ts;
+	u_int rto = 0;
 	int code;
 
 	__warnx(TIRPC_DEBUG_FLAG_CLNT_REQ,
@@ -606,6 +1538,22 @@ clnt_req_wait_reply(struct clnt_req *cc)
 		cc->cc_timeout.tv_sec, cc->cc_timeout.tv_nsec);
 
  call_again:
+	/* released by a reply, so again after a refresh */
+	if (!(atomic_fetch_uint16_t(&cc->cc_flags) & CLNT_REQ_FLAG_SLOT)
+	 && !clnt_req_slot_get(cc, CLNT_REQ_FLAG_SLOTWAIT)) {
+		code = clnt_req_slot_wait(cc);
+		if (code) {
+			cc->cc_error.re_status = (code == EPIPE)
+						 ? RPC_CANTSEND : RPC_TIMEDOUT;
+			return (cc->cc_error.re_status);
+		}
+	}
+
+	if (cc->cc_clnt->cl_ops->cl_wait
+	 && (cc->cc_timeout.tv_sec + cc->cc_timeout.tv_nsec)) {
+		/* the transport may take the read side while sending */
+		atomic_set_uint16_t_bits(&cc->cc_flags, CLNT_REQ_FLAG_DIRECT);
+	}
 	cc->cc_error.re_status = CLNT_CALL_ONCE(cc);
 	if (cc->cc_error.re_status != RPC_SUCCESS) {
 		return (cc->cc_error.re_status);
@@ -617,7 +1565,14 @@ clnt_req_wait_reply(struct clnt_req *cc)
 
 	(void)clock_gettime(CLOCK_REALTIME_FAST, &ts);
 	timespecadd(&ts, &cc->cc_timeout);
-	code = cond_timedwait(&cc->cc_we.cv, &cc->cc_we.mtx, &ts);
+	if (cc->cc_clnt->cl_ops->cl_rto)
+		rto = (*cc->cc_clnt->cl_ops->cl_rto)(cc->cc_clnt, false);
+	if (rto)
+		code = clnt_req_wait_rexmit(cc, &ts, rto);
+	else if (cc->cc_clnt->cl_ops->cl_wait)
+		code = clnt_req_wait_direct(cc, &ts);
+	else
+		code = cond_timedwait(&cc->cc_we.cv, &cc->cc_we.mtx, &ts);
 
 	__warnx(TIRPC_DEBUG_FLAG_CLNT_REQ,
 		"%s: %p fd %d replied xid %" PRIu32,
@@ -643,7 +1598,8 @@ clnt_req_wait_reply(struct clnt_req *cc)
 			}
 		}
 		atomic_clear_uint16_t_bits(&cc->cc_flags,
-					   CLNT_REQ_FLAG_ACKSYNC);
+					   CLNT_REQ_FLAG_ACKSYNC
+					   | CLNT_REQ_FLAG_WAKEUP);
 		goto call_again;
 	}
 	if (code == ETIMEDOUT) {
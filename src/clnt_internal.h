@@ -41,6 +41,49 @@ struct cx_data {
 };
 #define CX_DATA(p) (opr_containerof((p), struct cx_data, cx_c))
 
+/* marshalled callmsg: xid, direction, rpcvers, prog, vers */
+#define cx_prog(cx) \
+	((rpcprog_t)ntohl(*(u_int32_t *)&(cx)->cx_mcallc[3 * BYTES_PER_XDR_UNIT]))
+#define cx_vers(cx) \
+	((rpcvers_t)ntohl(*(u_int32_t *)&(cx)->cx_mcallc[4 * BYTES_PER_XDR_UNIT]))
+
+/*
+ * Copy the marshalled callmsg to the call buffer with this call's xid.
+ * The template is not written after create, except prog and vers by
+ * CLSET_* (as whole words), so encoding needs no lock.
+ */
+static inline bool
+cx_callhdr(struct cx_data *cx, XDR *xdrs, u_int32_t xid)
+{
+	u_int32_t mcallc[MCALL_MSG_SIZE / BYTES_PER_XDR_UNIT];
+	u_int32_t *uint32p = (u_int32_t *)cx->cx_mcallc;
+	u_int i;
+
+	mcallc[0] = htonl(xid);
+	for (i = 1; i < cx->cx_mpos / BYTES_PER_XDR_UNIT; i++)
+		mcallc[i] = atomic_fetch_uint32_t(&uint32p[i]);
+
+	return (XDR_PUTBYTES(xdrs, (char *)mcallc, cx->cx_mpos));
+}
+
+/*
+ * cx_rec is replaced when clnt_vc reconnects, moving its requests (see
+ * clnt_vc_replace()).  Returns the current one, recv locked.
+ */
+static inline struct rpc_dplx_rec *
+cx_rec_rli(struct cx_data *cx)
+{
+	struct rpc_dplx_rec *rec;
+
+	for (;;) {
+		rec = atomic_fetch_voidptr((void **)&cx->cx_rec);
+		rpc_dplx_rli(rec);
+		if (likely(rec == cx->cx_rec))
+			return (rec);
+		rpc_dplx_rui(rec);
+	}
+}
+
 /* compartmentalize a bit */
 static inline void
 clnt_data_init(struct cx_data *cx)
@@ -61,8 +104,49 @@ clnt_data_destroy(struct cx_data *cx)
 		mem_free(cx->cx_c.cl_tp, strlen(cx->cx_c.cl_tp) + 1);
 }
 
+/* in clnt_generic.c */
+void clnt_req_fail(struct clnt_req *, enum clnt_stat);
+bool clnt_req_slot_get(struct clnt_req *, uint16_t);
+bool clnt_req_slot_control(struct rpc_dplx_rec *, u_int, void *);
+void clnt_req_slot_drain(struct rpc_dplx_rec *);
+void clnt_req_slot_move(struct rpc_dplx_rec *, struct rpc_dplx_rec *);
+
+/* in clnt_vc.c */
+
+/* milliseconds before a connect in progress is abandoned (not TLS) */
+#define CLNT_VC_CONNECT_MAX_MS (10000)
+
+/* milliseconds at most between steps of a connect in progress */
+#define CLNT_VC_CONNECT_STEP_MS (100)
+
+/* clnt_vc_ncreatef(): connected, and TLS started, by clnt_vc_conn_step() */
+#define CLNT_CREATE_FLAG_STARTED	0x00400000
+
+/*
+ * A connect in progress, then the TLS probe and handshake when flagged
+ * (CLNT_CREATE_FLAG_TLS), stepped without blocking.  The caller keeps
+ * the fd, and closes it on failure.
+ */
+struct clnt_vc_conn {
+	struct timespec cn_due;		/* connect abandoned */
+	struct rpc_tls_clnt *cn_tls;
+	rpcprog_t cn_prog;
+	rpcvers_t cn_vers;
+	uint32_t cn_flags;
+	int cn_fd;			/* in progress, or -1 */
+	int cn_fl;			/* file status flags before */
+	short cn_events;		/* awaited */
+	bool cn_connected;
+};
+
+int clnt_vc_conn_start(struct clnt_vc_conn *, int, const struct netbuf *,
+		       rpcprog_t, rpcvers_t, uint32_t, int);
+int clnt_vc_conn_step(struct clnt_vc_conn *, struct rpc_err *);
+void clnt_vc_conn_abort(struct clnt_vc_conn *);
+
 /* in svc_rqst.c */
 void svc_rqst_expire_insert(struct clnt_req *);
+void svc_rqst_expire_insertv(struct clnt_req **, int);
 void svc_rqst_expire_remove(struct clnt_req *);
 
 #endif				/* _CLNT_INTERNAL_H */
@@ -0,0 +1,521 @@
+/*
+ * Copyright (c) 2018 Red Hat, Inc. and/or its affiliates.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR `AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/**
+ * @file clnt_nconn.c
+ * @brief Client handle over several connections (nconnect)
+ *
+ * @section DESCRIPTION
+ *
+ * The handle owns nconn clnt_vc handles to the same server address.
+ * clnt_req_setup() asks it (cl_pick) for the connection with the fewest
+ * requests awaiting replies, and the request then belongs to that
+ * connection: its xid, timeout and reply are handled as for any other
+ * clnt_vc request, and cc_clnt is that connection (with the same cl_u1
+ * and cl_u2).  Auth is per request, so it is shared already; the program
+ * and version are kept here and applied to every connection.
+ *
+ * A connection whose transport has been destroyed is skipped, and is
+ * reconnected by a work pool task, at most once a second.  The task does
+ * not wait on the connect, but checks it again after a delay.
+ */
+
+#include "config.h"
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <errno.h>
+#include <signal.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <rpc/types.h>
+#include <misc/portable.h>
+#include <reentrant.h>
+#include <rpc/rpc.h>
+#include <misc/timespec.h>
+
+#include "rpc_com.h"
+#include "clnt_internal.h"
+#include "svc_internal.h"
+
+/* seconds between attempts to reconnect */
+#define NC_RETRY_SEC (1)
+
+struct nc_conn {
+	CLIENT *clnt;			/* clnt_vc handle, or NULL */
+	struct nc_data *nc;
+	struct work_pool_entry wpe;	/* reconnecting */
+	struct clnt_vc_conn cn;		/* in progress, or cn_fd -1 */
+	time_t attempt;			/* last reconnect, monotonic */
+	u_int step_ms;			/* between steps, doubling */
+	bool rebuilding;
+};
+
+struct nc_data {
+	struct cx_data nc_cx;		/* cx_rec is NULL */
+	struct sockaddr_storage nc_raddr;
+	u_int nc_rlen;
+	rpcprog_t nc_prog;
+	rpcvers_t nc_vers;
+	u_int nc_sendsz;
+	u_int nc_recvsz;
+	uint32_t nc_flags;
+	uint32_t nc_next;		/* rotates among equals */
+	u_int nc_count;
+	struct nc_conn nc_conn[];
+};
+#define NC_DATA(p) (opr_containerof((p), struct nc_data, nc_cx))
+
+static struct clnt_ops *clnt_nconn_ops(void);
+
+static inline bool
+clnt_nconn_alive(CLIENT *clnt)
+{
+	struct rpc_dplx_rec *rec = CX_DATA(clnt)->cx_rec;
+
+	return (rec && !(rec->xprt.xp_flags & SVC_XPRT_FLAG_DESTROYED));
+}
+
+/*
+ * fd is connected by clnt_vc_ncreatef(), unless flags has
+ * CLNT_CREATE_FLAG_STARTED.  It is closed on failure.
+ */
+static CLIENT *
+clnt_nconn_create(struct nc_data *nc, int fd, uint32_t flags)
+{
+	struct netbuf raddr = {
+		.maxlen = sizeof(nc->nc_raddr),
+		.len = nc->nc_rlen,
+		.buf = &nc->nc_raddr,
+	};
+	CLIENT *clnt;
+
+	clnt = clnt_vc_ncreatef(fd, &raddr, nc->nc_prog, nc->nc_vers,
+				nc->nc_sendsz, nc->nc_recvsz,
+				nc->nc_flags | CLNT_CREATE_FLAG_CONNECT
+				| CLNT_CREATE_FLAG_CLOSE | flags);
+	if (CLNT_FAILURE(clnt)) {
+		__warnx(TIRPC_DEBUG_FLAG_CLNT_VC,
+			"%s: fd %d connect failed (%d)",
+			__func__, fd, clnt->cl_error.re_errno);
+		if (!CX_DATA(clnt)->cx_rec) {
+			/* not yet owned by a transport */
+			close(fd);
+		}
+		CLNT_DESTROY(clnt);
+		return (NULL);
+	}
+	return (clnt);
+}
+
+static CLIENT *
+clnt_nconn_connect(struct nc_data *nc)
+{
+	int fd;
+
+	fd = socket(nc->nc_raddr.ss_family, SOCK_STREAM, 0);
+	if (fd < 0) {
+		__warnx(TIRPC_DEBUG_FLAG_ERROR,
+			"%s: socket failed (%d)",
+			__func__, errno);
+		return (NULL);
+	}
+	return (clnt_nconn_create(nc, fd, 0));
+}
+
+/*
+ * Starts or steps a connect (and TLS), see clnt_vc_conn_step().  Returns
+ * the new connection, or NULL: in progress while conn->cn.cn_fd is set,
+ * else failed.
+ */
+static CLIENT *
+clnt_nconn_rebuild_step(struct nc_data *nc, struct nc_conn *conn)
+{
+	struct netbuf raddr = {
+		.maxlen = sizeof(nc->nc_raddr),
+		.len = nc->nc_rlen,
+		.buf = &nc->nc_raddr,
+	};
+	struct rpc_err rpc_error;
+	int error;
+	int fd;
+
+	if (conn->cn.cn_fd < 0) {
+		fd = socket(nc->nc_raddr.ss_family, SOCK_STREAM, 0);
+		if (fd < 0) {
+			__warnx(TIRPC_DEBUG_FLAG_ERROR,
+				"%s: socket failed (%d)",
+				__func__, errno);
+			return (NULL);
+		}
+		error = clnt_vc_conn_start(&conn->cn, fd, &raddr,
+					   nc->nc_prog, nc->nc_vers,
+					   nc->nc_flags,
+					   CLNT_VC_CONNECT_MAX_MS);
+		if (error) {
+			__warnx(TIRPC_DEBUG_FLAG_CLNT_VC,
+				"%s: fd %d connect failed (%d)",
+				__func__, fd, error);
+			close(fd);
+			return (NULL);
+		}
+		conn->step_ms = 1;
+	}
+	fd = conn->cn.cn_fd;
+
+	error = clnt_vc_conn_step(&conn->cn, &rpc_error);
+	if (error == EINPROGRESS)
+		return (NULL);
+	if (error) {
+		close(fd);
+		return (NULL);
+	}
+	return (clnt_nconn_create(nc, fd, CLNT_CREATE_FLAG_STARTED));
+}
+
+/*
+ * One step: starts or checks a connect, then submits itself again after
+ * a doubling delay, so that no pool thread waits on the network.
+ */
+static void
+clnt_nconn_rebuild_task(struct work_pool_entry *wpe)
+{
+	struct nc_conn *conn = opr_containerof(wpe, struct nc_conn, wpe);
+	struct nc_data *nc = conn->nc;
+	CLIENT *ncclnt = &nc->nc_cx.cx_c;
+	CLIENT *clnt = NULL;
+	CLIENT *old;
+	u_int ms;
+
+	if (ncclnt->cl_flags & CLNT_FLAG_DESTROYED) {
+		if (conn->cn.cn_fd >= 0) {
+			int fd = conn->cn.cn_fd;
+
+			clnt_vc_conn_abort(&conn->cn);
+			close(fd);
+		}
+	} else {
+		clnt = clnt_nconn_rebuild_step(nc, conn);
+		if (!clnt && conn->cn.cn_fd >= 0) {
+			/* in progress */
+			ms = conn->step_ms;
+			conn->step_ms = MIN(ms * 2, CLNT_VC_CONNECT_STEP_MS);
+			work_pool_submit_delayed(&svc_work_pool, wpe,
+						 ms * 1000);
+			return;
+		}
+	}
+
+	mutex_lock(&ncclnt->cl_lock);
+	old = conn->clnt;
+	if (clnt)
+		conn->clnt = clnt;
+	conn->rebuilding = false;
+	mutex_unlock(&ncclnt->cl_lock);
+
+	if (clnt) {
+		__warnx(TIRPC_DEBUG_FLAG_CLNT_VC,
+			"%s: %p connection %d replaced",
+			__func__, ncclnt, (int)(conn - nc->nc_conn));
+		if (old)
+			CLNT_DESTROY(old);
+	}
+	CLNT_RELEASE(ncclnt, CLNT_RELEASE_FLAG_NONE);
+}
+
+/*
+ * Called with cl_lock held.
+ */
+static void
+clnt_nconn_rebuild(struct nc_data *nc, struct nc_conn *conn)
+{
+	struct timespec now;
+
+	if (conn->rebuilding)
+		return;
+
+	(void)clock_gettime(CLOCK_MONOTONIC_FAST, &now);
+	if (conn->attempt && now.tv_sec - conn->attempt < NC_RETRY_SEC)
+		return;
+
+	conn->attempt = now.tv_sec;
+	conn->rebuilding = true;
+
+	/* held by the task */
+	CLNT_REF(&nc->nc_cx.cx_c, CLNT_REF_FLAG_NONE);
+	conn->wpe.fun = clnt_nconn_rebuild_task;
+	conn->wpe.arg = NULL;
+	work_pool_submit(&svc_work_pool, &conn->wpe);
+}
+
+CLIENT *
+clnt_nconn_ncreatef(const struct netbuf *raddr,	/* servers address */
+		    const rpcprog_t prog,	/* program number */
+		    const rpcvers_t vers,	/* version number */
+		    const u_int sendsz,	/* buffer send size */
+		    const u_int recvsz,	/* buffer recv size */
+		    const u_int nconn,	/* connections */
+		    const uint32_t flags)
+{
+	u_int count = nconn ? nconn : 1;
+	struct nc_data *nc = mem_zalloc(sizeof(struct nc_data)
+					+ count * sizeof(struct nc_conn));
+	CLIENT *clnt = &nc->nc_cx.cx_c;
+	u_int live = 0;
+	u_int i;
+
+	clnt_data_init(&nc->nc_cx);
+	clnt->cl_ops = clnt_nconn_ops();
+	nc->nc_count = count;
+
+	if (raddr == NULL || sizeof(nc->nc_raddr) < raddr->len) {
+		__warnx(TIRPC_DEBUG_FLAG_ERROR,
+			"%s: missing or invalid servers address",
+			__func__);
+		clnt->cl_error.re_status = RPC_UNKNOWNADDR;
+		return (clnt);
+	}
+	memcpy(&nc->nc_raddr, raddr->buf, raddr->len);
+	nc->nc_rlen = raddr->len;
+	nc->nc_prog = prog;
+	nc->nc_vers = vers;
+	nc->nc_sendsz = sendsz;
+	nc->nc_recvsz = recvsz;
+	nc->nc_flags = flags & ~(CLNT_CREATE_FLAG_CONNECT
+				 | CLNT_CREATE_FLAG_CLOSE);
+
+	for (i = 0; i < count; i++) {
+		struct nc_conn *conn = &nc->nc_conn[i];
+
+		conn->nc = nc;
+		conn->cn.cn_fd = -1;
+		conn->clnt = clnt_nconn_connect(nc);
+		if (conn->clnt)
+			live++;
+	}
+
+	if (!live) {
+		/* nothing to rebuild from */
+		clnt->cl_error.re_status = RPC_SYSTEMERROR;
+		clnt->cl_error.re_errno = ECONNREFUSED;
+		return (clnt);
+	}
+
+	__warnx(TIRPC_DEBUG_FLAG_CLNT_VC,
+		"%s: %p %u of %u connections",
+		__func__, clnt, live, count);
+	return (clnt);
+}
+
+static CLIENT *
+clnt_nconn_pick(CLIENT *clnt)
+{
+	struct nc_data *nc = NC_DATA(CX_DATA(clnt));
+	uint32_t start = atomic_inc_uint32_t(&nc->nc_next);
+	uint64_t least = UINT64_MAX;
+	CLIENT *best = NULL;
+	u_int i;
+
+	mutex_lock(&clnt->cl_lock);
+	for (i = 0; i < nc->nc_count; i++) {
+		struct nc_conn *conn = &nc->nc_conn[(start + i)
+						    % nc->nc_count];
+		uint64_t outstanding;
+
+		if (!conn->clnt) {
+			clnt_nconn_rebuild(nc, conn);
+			continue;
+		}
+
+		/* unlocked, a hint */
+		outstanding = CX_DATA(conn->clnt)->cx_rec->call_replies.size;
+
+		if (!clnt_nconn_alive(conn->clnt)) {
+			if (!(nc->nc_flags & CLNT_CREATE_FLAG_RECONNECT)) {
+				clnt_nconn_rebuild(nc, conn);
+				continue;
+			}
+			/* reconnecting itself, only if no other is up */
+			outstanding = UINT64_MAX - 1;
+		}
+		if (outstanding < least) {
+			least = outstanding;
+			best = conn->clnt;
+		}
+	}
+	if (best) {
+		/* callbacks see the connection as cc_clnt */
+		best->cl_u1 = clnt->cl_u1;
+		best->cl_u2 = clnt->cl_u2;
+		CLNT_REF(best, CLNT_REF_FLAG_NONE);
+	}
+	mutex_unlock(&clnt->cl_lock);
+
+	return (best);
+}
+
+static enum clnt_stat
+clnt_nconn_call(struct clnt_req *cc)
+{
+	/* clnt_req_setup() moves requests to a connection */
+	__warnx(TIRPC_DEBUG_FLAG_ERROR,
+		"%s: %p request not set up",
+		__func__, cc->cc_clnt);
+	return (RPC_TLIERROR);
+}
+
+static bool
+clnt_nconn_freeres(CLIENT *clnt, xdrproc_t xdr_res, void *res_ptr)
+{
+	return (xdr_free(xdr_res, res_ptr));
+}
+
+ /*ARGSUSED*/
+static void
+clnt_nconn_abort(CLIENT *clnt)
+{
+}
+
+/*
+ * Settings are applied to every connection (and remembered for those
+ * rebuilt, where that applies); queries go to the first live one.
+ */
+static bool
+clnt_nconn_control(CLIENT *clnt, u_int request, void *info)
+{
+	struct nc_data *nc = NC_DATA(CX_DATA(clnt));
+	struct netbuf *addr;
+	CLIENT *conns[nc->nc_count];
+	bool rslt = true;
+	u_int n = 0;
+	u_int i;
+
+	mutex_lock(&clnt->cl_lock);
+	switch (request) {
+	case CLGET_SERVER_ADDR:
+		if (info)
+			memcpy(info, &nc->nc_raddr, nc->nc_rlen);
+		else
+			rslt = false;
+		mutex_unlock(&clnt->cl_lock);
+		return (rslt);
+	case CLGET_SVC_ADDR:
+		if (info) {
+			/* The caller should not free this memory area */
+			addr = (struct netbuf *)info;
+			addr->buf = &nc->nc_raddr;
+			addr->len = nc->nc_rlen;
+			addr->maxlen = sizeof(nc->nc_raddr);
+		} else
+			rslt = false;
+		mutex_unlock(&clnt->cl_lock);
+		return (rslt);
+	case CLSET_PROG:
+		if (info)
+			nc->nc_prog = *(u_int32_t *)info;
+		break;
+	case CLSET_VERS:
+		if (info)
+			nc->nc_vers = *(u_int32_t *)info;
+		break;
+	default:
+		break;
+	}
+
+	for (i = 0; i < nc->nc_count; i++) {
+		CLIENT *conn = nc->nc_conn[i].clnt;
+
+		if (conn && clnt_nconn_alive(conn)) {
+			CLNT_REF(conn, CLNT_REF_FLAG_NONE);
+			conns[n++] = conn;
+		}
+	}
+	mutex_unlock(&clnt->cl_lock);
+
+	if (!n)
+		return (false);
+
+	switch (request) {
+	case CLSET_FD_CLOSE:
+	case CLSET_FD_NCLOSE:
+	case CLSET_XID:
+	case CLSET_VERS:
+	case CLSET_PROG:
+	case CLSET_SLOTS:
+		for (i = 0; i < n; i++)
+			rslt = CLNT_CONTROL(conns[i], request, info) && rslt;
+		break;
+	default:
+		rslt = CLNT_CONTROL(conns[0], request, info);
+		break;
+	}
+
+	for (i = 0; i < n; i++)
+		CLNT_RELEASE(conns[i], CLNT_RELEASE_FLAG_NONE);
+	return (rslt);
+}
+
+static void
+clnt_nconn_destroy(CLIENT *clnt)
+{
+	struct nc_data *nc = NC_DATA(CX_DATA(clnt));
+	u_int i;
+
+	/* no rebuild is running, each holds a reference */
+	for (i = 0; i < nc->nc_count; i++) {
+		if (nc->nc_conn[i].clnt)
+			CLNT_DESTROY(nc->nc_conn[i].clnt);
+	}
+	clnt_data_destroy(&nc->nc_cx);
+	mem_free(nc, sizeof(struct nc_data)
+		     + nc->nc_count * sizeof(struct nc_conn));
+}
+
+static struct clnt_ops *
+clnt_nconn_ops(void)
+{
+	static struct clnt_ops ops;
+	extern mutex_t ops_lock;
+	sigset_t mask, newmask;
+
+	/* VARIABLES PROTECTED BY ops_lock: ops */
+
+	sigfillset(&newmask);
+	thr_sigsetmask(SIG_SETMASK, &newmask, &mask);
+	mutex_lock(&ops_lock);
+	if (ops.cl_call == NULL) {
+		ops.cl_call = clnt_nconn_call;
+		ops.cl_pick = clnt_nconn_pick;
+		ops.cl_abort = clnt_nconn_abort;
+		ops.cl_freeres = clnt_nconn_freeres;
+		ops.cl_destroy = clnt_nconn_destroy;
+		ops.cl_control = clnt_nconn_control;
+	}
+	mutex_unlock(&ops_lock);
+	thr_sigsetmask(SIG_SETMASK, &(mask), NULL);
+	return (&ops);
+}
@@ -163,7 +163,6 @@ clnt_rdma_call(struct clnt_req *cc)
 				 "call context", 1, IOQ_FLAG_NONE);
 	struct rpc_rdma_cbc *cbc = (struct rpc_rdma_cbc *)(_IOQ(have));
 	XDR *xdrs;
-	u_int32_t *uint32p;
 
 	/* free old buffers (should do nothing) */
 	xdr_ioq_release(&cbc->workq.ioq_uv.uvqh);
@@ -180,24 +179,18 @@ clnt_rdma_call(struct clnt_req *cc)
 	xdrs = cbc->holdq.xdrs;
 	cc->cc_error.re_status = RPC_SUCCESS;
 
-	mutex_lock(&cl->cl_lock);
-	uint32p = (u_int32_t *)&cx->cx_mcallc[0];
-	*uint32p = htonl(cc->cc_xid);
-
-	if (!XDR_PUTBYTES(xdrs, cx->cx_mcallc, cx->cx_mpos)
+	if (!cx_callhdr(cx, xdrs, cc->cc_xid)
 	 || !XDR_PUTUINT32(xdrs, cc->cc_proc)
 	 || !AUTH_MARSHALL(cc->cc_auth, xdrs)
 	 || !AUTH_WRAP(cc->cc_auth, xdrs,
 		       cc->cc_call.proc, cc->cc_call.where)) {
 		/* error case */
-		mutex_unlock(&cl->cl_lock);
 		__warnx(TIRPC_DEBUG_FLAG_CLNT_RDMA,
 			"%s: %p@%p failed",
 			__func__, cl, cx->cx_rec);
 		xdr_ioq_release(&cbc->holdq.ioq_uv.uvqh);
 		return (RPC_CANTENCODEARGS);
 	}
-	mutex_unlock(&cl->cl_lock);
 
 	if (!xdr_rdma_clnt_flushout(cbc)) {
 		cl->cl_error.re_errno = errno;
@@ -256,12 +249,10 @@ clnt_rdma_control(CLIENT *cl, u_int request, void *info)
 
 	case CLGET_XID:
 		/*
-		 * use the knowledge that xid is the
-		 * first element in the call structure *.
+		 * the xid assigned by clnt_req_setup() most recently.
 		 * This will get the xid of the PREVIOUS call
 		 */
-		uint32p = (u_int32_t *)&cx->cx_mcallc[0];
-		*(u_int32_t *)info = ntohl(*uint32p);
+		*(u_int32_t *)info = rec->call_xid;
 		break;
 
 	case CLSET_XID:
@@ -282,7 +273,7 @@ clnt_rdma_control(CLIENT *cl, u_int request, void *info)
 
 	case CLSET_VERS:
 		uint32p = (u_int32_t *)&cx->cx_mcallc[4 * BYTES_PER_XDR_UNIT];
-		*uint32p = htonl(*(u_int32_t *)info);
+		atomic_store_uint32_t(uint32p, htonl(*(u_int32_t *)info));
 		break;
 
 	case CLGET_PROG:
@@ -297,7 +288,12 @@ clnt_rdma_control(CLIENT *cl, u_int request, void *info)
 
 	case CLSET_PROG:
 		uint32p = (u_int32_t *)&cx->cx_mcallc[3 * BYTES_PER_XDR_UNIT];
-		*uint32p = htonl(*(u_int32_t *)info);
+		atomic_store_uint32_t(uint32p, htonl(*(u_int32_t *)info));
+		break;
+
+	case CLGET_SLOTS:
+	case CLSET_SLOTS:
+		rslt = clnt_req_slot_control(rec, request, info);
 		break;
 
 	default:
@@ -0,0 +1,326 @@
+/*
+ * Copyright (c) 2018 Red Hat, Inc. and/or its affiliates.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR `AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * clnt_shm.c, Client side of the shared memory transport (svc_shm.c).
+ *
+ * Calls are copied into the call ring; replies are decoded in place from
+ * the reply ring, by the same event channel machinery as clnt_vc.
+ */
+#include "config.h"
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <assert.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+#include <rpc/types.h>
+#include <misc/portable.h>
+#include <reentrant.h>
+#include <rpc/rpc.h>
+#include "rpc_com.h"
+#include <rpc/svc_rqst.h>
+#include <rpc/xdr_ioq.h>
+#include "clnt_internal.h"
+#include "svc_internal.h"
+
+static enum xprt_stat clnt_shm_process(struct svc_req *req);
+static struct clnt_ops *clnt_shm_ops(void);
+
+static void
+clnt_shm_data_free(struct cx_data *cx)
+{
+	clnt_data_destroy(cx);
+	mem_free(cx, sizeof(struct cx_data));
+}
+
+static struct cx_data *
+clnt_shm_data_zalloc(void)
+{
+	struct cx_data *cx = mem_zalloc(sizeof(struct cx_data));
+
+	clnt_data_init(cx);
+	return (cx);
+}
+
+/*
+ * Create a client handle on a connected AF_LOCAL stream socket, with a
+ * svc_shm_ncreatef() listener at the other end.  The sizes are the call
+ * and reply rings, 0 => use the default.  The largest call or reply is
+ * half of its ring.
+ */
+CLIENT *
+clnt_shm_ncreatef(const int fd,	/* connected AF_LOCAL socket */
+		  const rpcprog_t prog,	/* program number */
+		  const rpcvers_t vers,	/* version number */
+		  const u_int sendsz,	/* call ring size */
+		  const u_int recvsz,	/* reply ring size */
+		  const uint32_t flags)
+{
+	struct cx_data *cx = clnt_shm_data_zalloc();
+	CLIENT *clnt = &cx->cx_c;
+	SVCXPRT *xprt;
+	struct rpc_msg call_msg;
+	sigset_t mask, newmask;
+	XDR cx_xdrs[1];		/* temp XDR stream */
+
+	clnt->cl_ops = clnt_shm_ops();
+
+	sigfillset(&newmask);
+	thr_sigsetmask(SIG_SETMASK, &newmask, &mask);
+
+	xprt = svc_shm_connect(fd, sendsz, recvsz, flags, &clnt->cl_error);
+	if (!xprt) {
+		__warnx(TIRPC_DEBUG_FLAG_ERROR,
+			"%s: fd %d svc_shm_connect failed (%d)",
+			__func__, fd, clnt->cl_error.re_errno);
+		goto err;
+	}
+
+	/* held until clnt_shm_destroy(), as the server may close first */
+	SVC_REF(xprt, SVC_REF_FLAG_NONE);
+	xprt->xp_dispatch.process_cb = clnt_shm_process;
+	svc_rqst_evchan_reg(__svc_params->ev_u.evchan.id, xprt,
+			    SVC_RQST_FLAG_CHAN_AFFINITY);
+	cx->cx_rec = REC_XPRT(xprt);
+
+	/*
+	 * initialize call message
+	 */
+	call_msg.rm_xid = cx->cx_rec->call_xid;
+	call_msg.rm_direction = CALL;
+	call_msg.rm_call.cb_rpcvers = RPC_MSG_VERSION;
+	call_msg.cb_prog = prog;
+	call_msg.cb_vers = vers;
+
+	/*
+	 * pre-serialize the static part of the call msg and stash it away
+	 */
+	xdrmem_create(cx_xdrs, cx->cx_mcallc, MCALL_MSG_SIZE, XDR_ENCODE);
+	if (!xdr_callhdr(cx_xdrs, &call_msg)) {
+		__warnx(TIRPC_DEBUG_FLAG_ERROR,
+			"%s: fd %d xdr_callhdr failed",
+			__func__, fd);
+		clnt->cl_error.re_status = RPC_CANTENCODEARGS;
+		XDR_DESTROY(cx_xdrs);
+		goto err;
+	}
+	cx->cx_mpos = XDR_GETPOS(cx_xdrs);
+	XDR_DESTROY(cx_xdrs);
+
+	__warnx(TIRPC_DEBUG_FLAG_CLNT_VC,
+		"%s: fd %d completed",
+		__func__, fd);
+ err:
+	thr_sigsetmask(SIG_SETMASK, &(mask), NULL);
+	return (clnt);
+}
+
+static enum xprt_stat
+clnt_shm_process(struct svc_req *req)
+{
+	SVCXPRT *xprt = req->rq_xprt;
+
+	__warnx(TIRPC_DEBUG_FLAG_WARN,
+		"%s: %p fd %d unexpected CALL",
+		__func__, xprt, xprt->xp_fd);
+	return SVC_STAT(xprt);
+}
+
+static enum clnt_stat
+clnt_shm_call(struct clnt_req *cc)
+{
+	CLIENT *clnt = cc->cc_clnt;
+	struct cx_data *cx = CX_DATA(clnt);
+	SVCXPRT *xprt = &cx->cx_rec->xprt;
+	struct xdr_ioq *xioq;
+	XDR *xdrs;
+	rpcprog_t prog = cx_prog(cx);
+	rpcvers_t vers = cx_vers(cx);
+
+	/* see clnt_vc_call() */
+	xioq = xdr_ioq_size_create(prog, vers, cc->cc_proc, XDR_IOQ_SIZE_CALL,
+				   __svc_params->ioq.send_max
+				   + RPC_MAXDATA_DEFAULT,
+				   (cc->cc_auth->ah_cred.oa_flavor == RPCSEC_GSS)
+				   ? UIO_FLAG_REALLOC | UIO_FLAG_FREE
+				   : UIO_FLAG_FREE);
+
+	xdrs = xioq->xdrs;
+	cc->cc_error.re_status = RPC_SUCCESS;
+
+	if ((!cx_callhdr(cx, xdrs, cc->cc_xid))
+	    || (!XDR_PUTUINT32(xdrs, cc->cc_proc))
+	    || (!AUTH_MARSHALL(cc->cc_auth, xdrs))
+	    || (!AUTH_WRAP(cc->cc_auth, xdrs,
+			   cc->cc_call.proc, cc->cc_call.where))) {
+		/* error case */
+		__warnx(TIRPC_DEBUG_FLAG_CLNT_VC,
+			"%s: fd %d failed",
+			__func__, xprt->xp_fd);
+		XDR_DESTROY(xdrs);
+		return (RPC_CANTENCODEARGS);
+	}
+	xdr_ioq_size_update(xioq, prog, vers, cc->cc_proc, XDR_IOQ_SIZE_CALL);
+
+	if (svc_shm_send(xprt, xioq) != XPRT_IDLE)
+		return (RPC_CANTSEND);
+
+	return (RPC_SUCCESS);
+}
+
+static bool
+clnt_shm_freeres(CLIENT *clnt, xdrproc_t xdr_res, void *res_ptr)
+{
+	return (xdr_free(xdr_res, res_ptr));
+}
+
+ /*ARGSUSED*/
+static void
+clnt_shm_abort(CLIENT *clnt)
+{
+}
+
+static bool
+clnt_shm_control(CLIENT *clnt, u_int request, void *info)
+{
+	struct cx_data *cx = CX_DATA(clnt);
+	struct rpc_dplx_rec *rec = cx->cx_rec;
+	u_int32_t *uint32p;
+	bool rslt = true;
+
+	/* always take recv lock first if taking together */
+	rpc_dplx_rli(rec);
+	mutex_lock(&clnt->cl_lock);
+
+	switch (request) {
+	case CLSET_FD_CLOSE:
+		(void)atomic_set_uint16_t_bits(&rec->xprt.xp_flags,
+						SVC_XPRT_FLAG_CLOSE);
+		goto unlock;
+	case CLSET_FD_NCLOSE:
+		(void)atomic_clear_uint16_t_bits(&rec->xprt.xp_flags,
+						SVC_XPRT_FLAG_CLOSE);
+		goto unlock;
+	default:
+		break;
+	}
+
+	/* for other requests which use info */
+	if (info == NULL) {
+		rslt = false;
+		goto unlock;
+	}
+	switch (request) {
+	case CLGET_FD:
+		*(int *)info = rec->xprt.xp_fd;
+		break;
+	case CLGET_SVC_ADDR:
+		/* The caller should not free this memory area */
+		*(struct netbuf *)info = rec->xprt.xp_remote.nb;
+		break;
+	case CLGET_XID:
+		/*
+		 * the xid assigned by clnt_req_setup() most recently.
+		 * This will get the xid of the PREVIOUS call
+		 */
+		*(u_int32_t *)info = rec->call_xid;
+		break;
+	case CLSET_XID:
+		/* decrement by 1 as clnt_req_setup() increments once */
+		rec->call_xid = htonl(*(u_int32_t *) info - 1);
+		break;
+	case CLGET_VERS:
+		uint32p = (u_int32_t *)&cx->cx_mcallc[4 * BYTES_PER_XDR_UNIT];
+		*(u_int32_t *)info = ntohl(*uint32p);
+		break;
+	case CLSET_VERS:
+		uint32p = (u_int32_t *)&cx->cx_mcallc[4 * BYTES_PER_XDR_UNIT];
+		atomic_store_uint32_t(uint32p, htonl(*(u_int32_t *)info));
+		break;
+	case CLGET_PROG:
+		uint32p = (u_int32_t *)&cx->cx_mcallc[3 * BYTES_PER_XDR_UNIT];
+		*(u_int32_t *)info = ntohl(*uint32p);
+		break;
+	case CLSET_PROG:
+		uint32p = (u_int32_t *)&cx->cx_mcallc[3 * BYTES_PER_XDR_UNIT];
+		atomic_store_uint32_t(uint32p, htonl(*(u_int32_t *)info));
+		break;
+
+	case CLGET_SLOTS:
+	case CLSET_SLOTS:
+		rslt = clnt_req_slot_control(rec, request, info);
+		break;
+
+	default:
+		rslt = false;
+		break;
+	}
+
+ unlock:
+	rpc_dplx_rui(rec);
+	mutex_unlock(&clnt->cl_lock);
+
+	return (rslt);
+}
+
+static void
+clnt_shm_destroy(CLIENT *clnt)
+{
+	struct cx_data *cx = CX_DATA(clnt);
+
+	if (cx->cx_rec) {
+		SVC_DESTROY(&cx->cx_rec->xprt);
+		SVC_RELEASE(&cx->cx_rec->xprt, SVC_RELEASE_FLAG_NONE);
+	}
+	clnt_shm_data_free(cx);
+}
+
+static struct clnt_ops *
+clnt_shm_ops(void)
+{
+	static struct clnt_ops ops;
+	extern mutex_t ops_lock;
+	sigset_t mask, newmask;
+
+	/* VARIABLES PROTECTED BY ops_lock: ops */
+
+	sigfillset(&newmask);
+	thr_sigsetmask(SIG_SETMASK, &newmask, &mask);
+	mutex_lock(&ops_lock);
+	if (ops.cl_call == NULL) {
+		ops.cl_call = clnt_shm_call;
+		ops.cl_abort = clnt_shm_abort;
+		ops.cl_freeres = clnt_shm_freeres;
+		ops.cl_destroy = clnt_shm_destroy;
+		ops.cl_control = clnt_shm_control;
+	}
+	mutex_unlock(&ops_lock);
+	thr_sigsetmask(SIG_SETMASK, &(mask), NULL);
+	return (&ops);
+}
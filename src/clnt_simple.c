@@ -49,6 +49,8 @@
 #include <unistd.h>
 
 #include <rpc/clnt.h>
+#include "rpc_com.h"
+#include "svc_internal.h"
 
 #ifndef MAXHOSTNAMELEN
 #define MAXHOSTNAMELEN 64
@@ -58,8 +60,15 @@
 #define NETIDLEN 32
 #endif
 
-struct rpc_call_private {
-	int valid;		/* Is this entry valid ? */
+/*
+ * rpc_call() handles, shared by all threads of the process.  Each entry
+ * holds the reference given by clnt_ncreate(); each call takes another
+ * for its duration, so an evicted handle is destroyed after its last
+ * call.  Most recently used first; the tail is evicted beyond
+ * clnt_cache_max (svc_init_params).
+ */
+struct rpc_call_entry {
+	TAILQ_ENTRY(rpc_call_entry) q;
 	CLIENT *client;		/* Client handle */
 	AUTH *auth;
 	pid_t pid;		/* process-id at moment of creation */
@@ -69,15 +78,154 @@ struct rpc_call_private {
 	char nettype[NETIDLEN];	/* Network type */
 };
 
-static void rpc_call_destroy(void *vp)
+static struct {
+	mutex_t mtx;
+	TAILQ_HEAD(rpc_call_head, rpc_call_entry) lru;
+	u_int count;
+} rpc_call_cache = {
+	MUTEX_INITIALIZER,
+	TAILQ_HEAD_INITIALIZER(rpc_call_cache.lru),
+	0
+};
+
+/*
+ * Locked.  The caller releases the cache reference (CLNT_DESTROY) after
+ * unlocking.
+ */
+static inline void
+rpc_call_remove(struct rpc_call_entry *rce)
+{
+	TAILQ_REMOVE(&rpc_call_cache.lru, rce, q);
+	rpc_call_cache.count--;
+}
+
+static void
+rpc_call_free(struct rpc_call_entry *rce)
+{
+	CLNT_DESTROY(rce->client);
+	mem_free(rce, sizeof(*rce));
+}
+
+/*
+ * Returns true with a CLNT_REF on the matching client, for the call.
+ * Entries created before a fork() are evicted (into *stale).
+ */
+static bool
+rpc_call_lookup(const char *host, rpcprog_t prognum, rpcvers_t versnum,
+		const char *nettype, CLIENT **client, AUTH **auth,
+		struct rpc_call_entry **stale)
 {
-	struct rpc_call_private *rcp = (struct rpc_call_private *)vp;
+	struct rpc_call_entry *rce;
+	pid_t pid = getpid();
 
-	if (rcp) {
-		if (rcp->client)
-			CLNT_DESTROY(rcp->client);
-		mem_free(rcp, sizeof(*rcp));
+	mutex_lock(&rpc_call_cache.mtx);
+	TAILQ_FOREACH(rce, &rpc_call_cache.lru, q) {
+		if (rce->prognum == prognum && rce->versnum == versnum
+		    && !strcmp(rce->host, host)
+		    && !strcmp(rce->nettype, nettype))
+			break;
 	}
+	if (rce && rce->pid != pid) {
+		rpc_call_remove(rce);
+		*stale = rce;
+		rce = NULL;
+	} else if (rce) {
+		if (rce != TAILQ_FIRST(&rpc_call_cache.lru)) {
+			TAILQ_REMOVE(&rpc_call_cache.lru, rce, q);
+			TAILQ_INSERT_HEAD(&rpc_call_cache.lru, rce, q);
+		}
+		CLNT_REF(rce->client, CLNT_REF_FLAG_NONE);
+		*client = rce->client;
+		*auth = rce->auth;
+	}
+	mutex_unlock(&rpc_call_cache.mtx);
+	return (rce != NULL);
+}
+
+/*
+ * Another thread may have added the same key meanwhile; that client is
+ * used (and rce freed).  Returns with a CLNT_REF for the call.
+ */
+static void
+rpc_call_insert(struct rpc_call_entry *rce, CLIENT **client, AUTH **auth)
+{
+	struct rpc_call_entry *have;
+	struct rpc_call_entry *victim = NULL;
+	u_int max = __svc_params->clnt_cache_max;
+
+	if (!max) {
+		/* before svc_init(), as formerly */
+		max = 1;
+	}
+	mutex_lock(&rpc_call_cache.mtx);
+	TAILQ_FOREACH(have, &rpc_call_cache.lru, q) {
+		if (have->prognum == rce->prognum
+		    && have->versnum == rce->versnum
+		    && have->pid == rce->pid
+		    && !strcmp(have->host, rce->host)
+		    && !strcmp(have->nettype, rce->nettype)) {
+			victim = rce;
+			rce = have;
+			break;
+		}
+	}
+	if (!victim) {
+		TAILQ_INSERT_HEAD(&rpc_call_cache.lru, rce, q);
+		if (++(rpc_call_cache.count) > max) {
+			victim = TAILQ_LAST(&rpc_call_cache.lru,
+					    rpc_call_head);
+			rpc_call_remove(victim);
+		}
+	}
+	CLNT_REF(rce->client, CLNT_REF_FLAG_NONE);
+	*client = rce->client;
+	*auth = rce->auth;
+	mutex_unlock(&rpc_call_cache.mtx);
+
+	if (victim)
+		rpc_call_free(victim);
+}
+
+/*
+ * After a failed call, unless already evicted.  The caller's CLNT_REF
+ * keeps the client from being reused meanwhile.
+ */
+static void
+rpc_call_evict(CLIENT *client)
+{
+	struct rpc_call_entry *rce;
+
+	mutex_lock(&rpc_call_cache.mtx);
+	TAILQ_FOREACH(rce, &rpc_call_cache.lru, q) {
+		if (rce->client == client)
+			break;
+	}
+	if (rce)
+		rpc_call_remove(rce);
+	mutex_unlock(&rpc_call_cache.mtx);
+
+	if (rce)
+		rpc_call_free(rce);
+}
+
+/*
+ * After a failed call: the address may be stale (eg, a datagram server
+ * restarted on another port, which creating the client cannot notice),
+ * so the next rpc_call() asks rpcbind.
+ */
+static void
+rpc_call_forget(const char *host, rpcprog_t prognum, rpcvers_t versnum,
+		CLIENT *client)
+{
+	struct netconfig *nconf;
+
+	if (!client->cl_netid || !client->cl_netid[0])
+		return;
+	nconf = getnetconfigent(client->cl_netid);
+	if (!nconf)
+		return;
+	__rpcb_cache_forget(prognum, versnum, nconf, host);
+	freenetconfigent(nconf);
 }
 
 static const struct timespec to = { 3, 0 };
@@ -85,7 +233,8 @@ static const struct timespec to = { 3, 0 };
 /*
  * This is the simplified interface to the client rpc layer.
  * The client handle is not destroyed here and is reused for
- * the future calls to same prog, vers, host and nettype combination.
+ * the future calls to same prog, vers, host and nettype combination,
+ * by any thread.
  *
  * The total time available is 9 seconds.
  */
@@ -100,76 +249,76 @@ rpc_call(const char *host,	/* host name */
 	 void *out,	/* recv/send data */
 	 const char *nettype /* nettype */)
 {
-	struct rpc_call_private *rcp;
+	struct rpc_call_entry *rce;
+	struct rpc_call_entry *stale = NULL;
 	struct clnt_req *cc;
+	CLIENT *client;
+	AUTH *auth;
 	enum clnt_stat clnt_stat;
-	extern thread_key_t rpc_call_key;
-	extern mutex_t tsd_lock;
-
-	if (rpc_call_key == -1) {
-		mutex_lock(&tsd_lock);
-		if (rpc_call_key == -1)
-			thr_keycreate(&rpc_call_key, rpc_call_destroy);
-		mutex_unlock(&tsd_lock);
-	}
-	rcp = (struct rpc_call_private *)thr_getspecific(rpc_call_key);
-	if (rcp == NULL) {
-		rcp = mem_alloc(sizeof(*rcp));
-		thr_setspecific(rpc_call_key, (void *)rcp);
-		rcp->valid = 0;
-		rcp->client = NULL;
-	}
+	bool cached;
+
 	if ((nettype == NULL) || (nettype[0] == 0))
 		nettype = "netpath";
-	if (!(rcp->valid && rcp->pid == getpid() && (rcp->prognum == prognum)
-	      && (rcp->versnum == versnum) && (!strcmp(rcp->host, host))
-	      && (!strcmp(rcp->nettype, nettype)))) {
+	cached = (strlen(host) < (size_t) MAXHOSTNAMELEN)
+		 && (strlen(nettype) < (size_t) NETIDLEN);
+	if (!cached
+	    || !rpc_call_lookup(host, prognum, versnum, nettype,
+				&client, &auth, &stale)) {
 		int fd;
 
-		rcp->valid = 0;
-		if (rcp->client)
-			CLNT_DESTROY(rcp->client);
+		if (stale)
+			rpc_call_free(stale);
+
 		/*
 		 * Using the first successful transport for that type
 		 */
-		rcp->client = clnt_ncreate(host, prognum, versnum, nettype);
-		rcp->pid = getpid();
-		clnt_stat = rcp->client->cl_error.re_status;
+		client = clnt_ncreate(host, prognum, versnum, nettype);
+		clnt_stat = client->cl_error.re_status;
 		if (clnt_stat) {
-			CLNT_DESTROY(rcp->client);
-			rcp->client = NULL;
+			CLNT_DESTROY(client);
 			return (clnt_stat);
 		}
 
-		rcp->auth = authnone_ncreate();	/* idempotent */
+		auth = authnone_ncreate();	/* idempotent */
 
-		if (CLNT_CONTROL(rcp->client, CLGET_FD, (char *)(void *)&fd))
+		if (CLNT_CONTROL(client, CLGET_FD, (char *)(void *)&fd))
 			fcntl(fd, F_SETFD, 1);	/* make it "close on exec" */
-		rcp->prognum = prognum;
-		rcp->versnum = versnum;
-		if ((strlen(host) < (size_t) MAXHOSTNAMELEN)
-		    && (strlen(nettype) < (size_t) NETIDLEN)) {
-			(void)strcpy(rcp->host, host);
-			(void)strcpy(rcp->nettype, nettype);
-			rcp->valid = 1;
-		} else {
-			rcp->valid = 0;
+
+		if (cached) {
+			rce = mem_zalloc(sizeof(*rce));
+			rce->client = client;
+			rce->auth = auth;
+			rce->pid = getpid();
+			rce->prognum = prognum;
+			rce->versnum = versnum;
+			(void)strcpy(rce->host, host);
+			(void)strcpy(rce->nettype, nettype);
+			rpc_call_insert(rce, &client, &auth);
 		}
-	}			/* else reuse old client */
+	}
 
 	cc = mem_alloc(sizeof(*cc));
 	/* LINTED const castaway */
-	clnt_req_fill(cc, rcp->client, rcp->auth, procnum,
+	clnt_req_fill(cc, client, auth, procnum,
 		      inproc, (void *)in, outproc, out);
 	clnt_stat = clnt_req_setup(cc, to);
 	if (clnt_stat == RPC_SUCCESS) {
 		clnt_stat = CLNT_CALL_WAIT(cc);
 	}
 	clnt_req_release(cc);
+
+	if (clnt_stat != RPC_SUCCESS)
+		rpc_call_forget(host, prognum, versnum, client);
+
+	if (!cached) {
+		CLNT_DESTROY(client);
+		return (clnt_stat);
+	}
 	/*
-	 * if call failed, empty cache
+	 * if call failed, evict from cache
 	 */
 	if (clnt_stat != RPC_SUCCESS)
-		rcp->valid = 0;
+		rpc_call_evict(client);
+	CLNT_RELEASE(client, CLNT_RELEASE_FLAG_NONE);
 	return (clnt_stat);
 }
@@ -58,12 +58,14 @@
 #include <assert.h>
 #include <err.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <netdb.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 #include <signal.h>
+#include <time.h>
 #include <rpc/types.h>
 #include <misc/portable.h>
 #include <reentrant.h>
@@ -76,15 +78,36 @@
 #include "svc_internal.h"
 
 static enum xprt_stat clnt_vc_process(struct svc_req *req);
+static enum clnt_stat clnt_vc_send(struct clnt_req *cc, bool direct);
+static enum clnt_stat clnt_vc_call(struct clnt_req *cc);
 static struct clnt_ops *clnt_vc_ops(void);
 
+/* milliseconds between attempts to reconnect, doubling */
+#define CT_RECONNECT_MIN_MS (10)
+#define CT_RECONNECT_MAX_MS (5000)
+
+/* microseconds between CLNT_CREATE_FLAG_DIRECT wakeup checks, doubling */
+#define CT_DIRECT_POLL_MIN_US (10)
+#define CT_DIRECT_POLL_MAX_US (1000)
+
 struct ct_data {
 	struct cx_data ct_cx;
 	struct sockaddr_storage ct_raddr;	/* remote addr */
 	int ct_rlen;
+	bool ct_owner;		/* created the xprt, destroys it */
+
+	/* CLNT_CREATE_FLAG_RECONNECT */
+	bool ct_reconnecting;	/* under cl_lock */
+	uint32_t ct_flags;	/* as created */
+	struct rpc_dplx_rec *ct_prev;	/* replaced, released at the next */
+	struct work_pool_entry ct_wpe;
+	struct clnt_vc_conn ct_conn;	/* in progress, or cn_fd -1 */
+	u_int ct_backoff_ms;
 };
 #define CT_DATA(p) (opr_containerof((p), struct ct_data, ct_cx))
 
+static void clnt_vc_disconnected(struct rpc_dplx_rec *rec, void *arg);
+
 static void
 clnt_vc_data_free(struct ct_data *ct)
 {
@@ -98,6 +121,7 @@ clnt_vc_data_zalloc(void)
 	struct ct_data *ct = mem_zalloc(sizeof(struct ct_data));
 
 	clnt_data_init(&ct->ct_cx);
+	ct->ct_conn.cn_fd = -1;
 	return (ct);
 }
 
@@ -125,6 +149,186 @@ clnt_vc_data_zalloc(void)
  *      server tranpsorts sharing an underlying bytestream (Matt).
  */
 
+/*
+ * Find or create the shared fd state, ref+1.
+ */
+static struct svc_vc_xprt *
+clnt_vc_attach(struct ct_data *ct, const int fd, const u_int sendsz,
+	       const u_int recvsz, const uint32_t flags)
+{
+	SVCXPRT *xprt = svc_fd_ncreatef(fd, sendsz, recvsz, flags);
+	struct svc_vc_xprt *xd;
+
+	if (!xprt) {
+		__warnx(TIRPC_DEBUG_FLAG_ERROR,
+			"%s: fd %d svc_fd_ncreatef failed",
+			__func__, fd);
+		return (NULL);
+	}
+	xd = VC_DR(REC_XPRT(xprt));
+	if (flags & CLNT_CREATE_FLAG_TLS)
+		xd->sx_tls = SVC_VC_TLS_ACTIVE;
+
+	if (!xd->sx_dr.ev_p) {
+		/* new xprt: the initial reference belongs to the fd, and is
+		 * released by SVC_DESTROY() on EOF or error.  Take our own,
+		 * so the handle outlives the connection.
+		 */
+		SVC_REF(xprt, SVC_REF_FLAG_NONE);
+		ct->ct_owner = true;
+		xprt->xp_dispatch.process_cb = clnt_vc_process;
+		if (flags & CLNT_CREATE_FLAG_RECONNECT) {
+			xd->sx_dr.disconnect_cb = clnt_vc_disconnected;
+			xd->sx_dr.disconnect_arg = ct;
+		}
+		svc_rqst_evchan_reg(__svc_params->ev_u.evchan.id, xprt,
+				    SVC_RQST_FLAG_CHAN_AFFINITY);
+	}
+	return (xd);
+}
+
+/*
+ * Connecting
+ *
+ * The connect does not block, nor the TLS probe and handshake after it.
+ * Each step checks what the last started; a pool task steps again after
+ * a delay, or a caller creating a handle waits for cn_events
+ * (clnt_vc_conn_wait()).  raddr is NULL when fd is connected already.
+ * Returns 0, or the error.
+ */
+int
+clnt_vc_conn_start(struct clnt_vc_conn *cn, int fd,
+		   const struct netbuf *raddr, rpcprog_t prog,
+		   rpcvers_t vers, uint32_t flags, int ms)
+{
+	memset(cn, 0, sizeof(*cn));
+	cn->cn_fd = -1;
+
+	cn->cn_fl = fcntl(fd, F_GETFL);
+	if (cn->cn_fl < 0 || fcntl(fd, F_SETFL, cn->cn_fl | O_NONBLOCK) < 0)
+		return (errno);
+
+	if (!raddr)
+		cn->cn_connected = true;
+	else if (connect(fd, (struct sockaddr *)raddr->buf, raddr->len) < 0
+		 && errno != EINPROGRESS) {
+		int error = errno;
+
+		(void)fcntl(fd, F_SETFL, cn->cn_fl);
+		return (error);
+	}
+
+	(void)clock_gettime(CLOCK_MONOTONIC_FAST, &cn->cn_due);
+	timespec_addms(&cn->cn_due, ms);
+	cn->cn_prog = prog;
+	cn->cn_vers = vers;
+	cn->cn_flags = flags;
+	cn->cn_fd = fd;
+	cn->cn_events = POLLOUT;
+	return (0);
+}
+
+void
+clnt_vc_conn_abort(struct clnt_vc_conn *cn)
+{
+	if (cn->cn_fd < 0)
+		return;
+#ifdef USE_TLS
+	if (cn->cn_tls)
+		rpc_tls_clnt_free(cn->cn_tls);
+#endif
+	(void)fcntl(cn->cn_fd, F_SETFL, cn->cn_fl);
+	memset(cn, 0, sizeof(*cn));
+	cn->cn_fd = -1;
+}
+
+/*
+ * Returns 0 when connected (and TLS started), the fd blocking again;
+ * EINPROGRESS, to step again after cn_events; or the error, with re set.
+ */
+int
+clnt_vc_conn_step(struct clnt_vc_conn *cn, struct rpc_err *re)
+{
+	struct pollfd pfd;
+	struct timespec now;
+	socklen_t len = sizeof(int);
+	int error = 0;
+
+	if (!cn->cn_connected) {
+		pfd.fd = cn->cn_fd;
+		pfd.events = POLLOUT;
+		pfd.revents = 0;
+		if (poll(&pfd, 1, 0) == 0) {
+			(void)clock_gettime(CLOCK_MONOTONIC_FAST, &now);
+			if (timespeccmp(&now, &cn->cn_due, <))
+				return (EINPROGRESS);
+			error = ETIMEDOUT;
+		} else if (getsockopt(cn->cn_fd, SOL_SOCKET, SO_ERROR, &error,
+				      &len) < 0)
+			error = errno;
+		if (error) {
+			__warnx(TIRPC_DEBUG_FLAG_CLNT_VC,
+				"%s: fd %d connect failed (%d)",
+				__func__, cn->cn_fd, error);
+			re->re_status = RPC_SYSTEMERROR;
+			re->re_errno = error;
+			goto out;
+		}
+		cn->cn_connected = true;
+	}
+
+	if (cn->cn_flags & CLNT_CREATE_FLAG_TLS) {
+#ifdef USE_TLS
+		if (!cn->cn_tls) {
+			cn->cn_tls = rpc_tls_clnt_start(cn->cn_fd, cn->cn_prog,
+							cn->cn_vers, re);
+			if (!cn->cn_tls) {
+				error = EINVAL;
+				goto out;
+			}
+		}
+		error = rpc_tls_clnt_step(cn->cn_tls, &cn->cn_events, re);
+		if (error == EINPROGRESS)
+			return (error);
+#else
+		re->re_status = RPC_SYSTEMERROR;
+		re->re_errno = ENOTSUP;
+		error = ENOTSUP;
+#endif
+	}
+ out:
+	clnt_vc_conn_abort(cn);
+	return (error);
+}
+
+/*
+ * A caller creating a handle waits, in turn, for each step.
+ */
+static int
+clnt_vc_conn_wait(struct clnt_vc_conn *cn, struct rpc_err *re)
+{
+	struct pollfd pfd;
+	struct timespec now;
+	int error;
+	int ms;
+
+	while ((error = clnt_vc_conn_step(cn, re)) == EINPROGRESS) {
+		/* the TLS steps have their own deadline */
+		ms = 1000;
+		if (!cn->cn_connected) {
+			(void)clock_gettime(CLOCK_MONOTONIC_FAST, &now);
+			ms = MIN(ms, (cn->cn_due.tv_sec - now.tv_sec) * 1000
+				 + (cn->cn_due.tv_nsec - now.tv_nsec)
+				   / 1000000 + 1);
+		}
+		pfd.fd = cn->cn_fd;
+		pfd.events = cn->cn_events;
+		pfd.revents = 0;
+		(void)poll(&pfd, 1, MAX(ms, 0));
+	}
+	return (error);
+}
+
 /*
  * Create a client handle for a connection.
  * Default options are set, which the user can change using clnt_control()'s.
@@ -143,16 +347,18 @@ clnt_vc_ncreatef(const int fd,	/* open file descriptor */
 		 const rpcvers_t vers,	/* version number */
 		 const u_int sendsz,	/* buffer send size */
 		 const u_int recvsz,	/* buffer recv size */
-		 const uint32_t flags)
+		 const uint32_t cflags)
 {
 	struct ct_data *ct = clnt_vc_data_zalloc();
 	CLIENT *clnt = &ct->ct_cx.cx_c;
-	SVCXPRT *xprt;
+	const struct netbuf *connect_addr = NULL;
+	struct clnt_vc_conn cn;
 	struct svc_vc_xprt *xd;
 	struct rpc_msg call_msg;
 	sigset_t mask, newmask;
 	struct sockaddr_storage ss;
 	XDR ct_xdrs[1];		/* temp XDR stream */
+	uint32_t flags = cflags;
 	socklen_t slen;
 
 	clnt->cl_ops = clnt_vc_ops();
@@ -178,7 +384,8 @@ clnt_vc_ncreatef(const int fd,	/* open file descriptor */
 	sigfillset(&newmask);
 	thr_sigsetmask(SIG_SETMASK, &newmask, &mask);
 
-	if (flags & CLNT_CREATE_FLAG_CONNECT) {
+	if ((flags & CLNT_CREATE_FLAG_CONNECT)
+	 && !(flags & CLNT_CREATE_FLAG_STARTED)) {
 		slen = sizeof(ss);
 		if (getpeername(fd, (struct sockaddr *)&ss, &slen) < 0) {
 			if (errno != ENOTCONN) {
@@ -186,36 +393,35 @@ clnt_vc_ncreatef(const int fd,	/* open file descriptor */
 				clnt->cl_error.re_errno = errno;
 				goto err;
 			}
-			if (connect
-			    (fd, (struct sockaddr *)raddr->buf,
-			     raddr->len) < 0) {
-				clnt->cl_error.re_status = RPC_SYSTEMERROR;
-				clnt->cl_error.re_errno = errno;
-				goto err;
-			}
-			__warnx(TIRPC_DEBUG_FLAG_CLNT_VC,
-				"%s: fd %d connected",
-				__func__, fd);
+			connect_addr = raddr;
 		}
 	}
 
-	/* find or create shared fd state; ref+1 */
-	xprt = svc_fd_ncreatef(fd, sendsz, recvsz, flags);
-	if (!xprt) {
-		__warnx(TIRPC_DEBUG_FLAG_ERROR,
-			"%s: fd %d svc_fd_ncreatef failed",
+	/* TLS before the fd is shared with the event loop */
+	if ((connect_addr || (flags & CLNT_CREATE_FLAG_TLS))
+	 && !(flags & CLNT_CREATE_FLAG_STARTED)) {
+		clnt->cl_error.re_errno =
+			clnt_vc_conn_start(&cn, fd, connect_addr, prog, vers,
+					   flags, CLNT_VC_CONNECT_MAX_MS);
+		if (clnt->cl_error.re_errno) {
+			clnt->cl_error.re_status = RPC_SYSTEMERROR;
+			goto err;
+		}
+		if (clnt_vc_conn_wait(&cn, &clnt->cl_error))
+			goto err;
+		__warnx(TIRPC_DEBUG_FLAG_CLNT_VC,
+			"%s: fd %d connected",
 			__func__, fd);
-		clnt->cl_error.re_status = RPC_TLIERROR;
-		goto err;
 	}
-	xd = VC_DR(REC_XPRT(xprt));
+	flags &= ~CLNT_CREATE_FLAG_STARTED;
 
-	if (!xd->sx_dr.ev_p) {
-		xprt->xp_dispatch.process_cb = clnt_vc_process;
-		svc_rqst_evchan_reg(__svc_params->ev_u.evchan.id, xprt,
-				    SVC_RQST_FLAG_CHAN_AFFINITY);
+	xd = clnt_vc_attach(ct, fd, sendsz, recvsz, flags);
+	if (!xd) {
+		clnt->cl_error.re_status = RPC_TLIERROR;
+		goto err;
 	}
 	ct->ct_cx.cx_rec = &xd->sx_dr;
+	ct->ct_flags = flags;
 
 	memcpy(&ct->ct_raddr, raddr->buf, raddr->len);
 	ct->ct_rlen = raddr->len;
@@ -279,58 +485,504 @@ clnt_vc_process(struct svc_req *req)
 	return SVC_STAT(xprt);
 }
 
+/*
+ * Reconnecting (CLNT_CREATE_FLAG_RECONNECT)
+ *
+ * A failed receive or send calls clnt_vc_disconnected(), as does a call
+ * finding the transport destroyed (eg, when idle).  A work pool task
+ * connects a new socket to the same address, until it succeeds or the
+ * handle is destroyed.  Neither the connect nor the TLS handshake
+ * blocks (clnt_vc_conn_step()): the task steps again after a doubling
+ * delay (work_pool_submit_delayed()).  The
+ * requests awaiting replies are moved to the new transport with their
+ * xids, so that the server's duplicate request cache can recognize them,
+ * and sent again.  The xid sequence and call slots carry over.
+ *
+ * Only requests already given to clnt_vc_call() are sent again; their
+ * callers hold a reference until it returns.  One racing the move may
+ * be sent twice, and the second reply is ignored.
+ */
+/*
+ * Returns the new transport, or NULL when the connect (or TLS) is in
+ * progress (ct_conn) or failed.
+ */
+static struct svc_vc_xprt *
+clnt_vc_reconnect(struct ct_data *ct, struct rpc_dplx_rec *old)
+{
+	struct cx_data *cx = &ct->ct_cx;
+	struct netbuf raddr = {
+		.maxlen = sizeof(ct->ct_raddr),
+		.len = ct->ct_rlen,
+		.buf = &ct->ct_raddr,
+	};
+	struct svc_vc_xprt *xd;
+	struct rpc_err rpc_error;
+	int error;
+	int fd;
+
+	if (ct->ct_conn.cn_fd < 0) {
+		fd = socket(ct->ct_raddr.ss_family, SOCK_STREAM, 0);
+		if (fd < 0) {
+			__warnx(TIRPC_DEBUG_FLAG_ERROR,
+				"%s: %p socket failed (%d)",
+				__func__, &cx->cx_c, errno);
+			return (NULL);
+		}
+		error = clnt_vc_conn_start(&ct->ct_conn, fd, &raddr,
+					   cx_prog(cx), cx_vers(cx),
+					   ct->ct_flags, CLNT_VC_CONNECT_MAX_MS);
+		if (error) {
+			__warnx(TIRPC_DEBUG_FLAG_CLNT_VC,
+				"%s: %p fd %d connect failed (%d)",
+				__func__, &cx->cx_c, fd, error);
+			close(fd);
+			return (NULL);
+		}
+	}
+	fd = ct->ct_conn.cn_fd;
+
+	error = clnt_vc_conn_step(&ct->ct_conn, &rpc_error);
+	if (error == EINPROGRESS)
+		return (NULL);
+	if (error) {
+		close(fd);
+		return (NULL);
+	}
+
+	xd = clnt_vc_attach(ct, fd, old->sendsz, old->recvsz,
+			    (ct->ct_flags & ~CLNT_CREATE_FLAG_CONNECT)
+			    | CLNT_CREATE_FLAG_CLOSE);
+	if (!xd)
+		close(fd);
+	return (xd);
+}
+
+static void
+clnt_vc_replace(struct ct_data *ct, struct rpc_dplx_rec *old,
+		struct rpc_dplx_rec *rec)
+{
+	struct cx_data *cx = &ct->ct_cx;
+	struct opr_rbtree_node *n;
+	struct rpc_dplx_rec *prev;
+	struct clnt_req **ccv;
+	struct clnt_req *cc;
+	int moved = 0;
+	int sent = 0;
+	int i, count = 0;
+
+	/* no more callbacks with ct from the old transport */
+	mutex_lock(&old->xprt.xp_lock);
+	old->disconnect_cb = NULL;
+	mutex_unlock(&old->xprt.xp_lock);
+
+	rpc_dplx_rli(old);
+	rpc_dplx_rli(rec);
+	rec->call_xid = old->call_xid;
+	while ((n = opr_rbtree_first(&old->call_replies))) {
+		opr_rbtree_remove(&old->call_replies, n);
+		(void)opr_rbtree_insert(&rec->call_replies, n);
+		moved++;
+	}
+	clnt_req_slot_move(old, rec);
+	atomic_store_voidptr((void **)&cx->cx_rec, rec);
+	rpc_dplx_rui(old);
+
+	/* held, so none is released (clnt_req_reset()) until sent */
+	ccv = mem_alloc(MAX(moved, 1) * sizeof(*ccv));
+	for (n = opr_rbtree_first(&rec->call_replies); n;
+	     n = opr_rbtree_next(n)) {
+		cc = opr_containerof(n, struct clnt_req, cc_dplx);
+
+		if ((atomic_fetch_uint16_t(&cc->cc_flags)
+		     & (CLNT_REQ_FLAG_SENT | CLNT_REQ_FLAG_ACKSYNC
+			| CLNT_REQ_FLAG_BACKSYNC))
+		    != CLNT_REQ_FLAG_SENT)
+			continue;
+		atomic_inc_uint32_t(&cc->cc_refs);
+		ccv[count++] = cc;
+	}
+	rpc_dplx_rui(rec);
+
+	/* not recv locked; the read side is left to each caller */
+	for (i = 0; i < count; i++) {
+		if (clnt_vc_send(ccv[i], false) == RPC_SUCCESS)
+			sent++;
+		clnt_req_release(ccv[i]);
+	}
+	mem_free(ccv, MAX(moved, 1) * sizeof(*ccv));
+
+	mutex_lock(&cx->cx_c.cl_lock);
+	prev = ct->ct_prev;
+	ct->ct_prev = old;
+	mutex_unlock(&cx->cx_c.cl_lock);
+
+	/* long replaced, any call still using it is done */
+	if (prev)
+		SVC_RELEASE(&prev->xprt, SVC_RELEASE_FLAG_NONE);
+
+	__warnx(TIRPC_DEBUG_FLAG_CLNT_VC,
+		"%s: %p fd %d replaced fd %d, %d of %d calls sent",
+		__func__, &cx->cx_c, rec->xprt.xp_fd, old->xprt.xp_fd,
+		sent, moved);
+}
+
+/*
+ * One step: starts or checks a connect, then submits itself again after
+ * the backoff, so that no pool thread waits on the network.
+ */
+static void
+clnt_vc_reconnect_task(struct work_pool_entry *wpe)
+{
+	struct ct_data *ct = opr_containerof(wpe, struct ct_data, ct_wpe);
+	CLIENT *clnt = &ct->ct_cx.cx_c;
+	struct rpc_dplx_rec *old = ct->ct_cx.cx_rec;
+	struct svc_vc_xprt *xd;
+	u_int ms;
+
+	if (clnt->cl_flags & CLNT_FLAG_DESTROYING) {
+		if (ct->ct_conn.cn_fd >= 0) {
+			int fd = ct->ct_conn.cn_fd;
+
+			clnt_vc_conn_abort(&ct->ct_conn);
+			close(fd);
+		}
+		goto done;
+	}
+
+	xd = clnt_vc_reconnect(ct, old);
+	if (xd) {
+		clnt_vc_replace(ct, old, &xd->sx_dr);
+		if (!(xd->sx_dr.xprt.xp_flags & SVC_XPRT_FLAG_DESTROYED))
+			goto done;
+		/* failed already, its callback was ignored */
+		ct->ct_backoff_ms = CT_RECONNECT_MIN_MS;
+	}
+
+	ms = ct->ct_backoff_ms;
+	ct->ct_backoff_ms = MIN(ms * 2, CT_RECONNECT_MAX_MS);
+	if (ct->ct_conn.cn_fd >= 0) {
+		/* in progress, its steps bounded by their own deadlines */
+		ms = MIN(ms, CLNT_VC_CONNECT_STEP_MS);
+	}
+	work_pool_submit_delayed(&svc_work_pool, wpe, ms * 1000);
+	return;
+
+ done:
+	mutex_lock(&clnt->cl_lock);
+	ct->ct_reconnecting = false;
+	mutex_unlock(&clnt->cl_lock);
+	CLNT_RELEASE(clnt, CLNT_RELEASE_FLAG_NONE);
+}
+
+/*
+ * Called with the transport's xp_lock held, see rpc_dplx_disconnected().
+ * The handle is not yet released: clnt_vc_destroy() clears the callback
+ * under the same lock.
+ */
+static void
+clnt_vc_disconnected(struct rpc_dplx_rec *rec, void *arg)
+{
+	struct ct_data *ct = arg;
+	CLIENT *clnt = &ct->ct_cx.cx_c;
+
+	if (clnt->cl_flags & CLNT_FLAG_DESTROYING)
+		return;
+
+	mutex_lock(&clnt->cl_lock);
+	if (ct->ct_reconnecting || rec != ct->ct_cx.cx_rec) {
+		mutex_unlock(&clnt->cl_lock);
+		return;
+	}
+	ct->ct_reconnecting = true;
+	ct->ct_backoff_ms = CT_RECONNECT_MIN_MS;
+	mutex_unlock(&clnt->cl_lock);
+
+	__warnx(TIRPC_DEBUG_FLAG_CLNT_VC,
+		"%s: %p fd %d reconnecting",
+		__func__, clnt, rec->xprt.xp_fd);
+
+	/* held by the task */
+	CLNT_REF(clnt, CLNT_REF_FLAG_NONE);
+	ct->ct_wpe.fun = clnt_vc_reconnect_task;
+	ct->ct_wpe.arg = NULL;
+	work_pool_submit(&svc_work_pool, &ct->ct_wpe);
+}
+
+/*
+ * direct: may take the read side for the caller (CLNT_REQ_FLAG_DIRECT),
+ * see clnt_vc_wait().  Not when sent again by clnt_vc_replace(), as the
+ * caller may be waiting already.
+ */
 static enum clnt_stat
-clnt_vc_call(struct clnt_req *cc)
+clnt_vc_send(struct clnt_req *cc, bool direct)
 {
 	CLIENT *clnt = cc->cc_clnt;
 	struct cx_data *cx = CX_DATA(clnt);
-	struct rpc_dplx_rec *rec = cx->cx_rec;
-	SVCXPRT *xprt = &rec->xprt;
+	struct rpc_dplx_rec *rec;
+	SVCXPRT *xprt;
 	struct xdr_ioq *xioq;
 	XDR *xdrs;
-	u_int32_t *uint32p;
+	rpcprog_t prog = cx_prog(cx);
+	rpcvers_t vers = cx_vers(cx);
+	uint16_t flags = 0;
+
+	/* before the transport is chosen, see clnt_vc_replace() */
+	atomic_set_uint16_t_bits(&cc->cc_flags, CLNT_REQ_FLAG_SENT);
+
+	/* set again when the read side is taken */
+	if (direct)
+		flags = atomic_postclear_uint16_t_bits(&cc->cc_flags,
+						       CLNT_REQ_FLAG_DIRECT);
+	rec = atomic_fetch_voidptr((void **)&cx->cx_rec);
+	xprt = &rec->xprt;
+
+	if (unlikely(xprt->xp_flags & SVC_XPRT_FLAG_DESTROYED)
+	 && rec->disconnect_cb) {
+		/* sent when reconnected, see clnt_vc_replace() */
+		rpc_dplx_disconnected(rec);
+		return (RPC_SUCCESS);
+	}
 
 	/* XXX Until gss_get_mic and gss_wrap can be replaced with
 	 * iov equivalents, replies with RPCSEC_GSS security must be
 	 * encoded in a contiguous buffer.
 	 *
-	 * Nb, we should probably use getpagesize() on Unix.  Need
-	 * an equivalent for Windows.
+	 * The first buffer is sized from earlier calls to this procedure.
 	 */
-	xioq = xdr_ioq_create(RPC_MAXDATA_DEFAULT,
-			      __svc_params->ioq.send_max + RPC_MAXDATA_DEFAULT,
-			      (cc->cc_auth->ah_cred.oa_flavor == RPCSEC_GSS)
-			      ? UIO_FLAG_REALLOC | UIO_FLAG_FREE
-			      : UIO_FLAG_FREE);
+	xioq = xdr_ioq_size_create(prog, vers, cc->cc_proc, XDR_IOQ_SIZE_CALL,
+				   __svc_params->ioq.send_max
+				   + RPC_MAXDATA_DEFAULT,
+				   (cc->cc_auth->ah_cred.oa_flavor == RPCSEC_GSS)
+				   ? UIO_FLAG_REALLOC | UIO_FLAG_FREE
+				   : UIO_FLAG_FREE);
 
 	xdrs = xioq->xdrs;
 	cc->cc_error.re_status = RPC_SUCCESS;
 
-	mutex_lock(&clnt->cl_lock);
-	uint32p = (u_int32_t *)&cx->cx_mcallc[0];
-	*uint32p = htonl(cc->cc_xid);
-
-	if ((!XDR_PUTBYTES(xdrs, cx->cx_mcallc, cx->cx_mpos))
+	if ((!cx_callhdr(cx, xdrs, cc->cc_xid))
 	    || (!XDR_PUTUINT32(xdrs, cc->cc_proc))
 	    || (!AUTH_MARSHALL(cc->cc_auth, xdrs))
 	    || (!AUTH_WRAP(cc->cc_auth, xdrs,
 			   cc->cc_call.proc, cc->cc_call.where))) {
 		/* error case */
-		mutex_unlock(&clnt->cl_lock);
 		__warnx(TIRPC_DEBUG_FLAG_CLNT_VC,
 			"%s: fd %d failed",
 			__func__, xprt->xp_fd);
 		XDR_DESTROY(xdrs);
 		return (RPC_CANTENCODEARGS);
 	}
-	mutex_unlock(&clnt->cl_lock);
+	xdr_ioq_size_update(xioq, prog, vers, cc->cc_proc, XDR_IOQ_SIZE_CALL);
 
 	xdrs->x_lib[1] = (void *)xprt;
-	svc_ioq_write_submit(xprt, xioq);
+	if (CT_DATA(cx)->ct_flags & CLNT_CREATE_FLAG_DIRECT) {
+		/* before the reply can be received elsewhere, see
+		 * clnt_vc_wait()
+		 */
+		if ((flags & CLNT_REQ_FLAG_DIRECT)
+		 && rec->call_replies.size == 1
+		 && svc_rqst_take_events(xprt)) {
+			atomic_set_uint16_t_bits(&cc->cc_flags,
+						 CLNT_REQ_FLAG_DIRECT);
+		}
+		/* send without a task switch */
+		svc_ioq_write_now(xprt, xioq);
+	} else
+		svc_ioq_write_submit(xprt, xioq);
 
 	return (RPC_SUCCESS);
 }
 
+static enum clnt_stat
+clnt_vc_call(struct clnt_req *cc)
+{
+	return (clnt_vc_send(cc, true));
+}
+
+#define LAST_FRAG ((u_int32_t)(1 << 31))
+
+/*
+ * Several calls as consecutive records in one output stream, each with
+ * its own record mark, written together.  A call that cannot be encoded
+ * is backed out and failed.  Returns the number sent.
+ */
+static int
+clnt_vc_callv(struct clnt_req **ccv, int n)
+{
+	CLIENT *clnt = ccv[0]->cc_clnt;
+	struct cx_data *cx = CX_DATA(clnt);
+	struct rpc_dplx_rec *rec;
+	SVCXPRT *xprt;
+	struct xdr_ioq *xioq = NULL;
+	XDR *xdrs = NULL;
+	enum clnt_stat stat;
+	u_int32_t *mark;
+	u_int start;
+	u_int len;
+	rpcprog_t prog = cx_prog(cx);
+	rpcvers_t vers = cx_vers(cx);
+	int sent = 0;
+	int i;
+
+	/* as in clnt_vc_call() */
+	for (i = 0; i < n; i++)
+		atomic_set_uint16_t_bits(&ccv[i]->cc_flags,
+					 CLNT_REQ_FLAG_SENT);
+	rec = atomic_fetch_voidptr((void **)&cx->cx_rec);
+	xprt = &rec->xprt;
+
+	if (unlikely(xprt->xp_flags & SVC_XPRT_FLAG_DESTROYED)
+	 && rec->disconnect_cb) {
+		rpc_dplx_disconnected(rec);
+		return (n);
+	}
+
+	for (i = 0; i < n; i++) {
+		struct clnt_req *cc = ccv[i];
+
+		if (cc->cc_auth->ah_cred.oa_flavor == RPCSEC_GSS) {
+			/* needs a contiguous buffer, see clnt_vc_call() */
+			stat = clnt_vc_call(cc);
+			if (stat == RPC_SUCCESS)
+				sent++;
+			else
+				clnt_req_fail(cc, stat);
+			continue;
+		}
+
+		if (!xioq) {
+			xioq = xdr_ioq_size_create(prog, vers, cc->cc_proc,
+						   XDR_IOQ_SIZE_CALL,
+						   __svc_params->ioq.send_max
+						   + RPC_MAXDATA_DEFAULT,
+						   UIO_FLAG_FREE);
+			xioq->ioq_s.qflags |= IOQ_FLAG_RECORDS;
+			xdrs = xioq->xdrs;
+		}
+		start = XDR_GETPOS(xdrs);
+
+		/* room for the mark, filled in when the length is known;
+		 * buffers hold whole units, so it is never split.
+		 */
+		(void)XDR_PUTUINT32(xdrs, 0);
+		mark = (u_int32_t *)(xdrs->x_data - BYTES_PER_XDR_UNIT);
+
+		if (!cx_callhdr(cx, xdrs, cc->cc_xid)
+		    || !XDR_PUTUINT32(xdrs, cc->cc_proc)
+		    || !AUTH_MARSHALL(cc->cc_auth, xdrs)
+		    || !AUTH_WRAP(cc->cc_auth, xdrs,
+				  cc->cc_call.proc, cc->cc_call.where)) {
+			__warnx(TIRPC_DEBUG_FLAG_CLNT_VC,
+				"%s: fd %d xid %" PRIu32 " failed",
+				__func__, xprt->xp_fd, cc->cc_xid);
+			xdr_ioq_truncate(xioq, start);
+			clnt_req_fail(cc, RPC_CANTENCODEARGS);
+			continue;
+		}
+
+		len = XDR_GETPOS(xdrs) - start - BYTES_PER_XDR_UNIT;
+		*mark = htonl(len | LAST_FRAG);
+		sent++;
+	}
+
+	if (xioq) {
+		if (XDR_GETPOS(xdrs)) {
+			xdrs->x_lib[1] = (void *)xprt;
+			svc_ioq_write_submit(xprt, xioq);
+		} else {
+			XDR_DESTROY(xdrs);
+		}
+	}
+	return (sent);
+}
+
+/*
+ * CLNT_CREATE_FLAG_DIRECT: while its call is the only one awaiting a
+ * reply, the caller takes the read side from the event channel (usually
+ * in clnt_vc_call(), CLNT_REQ_FLAG_DIRECT), waits for the socket itself,
+ * and receives as svc_rqst_xprt_task() would.  Each record received gives
+ * the read side back (svc_vc_recv() rearms), so another caller or the
+ * event channel may take the next.
+ *
+ * svc_vc_recv() rearms before the record is decoded, so a reply already
+ * received elsewhere may complete this call while it polls; the poll is
+ * sliced (briefly at first) to notice.
+ */
+static int
+clnt_vc_wait(struct clnt_req *cc, const struct timespec *deadline)
+{
+	struct cx_data *cx = CX_DATA(cc->cc_clnt);
+	struct rpc_dplx_rec *rec;
+	struct pollfd pfd;
+	struct timespec slice;
+	struct timespec ts;
+	long us;
+	long ns;
+	int code;
+	bool held = atomic_postclear_uint16_t_bits(&cc->cc_flags,
+						   CLNT_REQ_FLAG_DIRECT)
+		    & CLNT_REQ_FLAG_DIRECT;
+
+	if (!(CT_DATA(cx)->ct_flags & CLNT_CREATE_FLAG_DIRECT))
+		return (EAGAIN);
+
+	while (!(atomic_fetch_uint16_t(&cc->cc_flags)
+		 & CLNT_REQ_FLAG_WAKEUP)) {
+		rec = atomic_fetch_voidptr((void **)&cx->cx_rec);
+
+		/* unlocked, a hint */
+		if (!held
+		 && (rec->call_replies.size > 1
+		     || !svc_rqst_take_events(&rec->xprt)))
+			return (EAGAIN);
+		held = false;
+
+		pfd.fd = rec->xprt.xp_fd;
+		pfd.events = POLLIN;
+		us = CT_DIRECT_POLL_MIN_US;
+		do {
+			(void)clock_gettime(CLOCK_REALTIME_FAST, &ts);
+			ns = (deadline->tv_sec - ts.tv_sec) * 1000000000L
+			   + (deadline->tv_nsec - ts.tv_nsec);
+			if (ns <= 0) {
+				code = 0;
+				break;
+			}
+			ns = MIN(ns, us * 1000);
+			slice.tv_sec = ns / 1000000000L;
+			slice.tv_nsec = ns % 1000000000L;
+			code = ppoll(&pfd, 1, &slice, NULL);
+			us = MIN(us * 2, CT_DIRECT_POLL_MAX_US);
+		} while (!code
+			 && !(atomic_fetch_uint16_t(&cc->cc_flags)
+			      & CLNT_REQ_FLAG_WAKEUP));
+
+		if (code <= 0) {
+			/* back to the event channel */
+			code = (code < 0) ? errno : (ns <= 0) ? ETIMEDOUT : 0;
+			if (unlikely(svc_rqst_rearm_events(&rec->xprt))) {
+				__warnx(TIRPC_DEBUG_FLAG_ERROR,
+					"%s: %p fd %d svc_rqst_rearm_events failed (will set dead)",
+					__func__, &rec->xprt, rec->xprt.xp_fd);
+				SVC_DESTROY(&rec->xprt);
+				rpc_dplx_disconnected(rec);
+			}
+			if (!code || code == EINTR)
+				continue;
+			return (code == ETIMEDOUT ? ETIMEDOUT : EAGAIN);
+		}
+
+		SVC_REF(&rec->xprt, SVC_REF_FLAG_NONE);
+		(void)clock_gettime(CLOCK_MONOTONIC_FAST, &rec->recv.ts);
+		if (SVC_RECV(&rec->xprt) == XPRT_DESTROYED) {
+			rpc_dplx_disconnected(rec);
+			SVC_RELEASE(&rec->xprt, SVC_RELEASE_FLAG_NONE);
+			return (EAGAIN);
+		}
+		SVC_RELEASE(&rec->xprt, SVC_RELEASE_FLAG_NONE);
+	}
+	return (0);
+}
+
 static bool
 clnt_vc_freeres(CLIENT *clnt, xdrproc_t xdr_res, void *res_ptr)
 {
@@ -348,13 +1000,13 @@ clnt_vc_control(CLIENT *clnt, u_int request, void *info)
 {
 	struct cx_data *cx = CX_DATA(clnt);
 	struct ct_data *ct = CT_DATA(cx);
-	struct rpc_dplx_rec *rec = cx->cx_rec;
+	struct rpc_dplx_rec *rec;
 	struct netbuf *addr;
 	u_int32_t *uint32p;
 	bool rslt = true;
 
 	/* always take recv lock first if taking together */
-	rpc_dplx_rli(rec);
+	rec = cx_rec_rli(cx);
 	mutex_lock(&clnt->cl_lock);
 
 	/*
@@ -397,12 +1049,10 @@ clnt_vc_control(CLIENT *clnt, u_int request, void *info)
 
 	case CLGET_XID:
 		/*
-		 * use the knowledge that xid is the
-		 * first element in the call structure
+		 * the xid assigned by clnt_req_setup() most recently.
 		 * This will get the xid of the PREVIOUS call
 		 */
-		uint32p = (u_int32_t *)&cx->cx_mcallc[0];
-		*(u_int32_t *)info = ntohl(*uint32p);
+		*(u_int32_t *)info = rec->call_xid;
 		break;
 
 	case CLSET_XID:
@@ -423,7 +1073,7 @@ clnt_vc_control(CLIENT *clnt, u_int request, void *info)
 
 	case CLSET_VERS:
 		uint32p = (u_int32_t *)&cx->cx_mcallc[4 * BYTES_PER_XDR_UNIT];
-		*uint32p = htonl(*(u_int32_t *)info);
+		atomic_store_uint32_t(uint32p, htonl(*(u_int32_t *)info));
 		break;
 
 	case CLGET_PROG:
@@ -438,7 +1088,12 @@ clnt_vc_control(CLIENT *clnt, u_int request, void *info)
 
 	case CLSET_PROG:
 		uint32p = (u_int32_t *)&cx->cx_mcallc[3 * BYTES_PER_XDR_UNIT];
-		*uint32p = htonl(*(u_int32_t *)info);
+		atomic_store_uint32_t(uint32p, htonl(*(u_int32_t *)info));
+		break;
+
+	case CLGET_SLOTS:
+	case CLSET_SLOTS:
+		rslt = clnt_req_slot_control(rec, request, info);
 		break;
 
 	default:
@@ -458,10 +1113,23 @@ clnt_vc_destroy(CLIENT *clnt)
 {
 	struct cx_data *cx = CX_DATA(clnt);
 
-	if (cx->cx_rec) {
-		SVC_RELEASE(&cx->cx_rec->xprt, SVC_RELEASE_FLAG_NONE);
+	struct ct_data *ct = CT_DATA(cx);
+	struct rpc_dplx_rec *rec = cx->cx_rec;
+
+	if (rec) {
+		/* no reconnecting task holds the handle */
+		mutex_lock(&rec->xprt.xp_lock);
+		rec->disconnect_cb = NULL;
+		mutex_unlock(&rec->xprt.xp_lock);
+
+		/* once-only; already done when the peer closed */
+		if (ct->ct_owner)
+			SVC_DESTROY(&rec->xprt);
+		SVC_RELEASE(&rec->xprt, SVC_RELEASE_FLAG_NONE);
 	}
-	clnt_vc_data_free(CT_DATA(cx));
+	if (ct->ct_prev)
+		SVC_RELEASE(&ct->ct_prev->xprt, SVC_RELEASE_FLAG_NONE);
+	clnt_vc_data_free(ct);
 }
 
 static struct clnt_ops *
@@ -478,6 +1146,8 @@ clnt_vc_ops(void)
 	mutex_lock(&ops_lock);
 	if (ops.cl_call == NULL) {
 		ops.cl_call = clnt_vc_call;
+		ops.cl_callv = clnt_vc_callv;
+		ops.cl_wait = clnt_vc_wait;
 		ops.cl_abort = clnt_vc_abort;
 		ops.cl_freeres = clnt_vc_freeres;
 		ops.cl_destroy = clnt_vc_destroy;
@@ -327,7 +327,8 @@ getnetconfig(void *handlep)
 	}
 	ncp->nc_configs = ni.tail;
 	mutex_unlock(&nc_mtx);
-	return (ni.tail->ncp);
+	/* not ni.tail, that may have moved on since unlock */
+	return (np);
 }
 
 /*
@@ -52,7 +52,12 @@ NTIRPC_${NTIRPC_VERSION} {
 
     # c*
     cbc_crypt;
+    clnt_cq_create;
+    clnt_cq_dequeue;
+    clnt_cq_destroy;
+    clnt_cq_fd;
     clnt_ncreate_timed;
+    clnt_nconn_ncreatef;
     clnt_ncreate_vers_timed;
     clnt_dg_ncreatef;
     clnt_perrno;
@@ -62,7 +67,9 @@ NTIRPC_${NTIRPC_VERSION} {
     clnt_req_release;
     clnt_req_reset;
     clnt_req_setup;
+    clnt_req_submit;
     clnt_req_wait_reply;
+    clnt_shm_ncreatef;
     clnt_sperrno;
     clnt_tli_create;
     clnt_tp_ncreate_timed;
@@ -106,12 +113,18 @@ NTIRPC_${NTIRPC_VERSION} {
     rpc_broadcast;
     rpc_broadcast_exp;
     rpc_call;
+    rpc_cksum;
     rpc_control;
+    rpc_crc32c;
+    rpc_crc32c_impl;
     rpc_perror;
     rpc_nullproc;
     rpc_rdma_ncreatef;
     rpc_reg;
     rpc_sperror;
+    @NTIRPC_MAP_TLS@rpc_tls_init;
+    @NTIRPC_MAP_TLS@rpc_tls_shutdown;
+    rpcb_cache_stats;
     rpcb_find_mapped_addr;
     rpcb_getaddr;
     rpcb_getmaps;
@@ -129,8 +142,14 @@ NTIRPC_${NTIRPC_VERSION} {
     svc_auth_authenticate;
     svc_auth_reg;
     svc_dg_ncreatef;
+    svc_drc_init;
+    svc_drc_release;
+    svc_drc_shutdown;
+    svc_drc_start;
+    svc_drc_stats;
     svc_fd_ncreatef;
     svc_init;
+    svc_ioq_stats;
     svc_ncreate;
     svc_raw_ncreate;
     svc_reg;
@@ -141,6 +160,7 @@ NTIRPC_${NTIRPC_VERSION} {
     svc_rqst_thrd_run;
     svc_rqst_thrd_signal;
     svc_sendreply;
+    svc_shm_ncreatef;
     svc_shutdown;
     svc_tli_ncreate;
     svc_tp_ncreate;
@@ -180,6 +200,12 @@ NTIRPC_${NTIRPC_VERSION} {
     xdr_float;
     xdr_free_null_stream;
     xdr_int;
+    xdr_ioq_create;
+    xdr_ioq_reset;
+    xdr_ioq_size_create;
+    xdr_ioq_size_estimate;
+    xdr_ioq_size_stats;
+    xdr_ioq_size_update;
     xdr_long;
     xdr_longlong_t;
     xdr_naccepted_reply;
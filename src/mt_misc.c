@@ -13,9 +13,6 @@
 /* protects the services list (svc.c) */
 pthread_rwlock_t svc_lock = RWLOCK_INITIALIZER;
 
-/* protects the RPCBIND address cache */
-pthread_rwlock_t rpcbaddr_cache_lock = RWLOCK_INITIALIZER;
-
 /* protects the Auths list (svc_auth.c) */
 pthread_mutex_t authsvc_lock = MUTEX_INITIALIZER;
 
@@ -47,7 +44,6 @@ pthread_mutex_t svcraw_lock = MUTEX_INITIALIZER;
 pthread_mutex_t tsd_lock = MUTEX_INITIALIZER;
 
 /* Library global tsd keys */
-thread_key_t rpc_call_key = -1;
 thread_key_t tcp_key = -1;
 thread_key_t udp_key = -1;
 thread_key_t nc_key = -1;
@@ -61,8 +57,6 @@ pthread_mutex_t serialize_pkey = MUTEX_INITIALIZER;
 
 void tsd_key_delete(void)
 {
-	if (rpc_call_key != -1)
-		pthread_key_delete(rpc_call_key);
 	if (tcp_key != -1)
 		pthread_key_delete(tcp_key);
 	if (udp_key != -1)
@@ -232,6 +232,9 @@ xdr_call_decode(XDR *xdrs, struct rpc_msg *cmsg, int32_t *buf)
 		return (false);
 	}
 
+	/* cb_cred and cb_verf bodies are copied into their oa_body (at most
+	 * MAX_AUTH_BYTES), which the auth flavors and callers read.
+	 */
 	buf = xdr_inline_decode(xdrs, 3 * BYTES_PER_XDR_UNIT);
 	if (buf != NULL) {
 		cmsg->cb_proc = IXDR_GET_U_INT32(buf);
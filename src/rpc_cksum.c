@@ -0,0 +1,365 @@
+/*
+ * Copyright (c) 2018 Red Hat, Inc. and/or its affiliates.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR `AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/**
+ * @file rpc_cksum.c
+ * @brief Request checksums
+ *
+ * @section DESCRIPTION
+ *
+ * crc32c using the CPU crc32c instructions, selected at first use.
+ *
+ * The crc32c instruction has a latency of 3 cycles and a throughput of
+ * 1 per cycle, so long buffers are split in 3 lanes computed together.
+ * The lane crcs are then combined by shifting each over the lanes that
+ * follow it (multiplying by x^(8 * bytes) modulo the polynomial), using
+ * PCLMULQDQ on x86, or the software multiply otherwise.
+ */
+
+#include "config.h"
+
+#include <sys/types.h>
+#include <stdint.h>
+#include <string.h>
+
+#if defined(__x86_64__)
+#include <nmmintrin.h>
+#include <wmmintrin.h>
+#elif defined(__aarch64__)
+#include <arm_acle.h>
+#include <sys/auxv.h>
+#include <asm/hwcap.h>
+#endif
+
+#include <misc/city.h>
+#include <rpc/rpc_cksum.h>
+
+#define CRC32C_POLY	0x82f63b78	/* reflected */
+#define CRC32C_X0	0x80000000	/* x^0, reflected */
+
+#define CRC32C_LONG	(8192)	/* bytes per lane */
+#define CRC32C_SHORT	(256)
+
+typedef uint32_t (*rpc_crc32c_fun_t) (uint32_t, const void *, size_t);
+
+static uint32_t rpc_crc32c_sw(uint32_t, const void *, size_t);
+static uint32_t rpc_crc32c_resolve(uint32_t, const void *, size_t);
+
+static rpc_crc32c_fun_t rpc_crc32c_fun = rpc_crc32c_resolve;
+static const char *rpc_crc32c_name = "software";
+
+/* lane shift constants */
+static struct {
+	uint32_t long1;		/* x^(8 * CRC32C_LONG) */
+	uint32_t long2;		/* x^(16 * CRC32C_LONG) */
+	uint32_t clmul_long1;	/* less 33, see crc32c_shift_clmul() */
+	uint32_t clmul_long2;
+	uint32_t clmul_short1;
+	uint32_t clmul_short2;
+} crc32c_k;
+
+/*
+ * a * b modulo the crc32c polynomial (reflected)
+ */
+static uint32_t
+crc32c_multmodp(uint32_t a, uint32_t b)
+{
+	uint32_t m = CRC32C_X0;
+	uint32_t p = 0;
+
+	for (;;) {
+		if (a & m) {
+			p ^= b;
+			if ((a & (m - 1)) == 0)
+				break;
+		}
+		m >>= 1;
+		b = (b & 1) ? (b >> 1) ^ CRC32C_POLY : b >> 1;
+	}
+	return (p);
+}
+
+/*
+ * x^n modulo the crc32c polynomial (reflected)
+ */
+static uint32_t
+crc32c_xpow(uint64_t n)
+{
+	uint32_t p = CRC32C_X0;
+	uint32_t sq = CRC32C_X0 >> 1;	/* x^1 */
+
+	while (n) {
+		if (n & 1)
+			p = crc32c_multmodp(sq, p);
+		sq = crc32c_multmodp(sq, sq);
+		n >>= 1;
+	}
+	return (p);
+}
+
+static uint32_t
+rpc_crc32c_sw(uint32_t crc, const void *buf, size_t len)
+{
+	const unsigned char *p = buf;
+
+	/* calculate_crc32c() takes unsigned int lengths */
+	while (len > UINT32_MAX) {
+		crc = calculate_crc32c(crc, p, UINT32_MAX);
+		p += UINT32_MAX;
+		len -= UINT32_MAX;
+	}
+	return (calculate_crc32c(crc, p, len));
+}
+
+#if defined(__x86_64__)
+
+/*
+ * crc * x^(8 * n) modulo the polynomial, for k = x^(8 * n - 33).
+ * The carry-less product of reflected operands is short 1 bit, and the
+ * crc32 instruction multiplies by x^32 as it reduces.
+ */
+__attribute__ ((target("sse4.2,pclmul")))
+static inline uint32_t
+crc32c_shift_clmul(uint32_t crc, uint32_t k)
+{
+	__m128i v = _mm_clmulepi64_si128(_mm_cvtsi32_si128(crc),
+					 _mm_cvtsi32_si128(k), 0);
+
+	return (_mm_crc32_u64(0, _mm_cvtsi128_si64(v)));
+}
+
+__attribute__ ((target("sse4.2")))
+static inline const unsigned char *
+crc32c_sse42_lanes(uint64_t *crc, const unsigned char *p, size_t blk)
+{
+	const unsigned char *end = p + blk;
+	uint64_t crc0 = *crc;
+	uint64_t crc1 = 0;
+	uint64_t crc2 = 0;
+	uint64_t v0, v1, v2;
+
+	do {
+		memcpy(&v0, p, sizeof(v0));
+		memcpy(&v1, p + blk, sizeof(v1));
+		memcpy(&v2, p + 2 * blk, sizeof(v2));
+		crc0 = _mm_crc32_u64(crc0, v0);
+		crc1 = _mm_crc32_u64(crc1, v1);
+		crc2 = _mm_crc32_u64(crc2, v2);
+		p += sizeof(v0);
+	} while (p < end);
+
+	crc[0] = crc0;
+	crc[1] = crc1;
+	crc[2] = crc2;
+	return (p + 2 * blk);
+}
+
+__attribute__ ((target("sse4.2,pclmul")))
+static uint32_t
+rpc_crc32c_sse42(uint32_t crc32c, const void *buf, size_t len)
+{
+	const unsigned char *p = buf;
+	uint64_t crc[3];
+	uint64_t v;
+
+	crc[0] = crc32c;
+
+	/* align the lanes */
+	while (len && ((uintptr_t)p & 7)) {
+		crc[0] = _mm_crc32_u8(crc[0], *p++);
+		len--;
+	}
+
+	while (len >= 3 * CRC32C_LONG) {
+		p = crc32c_sse42_lanes(crc, p, CRC32C_LONG);
+		crc[0] = crc32c_shift_clmul(crc[0], crc32c_k.clmul_long2)
+		       ^ crc32c_shift_clmul(crc[1], crc32c_k.clmul_long1)
+		       ^ crc[2];
+		len -= 3 * CRC32C_LONG;
+	}
+
+	while (len >= 3 * CRC32C_SHORT) {
+		p = crc32c_sse42_lanes(crc, p, CRC32C_SHORT);
+		crc[0] = crc32c_shift_clmul(crc[0], crc32c_k.clmul_short2)
+		       ^ crc32c_shift_clmul(crc[1], crc32c_k.clmul_short1)
+		       ^ crc[2];
+		len -= 3 * CRC32C_SHORT;
+	}
+
+	while (len >= sizeof(v)) {
+		memcpy(&v, p, sizeof(v));
+		crc[0] = _mm_crc32_u64(crc[0], v);
+		p += sizeof(v);
+		len -= sizeof(v);
+	}
+
+	while (len--)
+		crc[0] = _mm_crc32_u8(crc[0], *p++);
+
+	return (crc[0]);
+}
+
+/* without PCLMULQDQ, one lane */
+__attribute__ ((target("sse4.2")))
+static uint32_t
+rpc_crc32c_sse42_1(uint32_t crc32c, const void *buf, size_t len)
+{
+	const unsigned char *p = buf;
+	uint64_t crc = crc32c;
+	uint64_t v;
+
+	while (len >= sizeof(v)) {
+		memcpy(&v, p, sizeof(v));
+		crc = _mm_crc32_u64(crc, v);
+		p += sizeof(v);
+		len -= sizeof(v);
+	}
+
+	while (len--)
+		crc = _mm_crc32_u8(crc, *p++);
+
+	return (crc);
+}
+
+#elif defined(__aarch64__)
+
+__attribute__ ((target("+crc")))
+static uint32_t
+rpc_crc32c_armv8(uint32_t crc32c, const void *buf, size_t len)
+{
+	const unsigned char *p = buf;
+	uint32_t crc0 = crc32c;
+	uint64_t v0, v1, v2;
+
+	while (len && ((uintptr_t)p & 7)) {
+		crc0 = __crc32cb(crc0, *p++);
+		len--;
+	}
+
+	/* the software shift is only worth it over long lanes */
+	while (len >= 3 * CRC32C_LONG) {
+		const unsigned char *end = p + CRC32C_LONG;
+		uint32_t crc1 = 0;
+		uint32_t crc2 = 0;
+
+		do {
+			memcpy(&v0, p, sizeof(v0));
+			memcpy(&v1, p + CRC32C_LONG, sizeof(v1));
+			memcpy(&v2, p + 2 * CRC32C_LONG, sizeof(v2));
+			crc0 = __crc32cd(crc0, v0);
+			crc1 = __crc32cd(crc1, v1);
+			crc2 = __crc32cd(crc2, v2);
+			p += sizeof(v0);
+		} while (p < end);
+
+		crc0 = crc32c_multmodp(crc32c_k.long2, crc0)
+		     ^ crc32c_multmodp(crc32c_k.long1, crc1)
+		     ^ crc2;
+		p += 2 * CRC32C_LONG;
+		len -= 3 * CRC32C_LONG;
+	}
+
+	while (len >= sizeof(v0)) {
+		memcpy(&v0, p, sizeof(v0));
+		crc0 = __crc32cd(crc0, v0);
+		p += sizeof(v0);
+		len -= sizeof(v0);
+	}
+
+	while (len--)
+		crc0 = __crc32cb(crc0, *p++);
+
+	return (crc0);
+}
+
+#endif
+
+/*
+ * Pick the implementation on first use.  Racing callers store the same
+ * values.
+ */
+static uint32_t
+rpc_crc32c_resolve(uint32_t crc, const void *buf, size_t len)
+{
+	rpc_crc32c_fun_t fun = rpc_crc32c_sw;
+
+	crc32c_k.long1 = crc32c_xpow(8 * CRC32C_LONG);
+	crc32c_k.long2 = crc32c_xpow(16 * CRC32C_LONG);
+	crc32c_k.clmul_long1 = crc32c_xpow(8 * CRC32C_LONG - 33);
+	crc32c_k.clmul_long2 = crc32c_xpow(16 * CRC32C_LONG - 33);
+	crc32c_k.clmul_short1 = crc32c_xpow(8 * CRC32C_SHORT - 33);
+	crc32c_k.clmul_short2 = crc32c_xpow(16 * CRC32C_SHORT - 33);
+
+#if defined(__x86_64__)
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("sse4.2")) {
+		if (__builtin_cpu_supports("pclmul")) {
+			fun = rpc_crc32c_sse42;
+			rpc_crc32c_name = "sse4.2+pclmul";
+		} else {
+			fun = rpc_crc32c_sse42_1;
+			rpc_crc32c_name = "sse4.2";
+		}
+	}
+#elif defined(__aarch64__)
+	if (getauxval(AT_HWCAP) & HWCAP_CRC32) {
+		fun = rpc_crc32c_armv8;
+		rpc_crc32c_name = "armv8-crc";
+	}
+#endif
+	__atomic_store_n(&rpc_crc32c_fun, fun, __ATOMIC_RELEASE);
+	return (fun(crc, buf, len));
+}
+
+uint32_t
+rpc_crc32c(uint32_t crc, const void *buf, size_t len)
+{
+	return (__atomic_load_n(&rpc_crc32c_fun, __ATOMIC_ACQUIRE)
+		(crc, buf, len));
+}
+
+const char *
+rpc_crc32c_impl(void)
+{
+	if (__atomic_load_n(&rpc_crc32c_fun, __ATOMIC_ACQUIRE)
+	    == rpc_crc32c_resolve)
+		(void)rpc_crc32c_resolve(0, NULL, 0);
+	return (rpc_crc32c_name);
+}
+
+uint64_t
+rpc_cksum(enum rpc_cksum_type type, const void *data, size_t length)
+{
+	switch (type) {
+	case RPC_CKSUM_CRC32C:
+		return (rpc_crc32c(0, data, length));
+	case RPC_CKSUM_CRC32C_SW:
+		return (rpc_crc32c_sw(0, data, length));
+	case RPC_CKSUM_CITYHASH:
+	default:
+		break;
+	};
+	return (CityHash64WithSeed(data, length, 103));
+}
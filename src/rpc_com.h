@@ -79,6 +79,8 @@ struct netbuf *__rpcb_findaddr(rpcprog_t, rpcvers_t, const struct netconfig *,
 struct netbuf *__rpcb_findaddr_timed(rpcprog_t, rpcvers_t,
 				     const struct netconfig *, const char *,
 				     CLIENT **, struct timeval *);
+void __rpcb_cache_forget(rpcprog_t, rpcvers_t, const struct netconfig *,
+			 const char *);
 
 bool __rpc_control(int, void *);
 
@@ -50,13 +50,20 @@ typedef struct rpc_dplx_lock {
 /* new unified state */
 struct rpc_dplx_rec {
 	struct svc_xprt xprt;		/**< Transport Independent handle */
-	struct xdr_ioq ioq;
-	struct opr_rbtree call_replies;
+
+	/* read on every event, set while creating the transport */
+	void *ev_p;			/* struct svc_rqst_rec (internal) */
 	struct opr_rbtree_node fd_node;
+	size_t maxrec;
+	long pagesz;
+	u_int recvsz;
+	u_int sendsz;
+
+	/* written by the receiving thread, and by calls under recv.lock */
 	struct {
 		rpc_dplx_lock_t lock;
 		struct timespec ts;
-	} recv;
+	} recv __attribute__ ((aligned(CACHE_LINE_SIZE)));
 
 	/*
 	 * union of event processor types
@@ -68,17 +75,47 @@ struct rpc_dplx_rec {
 		} epoll;
 #endif
 	} ev_u;
-	void *ev_p;			/* struct svc_rqst_rec (internal) */
 
-	size_t maxrec;
-	long pagesz;
-	u_int recvsz;
-	u_int sendsz;
+	struct opr_rbtree call_replies;
 	uint32_t call_xid;		/**< current call xid */
 	uint32_t ev_count;		/**< atomic count of waiting events */
+
+	/* client reconnect, see clnt_vc.c; under xprt.xp_lock */
+	void (*disconnect_cb)(struct rpc_dplx_rec *, void *);
+	void *disconnect_arg;
+
+	/* client calls outstanding, under recv.lock, see clnt_generic.c */
+	struct {
+		TAILQ_HEAD(, clnt_req) waitq;	/* in order of arrival */
+		u_int used;
+		u_int limit;		/* 0 until the first call */
+		u_int min;
+		u_int max;
+		u_int ssthresh;
+		u_int waiting;
+		u_int replies;		/* in this sample window */
+		uint64_t win_min_ns;	/* least latency in the window */
+		uint64_t base_ns;	/* smoothed least latency */
+		bool dispatching;
+	} call_slots;
+
+	/* written by any thread with output */
+	struct {
+		struct poolq_head qh;		/* output records */
+		struct poolq_entry ready;	/* on a ready list, see svc_ioq */
+		struct work_pool_entry wpe;	/* after coalesce_window */
+		uint16_t flags;			/* (atomic) */
+	} send __attribute__ ((aligned(CACHE_LINE_SIZE)));
+
+	/* submitted to the work pool for each event */
+	struct xdr_ioq ioq;
 };
 #define REC_XPRT(p) (opr_containerof((p), struct rpc_dplx_rec, xprt))
 
+/* send.flags */
+#define RPC_DPLX_SEND_CLAIMED       0x0001	/* a thread is sending */
+#define RPC_DPLX_SEND_WINDOW        0x0002	/* claimed, waited for more */
+
 #define RPC_DPLX_FLAG_NONE          0x0000
 #define RPC_DPLX_FLAG_LOCKED        0x0001
 #define RPC_DPLX_FLAG_UNLOCK        0x0002
@@ -115,16 +152,34 @@ rpc_dplx_rec_init(struct rpc_dplx_rec *rec)
 {
 	rpc_dplx_lock_init(&rec->recv.lock);
 	opr_rbtree_init(&rec->call_replies, clnt_req_xid_cmpf);
+	TAILQ_INIT(&rec->call_slots.waitq);
 	mutex_init(&rec->xprt.xp_lock, NULL);
+	poolq_head_setup(&rec->send.qh);
 
 	rec->xprt.xp_refs = 1;
 }
 
+/*
+ * After SVC_DESTROY() for a failed receive or send.
+ */
+static inline void
+rpc_dplx_disconnected(struct rpc_dplx_rec *rec)
+{
+	if (likely(!rec->disconnect_cb))
+		return;
+
+	mutex_lock(&rec->xprt.xp_lock);
+	if (rec->disconnect_cb)
+		(*rec->disconnect_cb)(rec, rec->disconnect_arg);
+	mutex_unlock(&rec->xprt.xp_lock);
+}
+
 static inline void
 rpc_dplx_rec_destroy(struct rpc_dplx_rec *rec)
 {
 	rpc_dplx_lock_destroy(&rec->recv.lock);
 	mutex_destroy(&rec->xprt.xp_lock);
+	poolq_head_destroy(&rec->send.qh);
 
 #if defined(HAVE_BLKIN)
 	if (rec->xprt.blkin.svc_name)
@@ -98,7 +98,8 @@ tirpc_aligned(size_t alignment, size_t size, const char *file, int line,
 	void *r;
 
 #if defined(_ISOC11_SOURCE)
-	r = aligned_alloc(alignment, size);
+	/* size must be a multiple of alignment */
+	r = aligned_alloc(alignment, roundup(size, alignment));
 #else
 	(void) posix_memalign(&r, alignment, size);
 #endif
@@ -1363,7 +1363,7 @@ rpc_rdma_allocate(const struct rpc_rdma_attr *xa)
 		return NULL;
 	}
 
-	xd = mem_zalloc(sizeof(*xd));
+	xd = mem_zalloc_aligned(CACHE_LINE_SIZE, sizeof(*xd));
 
 	xd->sm_dr.xprt.xp_type = XPRT_RDMA;
 	xd->sm_dr.xprt.xp_refs = 1;
@@ -1659,7 +1659,7 @@ rpc_rdma_setup_cbq(struct poolq_head *ioqh, u_int depth, u_int sge)
 	 * debugging memory bounds checking of trailing ibv_sge array.
 	 */
 	while (depth--) {
-		cbc = mem_zalloc(ioqh->qsize);
+		cbc = mem_zalloc_aligned(CACHE_LINE_SIZE, ioqh->qsize);
 
 		xdr_ioq_setup(&cbc->workq);
 		xdr_ioq_setup(&cbc->holdq);
@@ -0,0 +1,709 @@
+/*
+ * Copyright (c) 2018 Red Hat, Inc. and/or its affiliates.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR `AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/**
+ * @file rpc_tls.c
+ * @brief RPC-over-TLS (RFC 9289) with kernel TLS
+ *
+ * @section DESCRIPTION
+ *
+ * The AUTH_TLS probe and its STARTTLS reply are the first record on a
+ * connection.  The server then steps the TLS 1.3 handshake on each
+ * receive event, non-blocking and outside the receive lock, until it is
+ * done or its deadline passes.  The client probe and handshake are
+ * stepped the same way, by whoever connects (clnt_vc_conn_step()),
+ * bounded by the same timeout.
+ *
+ * OpenSSL (SSL_OP_ENABLE_KTLS) gives the session keys to the kernel
+ * (TCP_ULP "tls"), and the connection is used without it afterwards.
+ * The server sends no session tickets; those a client receives are
+ * discarded, see rpc_tls_recv_control().  Any other non-data record
+ * (such as an alert) closes the connection.
+ */
+
+#include "config.h"
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <linux/tls.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <openssl/err.h>
+#include <openssl/ssl.h>
+#include <openssl/x509v3.h>
+
+#include <rpc/types.h>
+#include <misc/portable.h>
+#include <misc/timespec.h>
+#include <rpc/rpc.h>
+#include <rpc/rpc_tls.h>
+#include <rpc/xdr_ioq.h>
+
+#include "rpc_com.h"
+#include "svc_internal.h"
+
+#ifndef SOL_TLS
+#define SOL_TLS 282
+#endif
+#ifndef TLS_GET_RECORD_TYPE
+#define TLS_GET_RECORD_TYPE 2
+#endif
+
+#define LAST_FRAG ((u_int32_t)(1 << 31))
+
+/* NULL call, AUTH_TLS credential, AUTH_NONE verifier */
+#define RPC_TLS_PROBE_UNITS	(10)
+/* accepted, STARTTLS verifier */
+#define RPC_TLS_REPLY_UNITS	(8)
+
+#define RPC_TLS_RECORD_MAX	(1 << 14)	/* plaintext */
+#define RPC_TLS_HANDSHAKE	(22)		/* record content type */
+#define RPC_TLS_NEW_SESSION_TICKET (4)		/* handshake type */
+
+static const char rpc_tls_starttls[8] = "STARTTLS";
+
+static struct {
+	SSL_CTX *svc_ctx;
+	SSL_CTX *clnt_ctx;
+	char *server_name;
+	u_int timeout;
+} rpc_tls;
+
+/* a server handshake, between receive events */
+struct rpc_tls_pending {
+	SSL *ssl;
+	struct timespec deadline;
+	int fl;			/* file status flags before */
+};
+
+/* a client probe and handshake, see rpc_tls_clnt_step() */
+struct rpc_tls_clnt {
+	SSL *ssl;			/* after STARTTLS */
+	struct timespec deadline;
+	uint32_t call[1 + RPC_TLS_PROBE_UNITS];
+	uint32_t reply[1 + RPC_TLS_REPLY_UNITS];
+	size_t sent;
+	size_t received;		/* record mark, then reply */
+	int fd;
+};
+
+static void
+rpc_tls_warn_ssl(const char *func, const char *what)
+{
+	char buf[256];
+	unsigned long e;
+
+	while ((e = ERR_get_error())) {
+		ERR_error_string_n(e, buf, sizeof(buf));
+		__warnx(TIRPC_DEBUG_FLAG_ERROR, "%s: %s: %s", func, what, buf);
+	}
+}
+
+/*
+ * The handshake is non-blocking; returns the flags to restore, or -1.
+ */
+static int
+rpc_tls_nonblock(int fd)
+{
+	int fl = fcntl(fd, F_GETFL);
+
+	if (fl < 0 || fcntl(fd, F_SETFL, fl | O_NONBLOCK) < 0)
+		return (-1);
+	return (fl);
+}
+
+/*
+ * The keys are in kernel TLS, in both directions.
+ */
+static bool
+rpc_tls_ktls(int fd, SSL *ssl)
+{
+	if (!BIO_get_ktls_send(SSL_get_wbio(ssl))
+	 || !BIO_get_ktls_recv(SSL_get_rbio(ssl))) {
+		__warnx(TIRPC_DEBUG_FLAG_ERROR,
+			"%s: fd %d %s not in kernel TLS",
+			__func__, fd, SSL_get_cipher_name(ssl));
+		return (false);
+	}
+	__warnx(TIRPC_DEBUG_FLAG_AUTH,
+		"%s: fd %d %s %s", __func__, fd,
+		SSL_get_version(ssl), SSL_get_cipher_name(ssl));
+	return (true);
+}
+
+static void
+rpc_tls_deadline(struct timespec *deadline)
+{
+	(void)clock_gettime(CLOCK_MONOTONIC_FAST, deadline);
+	deadline->tv_sec += rpc_tls.timeout;
+}
+
+static int
+rpc_tls_wait(int fd, short events, const struct timespec *deadline)
+{
+	struct pollfd pfd = {
+		.fd = fd,
+		.events = events,
+	};
+	struct timespec now;
+	int ms;
+
+	(void)clock_gettime(CLOCK_MONOTONIC_FAST, &now);
+	ms = (deadline->tv_sec - now.tv_sec) * 1000
+	   + (deadline->tv_nsec - now.tv_nsec) / 1000000;
+	if (ms <= 0)
+		return (ETIMEDOUT);
+
+	switch (poll(&pfd, 1, ms)) {
+	case -1:
+		return ((errno == EINTR) ? 0 : errno);
+	case 0:
+		return (ETIMEDOUT);
+	default:
+		break;
+	};
+	return (0);
+}
+
+/*
+ * The server's certificate must have server_name, else the address
+ * connected to.
+ */
+static bool
+rpc_tls_peer_name(int fd, SSL *ssl)
+{
+	struct sockaddr_storage ss;
+	socklen_t slen = sizeof(ss);
+
+	if (rpc_tls.server_name)
+		return (SSL_set_tlsext_host_name(ssl, rpc_tls.server_name)
+		     && SSL_set1_host(ssl, rpc_tls.server_name));
+
+	if (getpeername(fd, (struct sockaddr *)&ss, &slen) < 0)
+		return (false);
+	switch (ss.ss_family) {
+	case AF_INET:
+		return (X509_VERIFY_PARAM_set1_ip(SSL_get0_param(ssl),
+			(u_char *)&((struct sockaddr_in *)&ss)->sin_addr,
+			sizeof(struct in_addr)));
+	case AF_INET6:
+		return (X509_VERIFY_PARAM_set1_ip(SSL_get0_param(ssl),
+			(u_char *)&((struct sockaddr_in6 *)&ss)->sin6_addr,
+			sizeof(struct in6_addr)));
+	default:
+		return (false);
+	};
+}
+
+static void
+rpc_tls_svc_done(struct svc_vc_xprt *xd)
+{
+	struct rpc_tls_pending *tp = xd->sx_tls_pending;
+
+	xd->sx_tls_pending = NULL;
+	SSL_free(tp->ssl);
+	if (tp->fl >= 0)
+		(void)fcntl(xd->sx_dr.xprt.xp_fd, F_SETFL, tp->fl);
+	mem_free(tp, sizeof(*tp));
+}
+
+/*
+ * The first record on a connection offering TLS.  An AUTH_TLS probe is
+ * answered with STARTTLS, and the handshake is started, see
+ * rpc_tls_svc_handshake().  On failure, the transport is destroyed.
+ * Returns false for any other record.
+ */
+bool
+rpc_tls_svc_starttls(SVCXPRT *xprt, struct xdr_ioq *xioq)
+{
+	struct svc_vc_xprt *xd = VC_DR(REC_XPRT(xprt));
+	struct xdr_ioq_uv *uv = IOQ_(TAILQ_FIRST(&xioq->ioq_uv.uvqh.qh));
+	uint32_t *call = (uint32_t *)uv->v.vio_head;
+	uint32_t reply[1 + RPC_TLS_REPLY_UNITS];
+	struct rpc_tls_pending *tp;
+	ssize_t n;
+
+	if (!rpc_tls.svc_ctx
+	 || ioquv_length(uv) < RPC_TLS_PROBE_UNITS * BYTES_PER_XDR_UNIT
+	 || ntohl(call[1]) != CALL
+	 || ntohl(call[2]) != RPC_MSG_VERSION
+	 || ntohl(call[5]) != NULLPROC
+	 || ntohl(call[6]) != AUTH_TLS)
+		return (false);
+
+	reply[0] = htonl(LAST_FRAG | RPC_TLS_REPLY_UNITS * BYTES_PER_XDR_UNIT);
+	reply[1] = call[0];	/* xid */
+	reply[2] = htonl(REPLY);
+	reply[3] = htonl(MSG_ACCEPTED);
+	reply[4] = htonl(AUTH_NONE);
+	reply[5] = htonl(sizeof(rpc_tls_starttls));
+	memcpy(&reply[6], rpc_tls_starttls, sizeof(rpc_tls_starttls));
+	reply[8] = htonl(SUCCESS);
+
+	/* nothing else was sent on this connection */
+	n = send(xprt->xp_fd, reply, sizeof(reply),
+		 MSG_DONTWAIT | MSG_NOSIGNAL);
+	if (n != sizeof(reply)) {
+		__warnx(TIRPC_DEBUG_FLAG_ERROR,
+			"%s: %p fd %d STARTTLS send failed (%d) (will set dead)",
+			__func__, xprt, xprt->xp_fd, (n < 0) ? errno : EAGAIN);
+		SVC_DESTROY(xprt);
+		return (true);
+	}
+
+	tp = mem_zalloc(sizeof(*tp));
+	tp->fl = rpc_tls_nonblock(xprt->xp_fd);
+	tp->ssl = SSL_new(rpc_tls.svc_ctx);
+	xd->sx_tls_pending = tp;
+	if (tp->fl < 0 || !tp->ssl || !SSL_set_fd(tp->ssl, xprt->xp_fd)) {
+		rpc_tls_warn_ssl(__func__, "SSL_new");
+		SVC_DESTROY(xprt);
+		return (true);
+	}
+	rpc_tls_deadline(&tp->deadline);
+	xd->sx_tls = SVC_VC_TLS_HANDSHAKE;
+	return (true);
+}
+
+/*
+ * Another step of the server handshake, on a receive event.  Called
+ * without the receive lock; no other record is received until done.
+ */
+enum xprt_stat
+rpc_tls_svc_handshake(SVCXPRT *xprt)
+{
+	struct svc_vc_xprt *xd = VC_DR(REC_XPRT(xprt));
+	struct rpc_tls_pending *tp = xd->sx_tls_pending;
+	struct timespec now;
+	int code;
+	int rc;
+
+	for (;;) {
+		rc = SSL_accept(tp->ssl);
+		if (rc == 1)
+			break;
+
+		switch (SSL_get_error(tp->ssl, rc)) {
+		case SSL_ERROR_WANT_READ:
+			/* the client's next flight */
+			(void)clock_gettime(CLOCK_MONOTONIC_FAST, &now);
+			if (timespeccmp(&now, &tp->deadline, >=)) {
+				code = ETIMEDOUT;
+				break;
+			}
+			if (unlikely(svc_rqst_rearm_events(xprt))) {
+				code = EINVAL;
+				break;
+			}
+			return SVC_STAT(xprt);
+		case SSL_ERROR_WANT_WRITE:
+			/* bounded, only on a full send buffer */
+			code = rpc_tls_wait(xprt->xp_fd, POLLOUT,
+					    &tp->deadline);
+			if (!code)
+				continue;
+			break;
+		default:
+			rpc_tls_warn_ssl(__func__, "handshake");
+			code = EPROTO;
+			break;
+		};
+		__warnx(TIRPC_DEBUG_FLAG_ERROR,
+			"%s: %p fd %d TLS failed (%d) (will set dead)",
+			__func__, xprt, xprt->xp_fd, code);
+		SVC_DESTROY(xprt);
+		return SVC_STAT(xprt);
+	}
+
+	if (!rpc_tls_ktls(xprt->xp_fd, tp->ssl)) {
+		SVC_DESTROY(xprt);
+		return SVC_STAT(xprt);
+	}
+	rpc_tls_svc_done(xd);
+	xd->sx_tls = SVC_VC_TLS_ACTIVE;
+
+	if (unlikely(svc_rqst_rearm_events(xprt))) {
+		__warnx(TIRPC_DEBUG_FLAG_ERROR,
+			"%s: %p fd %d svc_rqst_rearm_events failed (will set dead)",
+			__func__, xprt, xprt->xp_fd);
+		SVC_DESTROY(xprt);
+	}
+	return SVC_STAT(xprt);
+}
+
+/*
+ * A handshake not finished when the transport is destroyed.
+ */
+void
+rpc_tls_svc_free(struct svc_vc_xprt *xd)
+{
+	if (xd->sx_tls_pending)
+		rpc_tls_svc_done(xd);
+}
+
+/*
+ * A record other than application data, that recv() fails (EIO) on a
+ * kernel TLS socket.  Session tickets are discarded, sessions are not
+ * resumed.  Returns 0, or the error for any other record.
+ */
+int
+rpc_tls_recv_control(int fd)
+{
+	char cbuf[CMSG_SPACE(sizeof(unsigned char))];
+	uint8_t *buf = mem_alloc(RPC_TLS_RECORD_MAX);
+	struct iovec iov = {
+		.iov_base = buf,
+		.iov_len = RPC_TLS_RECORD_MAX,
+	};
+	struct msghdr msg = {
+		.msg_iov = &iov,
+		.msg_iovlen = 1,
+		.msg_control = cbuf,
+		.msg_controllen = sizeof(cbuf),
+	};
+	struct cmsghdr *cmsg;
+	size_t off;
+	ssize_t n;
+	int code = EPROTO;
+
+	n = recvmsg(fd, &msg, MSG_DONTWAIT);
+	if (n < 0) {
+		code = errno;
+		goto out;
+	}
+
+	cmsg = CMSG_FIRSTHDR(&msg);
+	if (!cmsg
+	 || cmsg->cmsg_level != SOL_TLS
+	 || cmsg->cmsg_type != TLS_GET_RECORD_TYPE
+	 || *CMSG_DATA(cmsg) != RPC_TLS_HANDSHAKE)
+		goto out;
+
+	/* type (1), length (3) */
+	for (off = 0; off + 4 <= n;
+	     off += 4 + ((buf[off + 1] << 16) | (buf[off + 2] << 8)
+			 | buf[off + 3])) {
+		if (buf[off] != RPC_TLS_NEW_SESSION_TICKET)
+			goto out;
+	}
+	if (off == n)
+		code = 0;
+ out:
+	if (code)
+		__warnx(TIRPC_DEBUG_FLAG_ERROR,
+			"%s: fd %d TLS record failed (%d)",
+			__func__, fd, code);
+	mem_free(buf, RPC_TLS_RECORD_MAX);
+	return (code);
+}
+
+/*
+ * The client side is stepped: each step sends or receives what it can,
+ * or continues the handshake, without blocking.  The caller waits for
+ * the events it returns, see clnt_vc_conn_step().  The fd must be
+ * non-blocking.
+ */
+struct rpc_tls_clnt *
+rpc_tls_clnt_start(int fd, rpcprog_t prog, rpcvers_t vers,
+		   struct rpc_err *re)
+{
+	struct rpc_tls_clnt *tc;
+	uint32_t *call;
+
+	if (!rpc_tls.clnt_ctx) {
+		__warnx(TIRPC_DEBUG_FLAG_ERROR,
+			"%s: fd %d rpc_tls_init() was not called",
+			__func__, fd);
+		re->re_status = RPC_SYSTEMERROR;
+		re->re_errno = ENOTSUP;
+		return (NULL);
+	}
+
+	tc = mem_zalloc(sizeof(*tc));
+	tc->fd = fd;
+	rpc_tls_deadline(&tc->deadline);
+
+	call = tc->call;
+	call[0] = htonl(LAST_FRAG | RPC_TLS_PROBE_UNITS * BYTES_PER_XDR_UNIT);
+	call[1] = htonl(__RPC_GETXID(&tc->deadline));
+	call[2] = htonl(CALL);
+	call[3] = htonl(RPC_MSG_VERSION);
+	call[4] = htonl(prog);
+	call[5] = htonl(vers);
+	call[6] = htonl(NULLPROC);
+	call[7] = htonl(AUTH_TLS);
+	call[8] = 0;
+	call[9] = htonl(AUTH_NONE);
+	call[10] = 0;
+	return (tc);
+}
+
+void
+rpc_tls_clnt_free(struct rpc_tls_clnt *tc)
+{
+	SSL_free(tc->ssl);
+	mem_free(tc, sizeof(*tc));
+}
+
+/*
+ * The STARTTLS reply, as much as has arrived.  Returns 0 when whole,
+ * EAGAIN, or the error.
+ */
+static int
+rpc_tls_clnt_recv(struct rpc_tls_clnt *tc)
+{
+	size_t want = sizeof(uint32_t);
+	uint32_t len;
+	ssize_t n;
+
+	for (;;) {
+		if (tc->received >= sizeof(uint32_t)) {
+			len = ntohl(tc->reply[0]) & ~LAST_FRAG;
+			if (len > RPC_TLS_REPLY_UNITS * BYTES_PER_XDR_UNIT
+			 || len < 3 * BYTES_PER_XDR_UNIT)
+				return (EPROTO);
+			want = sizeof(uint32_t) + len;
+		}
+		if (tc->received == want && want > sizeof(uint32_t))
+			return (0);
+
+		n = recv(tc->fd, (char *)tc->reply + tc->received,
+			 want - tc->received, 0);
+		if (n > 0) {
+			tc->received += n;
+			continue;
+		}
+		if (!n)
+			return (ECONNRESET);
+		if (errno != EINTR)
+			return (errno);
+	}
+}
+
+/*
+ * Returns 0 when the keys are in kernel TLS, EINPROGRESS with the
+ * events to wait for, or the error (re is set).
+ */
+int
+rpc_tls_clnt_step(struct rpc_tls_clnt *tc, short *events,
+		  struct rpc_err *re)
+{
+	uint32_t *reply = tc->reply;
+	struct timespec now;
+	ssize_t n;
+	int code;
+	int rc;
+
+	(void)clock_gettime(CLOCK_MONOTONIC_FAST, &now);
+	if (timespeccmp(&now, &tc->deadline, >=)) {
+		__warnx(TIRPC_DEBUG_FLAG_ERROR,
+			"%s: fd %d timed out",
+			__func__, tc->fd);
+		re->re_status = RPC_TIMEDOUT;
+		re->re_errno = ETIMEDOUT;
+		return (ETIMEDOUT);
+	}
+
+	while (tc->sent < sizeof(tc->call)) {
+		n = send(tc->fd, (char *)tc->call + tc->sent,
+			 sizeof(tc->call) - tc->sent, MSG_NOSIGNAL);
+		if (n > 0) {
+			tc->sent += n;
+			continue;
+		}
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+			*events = POLLOUT;
+			return (EINPROGRESS);
+		}
+		re->re_status = RPC_CANTSEND;
+		re->re_errno = (n < 0) ? errno : EIO;
+		return (re->re_errno);
+	}
+
+	if (!tc->ssl) {
+		code = rpc_tls_clnt_recv(tc);
+		if (code == EAGAIN || code == EWOULDBLOCK) {
+			*events = POLLIN;
+			return (EINPROGRESS);
+		}
+		if (code) {
+			re->re_status = (code == EPROTO) ? RPC_CANTDECODERES
+							 : RPC_CANTRECV;
+			re->re_errno = code;
+			return (code);
+		}
+
+		if (tc->received
+		    != (1 + RPC_TLS_REPLY_UNITS) * BYTES_PER_XDR_UNIT
+		 || reply[1] != tc->call[1]
+		 || ntohl(reply[2]) != REPLY
+		 || ntohl(reply[3]) != MSG_ACCEPTED
+		 || ntohl(reply[4]) != AUTH_NONE
+		 || ntohl(reply[5]) != sizeof(rpc_tls_starttls)
+		 || memcmp(&reply[6], rpc_tls_starttls,
+			   sizeof(rpc_tls_starttls))
+		 || ntohl(reply[8]) != SUCCESS) {
+			__warnx(TIRPC_DEBUG_FLAG_ERROR,
+				"%s: fd %d server does not support TLS",
+				__func__, tc->fd);
+			re->re_status = RPC_AUTHERROR;
+			re->re_why = AUTH_REJECTEDCRED;
+			return (EPROTO);
+		}
+
+		tc->ssl = SSL_new(rpc_tls.clnt_ctx);
+		if (!tc->ssl || !SSL_set_fd(tc->ssl, tc->fd)
+		 || !rpc_tls_peer_name(tc->fd, tc->ssl)) {
+			rpc_tls_warn_ssl(__func__, "SSL_new");
+			re->re_status = RPC_AUTHERROR;
+			re->re_why = AUTH_FAILED;
+			return (EPROTO);
+		}
+	}
+
+	rc = SSL_connect(tc->ssl);
+	if (rc != 1) {
+		switch (SSL_get_error(tc->ssl, rc)) {
+		case SSL_ERROR_WANT_READ:
+			*events = POLLIN;
+			return (EINPROGRESS);
+		case SSL_ERROR_WANT_WRITE:
+			*events = POLLOUT;
+			return (EINPROGRESS);
+		default:
+			rc = SSL_get_verify_result(tc->ssl);
+			if (rc != X509_V_OK)
+				__warnx(TIRPC_DEBUG_FLAG_ERROR,
+					"%s: fd %d server not verified: %s",
+					__func__, tc->fd,
+					X509_verify_cert_error_string(rc));
+			rpc_tls_warn_ssl(__func__, "handshake");
+			break;
+		};
+	} else if (rpc_tls_ktls(tc->fd, tc->ssl))
+		return (0);
+
+	re->re_status = RPC_AUTHERROR;
+	re->re_why = AUTH_FAILED;
+	return (EPROTO);
+}
+
+static SSL_CTX *
+rpc_tls_ctx(rpc_tls_params *params, bool server)
+{
+	SSL_CTX *ctx = SSL_CTX_new(server ? TLS_server_method()
+					  : TLS_client_method());
+
+	if (!ctx)
+		goto err;
+
+	/* RFC 9289 requires TLS 1.3; kernel TLS ciphers only */
+	if (!SSL_CTX_set_min_proto_version(ctx, TLS1_3_VERSION)
+	 || !SSL_CTX_set_ciphersuites(ctx,
+				      "TLS_AES_128_GCM_SHA256:"
+				      "TLS_AES_256_GCM_SHA384"
+#ifdef TLS_CIPHER_CHACHA20_POLY1305
+				      ":TLS_CHACHA20_POLY1305_SHA256"
+#endif
+				      ))
+		goto err;
+
+	/* the keys are given to the kernel; no resumption */
+	SSL_CTX_set_options(ctx, SSL_OP_ENABLE_KTLS | SSL_OP_NO_TICKET);
+	SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_OFF);
+	if (server && !SSL_CTX_set_num_tickets(ctx, 0))
+		goto err;
+
+	if (params->cert_file
+	 && (SSL_CTX_use_certificate_chain_file(ctx, params->cert_file) != 1
+	  || SSL_CTX_use_PrivateKey_file(ctx, params->key_file
+					 ? params->key_file
+					 : params->cert_file,
+					 SSL_FILETYPE_PEM) != 1
+	  || SSL_CTX_check_private_key(ctx) != 1))
+		goto err;
+
+	if (params->ca_file) {
+		if (SSL_CTX_load_verify_locations(ctx, params->ca_file,
+						  NULL) != 1)
+			goto err;
+		SSL_CTX_set_verify(ctx, SSL_VERIFY_PEER, NULL);
+	} else if (!server && !(params->flags & RPC_TLS_FLAG_NO_VERIFY)) {
+		if (SSL_CTX_set_default_verify_paths(ctx) != 1)
+			goto err;
+		SSL_CTX_set_verify(ctx, SSL_VERIFY_PEER, NULL);
+	}
+	if (!server && (params->flags & RPC_TLS_FLAG_NO_VERIFY))
+		SSL_CTX_set_verify(ctx, SSL_VERIFY_NONE, NULL);
+	return (ctx);
+
+ err:
+	rpc_tls_warn_ssl(__func__, server ? "server" : "client");
+	SSL_CTX_free(ctx);
+	return (NULL);
+}
+
+bool
+rpc_tls_init(rpc_tls_params *params)
+{
+	rpc_tls.timeout = params->timeout ? params->timeout : 10;
+	if (params->server_name && !rpc_tls.server_name)
+		rpc_tls.server_name = mem_strdup(params->server_name);
+
+	if (!rpc_tls.clnt_ctx) {
+		rpc_tls.clnt_ctx = rpc_tls_ctx(params, false);
+		if (!rpc_tls.clnt_ctx)
+			return (false);
+	}
+
+	if (params->cert_file && !rpc_tls.svc_ctx) {
+		rpc_tls.svc_ctx = rpc_tls_ctx(params, true);
+		if (!rpc_tls.svc_ctx)
+			return (false);
+	}
+	return (true);
+}
+
+void
+rpc_tls_shutdown(void)
+{
+	SSL_CTX_free(rpc_tls.svc_ctx);
+	rpc_tls.svc_ctx = NULL;
+	SSL_CTX_free(rpc_tls.clnt_ctx);
+	rpc_tls.clnt_ctx = NULL;
+	if (rpc_tls.server_name) {
+		mem_free(rpc_tls.server_name, 0);
+		rpc_tls.server_name = NULL;
+	}
+}
@@ -56,8 +56,13 @@
 #include <netdb.h>
 #include <syslog.h>
 #include <assert.h>
+#include <time.h>
+
+#include <misc/city.h>
+#include <misc/portable.h>
 
 #include "rpc_com.h"
+#include "svc_internal.h"
 
 /* retry timeout default to the moon and back */
 static struct timespec to = { 3, 0 };
@@ -68,27 +73,11 @@ static const char nullstring[] = "\000";
 
 #define RPCB_OWNER_STRING "libntirpc"
 
-#define CACHESIZE 6
-
-struct address_cache {
-	char *ac_host;
-	char *ac_netid;
-	char *ac_uaddr;
-	struct netbuf *ac_taddr;
-	struct address_cache *ac_next;
-};
-
-static struct address_cache *front;
-static int cachesize;
-
 #define CLCR_GET_RPCB_TIMEOUT 1
 #define CLCR_SET_RPCB_TIMEOUT 2
 
 extern int __rpc_lowvers;
 
-static struct address_cache *check_cache(const char *, const char *);
-static void delete_cache(struct netbuf *);
-static void add_cache(const char *, const char *, struct netbuf *, char *);
 static CLIENT *getclnthandle(const char *, const struct netconfig *, char **);
 static CLIENT *local_rpcb(const char *);
 #ifdef NOTUSED
@@ -123,129 +112,407 @@ bool __rpc_control(int request, void *info)
 }
 
 /*
- * It might seem that a reader/writer lock would be more reasonable here.
- * However because getclnthandle(), the only user of the cache functions,
- * may do a delete_cache() operation if a check_cache() fails to return an
- * address useful to clnt_tli_ncreate(), we may as well use a mutex.
+ * Addresses found with rpcbind, keyed by (host, netid, prog, vers); the
+ * address of rpcbind itself is kept as (host, netid, RPCBPROG,
+ * RPCB_CACHE_SELF), for getclnthandle().
+ *
+ * The cache is partitioned by key hash.  Each partition has a hash table
+ * of entries and a list in least recently used order, under one mutex,
+ * and an equal part of rpcb_cache_max (svc_init_params).  Entries live
+ * rpcb_cache_ttl seconds; a lookup in the last quarter of that asks
+ * rpcbind again in the background (svc_work_pool), so that busy entries
+ * do not expire.  An unknown host or program is kept rpcb_cache_neg_ttl
+ * seconds.  An address is forgotten when creating a client or calling
+ * it fails (__rpcb_cache_forget()).
+ *
+ * Before svc_init(), as formerly: only rpcbind addresses, one per
+ * partition, kept until evicted or found stale.
  */
+#define RPCB_CACHE_PARTS	(16)	/* power of 2 */
+#define RPCB_CACHE_BUCKETS	(64)	/* per partition, power of 2 */
+#define RPCB_CACHE_SELF		(0)	/* vers of the rpcbind address */
+
+struct rpcb_cache_entry {
+	TAILQ_ENTRY(rpcb_cache_entry) rce_hq;	/* hash bucket */
+	TAILQ_ENTRY(rpcb_cache_entry) rce_lru;	/* partition, oldest first */
+	uint64_t rce_hash;
+	rpcprog_t rce_prog;
+	rpcvers_t rce_vers;
+	enum clnt_stat rce_stat;	/* RPC_SUCCESS, or failure kept */
+	struct netbuf rce_taddr;
+	char *rce_uaddr;		/* or NULL */
+	char *rce_netid;		/* in rce_host */
+	time_t rce_expires;		/* or 0, never */
+	time_t rce_refresh;		/* ask again after, or 0 */
+	bool rce_refreshing;
+	char rce_host[];
+};
+
+TAILQ_HEAD(rpcb_cache_head, rpcb_cache_entry);
+
+struct rpcb_cache_part {
+	mutex_t rcp_mtx;
+	struct rpcb_cache_head rcp_lru;
+	struct rpcb_cache_head rcp_hq[RPCB_CACHE_BUCKETS];
+	u_int rcp_entries;
+} __attribute__ ((aligned(CACHE_LINE_SIZE)));
+
+static struct {
+	once_t once;		/* initialization */
+	struct rpcb_cache_part parts[RPCB_CACHE_PARTS];
+	struct rpcb_cache_stats st;
+} rpcb_cache = {
+	.once = ONCE_INITIALIZER,
+};
+
+struct rpcb_cache_refresh {
+	struct work_pool_entry rcr_wpe;
+	struct netconfig *rcr_nconf;
+	rpcprog_t rcr_prog;
+	rpcvers_t rcr_vers;
+	char rcr_host[];
+};
+
+static void rpcb_cache_refresh(const char *, const char *, rpcprog_t,
+			       rpcvers_t);
+static struct netbuf *rpcb_findaddr(rpcprog_t, rpcvers_t,
+				    const struct netconfig *, const char *,
+				    CLIENT **, struct timeval *,
+				    enum clnt_stat *);
+
+static void
+rpcb_cache_init(void)
+{
+	struct rpcb_cache_part *rcp;
+	int i;
+	int j;
+
+	for (i = 0; i < RPCB_CACHE_PARTS; i++) {
+		rcp = &rpcb_cache.parts[i];
+		mutex_init(&rcp->rcp_mtx, NULL);
+		TAILQ_INIT(&rcp->rcp_lru);
+		for (j = 0; j < RPCB_CACHE_BUCKETS; j++)
+			TAILQ_INIT(&rcp->rcp_hq[j]);
+	}
+}
+
+static inline time_t
+rpcb_cache_now(void)
+{
+	struct timespec ts;
+
+	(void)clock_gettime(CLOCK_MONOTONIC_FAST, &ts);
+	return (ts.tv_sec);
+}
+
+static inline uint64_t
+rpcb_cache_hash(const char *host, const char *netid, rpcprog_t prog,
+		rpcvers_t vers)
+{
+	uint64_t hash = CityHash64WithSeed(host, strlen(host),
+					   ((uint64_t)prog << 32) | vers);
+
+	return (CityHash64WithSeed(netid, strlen(netid), hash));
+}
+
+static inline struct rpcb_cache_part *
+rpcb_cache_part_of(uint64_t hash)
+{
+	thr_once(&rpcb_cache.once, rpcb_cache_init);
+	return (&rpcb_cache.parts[hash & (RPCB_CACHE_PARTS - 1)]);
+}
+
+static inline struct rpcb_cache_head *
+rpcb_cache_bucket(struct rpcb_cache_part *rcp, uint64_t hash)
+{
+	return (&rcp->rcp_hq[(hash >> 4) & (RPCB_CACHE_BUCKETS - 1)]);
+}
+
+/* partition locked */
+static struct rpcb_cache_entry *
+rpcb_cache_lookup(struct rpcb_cache_part *rcp, uint64_t hash,
+		  const char *host, const char *netid, rpcprog_t prog,
+		  rpcvers_t vers)
+{
+	struct rpcb_cache_entry *rce;
+
+	TAILQ_FOREACH(rce, rpcb_cache_bucket(rcp, hash), rce_hq) {
+		if (rce->rce_hash == hash
+		    && rce->rce_prog == prog
+		    && rce->rce_vers == vers
+		    && !strcmp(rce->rce_host, host)
+		    && !strcmp(rce->rce_netid, netid))
+			return (rce);
+	}
+	return (NULL);
+}
+
+/* partition locked */
+static void
+rpcb_cache_remove(struct rpcb_cache_part *rcp, struct rpcb_cache_entry *rce)
+{
+	TAILQ_REMOVE(rpcb_cache_bucket(rcp, rce->rce_hash), rce, rce_hq);
+	TAILQ_REMOVE(&rcp->rcp_lru, rce, rce_lru);
+	rcp->rcp_entries--;
+	atomic_dec_uint64_t(&rpcb_cache.st.entries);
+
+	if (rce->rce_taddr.buf)
+		mem_free(rce->rce_taddr.buf, rce->rce_taddr.len);
+	if (rce->rce_uaddr)
+		mem_free(rce->rce_uaddr, 0);
+	mem_free(rce, 0);
+}
+
 /*
- * As it turns out, if the cache lock is *not* a reader/writer lock, we will
- * block all clnt_ncreate's if we are trying to connect to a host that's down,
- * since the lock will be held all during that time.
+ * Answers that another lookup soon after would repeat: no such host, or
+ * no such program.  Transport failures (including a timeout) are not
+ * kept, as the next lookup may well succeed.
  */
-extern rwlock_t rpcbaddr_cache_lock;
+static inline bool
+rpcb_cache_negative(enum clnt_stat stat)
+{
+	switch (stat) {
+	case RPC_UNKNOWNHOST:
+	case RPC_PROGNOTREGISTERED:
+		return (true);
+	default:
+		return (false);
+	}
+}
 
 /*
- * The routines check_cache(), add_cache(), delete_cache() manage the
- * cache of rpcbind addresses for (host, netid).
+ * On a hit, returns true with a copy of the address (and *uaddr, when
+ * asked), or with NULL and the failure kept.
  */
-
-static struct address_cache *
-check_cache(const char *host, const char *netid)
+static bool
+rpcb_cache_find(const char *host, const char *netid, rpcprog_t prog,
+		rpcvers_t vers, struct netbuf **taddr, char **uaddr,
+		enum clnt_stat *stat)
 {
-	struct address_cache *cptr;
+	uint64_t hash = rpcb_cache_hash(host, netid, prog, vers);
+	struct rpcb_cache_part *rcp = rpcb_cache_part_of(hash);
+	struct rpcb_cache_entry *rce;
+	struct netbuf *nb;
+	time_t now = rpcb_cache_now();
+	bool refresh;
+
+	mutex_lock(&rcp->rcp_mtx);
+	rce = rpcb_cache_lookup(rcp, hash, host, netid, prog, vers);
+	if (rce && rce->rce_expires && now >= rce->rce_expires) {
+		rpcb_cache_remove(rcp, rce);
+		atomic_inc_uint64_t(&rpcb_cache.st.expired);
+		rce = NULL;
+	}
+	if (!rce) {
+		mutex_unlock(&rcp->rcp_mtx);
+		atomic_inc_uint64_t(&rpcb_cache.st.misses);
+		return (false);
+	}
 
-	/* READ LOCK HELD ON ENTRY: rpcbaddr_cache_lock */
-	for (cptr = front; cptr != NULL; cptr = cptr->ac_next) {
-		if (!strcmp(cptr->ac_host, host)
-		    && !strcmp(cptr->ac_netid, netid)) {
-#ifdef ND_DEBUG
-			fprintf(stderr, "Found cache entry for %s: %s\n", host,
-				netid);
-#endif
-			return (cptr);
-		}
+	/* most recently used last */
+	TAILQ_REMOVE(&rcp->rcp_lru, rce, rce_lru);
+	TAILQ_INSERT_TAIL(&rcp->rcp_lru, rce, rce_lru);
+
+	*stat = rce->rce_stat;
+	if (rce->rce_stat != RPC_SUCCESS) {
+		mutex_unlock(&rcp->rcp_mtx);
+		*taddr = NULL;
+		atomic_inc_uint64_t(&rpcb_cache.st.negative_hits);
+		return (true);
 	}
-	return ((struct address_cache *)NULL);
+
+	nb = mem_zalloc(sizeof(struct netbuf));
+	nb->buf = mem_alloc(rce->rce_taddr.len);
+	memcpy(nb->buf, rce->rce_taddr.buf, rce->rce_taddr.len);
+	nb->len = nb->maxlen = rce->rce_taddr.len;
+	*taddr = nb;
+	if (uaddr)
+		*uaddr = rce->rce_uaddr ? mem_strdup(rce->rce_uaddr) : NULL;
+
+	refresh = rce->rce_refresh && now >= rce->rce_refresh
+		  && !rce->rce_refreshing
+		  && svc_work_pool.params.thrd_max;
+	if (refresh)
+		rce->rce_refreshing = true;
+	mutex_unlock(&rcp->rcp_mtx);
+
+	if (refresh)
+		rpcb_cache_refresh(host, netid, prog, vers);
+	atomic_inc_uint64_t(&rpcb_cache.st.hits);
+	return (true);
 }
 
+/*
+ * Keep the address (taddr non-NULL), or the failure when
+ * rpcb_cache_negative(), replacing any entry for the key.  Otherwise, only
+ * ends a refresh, leaving the entry as it was.
+ */
 static void
-delete_cache(struct netbuf *addr)
+rpcb_cache_store(const char *host, const char *netid, rpcprog_t prog,
+		 rpcvers_t vers, const struct netbuf *taddr, const char *uaddr,
+		 enum clnt_stat stat)
 {
-	struct address_cache *cptr, *prevptr = NULL;
-
-	/* WRITE LOCK HELD ON ENTRY: rpcbaddr_cache_lock */
-	for (cptr = front; cptr != NULL; cptr = cptr->ac_next) {
-		if (!memcmp(cptr->ac_taddr->buf, addr->buf, addr->len)) {
-			mem_free(cptr->ac_host, 0);	/* XXX */
-			mem_free(cptr->ac_netid, 0);
-			mem_free(cptr->ac_taddr->buf, cptr->ac_taddr->len);
-			mem_free(cptr->ac_taddr, sizeof(struct netbuf));
-			if (cptr->ac_uaddr)
-				mem_free(cptr->ac_uaddr, 0);
-			if (prevptr)
-				prevptr->ac_next = cptr->ac_next;
-			else
-				front = cptr->ac_next;
-			mem_free(cptr, sizeof(struct address_cache));
-			cachesize--;
-			break;
-		}
-		prevptr = cptr;
+	uint64_t hash = rpcb_cache_hash(host, netid, prog, vers);
+	struct rpcb_cache_part *rcp = rpcb_cache_part_of(hash);
+	struct rpcb_cache_entry *rce;
+	struct rpcb_cache_entry *have;
+	u_int max = __svc_params->rpcb_cache.max;
+	u_int ttl = __svc_params->rpcb_cache.ttl;
+	size_t hlen = strlen(host) + 1;
+	size_t nlen = strlen(netid) + 1;
+	time_t now;
+
+	if (!taddr && (!rpcb_cache_negative(stat)
+		       || !__svc_params->rpcb_cache.neg_ttl)) {
+		mutex_lock(&rcp->rcp_mtx);
+		rce = rpcb_cache_lookup(rcp, hash, host, netid, prog, vers);
+		if (rce)
+			rce->rce_refreshing = false;
+		mutex_unlock(&rcp->rcp_mtx);
+		return;
+	}
+
+	rce = mem_zalloc(sizeof(*rce) + hlen + nlen);
+	rce->rce_hash = hash;
+	rce->rce_prog = prog;
+	rce->rce_vers = vers;
+	rce->rce_stat = taddr ? RPC_SUCCESS : stat;
+	memcpy(rce->rce_host, host, hlen);
+	rce->rce_netid = rce->rce_host + hlen;
+	memcpy(rce->rce_netid, netid, nlen);
+	if (taddr) {
+		rce->rce_taddr.buf = mem_alloc(taddr->len);
+		memcpy(rce->rce_taddr.buf, taddr->buf, taddr->len);
+		rce->rce_taddr.len = rce->rce_taddr.maxlen = taddr->len;
+		rce->rce_uaddr = uaddr ? mem_strdup(uaddr) : NULL;
+	} else
+		ttl = __svc_params->rpcb_cache.neg_ttl;
+
+	now = rpcb_cache_now();
+	if (ttl) {
+		rce->rce_expires = now + ttl;
+		/* not rpcbind itself, found again as needed */
+		if (taddr && vers != RPCB_CACHE_SELF)
+			rce->rce_refresh = rce->rce_expires - ttl / 4;
+	}
+
+	if (!max) {
+		/* before svc_init() */
+		max = RPCB_CACHE_PARTS;
 	}
+	max = (max + RPCB_CACHE_PARTS - 1) / RPCB_CACHE_PARTS;
+
+	mutex_lock(&rcp->rcp_mtx);
+	have = rpcb_cache_lookup(rcp, hash, host, netid, prog, vers);
+	if (have)
+		rpcb_cache_remove(rcp, have);
+	while (rcp->rcp_entries >= max) {
+		have = TAILQ_FIRST(&rcp->rcp_lru);
+		if (have->rce_expires && now >= have->rce_expires)
+			atomic_inc_uint64_t(&rpcb_cache.st.expired);
+		else
+			atomic_inc_uint64_t(&rpcb_cache.st.evicted);
+		rpcb_cache_remove(rcp, have);
+	}
+	TAILQ_INSERT_HEAD(rpcb_cache_bucket(rcp, hash), rce, rce_hq);
+	TAILQ_INSERT_TAIL(&rcp->rcp_lru, rce, rce_lru);
+	rcp->rcp_entries++;
+	atomic_inc_uint64_t(&rpcb_cache.st.entries);
+	mutex_unlock(&rcp->rcp_mtx);
 }
 
 static void
-add_cache(const char *host, const char *netid, struct netbuf *taddr,
-	  char *uaddr)
+rpcb_cache_delete(const char *host, const char *netid, rpcprog_t prog,
+		  rpcvers_t vers)
 {
-	struct address_cache *ad_cache, *cptr, *prevptr;
+	uint64_t hash = rpcb_cache_hash(host, netid, prog, vers);
+	struct rpcb_cache_part *rcp = rpcb_cache_part_of(hash);
+	struct rpcb_cache_entry *rce;
+
+	mutex_lock(&rcp->rcp_mtx);
+	rce = rpcb_cache_lookup(rcp, hash, host, netid, prog, vers);
+	if (rce)
+		rpcb_cache_remove(rcp, rce);
+	mutex_unlock(&rcp->rcp_mtx);
+}
+
+static void
+rpcb_cache_refresh_task(struct work_pool_entry *wpe)
+{
+	struct rpcb_cache_refresh *rcr =
+		opr_containerof(wpe, struct rpcb_cache_refresh, rcr_wpe);
+	struct netbuf *address;
+	enum clnt_stat stat;
 
-	if (!host) {
-		__warnx(TIRPC_DEBUG_FLAG_ERROR, "%s: missing host", __func__);
+	atomic_inc_uint64_t(&rpcb_cache.st.refreshes);
+	address = rpcb_findaddr(rcr->rcr_prog, rcr->rcr_vers, rcr->rcr_nconf,
+				rcr->rcr_host, NULL, NULL, &stat);
+
+	/* unreachable now may be only for now: keep the address until
+	 * it expires, as it would have been without the refresh
+	 */
+	if (!address && stat != RPC_PROGNOTREGISTERED)
+		stat = RPC_FAILED;
+
+	rpcb_cache_store(rcr->rcr_host, rcr->rcr_nconf->nc_netid,
+			 rcr->rcr_prog, rcr->rcr_vers, address, NULL, stat);
+	if (address) {
+		mem_free(address->buf, address->len);
+		mem_free(address, sizeof(*address));
+	}
+	freenetconfigent(rcr->rcr_nconf);
+	mem_free(rcr, 0);
+}
+
+/*
+ * Ask rpcbind again in the background; rce_refreshing is set, and
+ * cleared by rpcb_cache_store().
+ */
+static void
+rpcb_cache_refresh(const char *host, const char *netid, rpcprog_t prog,
+		   rpcvers_t vers)
+{
+	struct rpcb_cache_refresh *rcr;
+	size_t len = strlen(host) + 1;
+
+	rcr = mem_zalloc(sizeof(*rcr) + len);
+	rcr->rcr_nconf = getnetconfigent(netid);
+	if (!rcr->rcr_nconf) {
+		mem_free(rcr, 0);
+		rpcb_cache_store(host, netid, prog, vers, NULL, NULL,
+				 RPC_UNKNOWNPROTO);
 		return;
 	}
-	ad_cache = (struct address_cache *)mem_zalloc(sizeof(*ad_cache));
-
-	ad_cache->ac_host = mem_strdup(host);
-	ad_cache->ac_netid = mem_strdup(netid);
-	ad_cache->ac_uaddr = uaddr ? mem_strdup(uaddr) : NULL;
-	ad_cache->ac_taddr = (struct netbuf *)mem_zalloc(sizeof(struct netbuf));
-	ad_cache->ac_taddr->len = ad_cache->ac_taddr->maxlen = taddr->len;
-	ad_cache->ac_taddr->buf = (char *)mem_zalloc(taddr->len);
-	memcpy(ad_cache->ac_taddr->buf, taddr->buf, taddr->len);
-#ifdef ND_DEBUG
-	fprintf(stderr, "Added to cache: %s : %s\n", host, netid);
-#endif
+	rcr->rcr_prog = prog;
+	rcr->rcr_vers = vers;
+	memcpy(rcr->rcr_host, host, len);
+	rcr->rcr_wpe.fun = rpcb_cache_refresh_task;
+	work_pool_submit(&svc_work_pool, &rcr->rcr_wpe);
+}
 
-	/* VARIABLES PROTECTED BY rpcbaddr_cache_lock:  cptr */
-	rwlock_wrlock(&rpcbaddr_cache_lock);
-	if (cachesize < CACHESIZE) {
-		ad_cache->ac_next = front;
-		front = ad_cache;
-		cachesize++;
-	} else {
-		/* Free the last entry */
-		cptr = front;
-		prevptr = NULL;
-		while (cptr->ac_next) {
-			prevptr = cptr;
-			cptr = cptr->ac_next;
-		}
+void
+rpcb_cache_stats(struct rpcb_cache_stats *stats)
+{
+	stats->hits = atomic_fetch_uint64_t(&rpcb_cache.st.hits);
+	stats->negative_hits =
+		atomic_fetch_uint64_t(&rpcb_cache.st.negative_hits);
+	stats->misses = atomic_fetch_uint64_t(&rpcb_cache.st.misses);
+	stats->refreshes = atomic_fetch_uint64_t(&rpcb_cache.st.refreshes);
+	stats->expired = atomic_fetch_uint64_t(&rpcb_cache.st.expired);
+	stats->evicted = atomic_fetch_uint64_t(&rpcb_cache.st.evicted);
+	stats->entries = atomic_fetch_uint64_t(&rpcb_cache.st.entries);
+}
 
-#ifdef ND_DEBUG
-		fprintf(stderr, "Deleted from cache: %s : %s\n", cptr->ac_host,
-			cptr->ac_netid);
-#endif
-		mem_free(cptr->ac_host, 0);	/* XXX */
-		mem_free(cptr->ac_netid, 0);
-		mem_free(cptr->ac_taddr->buf, cptr->ac_taddr->len);
-		mem_free(cptr->ac_taddr, sizeof(struct netbuf));
-		if (cptr->ac_uaddr)
-			mem_free(cptr->ac_uaddr, 0);
-
-		if (prevptr) {
-			prevptr->ac_next = NULL;
-			ad_cache->ac_next = front;
-			front = ad_cache;
-		} else {
-			front = ad_cache;
-			ad_cache->ac_next = NULL;
-		}
-		mem_free(cptr, sizeof(struct address_cache));
-	}
-	rwlock_unlock(&rpcbaddr_cache_lock);
-	return;
+/*
+ * The address is no longer useful (eg, the connection was refused), so
+ * the next lookup asks rpcbind.
+ */
+void
+__rpcb_cache_forget(rpcprog_t program, rpcvers_t version,
+		    const struct netconfig *nconf, const char *host)
+{
+	if (host && nconf)
+		rpcb_cache_delete(host, nconf->nc_netid, program, version);
 }
 
 /*
@@ -260,58 +527,50 @@ static CLIENT *getclnthandle(const char *host, const struct netconfig *nconf,
 {
 	CLIENT *client;
 	struct netbuf *addr, taddr;
-	struct netbuf addr_to_delete;
 	struct __rpc_sockinfo si;
 	struct addrinfo hints, *res, *tres;
-	struct address_cache *ad_cache;
+	enum clnt_stat stat;
 	char *tmpaddr;
 	char *t;
 
-	memset(&addr_to_delete, '\0', sizeof(addr_to_delete));
-
-/* VARIABLES PROTECTED BY rpcbaddr_cache_lock:  ad_cache */
-
 	/* Get the address of the rpcbind.  Check cache first */
 	client = NULL;
 	if (targaddr)
 		*targaddr = NULL;
-	addr_to_delete.len = 0;
-	rwlock_rdlock(&rpcbaddr_cache_lock);
-	ad_cache = NULL;
-	if (host != NULL)
-		ad_cache = check_cache(host, nconf->nc_netid);
-	if (ad_cache != NULL) {
-		addr = ad_cache->ac_taddr;
+	if (host != NULL
+	    && rpcb_cache_find(host, nconf->nc_netid, RPCBPROG,
+			       RPCB_CACHE_SELF, &addr, targaddr, &stat)) {
+		/* connect without the partition locked */
 		client =
 		    clnt_tli_ncreate(RPC_ANYFD, nconf, addr,
 				     (rpcprog_t) RPCBPROG,
 				     (rpcvers_t) RPCBVERS4, 0, 0);
 		if (CLNT_SUCCESS(client)) {
-			if (targaddr)
-				*targaddr = mem_strdup(ad_cache->ac_uaddr);
-			rwlock_unlock(&rpcbaddr_cache_lock);
+			if (targaddr && !*targaddr)
+				*targaddr = taddr2uaddr(nconf, addr);
+			mem_free(addr->buf, addr->len);
+			mem_free(addr, sizeof(*addr));
 			return (client);
 		}
 
 		t = rpc_sperror(&client->cl_error, __func__);
 		__warnx(TIRPC_DEBUG_FLAG_CLNT_RPCB, "%s", t);
 		mem_free(t, RPC_SPERROR_BUFLEN);
-		goto out_err;
+		CLNT_DESTROY(client);
+		client = NULL;
+		mem_free(addr->buf, addr->len);
+		mem_free(addr, sizeof(*addr));
+		if (targaddr) {
+			mem_free(*targaddr, 0);
+			*targaddr = NULL;
+		}
 
-		addr_to_delete.len = addr->len;
-		addr_to_delete.buf = (char *)mem_zalloc(addr->len);
-		memcpy(addr_to_delete.buf, addr->buf, addr->len);
-	}
-	rwlock_unlock(&rpcbaddr_cache_lock);
-	if (addr_to_delete.len != 0) {
 		/*
 		 * Assume this may be due to cache data being
 		 *  outdated
 		 */
-		rwlock_wrlock(&rpcbaddr_cache_lock);
-		delete_cache(&addr_to_delete);
-		rwlock_unlock(&rpcbaddr_cache_lock);
-		mem_free(addr_to_delete.buf, addr_to_delete.len);
+		rpcb_cache_delete(host, nconf->nc_netid, RPCBPROG,
+				  RPCB_CACHE_SELF);
 	}
 	if (!__rpc_nconf2sockinfo(nconf, &si)) {
 		assert(client == NULL);
@@ -389,7 +648,10 @@ static CLIENT *getclnthandle(const char *host, const struct netconfig *nconf,
 				     (rpcvers_t) RPCBVERS4, 0, 0);
 		if (CLNT_SUCCESS(client)) {
 			tmpaddr = targaddr ? taddr2uaddr(nconf, &taddr) : NULL;
-			add_cache(host, nconf->nc_netid, &taddr, tmpaddr);
+			if (host)
+				rpcb_cache_store(host, nconf->nc_netid,
+						 RPCBPROG, RPCB_CACHE_SELF,
+						 &taddr, tmpaddr, RPC_SUCCESS);
 			if (targaddr)
 				*targaddr = tmpaddr;
 			break;
@@ -627,12 +889,45 @@ __rpcbind_is_up(void)
  * handle for COTS cases and hence in these cases we do not return the
  * client handle.  This code will change if t_connect() ever
  * starts working properly.  Also look under clnt_vc.c.
+ *
+ * The result is kept in the address cache (see rpcb_cache_find()); on a
+ * hit, no client handle is returned.
  */
 struct netbuf *
 __rpcb_findaddr_timed(rpcprog_t program, rpcvers_t version,
 		      const struct netconfig *nconf,
 		      const char *host, CLIENT **clpp,
 		      struct timeval *tp)
+{
+	struct netbuf *address;
+	enum clnt_stat stat;
+
+	if (clpp)
+		*clpp = NULL;
+	if (!host || !nconf || !__svc_params->rpcb_cache.ttl)
+		return (rpcb_findaddr(program, version, nconf, host, clpp, tp,
+				      &stat));
+
+	if (rpcb_cache_find(host, nconf->nc_netid, program, version,
+			    &address, NULL, &stat)) {
+		if (!address && clpp) {
+			*clpp = clnt_raw_ncreate(program, version);
+			(*clpp)->cl_error.re_status = stat;
+		}
+		return (address);
+	}
+
+	address = rpcb_findaddr(program, version, nconf, host, clpp, tp,
+				&stat);
+	rpcb_cache_store(host, nconf->nc_netid, program, version, address,
+			 NULL, stat);
+	return (address);
+}
+
+static struct netbuf *
+rpcb_findaddr(rpcprog_t program, rpcvers_t version,
+	      const struct netconfig *nconf, const char *host, CLIENT **clpp,
+	      struct timeval *tp, enum clnt_stat *statp)
 {
 	char *ua = NULL;
 	struct netbuf *address = NULL;
@@ -846,6 +1141,10 @@ __rpcb_findaddr_timed(rpcprog_t program, rpcvers_t version,
  done:
 	if (ua)
 		xdr_free((xdrproc_t) xdr_wrapstring, (char *)(void *)&ua);
+	if (address)
+		*statp = RPC_SUCCESS;
+	else
+		*statp = client ? client->cl_error.re_status : RPC_FAILED;
 	if (clpp)
 		*clpp = client;
 	else if (client)
@@ -165,6 +165,7 @@ svc_init(svc_init_params *params)
 	 * event systems, reworked select, etc. */
 #endif
 	__svc_params->idle_timeout = params->idle_timeout;
+	__svc_params->idle_quiesce = params->idle_quiesce;
 
 	/* allow consumers to manage all xprt registration */
 	if (params->flags & SVC_INIT_NOREG_XPRTS)
@@ -183,6 +184,46 @@ svc_init(svc_init_params *params)
 	if (__svc_params->ioq.thrd_max < params->ioq_thrd_max)
 		__svc_params->ioq.thrd_max = params->ioq_thrd_max;
 
+	/* reply coalescing, see svc_ioq_flush() and svc_ioq_flushm() */
+	if (params->ioq_coalesce_max)
+		__svc_params->ioq.coalesce_max = params->ioq_coalesce_max;
+	else
+		__svc_params->ioq.coalesce_max = 16;
+	if (__svc_params->ioq.coalesce_max > SVC_IOQ_COALESCE_LIMIT)
+		__svc_params->ioq.coalesce_max = SVC_IOQ_COALESCE_LIMIT;
+	__svc_params->ioq.coalesce_window = params->ioq_coalesce_window;
+	if (__svc_params->ioq.coalesce_window > 999999)
+		__svc_params->ioq.coalesce_window = 999999;
+
+	/* client call slots, off by default, see clnt_req_slot_get() */
+	__svc_params->clnt_slots.max = params->clnt_slots_max;
+	if (params->clnt_slots_min)
+		__svc_params->clnt_slots.min = params->clnt_slots_min;
+	else
+		__svc_params->clnt_slots.min = MIN(16, params->clnt_slots_max);
+	if (__svc_params->clnt_slots.max < __svc_params->clnt_slots.min)
+		__svc_params->clnt_slots.max = __svc_params->clnt_slots.min;
+
+	/* see rpc_call() */
+	if (params->clnt_cache_max)
+		__svc_params->clnt_cache_max = params->clnt_cache_max;
+	else
+		__svc_params->clnt_cache_max = 16;
+
+	/* see __rpcb_findaddr_timed() */
+	if (params->rpcb_cache_max)
+		__svc_params->rpcb_cache.max = params->rpcb_cache_max;
+	else
+		__svc_params->rpcb_cache.max = 1024;
+	if (params->rpcb_cache_ttl)
+		__svc_params->rpcb_cache.ttl = params->rpcb_cache_ttl;
+	else
+		__svc_params->rpcb_cache.ttl = 60;
+	if (params->rpcb_cache_neg_ttl)
+		__svc_params->rpcb_cache.neg_ttl = params->rpcb_cache_neg_ttl;
+	else
+		__svc_params->rpcb_cache.neg_ttl = 5;
+
 	svc_ioq_init();
 
 	work_pool_params.thrd_min = __svc_params->ioq.thrd_min + channels;
@@ -225,6 +266,37 @@ svc_init(svc_init_params *params)
 	else
 		__svc_params->gss.max_gc = 200;
 
+	/* header-split receive, see svc_vc_recv() */
+	__svc_params->split.cb = params->split_cb;
+	__svc_params->split.pagesz = sysconf(_SC_PAGESIZE);
+
+	if (params->split_bsize)
+		__svc_params->split.bsize = params->split_bsize;
+	else
+		__svc_params->split.bsize = 65536;
+	__svc_params->split.bsize += __svc_params->split.pagesz - 1;
+	__svc_params->split.bsize &= ~(__svc_params->split.pagesz - 1);
+
+	if (params->split_hdr_size)
+		__svc_params->split.hdr_size = RNDUP(params->split_hdr_size);
+	else
+		__svc_params->split.hdr_size = 512;
+	if (__svc_params->split.hdr_size > __svc_params->split.pagesz)
+		__svc_params->split.hdr_size = __svc_params->split.pagesz;
+
+	if (params->split_pool_max)
+		__svc_params->split.pool_max = params->split_pool_max;
+	else
+		__svc_params->split.pool_max = 64;
+
+	/* streaming dispatch, see svc_vc_recv() */
+	__svc_params->stream.cb = params->stream_cb;
+
+	if (params->stream_min)
+		__svc_params->stream.min = params->stream_min;
+	else
+		__svc_params->stream.min = 65536;
+
 #ifdef USE_RPC_RDMA
 	rpc_rdma_internals_init();
 #endif
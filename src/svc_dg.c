@@ -42,6 +42,7 @@
 #include <sys/socket.h>
 #include <sys/param.h>
 #include <sys/poll.h>
+#include <netinet/udp.h>
 #include <rpc/types.h>
 #include <misc/portable.h>
 #include <rpc/rpc.h>
@@ -69,7 +70,38 @@ static void svc_dg_rendezvous_ops(SVCXPRT *);
 static void svc_dg_override_ops(SVCXPRT *, SVCXPRT *);
 
 static void svc_dg_enable_pktinfo(int, const struct __rpc_sockinfo *);
-static int svc_dg_store_pktinfo(struct msghdr *, SVCXPRT *);
+static struct cmsghdr *svc_dg_store_pktinfo(struct msghdr *, SVCXPRT *);
+
+#if defined(UDP_GRO) && defined(UDP_SEGMENT)
+#define SVC_DG_GSO 1
+#endif
+
+#define SVC_DG_GRO_SIZE		65536	/* largest coalesced receive */
+#define SVC_DG_GSO_SEGS		64	/* UDP_MAX_SEGMENTS */
+
+/*
+ * Replies to the datagrams of one UDP_GRO receive.  The requests are
+ * dispatched in turn, and replies made meanwhile are held, then sent
+ * to the (common) client with UDP_SEGMENT.  Later replies are sent at
+ * once.  Each request holds a reference.
+ */
+struct svc_dg_batch {
+	mutex_t sb_lock;
+	uint32_t sb_refs;
+	bool sb_open;
+	int sb_count;
+	SVCXPRT **sb_request;		/* to dispatch, after sb_reply */
+	SVCXPRT *sb_reply[];
+};
+
+static void
+svc_dg_batch_release(struct svc_dg_batch *batch)
+{
+	if (atomic_dec_uint32_t(&batch->sb_refs))
+		return;
+	mutex_destroy(&batch->sb_lock);
+	mem_free(batch, 0);
+}
 
 /*
  * Usage:
@@ -84,13 +116,19 @@ svc_dg_xprt_free(struct svc_dg_xprt *su)
 {
 	XDR_DESTROY(su->su_dr.ioq.xdrs);
 	rpc_dplx_rec_destroy(&su->su_dr);
+	if (su->su_gro)
+		mem_free(su->su_gro, SVC_DG_GRO_SIZE);
+	if (su->su_batch)
+		svc_dg_batch_release(su->su_batch);
 	mem_free(su, sizeof(struct svc_dg_xprt) + su->su_dr.maxrec);
 }
 
 static struct svc_dg_xprt *
 svc_dg_xprt_zalloc(size_t iosz)
 {
-	struct svc_dg_xprt *su = mem_zalloc(sizeof(struct svc_dg_xprt) + iosz);
+	struct svc_dg_xprt *su = mem_zalloc_aligned(CACHE_LINE_SIZE,
+						    sizeof(struct svc_dg_xprt)
+						    + iosz);
 
 	/* Init SVCXPRT locks, etc */
 	rpc_dplx_rec_init(&su->su_dr);
@@ -194,6 +232,23 @@ svc_dg_ncreatef(const int fd, const u_int sendsz, const u_int recvsz,
 	/* Enable reception of IP*_PKTINFO control msgs */
 	svc_dg_enable_pktinfo(fd, &si);
 
+#ifdef SVC_DG_GSO
+	if ((flags & SVC_CREATE_FLAG_UDP_GSO)
+	 && si.si_proto == IPPROTO_UDP
+	 && (si.si_af == AF_INET || si.si_af == AF_INET6)) {
+		int val = 1;
+
+		if (setsockopt(fd, IPPROTO_UDP, UDP_GRO, &val, sizeof(val))) {
+			__warnx(TIRPC_DEBUG_FLAG_SVC_DG,
+				"%s: fd %d UDP_GRO failed (%d)",
+				__func__, fd, errno);
+		} else {
+			su->su_gro = mem_alloc(SVC_DG_GRO_SIZE);
+			su->su_gso_max = SVC_DG_GRO_SIZE;
+		}
+	}
+#endif
+
 	/* Conditional register */
 	if ((!(__svc_params->flags & SVC_FLAG_NOREG_XPRTS)
 	     && !(flags & SVC_CREATE_FLAG_XPRT_NOREG))
@@ -220,17 +275,16 @@ svc_dg_stat(SVCXPRT *xprt)
 	return SVC_STAT(xprt->xp_parent);
 }
 
-static enum xprt_stat
-svc_dg_rendezvous(SVCXPRT *xprt)
+/*
+ * Make the transport for one request received on the listener.
+ */
+static struct svc_dg_xprt *
+svc_dg_xprt_request(SVCXPRT *xprt)
 {
 	struct svc_dg_xprt *req_su = su_data(xprt);
 	struct svc_dg_xprt *su = svc_dg_xprt_zalloc(req_su->su_dr.maxrec);
 	SVCXPRT *newxprt = &su->su_dr.xprt;
-	struct sockaddr *sp = (struct sockaddr *)&newxprt->xp_remote.ss;
-	struct msghdr *mesgp;
 	struct timespec now;
-	struct iovec iov;
-	ssize_t rlen;
 
 	newxprt->xp_fd = xprt->xp_fd;
 	newxprt->xp_flags = SVC_XPRT_FLAG_INITIAL | SVC_XPRT_FLAG_INITIALIZED;
@@ -241,6 +295,200 @@ svc_dg_rendezvous(SVCXPRT *xprt)
 	su->su_dr.recvsz = req_su->su_dr.recvsz;
 	su->su_dr.maxrec = req_su->su_dr.maxrec;
 	svc_dg_override_ops(newxprt, xprt);
+	return (su);
+}
+
+/*
+ * The request (rlen bytes) is in the transport buffer, and its sender
+ * in xp_remote.  mesgp has the control messages received with it.
+ */
+static void
+svc_dg_xprt_received(SVCXPRT *xprt, struct svc_dg_xprt *su,
+		     struct msghdr *mesgp, size_t rlen)
+{
+	SVCXPRT *newxprt = &su->su_dr.xprt;
+	struct cmsghdr *cmsg;
+	size_t space;
+
+	__rpc_address_setup(&newxprt->xp_local);
+	__rpc_address_setup(&newxprt->xp_remote);
+	newxprt->xp_remote.nb.len = mesgp->msg_namelen;
+
+	/* Check whether there's an IP_PKTINFO or IP6_PKTINFO control message.
+	 * If yes, preserve (only) it for svc_dg_reply; otherwise just zap
+	 * any cmsgs */
+	cmsg = svc_dg_store_pktinfo(mesgp, newxprt);
+	space = cmsg ? CMSG_SPACE(cmsg->cmsg_len - CMSG_LEN(0)) : 0;
+	if (cmsg && space <= sizeof(su->su_cmsg)) {
+		if ((void *)cmsg != (void *)su->su_cmsg)
+			memmove(su->su_cmsg, cmsg, cmsg->cmsg_len);
+		su->su_msghdr.msg_control = su->su_cmsg;
+		su->su_msghdr.msg_controllen = space;
+	} else {
+		su->su_msghdr.msg_control = NULL;
+		su->su_msghdr.msg_controllen = 0;
+		newxprt->xp_local.nb.len = 0;
+	}
+	XPRT_TRACE(newxprt, __func__, __func__, __LINE__);
+
+#if defined(HAVE_BLKIN)
+	__rpc_set_blkin_endpoint(newxprt, "svc_dg");
+#endif
+
+	if (newxprt->xp_cksum & RPC_CKSUM_FULL) {
+		/* just received, still in cache */
+		svc_cksum_record(newxprt->xp_cksum, &su->su_dr.ioq, &su[1],
+				 rlen);
+	}
+
+	xdrmem_create(su->su_dr.ioq.xdrs, (char *)&su[1], su->su_dr.maxrec,
+		      XDR_DECODE);
+
+	SVC_REF(xprt, SVC_REF_FLAG_NONE);
+	newxprt->xp_parent = xprt;
+}
+
+#ifdef SVC_DG_GSO
+static void svc_dg_gso_flush(SVCXPRT *, struct svc_dg_batch *);
+
+/*
+ * With UDP_GRO, one receive may hold several datagrams of a flow, each
+ * of the UDP_GRO cmsg size (the last may be shorter).  They are copied
+ * out into request transports before the listener is rearmed.
+ */
+static enum xprt_stat
+svc_dg_rendezvous_gro(SVCXPRT *xprt)
+{
+	struct svc_dg_xprt *req_su = su_data(xprt);
+	struct sockaddr_storage ss;
+	union {
+		struct cmsghdr cm;
+		char buf[SVC_CMSG_SIZE + CMSG_SPACE(sizeof(int))];
+	} u;
+	struct msghdr mesg;
+	struct iovec iov;
+	struct cmsghdr *cmsg;
+	struct svc_dg_batch *batch = NULL;
+	struct svc_dg_xprt *su;
+	SVCXPRT *one = NULL;
+	enum xprt_stat stat = XPRT_IDLE;
+	ssize_t rlen;
+	size_t off;
+	size_t len;
+	int gso = 0;
+	int n;
+	int i;
+
+ again:
+	iov.iov_base = req_su->su_gro;
+	iov.iov_len = SVC_DG_GRO_SIZE;
+	memset(&mesg, 0, sizeof(mesg));
+	mesg.msg_iov = &iov;
+	mesg.msg_iovlen = 1;
+	mesg.msg_name = &ss;
+	ss.ss_family = (sa_family_t) 0xffff;
+	mesg.msg_namelen = sizeof(ss);
+	mesg.msg_control = u.buf;
+	mesg.msg_controllen = sizeof(u.buf);
+
+	rlen = recvmsg(xprt->xp_fd, &mesg, 0);
+
+	if (ss.ss_family == (sa_family_t) 0xffff)
+		return (XPRT_DIED);
+
+	if (rlen == -1 && errno == EINTR)
+		goto again;
+	if (rlen == -1 || (rlen < (ssize_t) (4 * sizeof(u_int32_t))))
+		return (XPRT_DIED);
+
+	for (cmsg = CMSG_FIRSTHDR(&mesg); cmsg;
+	     cmsg = CMSG_NXTHDR(&mesg, cmsg)) {
+		if (cmsg->cmsg_level == IPPROTO_UDP
+		 && cmsg->cmsg_type == UDP_GRO
+		 && cmsg->cmsg_len >= CMSG_LEN(sizeof(int)))
+			memcpy(&gso, CMSG_DATA(cmsg), sizeof(int));
+	}
+	if (gso <= 0 || gso >= rlen)
+		gso = rlen;
+	n = (rlen + gso - 1) / gso;
+
+	if (n > 1) {
+		batch = mem_zalloc(sizeof(*batch) + 2 * n * sizeof(SVCXPRT *));
+		batch->sb_request = &batch->sb_reply[n];
+		mutex_init(&batch->sb_lock, NULL);
+		batch->sb_refs = 1;
+		batch->sb_open = true;
+	}
+
+	/* the batch keeps the requests until dispatched */
+	for (off = 0, i = 0; off < rlen; off += len) {
+		len = MIN(gso, rlen - off);
+		if (len < 4 * sizeof(u_int32_t)
+		 || len > req_su->su_dr.maxrec)
+			continue;
+
+		su = svc_dg_xprt_request(xprt);
+		memcpy(&su[1], (char *)iov.iov_base + off, len);
+		memcpy(&su->su_dr.xprt.xp_remote.ss, &ss, mesg.msg_namelen);
+		svc_dg_xprt_received(xprt, su, &mesg, len);
+		if (!batch) {
+			one = &su->su_dr.xprt;
+			continue;
+		}
+		atomic_inc_uint32_t(&batch->sb_refs);
+		su->su_batch = batch;
+		batch->sb_request[i++] = &su->su_dr.xprt;
+	}
+	n = i;
+
+	if (unlikely(svc_rqst_rearm_events(xprt))) {
+		__warnx(TIRPC_DEBUG_FLAG_ERROR,
+			"%s: %p fd %d svc_rqst_rearm_events failed (will set dead)",
+			__func__, xprt, xprt->xp_fd);
+		stat = XPRT_DIED;
+	}
+
+	if (!batch) {
+		if (!one)
+			return (stat);
+		if (stat == XPRT_DIED) {
+			SVC_RELEASE(one, SVC_RELEASE_FLAG_NONE);
+			return (stat);
+		}
+		return (xprt->xp_dispatch.rendezvous_cb(one));
+	}
+
+	/* svc_dg_reply() adds to sb_reply while open */
+	for (i = 0; i < n; i++) {
+		one = batch->sb_request[i];
+		if (stat == XPRT_DIED)
+			SVC_RELEASE(one, SVC_RELEASE_FLAG_NONE);
+		else
+			(void)xprt->xp_dispatch.rendezvous_cb(one);
+	}
+	svc_dg_gso_flush(xprt, batch);
+	return (stat);
+}
+#endif /* SVC_DG_GSO */
+
+static enum xprt_stat
+svc_dg_rendezvous(SVCXPRT *xprt)
+{
+	struct svc_dg_xprt *req_su = su_data(xprt);
+	struct svc_dg_xprt *su;
+	SVCXPRT *newxprt;
+	struct sockaddr *sp;
+	struct msghdr *mesgp;
+	struct iovec iov;
+	ssize_t rlen;
+
+#ifdef SVC_DG_GSO
+	if (req_su->su_gro)
+		return (svc_dg_rendezvous_gro(xprt));
+#endif
+	su = svc_dg_xprt_request(xprt);
+	newxprt = &su->su_dr.xprt;
+	sp = (struct sockaddr *)&newxprt->xp_remote.ss;
 
  again:
 	iov.iov_base = &su[1];
@@ -277,28 +525,7 @@ svc_dg_rendezvous(SVCXPRT *xprt)
 		return (XPRT_DIED);
 	}
 
-	__rpc_address_setup(&newxprt->xp_local);
-	__rpc_address_setup(&newxprt->xp_remote);
-	newxprt->xp_remote.nb.len = mesgp->msg_namelen;
-
-	/* Check whether there's an IP_PKTINFO or IP6_PKTINFO control message.
-	 * If yes, preserve it for svc_dg_reply; otherwise just zap any cmsgs */
-	if (!svc_dg_store_pktinfo(mesgp, newxprt)) {
-		mesgp->msg_control = NULL;
-		mesgp->msg_controllen = 0;
-		newxprt->xp_local.nb.len = 0;
-	}
-	XPRT_TRACE(newxprt, __func__, __func__, __LINE__);
-
-#if defined(HAVE_BLKIN)
-	__rpc_set_blkin_endpoint(newxprt, "svc_dg");
-#endif
-
-	xdrmem_create(su->su_dr.ioq.xdrs, iov.iov_base, iov.iov_len,
-		      XDR_DECODE);
-
-	SVC_REF(xprt, SVC_REF_FLAG_NONE);
-	newxprt->xp_parent = xprt;
+	svc_dg_xprt_received(xprt, su, mesgp, rlen);
 	return (xprt->xp_dispatch.rendezvous_cb(newxprt));
 }
 
@@ -331,6 +558,7 @@ svc_dg_decode(struct svc_req *req)
 	xdrs->x_op = XDR_DECODE;
 	XDR_SETPOS(xdrs, 0);
 	rpc_msg_init(&req->rq_msg);
+	req->rq_drc = NULL;	/* until svc_drc_start() */
 
 	if (!xdr_dplx_decode(xdrs, &req->rq_msg)) {
 		__warnx(TIRPC_DEBUG_FLAG_ERROR,
@@ -361,14 +589,18 @@ svc_dg_decode(struct svc_req *req)
 static void
 svc_dg_checksum(struct svc_req *req, void *data, size_t length)
 {
-	req->rq_cksum =
-#if 1
-	/* CithHash64 is -substantially- faster than crc32c from FreeBSD
-	 * SCTP, so prefer it until fast crc32c bests it */
-		CityHash64WithSeed(data, MIN(256, length), 103);
-#else
-		calculate_crc32c(0, data, MIN(256, length));
-#endif
+	if (req->rq_xprt->xp_cksum & RPC_CKSUM_FULL) {
+		struct xdr_ioq *xioq = XIOQ(req->rq_xdrs);
+
+		/* summed as received, or these (unwrapped) arguments */
+		req->rq_cksum = (xioq->ioq_cksum_args > 0)
+			? xioq->ioq_cksum
+			: rpc_cksum_update(req->rq_xprt->xp_cksum, 0,
+					   data, length);
+		return;
+	}
+	req->rq_cksum = rpc_cksum(RPC_CKSUM_TYPE(req->rq_xprt->xp_cksum),
+				  data, MIN(256, length));
 }
 
 static enum xprt_stat
@@ -378,9 +610,7 @@ svc_dg_reply(struct svc_req *req)
 	struct rpc_dplx_rec *rec = REC_XPRT(xprt);
 	XDR *xdrs = rec->ioq.xdrs;
 	struct svc_dg_xprt *su = DG_DR(rec);
-	struct msghdr *msg = &su->su_msghdr;
 	struct iovec iov;
-	size_t slen;
 
 	if (!xprt->xp_remote.nb.len) {
 		__warnx(TIRPC_DEBUG_FLAG_WARN,
@@ -408,9 +638,54 @@ svc_dg_reply(struct svc_req *req)
 		return (XPRT_DIED);
 	}
 	iov.iov_base = &su[1];
-	iov.iov_len = slen = XDR_GETPOS(xdrs);
-	msg->msg_iov = &iov;
-	msg->msg_iovlen = 1;
+	iov.iov_len = XDR_GETPOS(xdrs);
+
+	if (req->rq_drc)
+		svc_drc_retain_buf(req, iov.iov_base, iov.iov_len);
+
+	if (su->su_batch) {
+		struct svc_dg_batch *batch = su->su_batch;
+		bool held = false;
+
+		mutex_lock(&batch->sb_lock);
+		if (batch->sb_open) {
+			SVC_REF(xprt, SVC_REF_FLAG_NONE);
+			su->su_len = iov.iov_len;
+			batch->sb_reply[batch->sb_count++] = xprt;
+			held = true;
+		}
+		mutex_unlock(&batch->sb_lock);
+		if (held)
+			return (XPRT_IDLE);
+	}
+
+	return (svc_dg_sendv(xprt, &iov, 1));
+}
+
+/*
+ * Send an encoded reply to the request's client (also used to replay
+ * duplicate request cache replies).
+ */
+enum xprt_stat
+svc_dg_sendv(SVCXPRT *xprt, struct iovec *iov, int iovcnt)
+{
+	struct svc_dg_xprt *su = DG_DR(REC_XPRT(xprt));
+	struct msghdr *msg = &su->su_msghdr;
+	size_t slen = 0;
+	int i;
+
+	if (!xprt->xp_remote.nb.len) {
+		__warnx(TIRPC_DEBUG_FLAG_WARN,
+			"%s: %p fd %d has no remote address",
+			__func__, xprt, xprt->xp_fd);
+		return (XPRT_IDLE);
+	}
+
+	for (i = 0; i < iovcnt; i++)
+		slen += iov[i].iov_len;
+
+	msg->msg_iov = iov;
+	msg->msg_iovlen = iovcnt;
 	msg->msg_name = (struct sockaddr *)&xprt->xp_remote.ss;
 	msg->msg_namelen = xprt->xp_remote.nb.len;
 	/* cmsg already set in svc_dg_rendezvous */
@@ -425,6 +700,120 @@ svc_dg_reply(struct svc_req *req)
 	return (XPRT_IDLE);
 }
 
+#ifdef SVC_DG_GSO
+/*
+ * Send replies of one size (the last may be shorter) as one datagram,
+ * segmented with UDP_SEGMENT.
+ */
+static bool
+svc_dg_gso_send(SVCXPRT *xprt, SVCXPRT **reply, int n, u_int size)
+{
+	struct svc_dg_xprt *su = su_data(reply[0]);
+	union {
+		struct cmsghdr cm;
+		char buf[SVC_CMSG_SIZE + CMSG_SPACE(sizeof(uint16_t))];
+	} u;
+	struct iovec iov[SVC_DG_GSO_SEGS];
+	struct msghdr msg;
+	struct cmsghdr *cmsg;
+	uint16_t gso = size;
+	size_t slen = 0;
+	int i;
+
+	for (i = 0; i < n; i++) {
+		iov[i].iov_base = &su_data(reply[i])[1];
+		iov[i].iov_len = su_data(reply[i])->su_len;
+		slen += iov[i].iov_len;
+	}
+
+	memset(&u, 0, sizeof(u));
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_iov = iov;
+	msg.msg_iovlen = n;
+	msg.msg_name = (struct sockaddr *)&reply[0]->xp_remote.ss;
+	msg.msg_namelen = reply[0]->xp_remote.nb.len;
+	msg.msg_control = u.buf;
+	msg.msg_controllen = su->su_msghdr.msg_controllen
+			   + CMSG_SPACE(sizeof(uint16_t));
+
+	/* PKTINFO first, as received */
+	memcpy(u.buf, su->su_cmsg, su->su_msghdr.msg_controllen);
+	cmsg = (struct cmsghdr *)(u.buf + su->su_msghdr.msg_controllen);
+	cmsg->cmsg_level = IPPROTO_UDP;
+	cmsg->cmsg_type = UDP_SEGMENT;
+	cmsg->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+	memcpy(CMSG_DATA(cmsg), &gso, sizeof(gso));
+
+	if (sendmsg(xprt->xp_fd, &msg, 0) == (ssize_t) slen)
+		return (true);
+
+	/* EINVAL over the path MTU, EIO without checksum offload */
+	__warnx(TIRPC_DEBUG_FLAG_SVC_DG,
+		"%s: %p fd %d UDP_SEGMENT %u x %d failed (%d)",
+		__func__, xprt, xprt->xp_fd, size, n, errno);
+	atomic_store_uint32_t(&su_data(xprt)->su_gso_max,
+			      errno == EINVAL ? size - 1 : 0);
+	return (false);
+}
+
+/*
+ * Close the batch, and send the replies held.  Runs of replies to the
+ * same client are sent with svc_dg_gso_send(), others one at a time.
+ */
+static void
+svc_dg_gso_flush(SVCXPRT *xprt, struct svc_dg_batch *batch)
+{
+	u_int gso_max = atomic_fetch_uint32_t(&su_data(xprt)->su_gso_max);
+	struct iovec iov;
+	SVCXPRT **reply = batch->sb_reply;
+	size_t slen;
+	u_int size;
+	int n;
+	int i;
+	int j;
+
+	mutex_lock(&batch->sb_lock);
+	batch->sb_open = false;
+	n = batch->sb_count;
+	mutex_unlock(&batch->sb_lock);
+
+	for (i = 0; i < n; i = j) {
+		size = su_data(reply[i])->su_len;
+		slen = size;
+		for (j = i + 1; j < n && j - i < SVC_DG_GSO_SEGS; j++) {
+			u_int len = su_data(reply[j])->su_len;
+
+			if (size > gso_max || len > size
+			 || slen + len > SVC_DG_GRO_SIZE
+			 || reply[j]->xp_remote.nb.len
+			    != reply[i]->xp_remote.nb.len
+			 || memcmp(&reply[j]->xp_remote.ss,
+				   &reply[i]->xp_remote.ss,
+				   reply[i]->xp_remote.nb.len))
+				break;
+			slen += len;
+			if (len < size) {
+				/* shorter only at the end */
+				j++;
+				break;
+			}
+		}
+		if (j - i > 1 && svc_dg_gso_send(xprt, &reply[i], j - i, size))
+			continue;
+
+		for (; i < j; i++) {
+			iov.iov_base = &su_data(reply[i])[1];
+			iov.iov_len = su_data(reply[i])->su_len;
+			(void)svc_dg_sendv(reply[i], &iov, 1);
+		}
+	}
+
+	for (i = 0; i < n; i++)
+		SVC_RELEASE(reply[i], SVC_RELEASE_FLAG_NONE);
+	svc_dg_batch_release(batch);
+}
+#endif /* SVC_DG_GSO */
+
 static void
 svc_dg_destroy_task(struct work_pool_entry *wpe)
 {
@@ -511,6 +900,14 @@ svc_dg_control(SVCXPRT *xprt, const u_int rq, void *in)
 	case SVCSET_XP_FLAGS:
 		xprt->xp_flags = *(u_int *) in;
 		break;
+	case SVCGET_XP_CHECKSUM:
+		*(u_int *) in = xprt->xp_cksum;
+		break;
+	case SVCSET_XP_CHECKSUM:
+		if (RPC_CKSUM_TYPE(*(u_int *) in) > RPC_CKSUM_CRC32C_SW)
+			return (false);
+		xprt->xp_cksum = *(u_int *) in;
+		break;
 	case SVCGET_XP_FREE_USER_DATA:
 		mutex_lock(&ops_lock);
 		*(svc_xprt_fun_t *) in = xprt->xp_ops->xp_free_user_data;
@@ -550,6 +947,8 @@ svc_dg_override_ops(SVCXPRT *xprt, SVCXPRT *rendezvous)
 	}
 	svc_override_ops(&ops, rendezvous);
 	xprt->xp_ops = &ops;
+	if (rendezvous)
+		xprt->xp_cksum = rendezvous->xp_cksum;
 	mutex_unlock(&ops_lock);
 }
 
@@ -649,48 +1048,47 @@ svc_dg_store_in6_pktinfo(struct cmsghdr *cmsg, SVCXPRT *xprt)
 }
 
 /*
- * When given a control message received from the socket
- * layer, check whether it contains valid PKTINFO data.
- * If so, store the data in the request.
+ * When given control messages received from the socket
+ * layer, check whether they contain valid PKTINFO data
+ * (other than UDP_GRO, there is no other).
+ * If so, store the data in the request, and return it.
  */
-static int
+static struct cmsghdr *
 svc_dg_store_pktinfo(struct msghdr *msg, SVCXPRT *xprt)
 {
 	struct cmsghdr *cmsg;
 
 	if (!msg->msg_name)
-		return 0;
+		return NULL;
 
 	if (msg->msg_flags & MSG_CTRUNC)
-		return 0;
+		return NULL;
 
-	cmsg = CMSG_FIRSTHDR(msg);
-	if (cmsg == NULL || CMSG_NXTHDR(msg, cmsg) != NULL)
-		return 0;
-
-	switch (((struct sockaddr *)msg->msg_name)->sa_family) {
-	case AF_INET:
+	for (cmsg = CMSG_FIRSTHDR(msg); cmsg; cmsg = CMSG_NXTHDR(msg, cmsg)) {
+		switch (((struct sockaddr *)msg->msg_name)->sa_family) {
+		case AF_INET:
 #ifdef SOL_IP
-		if (svc_dg_store_in_pktinfo(cmsg, xprt))
-			return 1;
+			if (svc_dg_store_in_pktinfo(cmsg, xprt))
+				return cmsg;
 #endif
-		break;
+			break;
 
-	case AF_INET6:
+		case AF_INET6:
 #ifdef SOL_IP
-		/* Handle IPv4 PKTINFO as well on IPV6 interface */
-		if (svc_dg_store_in_pktinfo(cmsg, xprt))
-			return 1;
+			/* Handle IPv4 PKTINFO as well on IPV6 interface */
+			if (svc_dg_store_in_pktinfo(cmsg, xprt))
+				return cmsg;
 #endif
 #ifdef SOL_IPV6
-		if (svc_dg_store_in6_pktinfo(cmsg, xprt))
-			return 1;
+			if (svc_dg_store_in6_pktinfo(cmsg, xprt))
+				return cmsg;
 #endif
-		break;
+			break;
 
-	default:
-		break;
+		default:
+			return NULL;
+		}
 	}
 
-	return 0;
+	return NULL;
 }
@@ -0,0 +1,590 @@
+/*
+ * Copyright (c) 2018 Red Hat, Inc. and/or its affiliates.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR `AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/**
+ * @file svc_drc.c
+ * @brief Duplicate request cache
+ *
+ * @section DESCRIPTION
+ *
+ * The cache is sharded by client address hash.  Each shard has a hash
+ * table of entries, a list of entries in progress in order of arrival,
+ * and a list of completed entries in least recently used order, under
+ * one mutex, and an equal part of the byte and entry limits.  An entry
+ * in progress for longer than in_progress_ttl is forgotten, so that a
+ * retransmission executes again rather than being dropped forever.
+ *
+ * Bytes are those allocated: each entry, and its retained xdr_ioq with
+ * whole buffers.  Over either limit, completed entries are evicted from
+ * the least recently used, then entries in progress from the oldest.
+ *
+ * An entry is referenced by its shard, by the request that is executing
+ * (until SVC_REPLY), and by each send of its reply.  Connected replies
+ * are retained in the xdr_ioq that was encoded, and sent from a second
+ * xdr_ioq referencing the same buffers.  Datagram replies are encoded in
+ * the transport's buffer, and retained as a copy.
+ */
+
+#include "config.h"
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+#include <rpc/types.h>
+#include <misc/city.h>
+#include <misc/portable.h>
+#include <misc/queue.h>
+#include <rpc/rpc.h>
+#include <rpc/svc.h>
+#include <rpc/svc_drc.h>
+#include <rpc/xdr_ioq.h>
+
+#include "rpc_com.h"
+#include "svc_internal.h"
+#include "rpc_dplx_internal.h"
+#include "svc_ioq.h"
+
+#define SVC_DRC_BUCKETS		(256)	/* per shard, power of 2 */
+#define SVC_DRC_ADDRLEN		(32)
+
+/* de_state */
+#define SVC_DRC_STATE_IN_PROGRESS	0
+#define SVC_DRC_STATE_DONE		1
+
+struct svc_drc_entry {
+	TAILQ_ENTRY(svc_drc_entry) de_hq;	/* hash bucket */
+	TAILQ_ENTRY(svc_drc_entry) de_lru;	/* shard list, oldest first */
+	struct svc_drc_shard *de_shard;
+
+	uint64_t de_hash;
+	uint64_t de_cksum;
+	uint32_t de_xid;
+	uint32_t de_prog;
+	uint32_t de_vers;
+	uint32_t de_proc;
+	uint8_t de_addr[SVC_DRC_ADDRLEN];
+	u_int de_addrlen;
+
+	struct xdr_ioq *de_reply;	/* retained, or NULL */
+	size_t de_bytes;
+	time_t de_time;
+	uint32_t de_refs;		/* (atomic) */
+	u_int de_state;
+	bool de_udp;
+	bool de_cached;			/* in shard */
+};
+
+TAILQ_HEAD(svc_drc_head, svc_drc_entry);
+
+struct svc_drc_shard {
+	mutex_t ds_mtx;
+	struct svc_drc_head ds_busy;	/* in progress */
+	struct svc_drc_head ds_lru;	/* done */
+	struct svc_drc_head ds_hq[SVC_DRC_BUCKETS];
+	size_t ds_bytes;
+	size_t ds_max_bytes;
+	u_int ds_entries;
+	u_int ds_max_entries;
+} __attribute__ ((aligned(CACHE_LINE_SIZE)));
+
+static struct {
+	struct svc_drc_shard *shards;
+	u_int nshards;
+	u_int tcp_ttl;
+	u_int udp_ttl;
+	u_int in_progress_ttl;
+	struct svc_drc_stats st;
+} svc_drc;
+
+bool
+svc_drc_init(svc_drc_params *params)
+{
+	u_int nshards = 16;
+	size_t max_bytes = 64 * 1024 * 1024;
+	u_int max_entries = 65536;
+	u_int i, j;
+
+	if (svc_drc.shards)
+		return (true);
+
+	if (params && params->shards) {
+		/* round up to a power of 2 */
+		for (nshards = 1; nshards < params->shards; nshards <<= 1)
+			;
+	}
+	if (params && params->max_bytes)
+		max_bytes = params->max_bytes;
+	if (params && params->max_entries)
+		max_entries = params->max_entries;
+
+	svc_drc.tcp_ttl = (params && params->tcp_ttl) ? params->tcp_ttl : 600;
+	svc_drc.udp_ttl = (params && params->udp_ttl) ? params->udp_ttl : 120;
+	svc_drc.in_progress_ttl = (params && params->in_progress_ttl)
+				? params->in_progress_ttl : 300;
+
+	svc_drc.shards = mem_zalloc_aligned(CACHE_LINE_SIZE, nshards
+					    * sizeof(struct svc_drc_shard));
+	for (i = 0; i < nshards; i++) {
+		struct svc_drc_shard *ds = &svc_drc.shards[i];
+
+		mutex_init(&ds->ds_mtx, NULL);
+		TAILQ_INIT(&ds->ds_busy);
+		TAILQ_INIT(&ds->ds_lru);
+		for (j = 0; j < SVC_DRC_BUCKETS; j++)
+			TAILQ_INIT(&ds->ds_hq[j]);
+		ds->ds_max_bytes = max_bytes / nshards;
+		ds->ds_max_entries = MAX(max_entries / nshards, 1);
+	}
+	svc_drc.nshards = nshards;
+	return (true);
+}
+
+static inline time_t
+svc_drc_now(void)
+{
+	struct timespec ts;
+
+	(void)clock_gettime(CLOCK_MONOTONIC_FAST, &ts);
+	return (ts.tv_sec);
+}
+
+static void
+svc_drc_put(struct svc_drc_entry *de)
+{
+	if (atomic_dec_uint32_t(&de->de_refs))
+		return;
+
+	if (de->de_reply)
+		XDR_DESTROY(de->de_reply->xdrs);
+	mem_free(de, sizeof(*de));
+}
+
+/* Called with ds_mtx locked. */
+static void
+svc_drc_remove(struct svc_drc_shard *ds, struct svc_drc_entry *de)
+{
+	TAILQ_REMOVE(&ds->ds_hq[de->de_hash & (SVC_DRC_BUCKETS - 1)], de,
+		     de_hq);
+	if (de->de_state == SVC_DRC_STATE_IN_PROGRESS)
+		TAILQ_REMOVE(&ds->ds_busy, de, de_lru);
+	else
+		TAILQ_REMOVE(&ds->ds_lru, de, de_lru);
+	ds->ds_bytes -= de->de_bytes;
+	ds->ds_entries--;
+	de->de_cached = false;
+
+	atomic_dec_uint64_t(&svc_drc.st.entries);
+	atomic_sub_uint64_t(&svc_drc.st.bytes, de->de_bytes);
+	svc_drc_put(de);
+}
+
+/*
+ * Forget entries in progress for longer than in_progress_ttl (whole
+ * seconds, so strictly more).  Their requests keep a reference; the reply
+ * is not retained.  Called with ds_mtx locked.
+ */
+static void
+svc_drc_age(struct svc_drc_shard *ds, time_t now)
+{
+	struct svc_drc_entry *de;
+
+	while ((de = TAILQ_FIRST(&ds->ds_busy))
+	       && now - de->de_time > svc_drc.in_progress_ttl) {
+		atomic_inc_uint64_t(&svc_drc.st.aged);
+		svc_drc_remove(ds, de);
+	}
+}
+
+static inline bool
+svc_drc_over(struct svc_drc_shard *ds)
+{
+	return (ds->ds_bytes > ds->ds_max_bytes
+		|| ds->ds_entries > ds->ds_max_entries);
+}
+
+/*
+ * Expire completed entries from the oldest, then evict until under the
+ * limits, in progress last.  Called with ds_mtx locked.
+ */
+static void
+svc_drc_trim(struct svc_drc_shard *ds, time_t now)
+{
+	struct svc_drc_entry *de;
+
+	while ((de = TAILQ_FIRST(&ds->ds_lru))) {
+		u_int ttl = de->de_udp ? svc_drc.udp_ttl : svc_drc.tcp_ttl;
+
+		if (now - de->de_time >= ttl) {
+			atomic_inc_uint64_t(&svc_drc.st.expired);
+		} else if (svc_drc_over(ds)) {
+			atomic_inc_uint64_t(&svc_drc.st.evicted);
+		} else {
+			break;
+		}
+		svc_drc_remove(ds, de);
+	}
+
+	/* forgotten as if aged; their requests keep a reference */
+	while (svc_drc_over(ds) && (de = TAILQ_FIRST(&ds->ds_busy))) {
+		atomic_inc_uint64_t(&svc_drc.st.evicted);
+		svc_drc_remove(ds, de);
+	}
+}
+
+/*
+ * Allocated size of a retained reply.
+ */
+static size_t
+svc_drc_ioq_bytes(struct xdr_ioq *xioq)
+{
+	struct poolq_entry *have;
+	size_t bytes = sizeof(*xioq);
+
+	TAILQ_FOREACH(have, &xioq->ioq_uv.uvqh.qh, q) {
+		struct xdr_ioq_uv *uv = IOQ_(have);
+
+		bytes += sizeof(*uv) + (uv->v.vio_wrap - uv->v.vio_base);
+	}
+	return (bytes);
+}
+
+/*
+ * Client address, without the port for connected transports.
+ */
+static u_int
+svc_drc_addr(SVCXPRT *xprt, uint8_t *addr, bool udp)
+{
+	struct sockaddr *sa = (struct sockaddr *)&xprt->xp_remote.ss;
+	u_int len;
+
+	switch (sa->sa_family) {
+	case AF_INET:
+	{
+		struct sockaddr_in *sin = (struct sockaddr_in *)sa;
+
+		memcpy(addr, &sin->sin_addr, sizeof(sin->sin_addr));
+		len = sizeof(sin->sin_addr);
+		if (udp) {
+			memcpy(addr + len, &sin->sin_port,
+			       sizeof(sin->sin_port));
+			len += sizeof(sin->sin_port);
+		}
+		break;
+	}
+	case AF_INET6:
+	{
+		struct sockaddr_in6 *sin6 = (struct sockaddr_in6 *)sa;
+
+		memcpy(addr, &sin6->sin6_addr, sizeof(sin6->sin6_addr));
+		len = sizeof(sin6->sin6_addr);
+		if (udp) {
+			memcpy(addr + len, &sin6->sin6_port,
+			       sizeof(sin6->sin6_port));
+			len += sizeof(sin6->sin6_port);
+		}
+		break;
+	}
+	default:
+		len = MIN(xprt->xp_remote.nb.len, SVC_DRC_ADDRLEN);
+		memcpy(addr, sa, len);
+		break;
+	}
+	return (len);
+}
+
+static inline bool
+svc_drc_match(struct svc_drc_entry *de, struct svc_drc_entry *key)
+{
+	return (de->de_hash == key->de_hash
+		&& de->de_xid == key->de_xid
+		&& de->de_cksum == key->de_cksum
+		&& de->de_proc == key->de_proc
+		&& de->de_prog == key->de_prog
+		&& de->de_vers == key->de_vers
+		&& de->de_udp == key->de_udp
+		&& de->de_addrlen == key->de_addrlen
+		&& !memcmp(de->de_addr, key->de_addr, key->de_addrlen));
+}
+
+static void
+svc_drc_uv_release(struct xdr_uio *uio, u_int flags)
+{
+	struct xdr_ioq_uv *uv = IOQU(uio);
+
+	svc_drc_put((struct svc_drc_entry *)uio->uio_p1);
+	mem_free(uv, sizeof(*uv));
+}
+
+/*
+ * An xdr_ioq referencing the retained reply, for svc_ioq_write_now().
+ */
+static struct xdr_ioq *
+svc_drc_send_ioq(struct svc_drc_entry *de)
+{
+	struct xdr_ioq *xioq = xdr_ioq_create(0, 0, UIO_FLAG_BUFQ);
+	struct poolq_entry *have;
+
+	TAILQ_FOREACH(have, &de->de_reply->ioq_uv.uvqh.qh, q) {
+		struct xdr_ioq_uv *data = IOQ_(have);
+		struct xdr_ioq_uv *uv = mem_zalloc(sizeof(*uv));
+
+		uv->v = data->v;
+		uv->u.uio_release = svc_drc_uv_release;
+		uv->u.uio_p1 = de;
+		uv->u.uio_references = 1;
+		atomic_inc_uint32_t(&de->de_refs);
+
+		(xioq->ioq_uv.uvqh.qcount)++;
+		TAILQ_INSERT_TAIL(&xioq->ioq_uv.uvqh.qh, &uv->uvq, q);
+	}
+	return (xioq);
+}
+
+static void
+svc_drc_replay(struct svc_req *req, struct svc_drc_entry *de)
+{
+	SVCXPRT *xprt = req->rq_xprt;
+
+	if (de->de_udp) {
+		struct iovec iov[1];
+		struct xdr_ioq_uv *uv =
+			IOQ_(TAILQ_FIRST(&de->de_reply->ioq_uv.uvqh.qh));
+
+		iov[0].iov_base = uv->v.vio_head;
+		iov[0].iov_len = ioquv_length(uv);
+		(void)svc_dg_sendv(xprt, iov, 1);
+	} else {
+		struct xdr_ioq *xioq = svc_drc_send_ioq(de);
+
+		xioq->xdrs[0].x_lib[1] = (void *)xprt;
+		svc_ioq_write_now(xprt, xioq);
+	}
+}
+
+enum svc_drc_stat
+svc_drc_start(struct svc_req *req)
+{
+	SVCXPRT *xprt = req->rq_xprt;
+	struct svc_drc_entry key;
+	struct svc_drc_entry *de;
+	struct svc_drc_shard *ds;
+	struct svc_drc_head *hq;
+	time_t now;
+
+	req->rq_drc = NULL;
+	if (!svc_drc.shards)
+		return (SVC_DRC_NEW);
+
+	key.de_udp = (xprt->xp_type == XPRT_UDP);
+	key.de_addrlen = svc_drc_addr(xprt, key.de_addr, key.de_udp);
+	key.de_xid = req->rq_msg.rm_xid;
+	key.de_prog = req->rq_msg.cb_prog;
+	key.de_vers = req->rq_msg.cb_vers;
+	key.de_proc = req->rq_msg.cb_proc;
+	key.de_cksum = req->rq_cksum;
+	key.de_hash = CityHash64WithSeed((char *)key.de_addr, key.de_addrlen,
+					 103);
+
+	/* address selects the shard, the rest of the key the bucket */
+	ds = &svc_drc.shards[key.de_hash & (svc_drc.nshards - 1)];
+	key.de_hash ^= key.de_xid * 2654435761U;
+	key.de_hash ^= key.de_cksum;
+	hq = &ds->ds_hq[key.de_hash & (SVC_DRC_BUCKETS - 1)];
+	now = svc_drc_now();
+
+	mutex_lock(&ds->ds_mtx);
+	svc_drc_age(ds, now);
+	TAILQ_FOREACH(de, hq, de_hq) {
+		if (!svc_drc_match(de, &key))
+			continue;
+
+		if (de->de_state == SVC_DRC_STATE_IN_PROGRESS) {
+			mutex_unlock(&ds->ds_mtx);
+			atomic_inc_uint64_t(&svc_drc.st.in_progress);
+			return (SVC_DRC_IN_PROGRESS);
+		}
+
+		/* most recently used */
+		TAILQ_REMOVE(&ds->ds_lru, de, de_lru);
+		TAILQ_INSERT_TAIL(&ds->ds_lru, de, de_lru);
+		de->de_time = now;
+		atomic_inc_uint32_t(&de->de_refs);
+		mutex_unlock(&ds->ds_mtx);
+
+		atomic_inc_uint64_t(&svc_drc.st.hits);
+		svc_drc_replay(req, de);
+		svc_drc_put(de);
+		return (SVC_DRC_REPLAYED);
+	}
+
+	de = mem_alloc(sizeof(*de));
+	*de = key;
+	de->de_shard = ds;
+	de->de_reply = NULL;
+	de->de_bytes = sizeof(*de);
+	de->de_time = now;
+	de->de_state = SVC_DRC_STATE_IN_PROGRESS;
+	de->de_refs = 2;	/* shard and request */
+	de->de_cached = true;
+
+	TAILQ_INSERT_TAIL(hq, de, de_hq);
+	TAILQ_INSERT_TAIL(&ds->ds_busy, de, de_lru);
+	ds->ds_bytes += de->de_bytes;
+	ds->ds_entries++;
+	atomic_inc_uint64_t(&svc_drc.st.entries);
+	atomic_add_uint64_t(&svc_drc.st.bytes, de->de_bytes);
+	svc_drc_trim(ds, now);
+	mutex_unlock(&ds->ds_mtx);
+
+	atomic_inc_uint64_t(&svc_drc.st.misses);
+	req->rq_drc = de;
+	return (SVC_DRC_NEW);
+}
+
+/*
+ * Complete the entry with its reply, dropping the request reference.
+ */
+static void
+svc_drc_done(struct svc_req *req, struct xdr_ioq *reply)
+{
+	struct svc_drc_entry *de = req->rq_drc;
+	struct svc_drc_shard *ds = de->de_shard;
+	size_t bytes = svc_drc_ioq_bytes(reply);
+
+	req->rq_drc = NULL;
+
+	mutex_lock(&ds->ds_mtx);
+	/* freed with the entry, after any sends referencing it */
+	de->de_reply = reply;
+	de->de_time = svc_drc_now();
+	if (de->de_cached) {
+		TAILQ_REMOVE(&ds->ds_busy, de, de_lru);
+		TAILQ_INSERT_TAIL(&ds->ds_lru, de, de_lru);
+	}
+	de->de_state = SVC_DRC_STATE_DONE;
+	if (de->de_cached) {
+		de->de_bytes += bytes;
+		ds->ds_bytes += bytes;
+		atomic_add_uint64_t(&svc_drc.st.bytes, bytes);
+		svc_drc_trim(ds, de->de_time);
+	}
+	mutex_unlock(&ds->ds_mtx);
+	svc_drc_put(de);
+}
+
+/*
+ * Retain an encoded connected reply.  Returns the xdr_ioq to send.
+ */
+struct xdr_ioq *
+svc_drc_retain(struct svc_req *req, struct xdr_ioq *xioq)
+{
+	struct svc_drc_entry *de = req->rq_drc;
+	struct xdr_ioq *send;
+
+	xdr_tail_update(xioq->xdrs);
+
+	/* the send references the entry before the shard may evict it;
+	 * not yet done, so not replayed meanwhile.
+	 */
+	de->de_reply = xioq;
+	send = svc_drc_send_ioq(de);
+
+	svc_drc_done(req, xioq);
+	return (send);
+}
+
+/*
+ * Retain a copy of an encoded datagram reply, in a buffer of its length.
+ */
+void
+svc_drc_retain_buf(struct svc_req *req, void *buf, size_t len)
+{
+	struct xdr_ioq *xioq = xdr_ioq_create(len, len, UIO_FLAG_FREE);
+
+	xioq->xdrs[0].x_op = XDR_ENCODE;
+	(void)XDR_PUTBYTES(xioq->xdrs, buf, len);
+	xdr_tail_update(xioq->xdrs);
+
+	svc_drc_done(req, xioq);
+}
+
+void
+svc_drc_release(struct svc_req *req)
+{
+	struct svc_drc_entry *de = req->rq_drc;
+	struct svc_drc_shard *ds;
+
+	if (!de)
+		return;
+
+	/* no reply to retain, forget the request */
+	req->rq_drc = NULL;
+	ds = de->de_shard;
+
+	mutex_lock(&ds->ds_mtx);
+	if (de->de_cached)
+		svc_drc_remove(ds, de);
+	mutex_unlock(&ds->ds_mtx);
+	svc_drc_put(de);
+}
+
+void
+svc_drc_stats(struct svc_drc_stats *stats)
+{
+	stats->hits = atomic_fetch_uint64_t(&svc_drc.st.hits);
+	stats->misses = atomic_fetch_uint64_t(&svc_drc.st.misses);
+	stats->in_progress = atomic_fetch_uint64_t(&svc_drc.st.in_progress);
+	stats->evicted = atomic_fetch_uint64_t(&svc_drc.st.evicted);
+	stats->expired = atomic_fetch_uint64_t(&svc_drc.st.expired);
+	stats->entries = atomic_fetch_uint64_t(&svc_drc.st.entries);
+	stats->bytes = atomic_fetch_uint64_t(&svc_drc.st.bytes);
+	stats->aged = atomic_fetch_uint64_t(&svc_drc.st.aged);
+}
+
+/*
+ * Release all entries.  The shards remain, so requests in progress may
+ * complete.
+ */
+void
+svc_drc_shutdown(void)
+{
+	u_int i;
+
+	for (i = 0; i < svc_drc.nshards; i++) {
+		struct svc_drc_shard *ds = &svc_drc.shards[i];
+		struct svc_drc_entry *de;
+
+		mutex_lock(&ds->ds_mtx);
+		while ((de = TAILQ_FIRST(&ds->ds_busy)))
+			svc_drc_remove(ds, de);
+		while ((de = TAILQ_FIRST(&ds->ds_lru)))
+			svc_drc_remove(ds, de);
+		mutex_unlock(&ds->ds_mtx);
+	}
+}
@@ -26,10 +26,13 @@
 #ifndef TIRPC_SVC_INTERNAL_H
 #define TIRPC_SVC_INTERNAL_H
 
+#include <string.h>
+#include <sys/uio.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
 #include <misc/os_epoll.h>
 #include <rpc/rpc_msg.h>
+#include <rpc/rpc_cksum.h>
 
 #include "rpc_dplx_internal.h"
 
@@ -68,11 +71,39 @@ struct svc_params {
 		u_int send_max;
 		u_int thrd_max;
 		u_int thrd_min;
+		u_int coalesce_max;
+		u_int coalesce_window;	/* usec */
 	} ioq;
 
+	struct {
+		svc_xprt_split_fun_t cb;
+		u_int hdr_size;
+		u_int bsize;
+		u_int pagesz;
+		u_int pool_max;
+	} split;
+
+	struct {
+		svc_xprt_stream_fun_t cb;
+		u_int min;
+	} stream;
+
+	struct {
+		u_int min;
+		u_int max;
+	} clnt_slots;
+	u_int clnt_cache_max;
+
+	struct {
+		u_int max;
+		u_int ttl;	/* seconds, 0 before svc_init() */
+		u_int neg_ttl;
+	} rpcb_cache;
+
 	u_long flags;
 	u_int max_connections;
 	int32_t idle_timeout;
+	int32_t idle_quiesce;
 };
 
 extern struct svc_params __svc_params[1];
@@ -98,6 +129,10 @@ struct svc_dg_xprt {
 	struct rpc_dplx_rec su_dr;	/* SVCXPRT indexed by fd */
 	struct msghdr su_msghdr;	/* msghdr received from clnt */
 	unsigned char su_cmsg[SVC_CMSG_SIZE];	/* cmsghdr received from clnt */
+	uint8_t *su_gro;		/* UDP_GRO receive buffer (listener) */
+	u_int su_gso_max;		/* largest UDP_SEGMENT size (listener) */
+	struct svc_dg_batch *su_batch;	/* replies held for one send */
+	u_int su_len;			/* encoded reply, while held */
 };
 #define DG_DR(p) (opr_containerof((p), struct svc_dg_xprt, su_dr))
 #define su_data(xprt) (DG_DR(REC_XPRT(xprt)))
@@ -112,9 +147,30 @@ struct svc_dg_xprt {
 struct svc_vc_xprt {
 	struct rpc_dplx_rec sx_dr;	/* SVCXPRT indexed by fd */
 	int32_t sx_fbtbc;		/* fragment bytes to be consumed */
+	u_int sx_split;			/* header-split receive state */
+	u_int sx_stream;		/* streaming dispatch state */
+	struct xdr_ioq *sx_stream_ioq;	/* dispatched, still receiving */
+	u_int sx_tls;			/* RPC-over-TLS state */
+	struct rpc_tls_pending *sx_tls_pending;	/* server handshake */
 };
 #define VC_DR(p) (opr_containerof((p), struct svc_vc_xprt, sx_dr))
 
+/* sx_split */
+#define SVC_VC_SPLIT_NONE	0
+#define SVC_VC_SPLIT_HDR	1	/* receiving header region */
+#define SVC_VC_SPLIT_BULK	2	/* receiving into pooled pages */
+
+/* sx_stream */
+#define SVC_VC_STREAM_NONE	0
+#define SVC_VC_STREAM_ASK	1	/* large record, ask stream.cb */
+#define SVC_VC_STREAM_ACTIVE	2	/* dispatched, see sx_stream_ioq */
+
+/* sx_tls */
+#define SVC_VC_TLS_NONE		0
+#define SVC_VC_TLS_OFFER	1	/* first record may be AUTH_TLS probe */
+#define SVC_VC_TLS_ACTIVE	2	/* kernel TLS */
+#define SVC_VC_TLS_HANDSHAKE	3	/* see rpc_tls_svc_handshake() */
+
 /* Epoll interface change */
 #ifndef EPOLL_CLOEXEC
 #define EPOLL_CLOEXEC 02000000
@@ -137,6 +193,30 @@ extern void __rpc_set_blkin_endpoint(SVCXPRT *xprt, const char *tag);
 
 enum xprt_stat svc_rendezvous_stat(SVCXPRT *);
 
+/* svc_dg.c */
+enum xprt_stat svc_dg_sendv(SVCXPRT *, struct iovec *, int);
+
+/* svc_shm.c */
+SVCXPRT *svc_shm_connect(const int, const u_int, const u_int, const uint32_t,
+			 struct rpc_err *);
+enum xprt_stat svc_shm_send(SVCXPRT *, struct xdr_ioq *);
+
+#ifdef USE_TLS
+/* rpc_tls.c */
+bool rpc_tls_svc_starttls(SVCXPRT *, struct xdr_ioq *);
+enum xprt_stat rpc_tls_svc_handshake(SVCXPRT *);
+void rpc_tls_svc_free(struct svc_vc_xprt *);
+int rpc_tls_recv_control(int);
+struct rpc_tls_clnt *rpc_tls_clnt_start(int, rpcprog_t, rpcvers_t,
+					struct rpc_err *);
+int rpc_tls_clnt_step(struct rpc_tls_clnt *, short *, struct rpc_err *);
+void rpc_tls_clnt_free(struct rpc_tls_clnt *);
+#endif
+
+/* svc_drc.c */
+struct xdr_ioq *svc_drc_retain(struct svc_req *, struct xdr_ioq *);
+void svc_drc_retain_buf(struct svc_req *, void *, size_t);
+
 static inline void
 svc_override_ops(struct xp_ops *ops, SVCXPRT *rendezvous)
 {
@@ -147,8 +227,77 @@ svc_override_ops(struct xp_ops *ops, SVCXPRT *rendezvous)
 	}
 }
 
+/* continue a full record checksum (RPC_CKSUM_FULL); calculate_crc32c()
+ * is not exported, so this is not in rpc_cksum.h
+ */
+static inline uint32_t
+rpc_cksum_update(u_int type, uint32_t crc, const void *data, size_t length)
+{
+	if (RPC_CKSUM_TYPE(type) == RPC_CKSUM_CRC32C_SW)
+		return (calculate_crc32c(crc, data, length));
+	return (rpc_crc32c(crc, data, length));
+}
+
+/* next XDR unit of a call header, at any alignment */
+static inline uint32_t
+svc_cksum_unit(const uint8_t *p)
+{
+	uint32_t u;
+
+	memcpy(&u, p, sizeof(u));
+	return (ntohl(u));
+}
+
+/*
+ * RPC_CKSUM_FULL sums the arguments of a call, after its verifier, so a
+ * retransmission matches whatever its credential.  Returns their offset
+ * in the record, 0 when more of the header is needed, or -1 when the
+ * record is not summed as received: not a call, or RPCSEC_GSS, summed
+ * by SVC_CHECKSUM() after the arguments are unwrapped.
+ */
+static inline int
+svc_cksum_args(const void *record, size_t length)
+{
+	const uint8_t *p = record;
+	size_t off = 6 * BYTES_PER_XDR_UNIT;	/* xid ... proc */
+	uint32_t len;
+	int i;
+
+	if (length >= 2 * BYTES_PER_XDR_UNIT
+	 && svc_cksum_unit(p + BYTES_PER_XDR_UNIT) != CALL)
+		return (-1);
+
+	/* credential, then verifier */
+	for (i = 0; i < 2; i++) {
+		if (length < off + 2 * BYTES_PER_XDR_UNIT)
+			return (0);
+		if (!i && svc_cksum_unit(p + off) == RPCSEC_GSS)
+			return (-1);
+		len = svc_cksum_unit(p + off + BYTES_PER_XDR_UNIT);
+		if (len > MAX_AUTH_BYTES)
+			return (-1);
+		off += 2 * BYTES_PER_XDR_UNIT + RNDUP(len);
+	}
+	if (length < off)
+		return (0);
+	return (off);
+}
+
+/* RPC_CKSUM_FULL of a record received in one buffer */
+static inline void
+svc_cksum_record(u_int type, struct xdr_ioq *xioq, const void *record,
+		 size_t length)
+{
+	xioq->ioq_cksum_args = svc_cksum_args(record, length);
+	if (xioq->ioq_cksum_args > 0)
+		xioq->ioq_cksum = rpc_cksum_update(type, 0,
+				(const uint8_t *)record + xioq->ioq_cksum_args,
+				length - xioq->ioq_cksum_args);
+}
+
 /* in svc_rqst.c */
 int svc_rqst_rearm_events(SVCXPRT *);
+bool svc_rqst_take_events(SVCXPRT *);
 int svc_rqst_xprt_register(SVCXPRT *, SVCXPRT *);
 void svc_rqst_xprt_unregister(SVCXPRT *);
 
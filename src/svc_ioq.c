@@ -46,6 +46,7 @@
 #include <string.h>
 #include <unistd.h>
 #include <signal.h>
+#include <sched.h>
 #include <misc/timespec.h>
 
 #include <rpc/types.h>
@@ -66,43 +67,65 @@
 #include <misc/opr.h>
 #include "svc_ioq.h"
 
-/* Queue per interface, determined per transport socket.
+/* Output is queued per transport (rpc_dplx_rec.send).
  *
- * Ideally, these would be some variant of weighted fair queuing.  Currently,
- * assuming supplied by underlying OS.
+ * Any thread may claim a transport for output (RPC_DPLX_SEND_CLAIMED).  The
+ * thread that queues the first record usually claims it and sends without a
+ * task switch; records queued meanwhile by other threads are left for it, and
+ * coalesced into its next send.
  *
- * The assigned thread should have affinity for the interface.  Therefore, the
- * first thread arriving for each interface is used for all subsequent work,
- * until the interface is idle.  This assumes that the output interface is
- * closely associated with the input interface.
- *
- * Note that this is a static fixed size list of interfaces.  In most cases,
- * many of these entries will be unused.
- *
- * For efficiency, a mask is applied to the ifindex, possibly causing overlap of
- * multiple interfaces.  The size is selected to be larger than expected number
- * of concurrently active interfaces.  Size must be a power of 2 for mask.
+ * A transport with more output than one thread should send in turn (or with
+ * output submitted asynchronously) is handed off, still claimed, to a ready
+ * list for the current CPU.  Each list has at most one task draining it, so
+ * output to different clients proceeds in parallel on different CPUs.
  */
-#define IOQ_IF_SIZE (16)
-#define IOQ_IF_MASK (IOQ_IF_SIZE - 1)
-struct poolq_head ioq_ifqh[IOQ_IF_SIZE];
+struct svc_ioq_cpu {
+	struct poolq_head qh;		/* claimed transports */
+	struct work_pool_entry wpe;
+	bool running;			/* wpe submitted, under qh.qmutex */
+} __attribute__ ((aligned(CACHE_LINE_SIZE)));
+
+static struct svc_ioq_cpu *svc_ioq_cpus;
+static int svc_ioq_ncpus;
+
+/* sends per claim before handing off */
+#define SVC_IOQ_BUDGET (16)
+
+static void svc_ioq_window_task(struct work_pool_entry *);
+static void svc_ioq_ready(struct rpc_dplx_rec *);
 
 void
 svc_ioq_init(void)
 {
-	struct poolq_head *ifph = &ioq_ifqh[0];
-	int i = 0;
+	int i;
 
-	for (; i < IOQ_IF_SIZE; ifph++, i++) {
-		ifph->qcount = 0;
-		TAILQ_INIT(&ifph->qh);
-		mutex_init(&ifph->qmutex, NULL);
-	}
+	if (svc_ioq_cpus)
+		return;
+
+	svc_ioq_ncpus = sysconf(_SC_NPROCESSORS_CONF);
+	if (svc_ioq_ncpus < 1)
+		svc_ioq_ncpus = 1;
+
+	svc_ioq_cpus = mem_zalloc_aligned(CACHE_LINE_SIZE, svc_ioq_ncpus
+					  * sizeof(struct svc_ioq_cpu));
+	for (i = 0; i < svc_ioq_ncpus; i++)
+		poolq_head_setup(&svc_ioq_cpus[i].qh);
 }
 
 #define LAST_FRAG ((u_int32_t)(1 << 31))
 #define MAXALLOCA (256)
 
+static struct svc_ioq_stats svc_ioq_st;
+
+void
+svc_ioq_stats(struct svc_ioq_stats *stats)
+{
+	stats->replies = atomic_fetch_uint64_t(&svc_ioq_st.replies);
+	stats->sends = atomic_fetch_uint64_t(&svc_ioq_st.sends);
+	stats->bytes = atomic_fetch_uint64_t(&svc_ioq_st.bytes);
+	stats->coalesced = atomic_fetch_uint64_t(&svc_ioq_st.coalesced);
+}
+
 static inline void
 svc_ioq_flushv(SVCXPRT *xprt, struct xdr_ioq *xioq)
 {
@@ -170,6 +193,9 @@ svc_ioq_flushv(SVCXPRT *xprt, struct xdr_ioq *xioq)
 
 		/* blocking write */
 		result = writev(xprt->xp_fd, wiov, iw);
+		atomic_inc_uint64_t(&svc_ioq_st.sends);
+		if (likely(result > 0))
+			atomic_add_uint64_t(&svc_ioq_st.bytes, result);
 		remaining -= result;
 
 		if (result == fbytes) {
@@ -182,6 +208,7 @@ svc_ioq_flushv(SVCXPRT *xprt, struct xdr_ioq *xioq)
 				"%s() writev failed (%d)\n",
 				__func__, errno);
 			SVC_DESTROY(xprt);
+			rpc_dplx_disconnected(REC_XPRT(xprt));
 			break;
 		}
 		fbytes -= result;
@@ -204,92 +231,356 @@ svc_ioq_flushv(SVCXPRT *xprt, struct xdr_ioq *xioq)
 	}
 }
 
-static void
-svc_ioq_write(SVCXPRT *xprt, struct xdr_ioq *xioq, struct poolq_head *ifph)
+/*
+ * Several complete records, each in a single fragment, in one send.
+ * MSG_MORE when further records for this transport are already queued.
+ * Output with IOQ_FLAG_RECORDS already carries its record marks.
+ */
+static inline void
+svc_ioq_flushm(SVCXPRT *xprt, struct xdr_ioq **batch, int n, int iovs,
+	       bool more)
 {
+	u_int32_t frag_header[SVC_IOQ_COALESCE_LIMIT];
+	struct msghdr msg;
+	struct iovec *iov, *tiov;
 	struct poolq_entry *have;
+	struct xdr_ioq_uv *data;
+	ssize_t result;
+	size_t remaining = 0;
+	u_int32_t fbytes;
+	u_int32_t vsize = iovs * sizeof(struct iovec);
+	int flags = 0;
+	int ix = 0;
+	int i;
+
+	if (unlikely(vsize > MAXALLOCA)) {
+		iov = mem_alloc(vsize);
+	} else {
+		iov = alloca(vsize);
+	}
+
+	for (i = 0; i < n; i++) {
+		struct xdr_ioq *xioq = batch[i];
+
+		/* update the most recent data length, just in case */
+		xdr_tail_update(xioq->xdrs);
+
+		tiov = NULL;
+		if (!(xioq->ioq_s.qflags & IOQ_FLAG_RECORDS))
+			tiov = &iov[ix++];
+		fbytes = 0;
+		TAILQ_FOREACH(have, &(xioq->ioq_uv.uvqh.qh), q) {
+			data = IOQ_(have);
+			iov[ix].iov_base = data->v.vio_head;
+			iov[ix].iov_len = ioquv_length(data);
+			fbytes += iov[ix].iov_len;
+			ix++;
+		}
+		remaining += fbytes;
+		if (!tiov)
+			continue;
+
+		frag_header[i] = htonl((u_int32_t) (fbytes | LAST_FRAG));
+		tiov->iov_base = &frag_header[i];
+		tiov->iov_len = sizeof(u_int32_t);
+		remaining += sizeof(u_int32_t);
+	}
+
+#ifdef MSG_MORE
+	if (more)
+		flags = MSG_MORE;
+#endif
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_iov = iov;
+
+	while (remaining > 0) {
+		/* a single stream of records may exceed one send */
+		msg.msg_iovlen = MIN(&iov[ix] - msg.msg_iov, __svc_maxiov);
+
+		/* blocking write */
+		result = sendmsg(xprt->xp_fd, &msg, flags);
+		atomic_inc_uint64_t(&svc_ioq_st.sends);
+
+		if (unlikely(result < 0)) {
+			__warnx(TIRPC_DEBUG_FLAG_ERROR,
+				"%s() sendmsg failed (%d)\n",
+				__func__, errno);
+			SVC_DESTROY(xprt);
+			rpc_dplx_disconnected(REC_XPRT(xprt));
+			break;
+		}
+		atomic_add_uint64_t(&svc_ioq_st.bytes, result);
+		remaining -= result;
+
+		/* rare? sendmsg underrun? (assume never overrun) */
+		for (tiov = msg.msg_iov; remaining > 0; ++tiov) {
+			if (tiov->iov_len > result) {
+				tiov->iov_len -= result;
+				tiov->iov_base += result;
+				break;
+			}
+			result -= tiov->iov_len;
+		} /* for */
+		msg.msg_iov = tiov;
+	} /* while */
+
+	if (unlikely(vsize > MAXALLOCA)) {
+		mem_free(iov, vsize);
+	}
+}
+
+/*
+ * Gather records queued for this transport, bounded by records and by
+ * iovecs per send.  A record needing more iovecs is sent alone.
+ * Called with rec->send.qh locked.
+ */
+static int
+svc_ioq_gather(struct rpc_dplx_rec *rec, struct xdr_ioq **batch, int n,
+	       int *iovs, bool *more)
+{
+	struct poolq_entry *have;
+
+	while ((have = TAILQ_FIRST(&rec->send.qh.qh))) {
+		struct xdr_ioq *xioq = _IOQ(have);
+		int cost = xioq->ioq_uv.uvqh.qcount
+			 + !(xioq->ioq_s.qflags & IOQ_FLAG_RECORDS);
+
+		if (n > 0
+		 && (n >= __svc_params->ioq.coalesce_max
+		  || *iovs + cost > __svc_maxiov)) {
+			*more = true;
+			break;
+		}
+		TAILQ_REMOVE(&rec->send.qh.qh, have, q);
+		(rec->send.qh.qcount)--;
+		batch[n++] = xioq;
+		*iovs += cost;
+	}
+	return (n);
+}
+
+static inline bool
+svc_ioq_claim(struct rpc_dplx_rec *rec)
+{
+	if (atomic_postset_uint16_t_bits(&rec->send.flags,
+					 RPC_DPLX_SEND_CLAIMED)
+	    & RPC_DPLX_SEND_CLAIMED)
+		return (false);
+
+	/* held while claimed, the last record may release the xprt */
+	SVC_REF(&rec->xprt, SVC_REF_FLAG_NONE);
+	return (true);
+}
+
+/*
+ * Send queued records for a claimed transport, up to a budget.
+ * Returns true when records remain (still claimed), or false after the
+ * claim has been released or handed to svc_ioq_window_task().
+ */
+static bool
+svc_ioq_flush(struct rpc_dplx_rec *rec)
+{
+	struct xdr_ioq *batch[SVC_IOQ_COALESCE_LIMIT];
+	SVCXPRT *xprt = &rec->xprt;
+	int budget = SVC_IOQ_BUDGET;
+	bool more;
+	bool empty;
+	int iovs;
+	int n;
+	int i;
 
 	for (;;) {
+		iovs = 0;
+		more = false;
+
+		mutex_lock(&rec->send.qh.qmutex);
+		n = svc_ioq_gather(rec, batch, 0, &iovs, &more);
+		mutex_unlock(&rec->send.qh.qmutex);
+
+		if (!n) {
+			atomic_clear_uint16_t_bits(&rec->send.flags,
+						   RPC_DPLX_SEND_CLAIMED);
+
+			/* queued before the claim was released? */
+			mutex_lock(&rec->send.qh.qmutex);
+			empty = TAILQ_EMPTY(&rec->send.qh.qh);
+			mutex_unlock(&rec->send.qh.qmutex);
+
+			if (empty
+			 || (atomic_postset_uint16_t_bits(&rec->send.flags,
+						RPC_DPLX_SEND_CLAIMED)
+			     & RPC_DPLX_SEND_CLAIMED)) {
+				SVC_RELEASE(xprt, SVC_RELEASE_FLAG_NONE);
+				return (false);
+			}
+			continue;
+		}
+
+		if (rec->send.flags & RPC_DPLX_SEND_WINDOW) {
+			/* sending after the window, see below */
+			atomic_clear_uint16_t_bits(&rec->send.flags,
+						   RPC_DPLX_SEND_WINDOW);
+		} else if (n == 1 && !more
+		 && __svc_params->ioq.coalesce_max > 1
+		 && __svc_params->ioq.coalesce_window
+		 && iovs < __svc_maxiov
+		 && svc_work_pool.params.thrd_max) {
+			/* replies completing shortly: put this one back,
+			 * and send after the window, still claimed.
+			 */
+			mutex_lock(&rec->send.qh.qmutex);
+			TAILQ_INSERT_HEAD(&rec->send.qh.qh, &batch[0]->ioq_s, q);
+			(rec->send.qh.qcount)++;
+			mutex_unlock(&rec->send.qh.qmutex);
+
+			atomic_set_uint16_t_bits(&rec->send.flags,
+						 RPC_DPLX_SEND_WINDOW);
+			rec->send.wpe.fun = svc_ioq_window_task;
+			work_pool_submit_delayed(&svc_work_pool, &rec->send.wpe,
+					__svc_params->ioq.coalesce_window);
+			return (false);
+		}
+		atomic_add_uint64_t(&svc_ioq_st.replies, n);
+		atomic_add_uint64_t(&svc_ioq_st.coalesced, n - 1);
+
 		/* do i/o unlocked */
 		if (svc_work_pool.params.thrd_max
 		 && !(xprt->xp_flags & SVC_XPRT_FLAG_DESTROYED)) {
 			/* all systems are go! */
-			svc_ioq_flushv(xprt, xioq);
+			if (n > 1
+			 || (batch[0]->ioq_s.qflags & IOQ_FLAG_RECORDS))
+				svc_ioq_flushm(xprt, batch, n, iovs, more);
+			else
+				svc_ioq_flushv(xprt, batch[0]);
+		}
+		for (i = 0; i < n; i++) {
+			SVC_RELEASE(xprt, SVC_RELEASE_FLAG_NONE);
+			XDR_DESTROY(batch[i]->xdrs);
 		}
-		SVC_RELEASE(xprt, SVC_RELEASE_FLAG_NONE);
-		XDR_DESTROY(xioq->xdrs);
 
-		mutex_lock(&ifph->qmutex);
-		if (--(ifph->qcount) == 0)
-			break;
+		if (!--budget)
+			return (true);
+	}
+}
 
-		have = TAILQ_FIRST(&ifph->qh);
-		TAILQ_REMOVE(&ifph->qh, have, q);
-		mutex_unlock(&ifph->qmutex);
+/*
+ * The coalesce_window has passed for a claimed transport.
+ */
+static void
+svc_ioq_window_task(struct work_pool_entry *wpe)
+{
+	struct rpc_dplx_rec *rec = opr_containerof(wpe, struct rpc_dplx_rec,
+						   send.wpe);
+
+	if (svc_ioq_flush(rec))
+		svc_ioq_ready(rec);
+}
+
+static void
+svc_ioq_cpu_task(struct work_pool_entry *wpe)
+{
+	struct svc_ioq_cpu *cpu = opr_containerof(wpe, struct svc_ioq_cpu,
+						  wpe);
+	struct poolq_entry *have;
+	struct rpc_dplx_rec *rec;
 
-		xioq = _IOQ(have);
-		xprt = (SVCXPRT *)xioq->xdrs[0].x_lib[1];
+	for (;;) {
+		mutex_lock(&cpu->qh.qmutex);
+		have = TAILQ_FIRST(&cpu->qh.qh);
+		if (!have) {
+			cpu->running = false;
+			mutex_unlock(&cpu->qh.qmutex);
+			return;
+		}
+		TAILQ_REMOVE(&cpu->qh.qh, have, q);
+		(cpu->qh.qcount)--;
+		mutex_unlock(&cpu->qh.qmutex);
+
+		rec = opr_containerof(have, struct rpc_dplx_rec, send.ready);
+		if (svc_ioq_flush(rec)) {
+			/* more output, after other transports on this list */
+			mutex_lock(&cpu->qh.qmutex);
+			TAILQ_INSERT_TAIL(&cpu->qh.qh, have, q);
+			(cpu->qh.qcount)++;
+			mutex_unlock(&cpu->qh.qmutex);
+		}
 	}
-	mutex_unlock(&ifph->qmutex);
 }
 
+/*
+ * Hand off a claimed transport to the ready list of the current CPU.
+ */
 static void
-svc_ioq_write_callback(struct work_pool_entry *wpe)
+svc_ioq_ready(struct rpc_dplx_rec *rec)
 {
-	struct xdr_ioq *xioq = opr_containerof(wpe, struct xdr_ioq, ioq_wpe);
-	SVCXPRT *xprt = (SVCXPRT *)xioq->xdrs[0].x_lib[1];
-	struct poolq_head *ifph = &ioq_ifqh[xprt->xp_ifindex & IOQ_IF_MASK];
+	int c = sched_getcpu();
+	struct svc_ioq_cpu *cpu;
+	bool submit = false;
+
+	if (c < 0)
+		c = 0;
+	cpu = &svc_ioq_cpus[c % svc_ioq_ncpus];
+
+	mutex_lock(&cpu->qh.qmutex);
+	TAILQ_INSERT_TAIL(&cpu->qh.qh, &rec->send.ready, q);
+	(cpu->qh.qcount)++;
+	if (!cpu->running) {
+		cpu->running = true;
+		submit = true;
+	}
+	mutex_unlock(&cpu->qh.qmutex);
+
+	if (submit) {
+		cpu->wpe.fun = svc_ioq_cpu_task;
+		work_pool_submit(&svc_work_pool, &cpu->wpe);
+	}
+}
+
+static inline void
+svc_ioq_enqueue(SVCXPRT *xprt, struct xdr_ioq *xioq)
+{
+	struct rpc_dplx_rec *rec = REC_XPRT(xprt);
 
-	svc_ioq_write(xprt, xioq, ifph);
+	SVC_REF(xprt, SVC_REF_FLAG_NONE);
+	mutex_lock(&rec->send.qh.qmutex);
+	TAILQ_INSERT_TAIL(&rec->send.qh.qh, &(xioq->ioq_s), q);
+	(rec->send.qh.qcount)++;
+	mutex_unlock(&rec->send.qh.qmutex);
 }
 
 void
 svc_ioq_write_now(SVCXPRT *xprt, struct xdr_ioq *xioq)
 {
-	struct poolq_head *ifph = &ioq_ifqh[xprt->xp_ifindex & IOQ_IF_MASK];
+	struct rpc_dplx_rec *rec = REC_XPRT(xprt);
 
-	SVC_REF(xprt, SVC_REF_FLAG_NONE);
-	mutex_lock(&ifph->qmutex);
+	svc_ioq_enqueue(xprt, xioq);
 
-	if ((ifph->qcount)++ > 0) {
-		/* queue additional output requests without task switch */
-		TAILQ_INSERT_TAIL(&ifph->qh, &(xioq->ioq_s), q);
-		mutex_unlock(&ifph->qmutex);
+	/* another thread is sending for this transport, and will send
+	 * this output request without a task switch.
+	 */
+	if (!svc_ioq_claim(rec))
 		return;
-	}
-	mutex_unlock(&ifph->qmutex);
 
 	/* handle this output request without queuing, then any additional
-	 * output requests without a task switch (using this thread).
+	 * output requests up to a budget (using this thread).
 	 */
-	svc_ioq_write(xprt, xioq, ifph);
+	if (svc_ioq_flush(rec))
+		svc_ioq_ready(rec);
 }
 
 /*
- * Handle rare case of first output followed by heavy traffic that prevents the
- * original thread from continuing for too long.
+ * Queue output without sending from this thread.
  *
- * In the more common case, server traffic will already have begun and this
+ * In the common case, server traffic will already have begun and this
  * will rapidly queue the output and return.
  */
 void
 svc_ioq_write_submit(SVCXPRT *xprt, struct xdr_ioq *xioq)
 {
-	struct poolq_head *ifph = &ioq_ifqh[xprt->xp_ifindex & IOQ_IF_MASK];
+	struct rpc_dplx_rec *rec = REC_XPRT(xprt);
 
-	SVC_REF(xprt, SVC_REF_FLAG_NONE);
-	mutex_lock(&ifph->qmutex);
-
-	if ((ifph->qcount)++ > 0) {
-		/* queue additional output requests, they will be handled by
-		 * existing thread without another task switch.
-		 */
-		TAILQ_INSERT_TAIL(&ifph->qh, &(xioq->ioq_s), q);
-		mutex_unlock(&ifph->qmutex);
-		return;
-	}
-	mutex_unlock(&ifph->qmutex);
+	svc_ioq_enqueue(xprt, xioq);
 
-	xioq->ioq_wpe.fun = svc_ioq_write_callback;
-	work_pool_submit(&svc_work_pool, &xioq->ioq_wpe);
+	if (svc_ioq_claim(rec))
+		svc_ioq_ready(rec);
 }
@@ -29,6 +29,9 @@
 #include <rpc/svc.h>
 #include <rpc/xdr_ioq.h>
 
+/* bound on svc_init_params.ioq_coalesce_max */
+#define SVC_IOQ_COALESCE_LIMIT (64)
+
 void svc_ioq_init(void);
 void svc_ioq_write_now(SVCXPRT *, struct xdr_ioq *);
 void svc_ioq_write_submit(SVCXPRT *, struct xdr_ioq *);
@@ -28,6 +28,7 @@
 #include "config.h"
 
 #include <sys/types.h>
+#include <stddef.h>
 #include <sys/poll.h>
 #include <stdint.h>
 #include <assert.h>
@@ -73,13 +74,9 @@ static uint32_t round_robin;
 /*static*/ uint32_t wakeups;
 
 struct svc_rqst_rec {
-	struct work_pool_entry ev_wpe;
-	struct opr_rbtree call_expires;
-	mutex_t ev_lock;
-
+	/* read on every event */
 	int sv[2];
 	uint32_t id_k;		/* chan id */
-	uint32_t refcnt;
 	uint16_t flags;
 
 	/*
@@ -99,8 +96,25 @@ struct svc_rqst_rec {
 			fd_set set;	/* select/fd_set (currently unhooked) */
 		} fd;
 	} ev_u;
+
+	/* written by each pass of the event loop */
+	struct work_pool_entry ev_wpe
+		__attribute__ ((aligned(CACHE_LINE_SIZE)));
+	uint32_t refcnt;
+
+	/* call expiry, from any thread */
+	mutex_t ev_lock
+		__attribute__ ((aligned(CACHE_LINE_SIZE)));
+	struct opr_rbtree call_expires;
 };
 
+_Static_assert(offsetof(struct svc_rqst_rec, ev_wpe) % CACHE_LINE_SIZE == 0,
+	       "ev_wpe shares a cache line with read-mostly fields");
+_Static_assert(offsetof(struct svc_rqst_rec, ev_lock) % CACHE_LINE_SIZE == 0,
+	       "ev_lock shares a cache line with ev_wpe");
+_Static_assert(sizeof(struct svc_rqst_rec) % CACHE_LINE_SIZE == 0,
+	       "svc_rqst_rec shares a cache line with its neighbor");
+
 struct svc_rqst_set {
 	mutex_t mtx;
 	struct svc_rqst_rec *srr;
@@ -164,7 +178,9 @@ svc_rqst_init(uint32_t channels)
 
 	svc_rqst_set.max_id = channels;
 	svc_rqst_set.next_id = channels;
-	svc_rqst_set.srr = mem_zalloc(channels * sizeof(struct svc_rqst_rec));
+	svc_rqst_set.srr = mem_zalloc_aligned(CACHE_LINE_SIZE,
+					      channels
+					      * sizeof(struct svc_rqst_rec));
 
  unlock:
 	mutex_unlock(&svc_rqst_set.mtx);
@@ -246,6 +262,40 @@ svc_rqst_expire_insert(struct clnt_req *cc)
 	ev_sig(sr_rec->sv[0], 0);	/* send wakeup */
 }
 
+/*
+ * Requests on the same client, with one clock reading and one wakeup.
+ */
+void
+svc_rqst_expire_insertv(struct clnt_req **ccv, int n)
+{
+	struct cx_data *cx = CX_DATA(ccv[0]->cc_clnt);
+	struct svc_rqst_rec *sr_rec = (struct svc_rqst_rec *)cx->cx_rec->ev_p;
+	struct timespec now;
+	struct timespec ts;
+	int i;
+
+	/* coarse nsec, not system time */
+	(void)clock_gettime(CLOCK_MONOTONIC_FAST, &now);
+
+	mutex_lock(&sr_rec->ev_lock);
+	for (i = 0; i < n; i++) {
+		struct clnt_req *cc = ccv[i];
+
+		ts = now;
+		timespecadd(&ts, &cc->cc_timeout);
+		cc->cc_expire_ms = timespec_ms(&ts);
+		cc->cc_flags = CLNT_REQ_FLAG_EXPIRING;
+		while (opr_rbtree_insert(&sr_rec->call_expires,
+					 &cc->cc_rqst)) {
+			/* add this slightly later */
+			cc->cc_expire_ms++;
+		}
+	}
+	mutex_unlock(&sr_rec->ev_lock);
+
+	ev_sig(sr_rec->sv[0], 0);	/* send wakeup */
+}
+
 void
 svc_rqst_expire_remove(struct clnt_req *cc)
 {
@@ -528,6 +578,57 @@ svc_rqst_rearm_events(SVCXPRT *xprt)
 	return (code);
 }
 
+/*
+ * The caller receives for xprt instead of the event channel, until it
+ * calls svc_rqst_rearm_events().  Fails when an event has been taken
+ * (SVC_XPRT_FLAG_ADDED clear), as one may already be handled.
+ */
+bool
+svc_rqst_take_events(SVCXPRT *xprt)
+{
+	struct rpc_dplx_rec *rec = REC_XPRT(xprt);
+	struct svc_rqst_rec *sr_rec = (struct svc_rqst_rec *)rec->ev_p;
+
+	if (xprt->xp_flags & SVC_XPRT_FLAG_DESTROYED)
+		return (false);
+
+	/* an event already returned by the kernel is dropped, see
+	 * svc_rqst_epoll_event()
+	 */
+	if (!(atomic_postclear_uint16_t_bits(&xprt->xp_flags,
+					     SVC_XPRT_FLAG_ADDED)
+	      & SVC_XPRT_FLAG_ADDED))
+		return (false);
+
+	switch (sr_rec->ev_type) {
+#if defined(TIRPC_EPOLL)
+	case SVC_EVENT_EPOLL:
+	{
+		struct epoll_event ev = rec->ev_u.epoll.event;
+
+		/* disarmed, no wakeups */
+		ev.events = EPOLLONESHOT;
+
+		rpc_dplx_rli(rec);
+		if (epoll_ctl(sr_rec->ev_u.epoll.epoll_fd, EPOLL_CTL_MOD,
+			      xprt->xp_fd, &ev)) {
+			/* non-fatal, an event would be dropped */
+			__warnx(TIRPC_DEBUG_FLAG_WARN,
+				"%s: %p fd %d epoll_fd %d disarm failed (%d)",
+				__func__, rec, xprt->xp_fd,
+				sr_rec->ev_u.epoll.epoll_fd, errno);
+		}
+		rpc_dplx_rui(rec);
+		break;
+	}
+#endif
+	default:
+		break;
+	}
+
+	return (true);
+}
+
 /*
  * SVC_RQST_FLAG_LOCKED, and SVC_XPRT_FLAG_ADDED set
  */
@@ -747,7 +848,8 @@ svc_rqst_xprt_task(struct work_pool_entry *wpe)
 		 * xp_refs need more than 1 (this task).
 		 */
 		(void)clock_gettime(CLOCK_MONOTONIC_FAST, &(rec->recv.ts));
-		(void)SVC_RECV(&rec->xprt);
+		if (SVC_RECV(&rec->xprt) == XPRT_DESTROYED)
+			rpc_dplx_disconnected(rec);
 	}
 
 	/* If tests fail, log non-fatal "WARNING! already destroying!" */
@@ -761,13 +863,16 @@ svc_rqst_xprt_task(struct work_pool_entry *wpe)
 struct svc_rqst_clean_arg {
 	struct timespec ts;
 	int timeout;
+	int quiesce;
 	int cleaned;
+	int quiesced;
 };
 
 static bool
 svc_rqst_clean_func(SVCXPRT *xprt, void *arg)
 {
 	struct svc_rqst_clean_arg *acc = (struct svc_rqst_clean_arg *)arg;
+	time_t idle;
 
 	if (xprt->xp_ops == NULL)
 		return (false);
@@ -775,12 +880,23 @@ svc_rqst_clean_func(SVCXPRT *xprt, void *arg)
 	if (xprt->xp_flags & (SVC_XPRT_FLAG_DESTROYED | SVC_XPRT_FLAG_UREG))
 		return (false);
 
-	if ((acc->ts.tv_sec - REC_XPRT(xprt)->recv.ts.tv_sec) < acc->timeout)
-		return (false);
+	idle = acc->ts.tv_sec - REC_XPRT(xprt)->recv.ts.tv_sec;
 
-	SVC_DESTROY(xprt);
-	acc->cleaned++;
-	return (true);
+	if (acc->timeout > 0 && idle >= acc->timeout) {
+		SVC_DESTROY(xprt);
+		acc->cleaned++;
+		return (true);
+	}
+
+	if (acc->quiesce > 0 && idle >= acc->quiesce) {
+		/* idle connections keep no receive buffers */
+		SVC_REF(xprt, SVC_REF_FLAG_NONE);
+		if (!(xprt->xp_flags & SVC_XPRT_FLAG_DESTROYED)
+		 && SVC_CONTROL(xprt, SVCSET_XP_QUIESCE, NULL))
+			acc->quiesced++;
+		SVC_RELEASE(xprt, SVC_RELEASE_FLAG_NONE);
+	}
+	return (false);
 }
 
 void authgss_ctx_gc_idle(void);
@@ -805,16 +921,22 @@ svc_rqst_clean_idle(int timeout)
 	authgss_ctx_gc_idle();
 #endif /* _HAVE_GSSAPI */
 
-	if (timeout <= 0)
+	if (timeout <= 0 && __svc_params->idle_quiesce <= 0)
 		goto unlock;
 
 	/* trim xprts (not sorted, not aggressive [but self limiting]) */
 	(void)clock_gettime(CLOCK_MONOTONIC_FAST, &acc.ts);
 	acc.timeout = timeout;
+	acc.quiesce = __svc_params->idle_quiesce;
 	acc.cleaned = 0;
+	acc.quiesced = 0;
 
 	svc_xprt_foreach(svc_rqst_clean_func, (void *)&acc);
 
+	__warnx(TIRPC_DEBUG_FLAG_SVC_RQST,
+		"%s: cleaned %d quiesced %d",
+		__func__, acc.cleaned, acc.quiesced);
+
  unlock:
 	--active;
 	mutex_unlock(&active_mtx);
@@ -942,6 +1064,9 @@ svc_rqst_epoll_loop(struct svc_rqst_rec *sr_rec)
 
 	for (;;) {
 		timeout_ms = SVC_RQST_TIMEOUT_MS;
+		if (__svc_params->idle_quiesce > 0
+		 && __svc_params->idle_quiesce * 1000 < timeout_ms)
+			timeout_ms = __svc_params->idle_quiesce * 1000;
 
 		/* coarse nsec, not system time */
 		(void)clock_gettime(CLOCK_MONOTONIC_FAST, &ts);
@@ -999,6 +1124,9 @@ svc_rqst_epoll_loop(struct svc_rqst_rec *sr_rec)
 		if (!n_events) {
 			/* timed out (idle) */
 			atomic_inc_uint32_t(&wakeups);
+			if (__svc_params->idle_quiesce > 0)
+				svc_rqst_clean_idle(
+					__svc_params->idle_timeout);
 			continue;
 		}
 		n_events = errno;
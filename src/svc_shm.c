@@ -0,0 +1,1421 @@
+/*
+ * Copyright (c) 2018 Red Hat, Inc. and/or its affiliates.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR `AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "config.h"
+
+/*
+ * svc_shm.c, Shared memory transport for same host clients.
+ *
+ * The client creates a sealed memfd holding a pair of single producer,
+ * single consumer rings (calls, replies), and passes it to the listener
+ * over an AF_UNIX connection.  Each side then sends by copying a record
+ * into its ring.  The connection stays open as the doorbell: it is the
+ * transport fd in the svc_rqst event channel, and its end of file is
+ * how either side learns that the other has exited.
+ *
+ * Received records are not copied: the xdr_ioq_uv points into the ring,
+ * and releasing it makes the space available to the producer again.
+ * Records are released in any order; the consumer head only advances
+ * past the oldest outstanding record.
+ *
+ * A producer only writes a byte to the connection when the consumer has
+ * found its ring empty (sr_sleeping).  A full ring is waited for by
+ * polling, as the consumer does not signal released space, for up to
+ * SVC_SHM_TIMEOUT; then the transport is destroyed.
+ *
+ * The server receives the hello like any other event on the accepted
+ * connection, so the listener never waits for a client.
+ *
+ * Both sides trust each other with the content of records, as with a
+ * local socket, but not with the ring indices or lengths.
+ */
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <rpc/types.h>
+#include <misc/portable.h>
+#include <misc/timespec.h>
+#include <rpc/clnt.h>
+#include <rpc/rpc.h>
+#include <rpc/rpc_cksum.h>
+#include <rpc/svc.h>
+#include <rpc/svc_auth.h>
+#include <rpc/svc_rqst.h>
+#include <rpc/xdr_ioq.h>
+#include <rpc/work_pool.h>
+
+#include "rpc_com.h"
+#include "clnt_internal.h"
+#include "svc_internal.h"
+#include "svc_xprt.h"
+
+#define SVC_SHM_MAGIC		0x4e534852	/* "NSHR" */
+#define SVC_SHM_VERSION		1
+#define SVC_SHM_LINE		128	/* fixed, both sides must agree */
+#define SVC_SHM_HDR_SIZE	4096
+#define SVC_SHM_RING_MIN	(64 * 1024)
+#define SVC_SHM_RING_DEFAULT	(1024 * 1024)
+#define SVC_SHM_RING_MAX	(1024 * 1024 * 1024)
+#define SVC_SHM_TIMEOUT		10	/* handshake or full ring, seconds */
+
+#define SVC_SHM_RING_CALL	0	/* client produces */
+#define SVC_SHM_RING_REPLY	1	/* server produces */
+
+/* mk_len of the filler before the ring wraps */
+#define SVC_SHM_WRAP		UINT32_MAX
+
+#define SVC_SHM_ALIGN(n)	(((n) + 7) & ~7)
+
+/* shared, in the first page of the memfd */
+struct svc_shm_ring {
+	uint64_t sr_head	/* consumer position */
+		__attribute__ ((aligned(SVC_SHM_LINE)));
+	uint32_t sr_sleeping;	/* consumer found the ring empty */
+	uint64_t sr_tail	/* producer position */
+		__attribute__ ((aligned(SVC_SHM_LINE)));
+	uint32_t sr_offset;	/* data, from start of memfd */
+	uint32_t sr_size;	/* data, power of 2 */
+};
+
+struct svc_shm_map {
+	uint32_t mp_magic;
+	uint32_t mp_version;
+	uint32_t mp_closed;	/* either side */
+	struct svc_shm_ring mp_ring[2];
+};
+
+/* each record is 8 byte aligned, after its length */
+struct svc_shm_mark {
+	uint32_t mk_len;
+	uint32_t mk_pad;
+};
+
+/* validated, copied from the peer */
+struct svc_shm_layout {
+	size_t size;
+	uint32_t offset[2];
+	uint32_t ring[2];
+};
+
+struct svc_shm_hello {
+	uint32_t magic;
+	uint32_t version;
+};
+
+/* a received record, until released */
+struct svc_shm_held {
+	struct xdr_ioq_uv sh_uv;
+	TAILQ_ENTRY(svc_shm_held) sh_q;
+	SVCXPRT *sh_xprt;
+	uint64_t sh_pos;
+	bool sh_done;
+};
+
+/**
+ * \struct svc_shm_xprt
+ * SHM transport instance
+ *
+ * Like struct svc_vc_xprt, locally wraps struct rpc_dplx_rec, which wraps
+ * struct svc_xprt indexed by fd (the AF_UNIX connection, or listener).
+ */
+struct svc_shm_xprt {
+	struct rpc_dplx_rec sh_dr;	/* SVCXPRT indexed by fd */
+	struct svc_shm_map *sh_map;
+	size_t sh_mapsz;
+	struct svc_shm_ring *sh_tx;	/* produced here */
+	struct svc_shm_ring *sh_rx;	/* consumed here */
+	uint8_t *sh_txdata;
+	uint8_t *sh_rxdata;
+	uint32_t sh_txsize;
+	uint32_t sh_rxsize;
+	uint64_t sh_txpos;		/* under sh_txlock */
+	uint64_t sh_rxpos;		/* under sh_rxlock */
+	mutex_t sh_txlock;
+	mutex_t sh_rxlock;
+	TAILQ_HEAD(, svc_shm_held) sh_held;	/* oldest first */
+	struct work_pool_entry sh_wpe;	/* receive the next record */
+	uint32_t sh_more;		/* sh_wpe submitted */
+};
+#define SHM_DR(p) (opr_containerof((p), struct svc_shm_xprt, sh_dr))
+
+static void svc_shm_rendezvous_ops(SVCXPRT *);
+static void svc_shm_override_ops(SVCXPRT *, SVCXPRT *);
+
+extern mutex_t ops_lock;
+
+static void
+svc_shm_xprt_free(struct svc_shm_xprt *sd)
+{
+	XDR_DESTROY(sd->sh_dr.ioq.xdrs);
+	mutex_destroy(&sd->sh_txlock);
+	mutex_destroy(&sd->sh_rxlock);
+	rpc_dplx_rec_destroy(&sd->sh_dr);
+	mem_free(sd, sizeof(struct svc_shm_xprt));
+}
+
+static struct svc_shm_xprt *
+svc_shm_xprt_zalloc(void)
+{
+	struct svc_shm_xprt *sd = mem_zalloc_aligned(CACHE_LINE_SIZE,
+						     sizeof(struct svc_shm_xprt));
+
+	/* Init SVCXPRT locks, etc */
+	rpc_dplx_rec_init(&sd->sh_dr);
+	xdr_ioq_setup(&sd->sh_dr.ioq);
+	mutex_init(&sd->sh_txlock, NULL);
+	mutex_init(&sd->sh_rxlock, NULL);
+	TAILQ_INIT(&sd->sh_held);
+	return (sd);
+}
+
+static void
+svc_shm_xprt_setup(SVCXPRT **sxpp)
+{
+	if (unlikely(*sxpp)) {
+		svc_shm_xprt_free(SHM_DR(REC_XPRT(*sxpp)));
+		*sxpp = NULL;
+	} else {
+		struct svc_shm_xprt *sd = svc_shm_xprt_zalloc();
+
+		*sxpp = &sd->sh_dr.xprt;
+	}
+}
+
+static inline uint32_t
+svc_shm_ring_size(u_int size)
+{
+	uint32_t n = SVC_SHM_RING_MIN;
+
+	if (!size)
+		return (SVC_SHM_RING_DEFAULT);
+	while (n < size && n < SVC_SHM_RING_MAX)
+		n <<= 1;
+	return (n);
+}
+
+/*
+ * Wake the peer.  A full socket buffer already holds wakeups, and a
+ * closed peer is found by the receive side.
+ */
+static inline void
+svc_shm_signal(int sock)
+{
+	uint8_t one = 1;
+
+	if (send(sock, &one, sizeof(one), MSG_DONTWAIT | MSG_NOSIGNAL) < 0
+	 && errno != EAGAIN && errno != EPIPE && errno != ECONNRESET) {
+		__warnx(TIRPC_DEBUG_FLAG_WARN,
+			"%s: fd %d send errno %d",
+			__func__, sock, errno);
+	}
+}
+
+/*
+ * Map the peer's memfd, checking the layout once.  The memfd must be
+ * sealed against shrinking, so the mapping cannot fault.
+ */
+static struct svc_shm_map *
+svc_shm_map(int memfd, struct svc_shm_layout *lay)
+{
+	struct svc_shm_map *map;
+	struct stat st;
+	int seals;
+	int i;
+
+	seals = fcntl(memfd, F_GET_SEALS);
+	if (seals < 0 || !(seals & F_SEAL_SHRINK)) {
+		__warnx(TIRPC_DEBUG_FLAG_ERROR,
+			"%s: memfd %d not sealed (%d)",
+			__func__, memfd, seals);
+		return (NULL);
+	}
+	if (fstat(memfd, &st) < 0
+	 || st.st_size < SVC_SHM_HDR_SIZE + 2 * SVC_SHM_RING_MIN
+	 || st.st_size > SVC_SHM_HDR_SIZE + 2 * (off_t)SVC_SHM_RING_MAX) {
+		__warnx(TIRPC_DEBUG_FLAG_ERROR,
+			"%s: memfd %d bad size",
+			__func__, memfd);
+		return (NULL);
+	}
+	lay->size = st.st_size;
+
+	map = mmap(NULL, lay->size, PROT_READ | PROT_WRITE, MAP_SHARED,
+		   memfd, 0);
+	if (map == MAP_FAILED) {
+		__warnx(TIRPC_DEBUG_FLAG_ERROR,
+			"%s: memfd %d mmap errno %d",
+			__func__, memfd, errno);
+		return (NULL);
+	}
+
+	if (map->mp_magic != SVC_SHM_MAGIC
+	 || map->mp_version != SVC_SHM_VERSION)
+		goto bad;
+
+	for (i = 0; i < 2; i++) {
+		lay->offset[i] = map->mp_ring[i].sr_offset;
+		lay->ring[i] = map->mp_ring[i].sr_size;
+
+		if (lay->ring[i] < SVC_SHM_RING_MIN
+		 || lay->ring[i] > SVC_SHM_RING_MAX
+		 || (lay->ring[i] & (lay->ring[i] - 1))
+		 || lay->offset[i] < SVC_SHM_HDR_SIZE
+		 || lay->offset[i] & 7
+		 || (size_t)lay->offset[i] + lay->ring[i] > lay->size)
+			goto bad;
+	}
+	return (map);
+
+ bad:
+	__warnx(TIRPC_DEBUG_FLAG_ERROR,
+		"%s: memfd %d bad layout",
+		__func__, memfd);
+	munmap(map, lay->size);
+	return (NULL);
+}
+
+/*
+ * Use the rings of a mapping.
+ */
+static void
+svc_shm_xprt_attach(struct svc_shm_xprt *sd, struct svc_shm_map *map,
+		    struct svc_shm_layout *lay, bool server)
+{
+	int tx = server ? SVC_SHM_RING_REPLY : SVC_SHM_RING_CALL;
+	int rx = server ? SVC_SHM_RING_CALL : SVC_SHM_RING_REPLY;
+
+	sd->sh_mapsz = lay->size;
+	sd->sh_tx = &map->mp_ring[tx];
+	sd->sh_rx = &map->mp_ring[rx];
+	sd->sh_txdata = (uint8_t *)map + lay->offset[tx];
+	sd->sh_rxdata = (uint8_t *)map + lay->offset[rx];
+	sd->sh_txsize = lay->ring[tx];
+	sd->sh_rxsize = lay->ring[rx];
+
+	sd->sh_dr.sendsz = sd->sh_txsize;
+	sd->sh_dr.recvsz = sd->sh_rxsize;
+	sd->sh_dr.maxrec = sd->sh_rxsize / 2 - sizeof(struct svc_shm_mark);
+
+	/* last, see svc_shm_recv() */
+	sd->sh_map = map;
+}
+
+/*
+ * Make the transport for one side of a connection.  The server has no
+ * mapping until the hello, see svc_shm_hello().
+ * Takes the mapping only on success.
+ */
+static SVCXPRT *
+svc_shm_xprt_create(int sock, struct svc_shm_map *map,
+		    struct svc_shm_layout *lay, bool server, uint32_t flags)
+{
+	struct svc_shm_xprt *sd;
+	SVCXPRT *xprt;
+	int rc;
+
+	/* atomically find or create shared fd state; ref+1; locked */
+	xprt = svc_xprt_lookup(sock, svc_shm_xprt_setup);
+	if (!xprt) {
+		__warnx(TIRPC_DEBUG_FLAG_SVC_VC,
+			"%s: fd %d svc_xprt_lookup failed",
+			__func__, sock);
+		return (NULL);
+	}
+	if (!(xprt->xp_flags & SVC_XPRT_FLAG_INITIAL)) {
+		/* already a transport */
+		rpc_dplx_rui(REC_XPRT(xprt));
+		SVC_RELEASE(xprt, SVC_RELEASE_FLAG_NONE);
+		return (NULL);
+	}
+	sd = SHM_DR(REC_XPRT(xprt));
+
+	sd->sh_dr.pagesz = sysconf(_SC_PAGESIZE);
+	if (map)
+		svc_shm_xprt_attach(sd, map, lay, server);
+
+	/* duplex streams are not used, records are in the ring */
+	xdrmem_create(sd->sh_dr.ioq.xdrs, NULL, 0, XDR_ENCODE);
+
+	atomic_set_uint16_t_bits(&xprt->xp_flags, (flags & SVC_XPRT_FLAG_CLOSE)
+						  | SVC_XPRT_FLAG_INITIALIZED);
+
+	__rpc_address_setup(&xprt->xp_local);
+	rc = getsockname(sock, xprt->xp_local.nb.buf,
+			 &xprt->xp_local.nb.len);
+	if (rc < 0)
+		xprt->xp_local.nb.len = 0;
+
+	__rpc_address_setup(&xprt->xp_remote);
+	rc = getpeername(sock, xprt->xp_remote.nb.buf,
+			 &xprt->xp_remote.nb.len);
+	if (rc < 0)
+		xprt->xp_remote.nb.len = 0;
+
+	xprt->xp_netid = mem_strdup("shm");
+
+	/* release */
+	rpc_dplx_rui(REC_XPRT(xprt));
+	XPRT_TRACE(xprt, __func__, __func__, __LINE__);
+
+	return (xprt);
+}
+
+/*
+ * Usage:
+ * xprt = svc_shm_ncreatef(sock, send_ring_max, recv_ring_max, flags);
+ *
+ * Creates, registers, and returns a shared memory rendezvous transport
+ * on an AF_UNIX stream socket.  The sizes limit the rings a client may
+ * ask for; 0 => SVC_SHM_RING_MAX.
+ */
+SVCXPRT *
+svc_shm_ncreatef(const int fd, const u_int sendsz, const u_int recvsz,
+		 const uint32_t flags)
+{
+	SVCXPRT *xprt;
+	struct rpc_dplx_rec *rec;
+	struct svc_shm_xprt *sd;
+	u_int xp_flags;
+	int rc;
+
+	/* atomically find or create shared fd state; ref+1; locked */
+	xprt = svc_xprt_lookup(fd, svc_shm_xprt_setup);
+	if (!xprt) {
+		__warnx(TIRPC_DEBUG_FLAG_SVC_VC,
+			"%s: fd %d svc_xprt_lookup failed",
+			__func__, fd);
+		return (NULL);
+	}
+	rec = REC_XPRT(xprt);
+
+	xp_flags = atomic_postset_uint16_t_bits(&xprt->xp_flags,
+						(flags & SVC_XPRT_FLAG_CLOSE)
+						| SVC_XPRT_FLAG_INITIALIZED);
+	if (xp_flags & SVC_XPRT_FLAG_INITIALIZED) {
+		rpc_dplx_rui(rec);
+		XPRT_TRACE(xprt, __func__, __func__, __LINE__);
+		return (xprt);
+	}
+
+	__rpc_address_setup(&xprt->xp_local);
+	rc = getsockname(fd, xprt->xp_local.nb.buf, &xprt->xp_local.nb.len);
+	if (rc < 0 || xprt->xp_local.ss.ss_family != AF_LOCAL) {
+		atomic_clear_uint16_t_bits(&xprt->xp_flags,
+					   SVC_XPRT_FLAG_INITIALIZED);
+		rpc_dplx_rui(rec);
+		__warnx(TIRPC_DEBUG_FLAG_ERROR,
+			"%s: fd %d not AF_LOCAL (%d)",
+			 __func__, fd, rc);
+		return (NULL);
+	}
+
+	sd = SHM_DR(rec);
+	sd->sh_dr.sendsz = sendsz ? svc_shm_ring_size(sendsz)
+				  : SVC_SHM_RING_MAX;
+	sd->sh_dr.recvsz = recvsz ? svc_shm_ring_size(recvsz)
+				  : SVC_SHM_RING_MAX;
+	sd->sh_dr.pagesz = sysconf(_SC_PAGESIZE);
+	sd->sh_dr.maxrec = __svc_maxrec;
+
+	/* duplex streams are not used by the rendezvous transport */
+	xdrmem_create(sd->sh_dr.ioq.xdrs, NULL, 0, XDR_ENCODE);
+
+	svc_shm_rendezvous_ops(xprt);
+
+	/* caller should know what it's doing */
+	if (flags & SVC_CREATE_FLAG_LISTEN) {
+		__warnx(TIRPC_DEBUG_FLAG_SVC_VC,
+			"%s: fd %d listen",
+			 __func__, fd);
+		listen(fd, SOMAXCONN);
+	}
+
+	xprt->xp_netid = mem_strdup("shm");
+
+	/* Conditional register */
+	if ((!(__svc_params->flags & SVC_FLAG_NOREG_XPRTS)
+	     && !(flags & SVC_CREATE_FLAG_XPRT_NOREG))
+	    || (flags & SVC_CREATE_FLAG_XPRT_DOREG))
+		svc_rqst_evchan_reg(__svc_params->ev_u.evchan.id, xprt,
+				    SVC_RQST_FLAG_LOCKED |
+				    SVC_RQST_FLAG_CHAN_AFFINITY);
+
+	/* release */
+	rpc_dplx_rui(rec);
+	XPRT_TRACE(xprt, __func__, __func__, __LINE__);
+
+	return (xprt);
+}
+
+/*
+ * The client handshake is synchronous; 0 clears the timeouts.
+ */
+static void
+svc_shm_timeout(int sock, time_t sec)
+{
+	struct timeval tv = {
+		.tv_sec = sec,
+		.tv_usec = 0,
+	};
+
+	(void) setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+	(void) setsockopt(sock, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+}
+
+/*
+ * Receive the hello, with the memfd.  Returns 0, EAGAIN before it has
+ * arrived, or another error.
+ */
+static int
+svc_shm_hello_recv(int sock, int *memfd)
+{
+	union {
+		struct cmsghdr cm;
+		char buf[CMSG_SPACE(sizeof(int))];
+	} u;
+	struct svc_shm_hello hello;
+	struct iovec iov = {
+		.iov_base = &hello,
+		.iov_len = sizeof(hello),
+	};
+	struct msghdr msg = {
+		.msg_iov = &iov,
+		.msg_iovlen = 1,
+		.msg_control = u.buf,
+		.msg_controllen = sizeof(u.buf),
+	};
+	struct cmsghdr *cmsg;
+	ssize_t rlen;
+	int n = 0;
+	int i;
+
+	rlen = recvmsg(sock, &msg, MSG_DONTWAIT | MSG_CMSG_CLOEXEC);
+	if (rlen < 0 && (errno == EAGAIN || errno == EINTR))
+		return (EAGAIN);
+
+	for (cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+		if (cmsg->cmsg_level != SOL_SOCKET
+		 || cmsg->cmsg_type != SCM_RIGHTS)
+			continue;
+		n = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+		if (n > 1) {
+			/* not ours to keep */
+			for (i = 0; i < n; i++)
+				close(((int *)CMSG_DATA(cmsg))[i]);
+			n = 0;
+			break;
+		}
+		memcpy(memfd, CMSG_DATA(cmsg), n * sizeof(int));
+		break;
+	}
+
+	if (rlen != sizeof(hello) || n != 1
+	 || (msg.msg_flags & MSG_CTRUNC)
+	 || hello.magic != SVC_SHM_MAGIC
+	 || hello.version != SVC_SHM_VERSION) {
+		__warnx(TIRPC_DEBUG_FLAG_ERROR,
+			"%s: fd %d bad hello (%zd, %d)",
+			__func__, sock, rlen, n);
+		if (n)
+			close(*memfd);
+		return (EPROTO);
+	}
+	return (0);
+}
+
+/*
+ * The first event on an accepted connection: map the client's rings,
+ * and answer.
+ */
+static enum xprt_stat
+svc_shm_hello(SVCXPRT *xprt)
+{
+	struct svc_shm_xprt *req_sd = SHM_DR(REC_XPRT(xprt->xp_parent));
+	struct svc_shm_xprt *sd = SHM_DR(REC_XPRT(xprt));
+	struct svc_shm_layout lay;
+	struct svc_shm_map *map;
+	uint32_t status;
+	int memfd;
+	int code;
+
+	code = svc_shm_hello_recv(xprt->xp_fd, &memfd);
+	if (code == EAGAIN) {
+		if (unlikely(svc_rqst_rearm_events(xprt))) {
+			__warnx(TIRPC_DEBUG_FLAG_ERROR,
+				"%s: %p fd %d svc_rqst_rearm_events failed (will set dead)",
+				__func__, xprt, xprt->xp_fd);
+			SVC_DESTROY(xprt);
+		}
+		return SVC_STAT(xprt);
+	}
+	if (code) {
+		SVC_DESTROY(xprt);
+		return SVC_STAT(xprt);
+	}
+
+	map = svc_shm_map(memfd, &lay);
+	close(memfd);
+	status = EINVAL;
+	if (map
+	 && lay.ring[SVC_SHM_RING_CALL] <= req_sd->sh_dr.recvsz
+	 && lay.ring[SVC_SHM_RING_REPLY] <= req_sd->sh_dr.sendsz) {
+		svc_shm_xprt_attach(sd, map, &lay, true);
+		status = 0;
+	}
+
+	/* the client waits for this, nothing else is queued */
+	if (send(xprt->xp_fd, &status, sizeof(status),
+		 MSG_DONTWAIT | MSG_NOSIGNAL) != sizeof(status)
+	 && !status)
+		status = errno;
+
+	if (status) {
+		__warnx(TIRPC_DEBUG_FLAG_SVC_VC,
+			"%s: %p fd %d refused (%" PRIu32 ")",
+			__func__, xprt, xprt->xp_fd, status);
+		if (map && !sd->sh_map)
+			munmap(map, lay.size);
+		SVC_DESTROY(xprt);
+		return SVC_STAT(xprt);
+	}
+
+	if (unlikely(svc_rqst_rearm_events(xprt))) {
+		__warnx(TIRPC_DEBUG_FLAG_ERROR,
+			"%s: %p fd %d svc_rqst_rearm_events failed (will set dead)",
+			__func__, xprt, xprt->xp_fd);
+		SVC_DESTROY(xprt);
+	}
+	return SVC_STAT(xprt);
+}
+
+ /*ARGSUSED*/
+static enum xprt_stat
+svc_shm_rendezvous(SVCXPRT *xprt)
+{
+	SVCXPRT *newxprt;
+	int fd;
+
+ again:
+	fd = accept4(xprt->xp_fd, NULL, NULL, SOCK_CLOEXEC);
+	if (fd < 0) {
+		if (errno == EINTR)
+			goto again;
+		return (XPRT_DIED);
+	}
+	if (unlikely(svc_rqst_rearm_events(xprt))) {
+		__warnx(TIRPC_DEBUG_FLAG_ERROR,
+			"%s: %p fd %d svc_rqst_rearm_events failed (will set dead)",
+			__func__, xprt, xprt->xp_fd);
+		close(fd);
+		return (XPRT_DIED);
+	}
+
+	/* the hello is the first event, see svc_shm_hello() */
+	newxprt = svc_shm_xprt_create(fd, NULL, NULL, true,
+				      SVC_XPRT_FLAG_CLOSE);
+	if (!newxprt) {
+		__warnx(TIRPC_DEBUG_FLAG_SVC_VC,
+			"%s: fd %d refused (%d)",
+			__func__, fd, ENOMEM);
+		close(fd);
+		return (XPRT_IDLE);
+	}
+
+	svc_shm_override_ops(newxprt, xprt);
+	XPRT_TRACE(newxprt, __func__, __func__, __LINE__);
+
+	SVC_REF(xprt, SVC_REF_FLAG_NONE);
+	newxprt->xp_parent = xprt;
+	if (xprt->xp_dispatch.rendezvous_cb(newxprt)
+	 || svc_rqst_xprt_register(newxprt, xprt)) {
+		SVC_DESTROY(newxprt);
+		return (XPRT_DESTROYED);
+	}
+	return (XPRT_IDLE);
+}
+
+/*
+ * Client side of the handshake, on a connected AF_UNIX socket.
+ *
+ * The sizes are the call (send) and reply (receive) rings; 0 => default.
+ * The largest record is half of its ring.
+ */
+SVCXPRT *
+svc_shm_connect(const int sock, const u_int sendsz, const u_int recvsz,
+		const uint32_t flags, struct rpc_err *err)
+{
+	union {
+		struct cmsghdr cm;
+		char buf[CMSG_SPACE(sizeof(int))];
+	} u;
+	struct svc_shm_hello hello = {
+		.magic = SVC_SHM_MAGIC,
+		.version = SVC_SHM_VERSION,
+	};
+	struct iovec iov = {
+		.iov_base = &hello,
+		.iov_len = sizeof(hello),
+	};
+	struct msghdr msg = {
+		.msg_iov = &iov,
+		.msg_iovlen = 1,
+		.msg_control = u.buf,
+		.msg_controllen = sizeof(u.buf),
+	};
+	struct cmsghdr *cmsg;
+	struct svc_shm_layout lay;
+	struct svc_shm_map *map = NULL;
+	SVCXPRT *xprt = NULL;
+	uint32_t status;
+	uint32_t callsz = svc_shm_ring_size(sendsz);
+	uint32_t replysz = svc_shm_ring_size(recvsz);
+	size_t size = SVC_SHM_HDR_SIZE + (size_t)callsz + replysz;
+	int memfd;
+
+	err->re_status = RPC_SYSTEMERROR;
+
+	memfd = memfd_create("ntirpc-shm", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+	if (memfd < 0
+	 || ftruncate(memfd, size) < 0
+	 || fcntl(memfd, F_ADD_SEALS,
+		  F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL) < 0) {
+		err->re_errno = errno;
+		goto out;
+	}
+
+	map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, memfd, 0);
+	if (map == MAP_FAILED) {
+		err->re_errno = errno;
+		map = NULL;
+		goto out;
+	}
+	map->mp_magic = SVC_SHM_MAGIC;
+	map->mp_version = SVC_SHM_VERSION;
+	map->mp_ring[SVC_SHM_RING_CALL].sr_offset = SVC_SHM_HDR_SIZE;
+	map->mp_ring[SVC_SHM_RING_CALL].sr_size = callsz;
+	map->mp_ring[SVC_SHM_RING_CALL].sr_sleeping = 1;
+	map->mp_ring[SVC_SHM_RING_REPLY].sr_offset = SVC_SHM_HDR_SIZE + callsz;
+	map->mp_ring[SVC_SHM_RING_REPLY].sr_size = replysz;
+	map->mp_ring[SVC_SHM_RING_REPLY].sr_sleeping = 1;
+	lay.size = size;
+	lay.offset[SVC_SHM_RING_CALL] = SVC_SHM_HDR_SIZE;
+	lay.offset[SVC_SHM_RING_REPLY] = SVC_SHM_HDR_SIZE + callsz;
+	lay.ring[SVC_SHM_RING_CALL] = callsz;
+	lay.ring[SVC_SHM_RING_REPLY] = replysz;
+
+	cmsg = CMSG_FIRSTHDR(&msg);
+	cmsg->cmsg_level = SOL_SOCKET;
+	cmsg->cmsg_type = SCM_RIGHTS;
+	cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+	memcpy(CMSG_DATA(cmsg), &memfd, sizeof(int));
+
+	svc_shm_timeout(sock, SVC_SHM_TIMEOUT);
+	if (sendmsg(sock, &msg, MSG_NOSIGNAL) != sizeof(hello)
+	 || recv(sock, &status, sizeof(status), MSG_WAITALL)
+	    != sizeof(status)) {
+		err->re_status = RPC_CANTRECV;
+		err->re_errno = errno;
+		goto out;
+	}
+	svc_shm_timeout(sock, 0);
+	if (status) {
+		__warnx(TIRPC_DEBUG_FLAG_CLNT_VC,
+			"%s: fd %d refused (%" PRIu32 ")",
+			__func__, sock, status);
+		err->re_errno = status;
+		goto out;
+	}
+
+	xprt = svc_shm_xprt_create(sock, map, &lay, false, flags);
+	if (!xprt) {
+		err->re_status = RPC_TLIERROR;
+		err->re_errno = ENOMEM;
+		goto out;
+	}
+	svc_shm_override_ops(xprt, NULL);
+	close(memfd);
+	err->re_status = RPC_SUCCESS;
+	return (xprt);
+
+ out:
+	if (map)
+		munmap(map, size);
+	if (memfd >= 0)
+		close(memfd);
+	return (NULL);
+}
+
+/*
+ * Copy a record into the send ring, waiting for space.
+ * Consumes the xdr_ioq.
+ */
+enum xprt_stat
+svc_shm_send(SVCXPRT *xprt, struct xdr_ioq *xioq)
+{
+	struct svc_shm_xprt *sd = SHM_DR(REC_XPRT(xprt));
+	struct timespec ts = {
+		.tv_sec = 0,
+		.tv_nsec = 1000,
+	};
+	struct timespec deadline = {
+		.tv_sec = 0,
+		.tv_nsec = 0,
+	};
+	struct timespec now;
+	struct svc_shm_mark *mark;
+	struct poolq_entry *have;
+	struct xdr_ioq_uv *uv;
+	uint8_t *dst;
+	uint64_t used;
+	uint32_t mask = sd->sh_txsize - 1;
+	uint32_t off;
+	uint32_t skip;
+	size_t need;
+	size_t len = 0;
+
+	xdr_tail_update(xioq->xdrs);
+	TAILQ_FOREACH(have, &xioq->ioq_uv.uvqh.qh, q) {
+		len += ioquv_length(IOQ_(have));
+	}
+	need = sizeof(struct svc_shm_mark) + SVC_SHM_ALIGN(len);
+
+	if (unlikely(!sd->sh_map)) {
+		/* before the hello */
+		XDR_DESTROY(xioq->xdrs);
+		return (XPRT_DIED);
+	}
+
+	if (unlikely(need > sd->sh_txsize / 2)) {
+		__warnx(TIRPC_DEBUG_FLAG_ERROR,
+			"%s: %p fd %d record %zu over ring %" PRIu32,
+			__func__, xprt, xprt->xp_fd, len, sd->sh_txsize);
+		XDR_DESTROY(xioq->xdrs);
+		return (XPRT_DIED);
+	}
+
+	mutex_lock(&sd->sh_txlock);
+	for (;;) {
+		off = sd->sh_txpos & mask;
+		skip = (sd->sh_txsize - off < need) ? sd->sh_txsize - off : 0;
+		used = sd->sh_txpos - atomic_fetch_uint64_t(&sd->sh_tx->sr_head);
+
+		if (unlikely(used > sd->sh_txsize
+			  || atomic_fetch_uint32_t(&sd->sh_map->mp_closed)
+			  || (xprt->xp_flags & SVC_XPRT_FLAG_DESTROYED))) {
+			mutex_unlock(&sd->sh_txlock);
+			__warnx(TIRPC_DEBUG_FLAG_SVC_VC,
+				"%s: %p fd %d closed (will set dead)",
+				__func__, xprt, xprt->xp_fd);
+			XDR_DESTROY(xioq->xdrs);
+			SVC_DESTROY(xprt);
+			return (XPRT_DIED);
+		}
+		if (used + skip + need <= sd->sh_txsize)
+			break;
+
+		/* released by the peer, not signalled */
+		(void)clock_gettime(CLOCK_MONOTONIC_FAST, &now);
+		if (!timespecisset(&deadline)) {
+			deadline = now;
+			deadline.tv_sec += SVC_SHM_TIMEOUT;
+		} else if (unlikely(timespeccmp(&now, &deadline, >=))) {
+			mutex_unlock(&sd->sh_txlock);
+			__warnx(TIRPC_DEBUG_FLAG_ERROR,
+				"%s: %p fd %d ring full (will set dead)",
+				__func__, xprt, xprt->xp_fd);
+			XDR_DESTROY(xioq->xdrs);
+			SVC_DESTROY(xprt);
+			return (XPRT_DIED);
+		}
+		nanosleep(&ts, NULL);
+		if (ts.tv_nsec < 1000000)
+			ts.tv_nsec <<= 1;
+	}
+
+	if (skip) {
+		mark = (struct svc_shm_mark *)(sd->sh_txdata + off);
+		mark->mk_len = SVC_SHM_WRAP;
+		sd->sh_txpos += skip;
+		off = 0;
+	}
+
+	mark = (struct svc_shm_mark *)(sd->sh_txdata + off);
+	mark->mk_len = len;
+	dst = (uint8_t *)&mark[1];
+	TAILQ_FOREACH(have, &xioq->ioq_uv.uvqh.qh, q) {
+		uv = IOQ_(have);
+		memcpy(dst, uv->v.vio_head, ioquv_length(uv));
+		dst += ioquv_length(uv);
+	}
+	sd->sh_txpos += need;
+
+	/* publish, then look for a sleeping consumer */
+	atomic_store_uint64_t(&sd->sh_tx->sr_tail, sd->sh_txpos);
+	mutex_unlock(&sd->sh_txlock);
+
+	if (atomic_fetch_uint32_t(&sd->sh_tx->sr_sleeping)
+	 && atomic_postclear_uint32_t_bits(&sd->sh_tx->sr_sleeping, 1))
+		svc_shm_signal(xprt->xp_fd);
+
+	XDR_DESTROY(xioq->xdrs);
+	return (XPRT_IDLE);
+}
+
+/*
+ * Release a received record.  The consumer head follows the oldest
+ * record still held.
+ */
+static void
+svc_shm_release(struct xdr_uio *uio, u_int flags)
+{
+	struct svc_shm_held *held =
+		opr_containerof(IOQU(uio), struct svc_shm_held, sh_uv);
+	SVCXPRT *xprt = held->sh_xprt;
+	struct svc_shm_xprt *sd = SHM_DR(REC_XPRT(xprt));
+	struct svc_shm_held *first;
+
+	mutex_lock(&sd->sh_rxlock);
+	held->sh_done = true;
+	while ((first = TAILQ_FIRST(&sd->sh_held)) && first->sh_done) {
+		TAILQ_REMOVE(&sd->sh_held, first, sh_q);
+		mem_free(first, sizeof(*first));
+	}
+	atomic_store_uint64_t(&sd->sh_rx->sr_head,
+			      first ? first->sh_pos : sd->sh_rxpos);
+	mutex_unlock(&sd->sh_rxlock);
+
+	SVC_RELEASE(xprt, SVC_RELEASE_FLAG_NONE);
+}
+
+/*
+ * Take the next record from the receive ring, if any.
+ * The peer's indices and lengths are checked against the ring.
+ */
+static int
+svc_shm_take(SVCXPRT *xprt, struct svc_shm_held **heldp)
+{
+	struct svc_shm_xprt *sd = SHM_DR(REC_XPRT(xprt));
+	struct svc_shm_held *held;
+	struct svc_shm_mark *mark;
+	struct xdr_ioq_uv *uv;
+	uint64_t tail = atomic_fetch_uint64_t(&sd->sh_rx->sr_tail);
+	uint64_t avail;
+	uint32_t off;
+	uint32_t len;
+	uint32_t need;
+	int code = 0;
+
+	*heldp = NULL;
+	mutex_lock(&sd->sh_rxlock);
+	while ((avail = tail - sd->sh_rxpos) != 0) {
+		if (avail > sd->sh_rxsize) {
+			code = EPROTO;
+			break;
+		}
+		off = sd->sh_rxpos & (sd->sh_rxsize - 1);
+		mark = (struct svc_shm_mark *)(sd->sh_rxdata + off);
+		len = atomic_fetch_uint32_t(&mark->mk_len);
+
+		if (len == SVC_SHM_WRAP) {
+			need = sd->sh_rxsize - off;
+			if (need > avail) {
+				code = EPROTO;
+				break;
+			}
+			sd->sh_rxpos += need;
+			continue;
+		}
+
+		need = sizeof(struct svc_shm_mark) + SVC_SHM_ALIGN(len);
+		if (!len || len > sd->sh_rxsize
+		 || need > avail || need > sd->sh_rxsize - off) {
+			code = EPROTO;
+			break;
+		}
+
+		held = mem_zalloc(sizeof(*held));
+		held->sh_xprt = xprt;
+		held->sh_pos = sd->sh_rxpos;
+
+		uv = &held->sh_uv;
+		uv->v.vio_base = (uint8_t *)&mark[1];
+		uv->v.vio_head = uv->v.vio_base;
+		uv->v.vio_tail = uv->v.vio_base + len;
+		uv->v.vio_wrap = uv->v.vio_tail;
+		uv->u.uio_release = svc_shm_release;
+		uv->u.uio_references = 1;	/* starting one */
+
+		TAILQ_INSERT_TAIL(&sd->sh_held, held, sh_q);
+		sd->sh_rxpos += need;
+		SVC_REF(xprt, SVC_REF_FLAG_NONE);
+		*heldp = held;
+		break;
+	}
+	if (TAILQ_EMPTY(&sd->sh_held))
+		atomic_store_uint64_t(&sd->sh_rx->sr_head, sd->sh_rxpos);
+	mutex_unlock(&sd->sh_rxlock);
+
+	return (code);
+}
+
+/*
+ * Nothing more to receive, after asking the producer for a signal.
+ */
+static inline bool
+svc_shm_idle(struct svc_shm_xprt *sd)
+{
+	if (atomic_fetch_uint64_t(&sd->sh_rx->sr_tail) != sd->sh_rxpos)
+		return (false);
+	atomic_store_uint32_t(&sd->sh_rx->sr_sleeping, 1);
+	return (atomic_fetch_uint64_t(&sd->sh_rx->sr_tail) == sd->sh_rxpos);
+}
+
+/*
+ * Empty the doorbell.  False at end of file: the peer has closed the
+ * connection, or exited.
+ */
+static bool
+svc_shm_drain(SVCXPRT *xprt)
+{
+	uint8_t buf[64];
+	ssize_t n;
+
+	for (;;) {
+		n = recv(xprt->xp_fd, buf, sizeof(buf), MSG_DONTWAIT);
+		if (n == sizeof(buf))
+			continue;
+		if (n > 0)
+			return (true);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n < 0 && errno == EAGAIN)
+			return (true);
+		return (false);
+	}
+}
+
+static void
+svc_shm_more_task(struct work_pool_entry *wpe)
+{
+	struct svc_shm_xprt *sd =
+			opr_containerof(wpe, struct svc_shm_xprt, sh_wpe);
+	SVCXPRT *xprt = &sd->sh_dr.xprt;
+
+	atomic_clear_uint32_t_bits(&sd->sh_more, 1);
+	if (!(xprt->xp_flags & SVC_XPRT_FLAG_DESTROYED))
+		(void)SVC_RECV(xprt);
+	SVC_RELEASE(xprt, SVC_RELEASE_FLAG_NONE);
+}
+
+/*
+ * Have another thread take the next record.  The producer only rings
+ * the doorbell for an empty ring.
+ */
+static inline void
+svc_shm_more(SVCXPRT *xprt)
+{
+	struct svc_shm_xprt *sd = SHM_DR(REC_XPRT(xprt));
+
+	if (atomic_postset_uint32_t_bits(&sd->sh_more, 1))
+		return;
+
+	SVC_REF(xprt, SVC_REF_FLAG_NONE);
+	sd->sh_wpe.fun = svc_shm_more_task;
+	work_pool_submit(&svc_work_pool, &sd->sh_wpe);
+}
+
+static enum xprt_stat
+svc_shm_stat(SVCXPRT *xprt)
+{
+	if (xprt->xp_flags & SVC_XPRT_FLAG_DESTROYED)
+		return (XPRT_DESTROYED);
+
+	return (XPRT_IDLE);
+}
+
+static enum xprt_stat
+svc_shm_recv(SVCXPRT *xprt)
+{
+	struct svc_shm_xprt *sd = SHM_DR(REC_XPRT(xprt));
+	struct svc_shm_held *held;
+	struct xdr_ioq *xioq;
+	bool hangup;
+	int code;
+
+	if (unlikely(!sd->sh_map))
+		return (svc_shm_hello(xprt));
+
+	/* records are taken under sh_rxlock, so this may run on more
+	 * than one thread (svc_shm_more).
+	 */
+	hangup = !svc_shm_drain(xprt);
+
+	code = svc_shm_take(xprt, &held);
+	if (!code && !held && !svc_shm_idle(sd))
+		code = svc_shm_take(xprt, &held);
+	if (unlikely(code)) {
+		__warnx(TIRPC_DEBUG_FLAG_ERROR,
+			"%s: %p fd %d bad ring (will set dead)",
+			__func__, xprt, xprt->xp_fd);
+		SVC_DESTROY(xprt);
+		return SVC_STAT(xprt);
+	}
+
+	if (!held) {
+		if (hangup || atomic_fetch_uint32_t(&sd->sh_map->mp_closed)) {
+			__warnx(TIRPC_DEBUG_FLAG_SVC_VC,
+				"%s: %p fd %d closed (will set dead)",
+				__func__, xprt, xprt->xp_fd);
+			SVC_DESTROY(xprt);
+			return SVC_STAT(xprt);
+		}
+		if (unlikely(svc_rqst_rearm_events(xprt))) {
+			__warnx(TIRPC_DEBUG_FLAG_ERROR,
+				"%s: %p fd %d svc_rqst_rearm_events failed (will set dead)",
+				__func__, xprt, xprt->xp_fd);
+			SVC_DESTROY(xprt);
+		}
+		return SVC_STAT(xprt);
+	}
+
+	if (!svc_shm_idle(sd))
+		svc_shm_more(xprt);
+
+	xioq = xdr_ioq_create(sd->sh_dr.pagesz, sd->sh_dr.maxrec,
+			      UIO_FLAG_BUFQ);
+	(xioq->ioq_uv.uvqh.qcount)++;
+	TAILQ_INSERT_TAIL(&xioq->ioq_uv.uvqh.qh, &held->sh_uv.uvq, q);
+	xdr_ioq_reset(xioq, 0);
+
+	if (xprt->xp_cksum & RPC_CKSUM_FULL) {
+		svc_cksum_record(xprt->xp_cksum, xioq, held->sh_uv.v.vio_head,
+				 ioquv_length(&held->sh_uv));
+	}
+
+	__warnx(TIRPC_DEBUG_FLAG_SVC_VC,
+		"%s: %p fd %d record %zu",
+		__func__, xprt, xprt->xp_fd, ioquv_length(&held->sh_uv));
+
+	if (unlikely(svc_rqst_rearm_events(xprt))) {
+		__warnx(TIRPC_DEBUG_FLAG_ERROR,
+			"%s: %p fd %d svc_rqst_rearm_events failed (will set dead)",
+			__func__, xprt, xprt->xp_fd);
+		xdr_ioq_destroy(xioq, xioq->ioq_s.qsize);
+		SVC_DESTROY(xprt);
+		return SVC_STAT(xprt);
+	}
+
+	return (__svc_params->request_cb(xprt, xioq->xdrs));
+}
+
+static enum xprt_stat
+svc_shm_decode(struct svc_req *req)
+{
+	XDR *xdrs = req->rq_xdrs;
+	SVCXPRT *xprt = req->rq_xprt;
+
+	xdrs->x_op = XDR_DECODE;
+	rpc_msg_init(&req->rq_msg);
+	req->rq_drc = NULL;	/* until svc_drc_start() */
+
+	if (!xdr_dplx_decode(xdrs, &req->rq_msg)) {
+		/* records are independent; only this one is lost */
+		__warnx(TIRPC_DEBUG_FLAG_ERROR,
+			"%s: %p fd %d failed",
+			__func__, xprt, xprt->xp_fd);
+		return SVC_STAT(xprt);
+	}
+
+	/* in order of likelihood */
+	if (req->rq_msg.rm_direction == CALL) {
+		/* an ordinary call header */
+		return xprt->xp_dispatch.process_cb(req);
+	}
+
+	if (req->rq_msg.rm_direction == REPLY) {
+		/* reply header (xprt OK) */
+		return clnt_req_process_reply(xprt, req);
+	}
+
+	__warnx(TIRPC_DEBUG_FLAG_WARN,
+		"%s: %p fd %d failed direction %" PRIu32,
+		__func__, xprt, xprt->xp_fd,
+		req->rq_msg.rm_direction);
+	return SVC_STAT(xprt);
+}
+
+static void
+svc_shm_checksum(struct svc_req *req, void *data, size_t length)
+{
+	if (req->rq_xprt->xp_cksum & RPC_CKSUM_FULL) {
+		struct xdr_ioq *xioq = XIOQ(req->rq_xdrs);
+
+		/* summed as received, or these (unwrapped) arguments */
+		req->rq_cksum = (xioq->ioq_cksum_args > 0)
+			? xioq->ioq_cksum
+			: rpc_cksum_update(req->rq_xprt->xp_cksum, 0,
+					   data, length);
+		return;
+	}
+	req->rq_cksum = rpc_cksum(RPC_CKSUM_TYPE(req->rq_xprt->xp_cksum),
+				  data, MIN(256, length));
+}
+
+static enum xprt_stat
+svc_shm_reply(struct svc_req *req)
+{
+	SVCXPRT *xprt = req->rq_xprt;
+	struct xdr_ioq *xioq;
+
+	/* XXX Until gss_get_mic and gss_wrap can be replaced with
+	 * iov equivalents, replies with RPCSEC_GSS security must be
+	 * encoded in a contiguous buffer.
+	 *
+	 * The first buffer is sized from earlier replies to this procedure.
+	 */
+	xioq = xdr_ioq_size_create(req->rq_msg.cb_prog, req->rq_msg.cb_vers,
+				   req->rq_msg.cb_proc, XDR_IOQ_SIZE_REPLY,
+				   __svc_params->ioq.send_max
+				   + RPC_MAXDATA_DEFAULT,
+				   (req->rq_msg.cb_cred.oa_flavor == RPCSEC_GSS)
+				   ? UIO_FLAG_REALLOC | UIO_FLAG_FREE
+				   : UIO_FLAG_FREE);
+
+	if (!xdr_reply_encode(xioq->xdrs, &req->rq_msg)) {
+		__warnx(TIRPC_DEBUG_FLAG_ERROR,
+			"%s: %p fd %d xdr_reply_encode failed (will set dead)",
+			__func__, xprt, xprt->xp_fd);
+		XDR_DESTROY(xioq->xdrs);
+		return (XPRT_DIED);
+	}
+	xdr_tail_update(xioq->xdrs);
+
+	if (req->rq_msg.rm_reply.rp_stat == MSG_ACCEPTED
+	 && req->rq_msg.rm_reply.rp_acpt.ar_stat == SUCCESS
+	 && req->rq_auth
+	 && !SVCAUTH_WRAP(req, xioq->xdrs)) {
+		__warnx(TIRPC_DEBUG_FLAG_ERROR,
+			"%s: %p fd %d SVCAUTH_WRAP failed (will set dead)",
+			__func__, xprt, xprt->xp_fd);
+		XDR_DESTROY(xioq->xdrs);
+		return (XPRT_DIED);
+	}
+	xdr_tail_update(xioq->xdrs);
+	xdr_ioq_size_update(xioq, req->rq_msg.cb_prog, req->rq_msg.cb_vers,
+			    req->rq_msg.cb_proc, XDR_IOQ_SIZE_REPLY);
+
+	if (req->rq_drc)
+		xioq = svc_drc_retain(req, xioq);
+
+	return (svc_shm_send(xprt, xioq));
+}
+
+static void
+svc_shm_destroy_task(struct work_pool_entry *wpe)
+{
+	struct rpc_dplx_rec *rec =
+			opr_containerof(wpe, struct rpc_dplx_rec, ioq.ioq_wpe);
+	struct svc_shm_xprt *sd = SHM_DR(rec);
+	uint16_t xp_flags;
+
+	__warnx(TIRPC_DEBUG_FLAG_REFCNT,
+		"%s() %p fd %d xp_refs %" PRIu32,
+		__func__, rec, rec->xprt.xp_fd, rec->xprt.xp_refs);
+
+	if (rec->xprt.xp_refs) {
+		/* instead of nanosleep */
+		work_pool_submit(&svc_work_pool, &(rec->ioq.ioq_wpe));
+		return;
+	}
+
+	/* the rendezvous transport has no mapping */
+	if (sd->sh_map)
+		munmap(sd->sh_map, sd->sh_mapsz);
+
+	xp_flags = atomic_postclear_uint16_t_bits(&rec->xprt.xp_flags,
+						  SVC_XPRT_FLAG_CLOSE);
+	if ((xp_flags & SVC_XPRT_FLAG_CLOSE)
+	    && rec->xprt.xp_fd != RPC_ANYFD) {
+		(void)close(rec->xprt.xp_fd);
+		rec->xprt.xp_fd = RPC_ANYFD;
+	}
+
+	if (rec->xprt.xp_ops->xp_free_user_data)
+		rec->xprt.xp_ops->xp_free_user_data(&rec->xprt);
+
+	if (rec->xprt.xp_tp)
+		mem_free(rec->xprt.xp_tp, 0);
+	if (rec->xprt.xp_netid)
+		mem_free(rec->xprt.xp_netid, 0);
+
+	if (rec->xprt.xp_parent)
+		SVC_RELEASE(rec->xprt.xp_parent, SVC_RELEASE_FLAG_NONE);
+
+	svc_shm_xprt_free(sd);
+}
+
+/*
+ * SVC_DESTROY(): client calls waiting for a slot are failed.
+ */
+static void
+svc_shm_destroying(SVCXPRT *xprt)
+{
+	clnt_req_slot_drain(REC_XPRT(xprt));
+}
+
+static void
+svc_shm_destroy_it(SVCXPRT *xprt, u_int flags, const char *tag,
+		   const int line)
+{
+	struct svc_shm_xprt *sd = SHM_DR(REC_XPRT(xprt));
+	struct timespec ts = {
+		.tv_sec = 0,
+		.tv_nsec = 0,
+	};
+
+	/* clears xprt from the xprt table (eg, idle scans) */
+	svc_rqst_xprt_unregister(xprt);
+
+	__warnx(TIRPC_DEBUG_FLAG_REFCNT,
+		"%s() %p fd %d xp_refs %" PRIu32
+		" should actually destroy things @ %s:%d",
+		__func__, xprt, xprt->xp_fd, xprt->xp_refs, tag, line);
+
+	if (sd->sh_map) {
+		/* the peer stops too */
+		atomic_store_uint32_t(&sd->sh_map->mp_closed, 1);
+		svc_shm_signal(xprt->xp_fd);
+	}
+
+	while (atomic_postset_uint16_t_bits(&(REC_XPRT(xprt)->ioq.ioq_s.qflags),
+					    IOQ_FLAG_WORKING)
+	       & IOQ_FLAG_WORKING) {
+		nanosleep(&ts, NULL);
+	}
+
+	REC_XPRT(xprt)->ioq.ioq_wpe.fun = svc_shm_destroy_task;
+	work_pool_submit(&svc_work_pool, &(REC_XPRT(xprt)->ioq.ioq_wpe));
+}
+
+ /*ARGSUSED*/
+static bool
+svc_shm_control(SVCXPRT *xprt, const u_int rq, void *in)
+{
+	switch (rq) {
+	case SVCGET_XP_FLAGS:
+		*(u_int *) in = xprt->xp_flags;
+		break;
+	case SVCSET_XP_FLAGS:
+		xprt->xp_flags = *(u_int *) in;
+		break;
+	case SVCGET_CONNMAXREC:
+		*(int *)in = REC_XPRT(xprt)->maxrec;
+		break;
+	case SVCGET_XP_CHECKSUM:
+		*(u_int *) in = xprt->xp_cksum;
+		break;
+	case SVCSET_XP_CHECKSUM:
+		if (RPC_CKSUM_TYPE(*(u_int *) in) > RPC_CKSUM_CRC32C_SW)
+			return (false);
+		xprt->xp_cksum = *(u_int *) in;
+		break;
+	case SVCGET_XP_FREE_USER_DATA:
+		mutex_lock(&ops_lock);
+		*(svc_xprt_fun_t *) in = xprt->xp_ops->xp_free_user_data;
+		mutex_unlock(&ops_lock);
+		break;
+	case SVCSET_XP_FREE_USER_DATA:
+		mutex_lock(&ops_lock);
+		xprt->xp_ops->xp_free_user_data = *(svc_xprt_fun_t) in;
+		mutex_unlock(&ops_lock);
+		break;
+	default:
+		return (FALSE);
+	}
+	return (TRUE);
+}
+
+static void
+svc_shm_override_ops(SVCXPRT *xprt, SVCXPRT *rendezvous)
+{
+	static struct xp_ops ops;
+
+	/* VARIABLES PROTECTED BY ops_lock: ops, xp_type */
+	mutex_lock(&ops_lock);
+
+	xprt->xp_type = XPRT_SHM;
+
+	if (ops.xp_recv == NULL) {
+		ops.xp_recv = svc_shm_recv;
+		ops.xp_stat = svc_shm_stat;
+		ops.xp_decode = svc_shm_decode;
+		ops.xp_reply = svc_shm_reply;
+		ops.xp_checksum = svc_shm_checksum;
+		ops.xp_destroy = svc_shm_destroy_it;
+		ops.xp_control = svc_shm_control;
+		ops.xp_free_user_data = NULL;	/* no default */
+		ops.xp_destroying = svc_shm_destroying;
+	}
+	svc_override_ops(&ops, rendezvous);
+	xprt->xp_ops = &ops;
+	if (rendezvous)
+		xprt->xp_cksum = rendezvous->xp_cksum;
+	mutex_unlock(&ops_lock);
+}
+
+static void
+svc_shm_rendezvous_ops(SVCXPRT *xprt)
+{
+	static struct xp_ops ops;
+
+	mutex_lock(&ops_lock);
+
+	xprt->xp_type = XPRT_SHM_RENDEZVOUS;
+
+	if (ops.xp_recv == NULL) {
+		ops.xp_recv = svc_shm_rendezvous;
+		ops.xp_stat = svc_rendezvous_stat;
+		ops.xp_decode = (svc_req_fun_t)abort;
+		ops.xp_reply = (svc_req_fun_t)abort;
+		ops.xp_checksum = NULL;		/* not used */
+		ops.xp_destroy = svc_shm_destroy_it;
+		ops.xp_control = svc_shm_control;
+		ops.xp_free_user_data = NULL;	/* no default */
+	}
+	xprt->xp_ops = &ops;
+	mutex_unlock(&ops_lock);
+}
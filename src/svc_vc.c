@@ -68,6 +68,7 @@
 #include <misc/timespec.h>
 #include <rpc/clnt.h>
 #include <rpc/rpc.h>
+#include <rpc/rpc_cksum.h>
 #include <rpc/svc.h>
 #include <rpc/svc_auth.h>
 #include <rpc/svc_rqst.h>
@@ -82,6 +83,8 @@
 
 static void svc_vc_rendezvous_ops(SVCXPRT *);
 static void svc_vc_override_ops(SVCXPRT *, SVCXPRT *);
+static void svc_vc_stream_done(struct svc_vc_xprt *);
+static bool svc_vc_quiesce(SVCXPRT *);
 
 /*
  * A record is composed of one or more record fragments.
@@ -124,7 +127,8 @@ svc_vc_xprt_free(struct svc_vc_xprt *xd)
 static struct svc_vc_xprt *
 svc_vc_xprt_zalloc(void)
 {
-	struct svc_vc_xprt *xd = mem_zalloc(sizeof(struct svc_vc_xprt));
+	struct svc_vc_xprt *xd = mem_zalloc_aligned(CACHE_LINE_SIZE,
+						    sizeof(struct svc_vc_xprt));
 
 	/* Init SVCXPRT locks, etc */
 	rpc_dplx_rec_init(&xd->sx_dr);
@@ -211,6 +215,8 @@ svc_vc_ncreatef(const int fd, const u_int sendsz, const u_int recvsz,
 	xd->sx_dr.recvsz = ((recvsize + 3) / 4) * 4;
 	xd->sx_dr.pagesz = sysconf(_SC_PAGESIZE);
 	xd->sx_dr.maxrec = __svc_maxrec;
+	if (flags & SVC_CREATE_FLAG_TLS)
+		xd->sx_tls = SVC_VC_TLS_OFFER;	/* inherited */
 
 	/* duplex streams are not used by the rendezvous transport */
 	xdrmem_create(xd->sx_dr.ioq.xdrs, NULL, 0, XDR_ENCODE);
@@ -489,6 +495,7 @@ svc_vc_rendezvous(SVCXPRT *xprt)
 	xd->sx_dr.recvsz = req_xd->sx_dr.recvsz;
 	xd->sx_dr.pagesz = req_xd->sx_dr.pagesz;
 	xd->sx_dr.maxrec = req_xd->sx_dr.maxrec;
+	xd->sx_tls = req_xd->sx_tls;
 
 	SVC_REF(xprt, SVC_REF_FLAG_NONE);
 	newxprt->xp_parent = xprt;
@@ -536,6 +543,12 @@ svc_vc_destroy_task(struct work_pool_entry *wpe)
 	if (rec->xprt.xp_parent)
 		SVC_RELEASE(rec->xprt.xp_parent, SVC_RELEASE_FLAG_NONE);
 
+	if (VC_DR(rec)->sx_stream_ioq)
+		svc_vc_stream_done(VC_DR(rec));
+
+#ifdef USE_TLS
+	rpc_tls_svc_free(VC_DR(rec));
+#endif
 	svc_vc_xprt_free(VC_DR(rec));
 }
 
@@ -584,6 +597,20 @@ svc_vc_control(SVCXPRT *xprt, const u_int rq, void *in)
 	case SVCSET_XP_FLAGS:
 		xprt->xp_flags = *(u_int *) in;
 		break;
+	case SVCGET_XP_CHECKSUM:
+		*(u_int *) in = xprt->xp_cksum;
+		break;
+	case SVCSET_XP_CHECKSUM:
+		if (RPC_CKSUM_TYPE(*(u_int *) in) > RPC_CKSUM_CRC32C_SW)
+			return (false);
+		xprt->xp_cksum = *(u_int *) in;
+		break;
+	case SVCGET_XP_TLS:
+		*(bool *) in = (VC_DR(REC_XPRT(xprt))->sx_tls
+				== SVC_VC_TLS_ACTIVE);
+		break;
+	case SVCSET_XP_QUIESCE:
+		return (svc_vc_quiesce(xprt));
 	case SVCGET_XP_FREE_USER_DATA:
 		mutex_lock(&ops_lock);
 		*(svc_xprt_fun_t *) in = xprt->xp_ops->xp_free_user_data;
@@ -612,6 +639,18 @@ svc_vc_rendezvous_control(SVCXPRT *xprt, const u_int rq, void *in)
 	case SVCSET_CONNMAXREC:
 		xd->sx_dr.maxrec = *(int *)in;
 		break;
+	case SVCGET_XP_CHECKSUM:
+		*(u_int *) in = xprt->xp_cksum;
+		break;
+	case SVCSET_XP_CHECKSUM:
+		if (RPC_CKSUM_TYPE(*(u_int *) in) > RPC_CKSUM_CRC32C_SW)
+			return (false);
+		xprt->xp_cksum = *(u_int *) in;
+		break;
+	case SVCGET_XP_TLS:
+		*(bool *) in = (VC_DR(REC_XPRT(xprt))->sx_tls
+				== SVC_VC_TLS_ACTIVE);
+		break;
 	case SVCGET_XP_FREE_USER_DATA:
 		mutex_lock(&ops_lock);
 		*(svc_xprt_fun_t *) in = xprt->xp_ops->xp_free_user_data;
@@ -628,6 +667,372 @@ svc_vc_rendezvous_control(SVCXPRT *xprt, const u_int rq, void *in)
 	return (TRUE);
 }
 
+/*
+ * Header-split receive pool of page-aligned bulk buffers.
+ *
+ * Buffers are returned here by xdr_ioq_uv_release(), possibly long after
+ * the request, when the program holds them via XDR_GETBUFS().
+ */
+static struct poolq_head svc_vc_split_pool = {
+	.qh = TAILQ_HEAD_INITIALIZER(svc_vc_split_pool.qh),
+	.qmutex = PTHREAD_MUTEX_INITIALIZER,
+};
+
+static void
+svc_vc_split_release(struct xdr_uio *uio, u_int flags)
+{
+	struct xdr_ioq_uv *uv = IOQU(uio);
+
+	pthread_mutex_lock(&svc_vc_split_pool.qmutex);
+	if (svc_vc_split_pool.qcount < __svc_params->split.pool_max) {
+		uv->u.uio_references = 1;	/* keeping one */
+		(svc_vc_split_pool.qcount)++;
+		TAILQ_INSERT_TAIL(&svc_vc_split_pool.qh, &uv->uvq, q);
+		pthread_mutex_unlock(&svc_vc_split_pool.qmutex);
+		return;
+	}
+	pthread_mutex_unlock(&svc_vc_split_pool.qmutex);
+
+	mem_free(uv->v.vio_base, ioquv_size(uv));
+	mem_free(uv, sizeof(*uv));
+}
+
+static struct xdr_ioq_uv *
+svc_vc_split_uv(u_int uio_flags)
+{
+	struct poolq_entry *have;
+	struct xdr_ioq_uv *uv;
+
+	pthread_mutex_lock(&svc_vc_split_pool.qmutex);
+	have = TAILQ_FIRST(&svc_vc_split_pool.qh);
+	if (have) {
+		TAILQ_REMOVE(&svc_vc_split_pool.qh, have, q);
+		(svc_vc_split_pool.qcount)--;
+	}
+	pthread_mutex_unlock(&svc_vc_split_pool.qmutex);
+
+	if (have) {
+		uv = IOQ_(have);
+	} else {
+		uv = mem_zalloc(sizeof(struct xdr_ioq_uv));
+		uv->v.vio_base = mem_aligned(__svc_params->split.pagesz,
+					     __svc_params->split.bsize);
+		uv->v.vio_wrap = uv->v.vio_base + __svc_params->split.bsize;
+		uv->u.uio_release = svc_vc_split_release;
+		uv->u.uio_references = 1;	/* starting one */
+	}
+	uv->v.vio_head = uv->v.vio_base;
+	uv->v.vio_tail = uv->v.vio_base;
+	uv->u.uio_flags = uio_flags;
+	return (uv);
+}
+
+/*
+ * Queue a receive buffer.  After streaming dispatch, the record is also
+ * being decoded, see svc_vc_stream_wait().
+ */
+static inline void
+svc_vc_append(struct svc_vc_xprt *xd, struct xdr_ioq *xioq,
+	      struct xdr_ioq_uv *uv)
+{
+	if (xd->sx_stream_ioq)
+		pthread_mutex_lock(&xioq->ioq_uv.uvqh.qmutex);
+	(xioq->ioq_uv.uvqh.qcount)++;
+	TAILQ_INSERT_TAIL(&xioq->ioq_uv.uvqh.qh, &uv->uvq, q);
+	if (xd->sx_stream_ioq)
+		pthread_mutex_unlock(&xioq->ioq_uv.uvqh.qmutex);
+}
+
+/*
+ * The current receive buffer is full, but the fragment is not.
+ *
+ * After the header region, ask the program where the bulk data begins.
+ * The remainder of the fragment is received directly into page-aligned
+ * pooled buffers; only bulk bytes already in the header region are copied.
+ */
+static struct xdr_ioq_uv *
+svc_vc_split(SVCXPRT *xprt, struct xdr_ioq *xioq, struct xdr_ioq_uv *uv)
+{
+	struct svc_vc_xprt *xd = VC_DR(REC_XPRT(xprt));
+	u_int flags = uv->u.uio_flags & UIO_FLAG_MORE;
+	struct xdr_ioq_uv *next;
+
+	if (xd->sx_split == SVC_VC_SPLIT_HDR) {
+		u_int len = ioquv_length(uv);
+		u_int offset = __svc_params->split.cb(xprt, uv->v.vio_head, len);
+
+		if (offset && offset <= len
+		 && !(offset & (BYTES_PER_XDR_UNIT - 1))) {
+			xd->sx_split = SVC_VC_SPLIT_BULK;
+			next = svc_vc_split_uv(flags);
+
+			len -= offset;
+			memcpy(next->v.vio_tail, uv->v.vio_head + offset, len);
+			next->v.vio_tail += len;
+			uv->v.vio_tail -= len;
+		} else {
+			xd->sx_split = SVC_VC_SPLIT_NONE;
+			next = xdr_ioq_uv_create(xd->sx_fbtbc,
+						 flags | UIO_FLAG_FREE);
+		}
+	} else if (xd->sx_split == SVC_VC_SPLIT_BULK) {
+		next = svc_vc_split_uv(flags);
+	} else {
+		next = xdr_ioq_uv_create(xd->sx_fbtbc, flags | UIO_FLAG_FREE);
+	}
+
+	svc_vc_append(xd, xioq, next);
+	return (next);
+}
+
+/*
+ * Streaming dispatch.
+ *
+ * A large record may be dispatched once the program has the leading
+ * bytes it asked for (see svc_init_params.stream_cb).  The receiver
+ * keeps appending to the record while it is decoded; the queue lock
+ * covers buffer tails and the buffer queue.  Decoding past the received
+ * data waits for more, or fails when the transport is destroyed.
+ *
+ * Whichever of the receiver and the decoder finishes with the record
+ * last destroys it (IOQ_FLAG_STREAM, IOQ_FLAG_RELEASED).
+ */
+static bool
+svc_vc_stream_wait(XDR *xdrs, u_int end)
+{
+	struct xdr_ioq *xioq = XIOQ(xdrs);
+	SVCXPRT *xprt = (SVCXPRT *)xdrs->x_lib[1];
+	struct poolq_entry *have;
+	u_int len;
+
+	while (xioq->ioq_s.qflags & IOQ_FLAG_STREAM) {
+		len = 0;
+		TAILQ_FOREACH(have, &xioq->ioq_uv.uvqh.qh, q) {
+			len += ioquv_length(IOQ_(have));
+		}
+		if (len >= end)
+			break;
+
+		if (xprt->xp_flags & SVC_XPRT_FLAG_DESTROYING) {
+			__warnx(TIRPC_DEBUG_FLAG_SVC_VC,
+				"%s: %p fd %d destroyed at %u of %u",
+				__func__, xprt, xprt->xp_fd, len, end);
+			return (false);
+		}
+
+		/* wakeups are from svc_vc_recv() and svc_vc_destroying() */
+		pthread_cond_wait(&xioq->ioq_cond, &xioq->ioq_uv.uvqh.qmutex);
+	}
+
+	/* the current buffer may have grown */
+	xdrs->x_v.vio_tail = IOQV(xdrs->x_base)->v.vio_tail;
+	return (true);
+}
+
+static bool
+svc_vc_stream_getunit(XDR *xdrs, uint32_t *p)
+{
+	struct xdr_ioq *xioq = XIOQ(xdrs);
+	bool result;
+
+	pthread_mutex_lock(&xioq->ioq_uv.uvqh.qmutex);
+	result = svc_vc_stream_wait(xdrs, XDR_GETPOS(xdrs) + sizeof(uint32_t))
+		&& xdr_ioq_getunit(xdrs, p);
+	pthread_mutex_unlock(&xioq->ioq_uv.uvqh.qmutex);
+	return (result);
+}
+
+static bool
+svc_vc_stream_getbytes(XDR *xdrs, char *addr, u_int len)
+{
+	struct xdr_ioq *xioq = XIOQ(xdrs);
+	bool result;
+
+	pthread_mutex_lock(&xioq->ioq_uv.uvqh.qmutex);
+	result = svc_vc_stream_wait(xdrs, XDR_GETPOS(xdrs) + len)
+		&& xdr_ioq_getbytes(xdrs, addr, len);
+	pthread_mutex_unlock(&xioq->ioq_uv.uvqh.qmutex);
+	return (result);
+}
+
+static bool
+svc_vc_stream_setpos(XDR *xdrs, u_int pos)
+{
+	struct xdr_ioq *xioq = XIOQ(xdrs);
+	bool result;
+
+	pthread_mutex_lock(&xioq->ioq_uv.uvqh.qmutex);
+	result = svc_vc_stream_wait(xdrs, pos)
+		&& xdr_ioq_ops.x_setpostn(xdrs, pos);
+	pthread_mutex_unlock(&xioq->ioq_uv.uvqh.qmutex);
+	return (result);
+}
+
+static bool
+svc_vc_stream_getbufs(XDR *xdrs, xdr_uio *uio, u_int len, u_int flags)
+{
+	struct xdr_ioq *xioq = XIOQ(xdrs);
+	bool result;
+
+	pthread_mutex_lock(&xioq->ioq_uv.uvqh.qmutex);
+	result = svc_vc_stream_wait(xdrs, XDR_GETPOS(xdrs) + len)
+		&& xdr_ioq_ops.x_getbufs(xdrs, uio, len, flags);
+	pthread_mutex_unlock(&xioq->ioq_uv.uvqh.qmutex);
+	return (result);
+}
+
+static void
+svc_vc_stream_destroy(XDR *xdrs)
+{
+	struct xdr_ioq *xioq = XIOQ(xdrs);
+	uint16_t qflags;
+
+	pthread_mutex_lock(&xioq->ioq_uv.uvqh.qmutex);
+	qflags = xioq->ioq_s.qflags;
+	xioq->ioq_s.qflags |= IOQ_FLAG_RELEASED;
+	pthread_mutex_unlock(&xioq->ioq_uv.uvqh.qmutex);
+
+	if (!(qflags & IOQ_FLAG_STREAM))
+		xdr_ioq_ops.x_destroy(xdrs);
+}
+
+static u_int
+svc_vc_stream_getpos(XDR *xdrs)
+{
+	return (xdr_ioq_ops.x_getpostn(xdrs));
+}
+
+static bool
+svc_vc_stream_control(XDR *xdrs, int rq, void *in)
+{
+	return (xdr_ioq_ops.x_control(xdrs, rq, in));
+}
+
+static bool
+svc_vc_stream_putbufs(XDR *xdrs, xdr_uio *uio, u_int flags)
+{
+	return (xdr_ioq_ops.x_putbufs(xdrs, uio, flags));
+}
+
+static const struct xdr_ops svc_vc_stream_ops = {
+	svc_vc_stream_getunit,
+	xdr_ioq_putunit,
+	svc_vc_stream_getbytes,
+	xdr_ioq_putbytes,
+	svc_vc_stream_getpos,
+	svc_vc_stream_setpos,
+	svc_vc_stream_destroy,
+	svc_vc_stream_control,
+	svc_vc_stream_getbufs,
+	svc_vc_stream_putbufs
+};
+
+/*
+ * SVC_DESTROY() while a dispatched record is still receiving: its decoder
+ * holds a reference, so svc_vc_destroy() waits on it.  Wake it instead.
+ * xp_lock orders this against svc_vc_stream_done().
+ *
+ * Client calls waiting for a slot are failed, unless the connection is
+ * to be replaced (they move, see clnt_vc_replace()).
+ */
+static void
+svc_vc_destroying(SVCXPRT *xprt)
+{
+	struct rpc_dplx_rec *rec = REC_XPRT(xprt);
+	struct svc_vc_xprt *xd = VC_DR(rec);
+	struct xdr_ioq *xioq;
+	bool drain;
+
+	mutex_lock(&xprt->xp_lock);
+	xioq = xd->sx_stream_ioq;
+	if (xioq) {
+		pthread_mutex_lock(&xioq->ioq_uv.uvqh.qmutex);
+		pthread_cond_broadcast(&xioq->ioq_cond);
+		pthread_mutex_unlock(&xioq->ioq_uv.uvqh.qmutex);
+	}
+	drain = !rec->disconnect_cb;
+	mutex_unlock(&xprt->xp_lock);
+
+	if (drain)
+		clnt_req_slot_drain(rec);
+}
+
+/*
+ * Ask the program whether to dispatch the partial record.
+ * On true, the record is the caller's to dispatch; the receiver
+ * continues with it in sx_stream_ioq.
+ */
+static bool
+svc_vc_stream(SVCXPRT *xprt, struct xdr_ioq *xioq)
+{
+	struct rpc_dplx_rec *rec = REC_XPRT(xprt);
+	struct svc_vc_xprt *xd = VC_DR(rec);
+	struct poolq_entry *have;
+	struct xdr_ioq_uv *uv;
+	u_int need;
+	u_int len = 0;
+
+	/* header region bytes may yet move to a bulk buffer */
+	if (xd->sx_stream != SVC_VC_STREAM_ASK
+	 || xd->sx_split == SVC_VC_SPLIT_HDR)
+		return (false);
+
+	uv = IOQ_(TAILQ_FIRST(&xioq->ioq_uv.uvqh.qh));
+	need = __svc_params->stream.cb(xprt, uv->v.vio_head,
+				       ioquv_length(uv));
+	if (!need) {
+		xd->sx_stream = SVC_VC_STREAM_NONE;
+		return (false);
+	}
+
+	TAILQ_FOREACH(have, &xioq->ioq_uv.uvqh.qh, q) {
+		len += ioquv_length(IOQ_(have));
+	}
+	if (len < need)
+		return (false);
+
+	__warnx(TIRPC_DEBUG_FLAG_SVC_VC,
+		"%s: %p fd %d dispatch at %u, need %" PRIu32,
+		__func__, xprt, xprt->xp_fd, len, xd->sx_fbtbc);
+
+	(rec->ioq.ioq_uv.uvqh.qcount)--;
+	TAILQ_REMOVE(&rec->ioq.ioq_uv.uvqh.qh, &xioq->ioq_s, q);
+	xdr_ioq_reset(xioq, 0);
+
+	xioq->ioq_s.qflags |= IOQ_FLAG_STREAM;
+	xioq->xdrs[0].x_ops = &svc_vc_stream_ops;
+	xioq->xdrs[0].x_lib[1] = (void *)xprt;
+	xd->sx_stream = SVC_VC_STREAM_ACTIVE;
+	mutex_lock(&xprt->xp_lock);
+	xd->sx_stream_ioq = xioq;
+	mutex_unlock(&xprt->xp_lock);
+	return (true);
+}
+
+/*
+ * The receiver is finished with a dispatched record.
+ */
+static void
+svc_vc_stream_done(struct svc_vc_xprt *xd)
+{
+	struct xdr_ioq *xioq = xd->sx_stream_ioq;
+	uint16_t qflags;
+
+	xd->sx_stream = SVC_VC_STREAM_NONE;
+	mutex_lock(&xd->sx_dr.xprt.xp_lock);
+	xd->sx_stream_ioq = NULL;
+	mutex_unlock(&xd->sx_dr.xprt.xp_lock);
+
+	pthread_mutex_lock(&xioq->ioq_uv.uvqh.qmutex);
+	qflags = xioq->ioq_s.qflags;
+	xioq->ioq_s.qflags &= ~IOQ_FLAG_STREAM;
+	pthread_cond_broadcast(&xioq->ioq_cond);
+	pthread_mutex_unlock(&xioq->ioq_uv.uvqh.qmutex);
+
+	if (qflags & IOQ_FLAG_RELEASED)
+		xdr_ioq_ops.x_destroy(xioq->xdrs);
+}
+
 static enum xprt_stat
 svc_vc_stat(SVCXPRT *xprt)
 {
@@ -637,8 +1042,75 @@ svc_vc_stat(SVCXPRT *xprt)
 	return (XPRT_IDLE);
 }
 
+/*
+ * Idle connection, see svc_init_params.idle_quiesce.
+ *
+ * Between records, no receive state is held (svc_vc_recv() does not
+ * create the record until its first fragment header arrives).  A record
+ * left partially received is trimmed to the bytes already received;
+ * svc_vc_recv() allocates the remainder on the next event.
+ */
+static bool
+svc_vc_quiesce(SVCXPRT *xprt)
+{
+	struct rpc_dplx_rec *rec = REC_XPRT(xprt);
+	struct svc_vc_xprt *xd = VC_DR(rec);
+	struct poolq_entry *have;
+	struct xdr_ioq_uv *uv;
+	struct xdr_ioq_uv *trim;
+	struct xdr_ioq *xioq;
+	u_int len;
+
+	/* receiving, not idle after all */
+	if (mutex_trylock(&rec->ioq.ioq_uv.uvqh.qmutex))
+		return (false);
+
+	have = TAILQ_LAST(&rec->ioq.ioq_uv.uvqh.qh, poolq_head_s);
+	if (!have || xd->sx_stream_ioq
+	 || xd->sx_split != SVC_VC_SPLIT_NONE) {
+		/* nothing held, or buffers owned elsewhere */
+		mutex_unlock(&rec->ioq.ioq_uv.uvqh.qmutex);
+		return (false);
+	}
+	xioq = _IOQ(have);
+
+	have = TAILQ_LAST(&xioq->ioq_uv.uvqh.qh, poolq_head_s);
+	if (!have) {
+		(rec->ioq.ioq_uv.uvqh.qcount)--;
+		TAILQ_REMOVE(&rec->ioq.ioq_uv.uvqh.qh, &xioq->ioq_s, q);
+		mutex_unlock(&rec->ioq.ioq_uv.uvqh.qmutex);
+		xdr_ioq_destroy(xioq, xioq->ioq_s.qsize);
+		return (true);
+	}
+	uv = IOQ_(have);
+
+	if (uv->u.uio_release || !(uv->u.uio_flags & UIO_FLAG_FREE)
+	 || !ioquv_more(uv)) {
+		mutex_unlock(&rec->ioq.ioq_uv.uvqh.qmutex);
+		return (false);
+	}
+
+	len = ioquv_length(uv);
+	trim = xdr_ioq_uv_create(len, uv->u.uio_flags);
+	if (len) {
+		memcpy(trim->v.vio_tail, uv->v.vio_head, len);
+		trim->v.vio_tail += len;
+	}
+	TAILQ_INSERT_BEFORE(&uv->uvq, &trim->uvq, q);
+	TAILQ_REMOVE(&xioq->ioq_uv.uvqh.qh, &uv->uvq, q);
+	mutex_unlock(&rec->ioq.ioq_uv.uvqh.qmutex);
+
+	__warnx(TIRPC_DEBUG_FLAG_SVC_VC,
+		"%s: %p fd %d trimmed %zu to %u, need %" PRIu32,
+		__func__, xprt, xprt->xp_fd, ioquv_size(uv), len,
+		xd->sx_fbtbc);
+
+	xdr_ioq_uv_release(uv);
+	return (true);
+}
+
 static enum xprt_stat
-svc_vc_recv(SVCXPRT *xprt)
+svc_vc_recv_it(SVCXPRT *xprt, XDR **xdrs, bool *destroy)
 {
 	struct rpc_dplx_rec *rec = REC_XPRT(xprt);
 	struct svc_vc_xprt *xd = VC_DR(rec);
@@ -649,15 +1121,18 @@ svc_vc_recv(SVCXPRT *xprt)
 	u_int flags;
 	int code;
 
-	/* no need for locking, only one svc_rqst_xprt_task() per event.
-	 * depends upon svc_rqst_rearm_events() for ordering.
+	/* only one svc_rqst_xprt_task() per event, depends upon
+	 * svc_rqst_rearm_events() for ordering.  svc_vc_recv() holds
+	 * the queue lock only against svc_vc_quiesce(), and calls
+	 * SVC_DESTROY() after, when *destroy is set.
 	 */
 	have = TAILQ_LAST(&rec->ioq.ioq_uv.uvqh.qh, poolq_head_s);
-	if (!have) {
-		xioq = xdr_ioq_create(xd->sx_dr.pagesz, xd->sx_dr.maxrec,
-				      UIO_FLAG_BUFQ);
-		(rec->ioq.ioq_uv.uvqh.qcount)++;
-		TAILQ_INSERT_TAIL(&rec->ioq.ioq_uv.uvqh.qh, &xioq->ioq_s, q);
+	if (xd->sx_stream_ioq) {
+		/* already dispatched, see svc_vc_stream() */
+		xioq = xd->sx_stream_ioq;
+	} else if (!have) {
+		/* created with the first fragment header */
+		xioq = NULL;
 	} else {
 		xioq = _IOQ(have);
 	}
@@ -678,14 +1153,14 @@ svc_vc_recv(SVCXPRT *xprt)
 						"%s: %p fd %d svc_rqst_rearm_events failed (will set dead)",
 						"svc_vc_wait",
 						xprt, xprt->xp_fd);
-					SVC_DESTROY(xprt);
+					*destroy = true;
 				}
 				return SVC_STAT(xprt);
 			}
 			__warnx(TIRPC_DEBUG_FLAG_WARN,
 				"%s: %p fd %d recv errno %d (will set dead)",
 				"svc_vc_wait", xprt, xprt->xp_fd, code);
-			SVC_DESTROY(xprt);
+			*destroy = true;
 			return SVC_STAT(xprt);
 		}
 
@@ -693,7 +1168,7 @@ svc_vc_recv(SVCXPRT *xprt)
 			__warnx(TIRPC_DEBUG_FLAG_SVC_VC,
 				"%s: %p fd %d recv closed (will set dead)",
 				"svc_vc_wait", xprt, xprt->xp_fd);
-			SVC_DESTROY(xprt);
+			*destroy = true;
 			return SVC_STAT(xprt);
 		}
 
@@ -709,40 +1184,89 @@ svc_vc_recv(SVCXPRT *xprt)
 			__warnx(TIRPC_DEBUG_FLAG_ERROR,
 				"%s: %p fd %d fragment is zero (will set dead)",
 				__func__, xprt, xprt->xp_fd);
-			SVC_DESTROY(xprt);
+			*destroy = true;
 			return SVC_STAT(xprt);
 		}
 
-		/* one buffer per fragment */
-		uv = xdr_ioq_uv_create(xd->sx_fbtbc, flags);
-		(xioq->ioq_uv.uvqh.qcount)++;
-		TAILQ_INSERT_TAIL(&xioq->ioq_uv.uvqh.qh, &uv->uvq, q);
+		if (!xioq) {
+			xioq = xdr_ioq_create(xd->sx_dr.pagesz,
+					      xd->sx_dr.maxrec,
+					      UIO_FLAG_BUFQ);
+			(rec->ioq.ioq_uv.uvqh.qcount)++;
+			TAILQ_INSERT_TAIL(&rec->ioq.ioq_uv.uvqh.qh,
+					  &xioq->ioq_s, q);
+		}
+
+		if (TAILQ_EMPTY(&xioq->ioq_uv.uvqh.qh)) {
+			/* first fragment of a record */
+			/* not before the full record checksum */
+			xd->sx_stream = (__svc_params->stream.cb
+					 && !(xprt->xp_cksum & RPC_CKSUM_FULL)
+					 && ((flags & UIO_FLAG_MORE)
+					     || xd->sx_fbtbc
+						> __svc_params->stream.min))
+					? SVC_VC_STREAM_ASK
+					: SVC_VC_STREAM_NONE;
+		}
+
+		if (__svc_params->split.cb
+		 && TAILQ_EMPTY(&xioq->ioq_uv.uvqh.qh)
+		 && xd->sx_fbtbc > __svc_params->split.hdr_size
+				 + __svc_params->split.pagesz) {
+			/* header region first, see svc_vc_split() */
+			xd->sx_split = SVC_VC_SPLIT_HDR;
+			uv = xdr_ioq_uv_create(__svc_params->split.hdr_size,
+						flags);
+		} else {
+			/* one buffer per fragment */
+			xd->sx_split = SVC_VC_SPLIT_NONE;
+			uv = xdr_ioq_uv_create(xd->sx_fbtbc, flags);
+		}
+		svc_vc_append(xd, xioq, uv);
 	} else {
 		uv = IOQ_(TAILQ_LAST(&xioq->ioq_uv.uvqh.qh, poolq_head_s));
 		flags = uv->u.uio_flags;
+
+		if (unlikely(!ioquv_more(uv))) {
+			/* trimmed while idle, see svc_vc_quiesce() */
+			struct xdr_ioq_uv *empty = ioquv_length(uv) ? NULL : uv;
+
+			uv = svc_vc_split(xprt, xioq, uv);
+			if (empty) {
+				(xioq->ioq_uv.uvqh.qcount)--;
+				TAILQ_REMOVE(&xioq->ioq_uv.uvqh.qh,
+					     &empty->uvq, q);
+				xdr_ioq_uv_release(empty);
+			}
+		}
 	}
 
-	rlen = recv(xprt->xp_fd, uv->v.vio_tail, xd->sx_fbtbc, MSG_DONTWAIT);
+ again:
+	rlen = recv(xprt->xp_fd, uv->v.vio_tail,
+		    MIN((size_t)xd->sx_fbtbc, ioquv_more(uv)), MSG_DONTWAIT);
 
 	if (unlikely(rlen < 0)) {
 		code = errno;
 
+#ifdef USE_TLS
+		if (code == EIO && xd->sx_tls == SVC_VC_TLS_ACTIVE) {
+			/* not application data, see rpc_tls_recv_control() */
+			code = rpc_tls_recv_control(xprt->xp_fd);
+			if (!code)
+				goto again;
+		}
+#endif
+
 		if (code == EAGAIN || code == EWOULDBLOCK) {
 			__warnx(TIRPC_DEBUG_FLAG_SVC_VC,
 				"%s: %p fd %d recv errno %d (try again)",
 				__func__, xprt, xprt->xp_fd, code);
-			if (unlikely(svc_rqst_rearm_events(xprt))) {
-				__warnx(TIRPC_DEBUG_FLAG_ERROR,
-					"%s: %p fd %d svc_rqst_rearm_events failed (will set dead)",
-					__func__, xprt, xprt->xp_fd);
-				SVC_DESTROY(xprt);
-			}
-			return SVC_STAT(xprt);
+			goto more;
 		}
 		__warnx(TIRPC_DEBUG_FLAG_ERROR,
 			"%s: %p fd %d recv errno %d (will set dead)",
 			__func__, xprt, xprt->xp_fd, code);
-		SVC_DESTROY(xprt);
+		*destroy = true;
 		return SVC_STAT(xprt);
 	}
 
@@ -750,23 +1274,86 @@ svc_vc_recv(SVCXPRT *xprt)
 		__warnx(TIRPC_DEBUG_FLAG_SVC_VC,
 			"%s: %p fd %d recv closed (will set dead)",
 			__func__, xprt, xprt->xp_fd);
-		SVC_DESTROY(xprt);
+		*destroy = true;
 		return SVC_STAT(xprt);
 	}
 
-	uv->v.vio_tail += rlen;
+	if (xprt->xp_cksum & RPC_CKSUM_FULL) {
+		/* while the bytes are in cache, across fragments */
+		uint8_t *data = uv->v.vio_tail;
+		size_t length = rlen;
+
+		if (!xioq->ioq_cksum_args) {
+			/* the call header is in the first buffer */
+			struct xdr_ioq_uv *first =
+				IOQ_(TAILQ_FIRST(&xioq->ioq_uv.uvqh.qh));
+
+			xioq->ioq_cksum_args = (uv != first) ? -1
+				: svc_cksum_args(uv->v.vio_head,
+						 uv->v.vio_tail + rlen
+						 - uv->v.vio_head);
+			if (xioq->ioq_cksum_args > 0) {
+				data = uv->v.vio_head + xioq->ioq_cksum_args;
+				length = uv->v.vio_tail + rlen - data;
+			}
+		}
+		if (xioq->ioq_cksum_args > 0)
+			xioq->ioq_cksum = rpc_cksum_update(xprt->xp_cksum,
+							   xioq->ioq_cksum,
+							   data, length);
+	}
+
+	if (unlikely(xd->sx_stream_ioq != NULL)) {
+		pthread_mutex_lock(&xioq->ioq_uv.uvqh.qmutex);
+		uv->v.vio_tail += rlen;
+		pthread_cond_broadcast(&xioq->ioq_cond);
+		pthread_mutex_unlock(&xioq->ioq_uv.uvqh.qmutex);
+	} else {
+		uv->v.vio_tail += rlen;
+	}
 	xd->sx_fbtbc -= rlen;
 
 	__warnx(TIRPC_DEBUG_FLAG_SVC_VC,
 		"%s: %p fd %d recv %zd, need %" PRIu32 ", flags %x",
 		__func__, xprt, xprt->xp_fd, rlen, xd->sx_fbtbc, flags);
 
+	if (xd->sx_fbtbc && !ioquv_more(uv)) {
+		/* more of this fragment is likely already queued */
+		uv = svc_vc_split(xprt, xioq, uv);
+		goto again;
+	}
+
 	if (xd->sx_fbtbc || (flags & UIO_FLAG_MORE)) {
+ more:
+		if (xd->sx_stream == SVC_VC_STREAM_ASK
+		 && svc_vc_stream(xprt, xioq)) {
+			if (unlikely(svc_rqst_rearm_events(xprt))) {
+				__warnx(TIRPC_DEBUG_FLAG_ERROR,
+					"%s: %p fd %d svc_rqst_rearm_events failed (will set dead)",
+					__func__, xprt, xprt->xp_fd);
+				*destroy = true;
+			}
+			*xdrs = xioq->xdrs;
+			return SVC_STAT(xprt);
+		}
 		if (unlikely(svc_rqst_rearm_events(xprt))) {
 			__warnx(TIRPC_DEBUG_FLAG_ERROR,
 				"%s: %p fd %d svc_rqst_rearm_events failed (will set dead)",
 				__func__, xprt, xprt->xp_fd);
-			SVC_DESTROY(xprt);
+			*destroy = true;
+		}
+		return SVC_STAT(xprt);
+	}
+
+	if (xd->sx_stream_ioq) {
+		/* finished a dispatched request */
+		svc_vc_stream_done(xd);
+
+		if (unlikely(svc_rqst_rearm_events(xprt))) {
+			__warnx(TIRPC_DEBUG_FLAG_ERROR,
+				"%s: %p fd %d svc_rqst_rearm_events failed (will set dead)",
+				__func__, xprt, xprt->xp_fd);
+			*destroy = true;
 		}
 		return SVC_STAT(xprt);
 	}
@@ -776,17 +1363,95 @@ svc_vc_recv(SVCXPRT *xprt)
 	TAILQ_REMOVE(&rec->ioq.ioq_uv.uvqh.qh, &xioq->ioq_s, q);
 	xdr_ioq_reset(xioq, 0);
 
+#ifdef USE_TLS
+	if (unlikely(xd->sx_tls == SVC_VC_TLS_OFFER)) {
+		/* not rearmed, see svc_vc_recv_offer() */
+		*xdrs = xioq->xdrs;
+		return SVC_STAT(xprt);
+	}
+#endif
+
 	if (unlikely(svc_rqst_rearm_events(xprt))) {
 		__warnx(TIRPC_DEBUG_FLAG_ERROR,
 			"%s: %p fd %d svc_rqst_rearm_events failed (will set dead)",
 			__func__, xprt, xprt->xp_fd);
 		xdr_ioq_destroy(xioq, xioq->ioq_s.qsize);
-		SVC_DESTROY(xprt);
+		*destroy = true;
 		return SVC_STAT(xprt);
 	}
 
+	*xdrs = xioq->xdrs;
+	return SVC_STAT(xprt);
+}
+
+#ifdef USE_TLS
+/*
+ * The first record, on a listener offering TLS, received and not yet
+ * rearmed.  An AUTH_TLS probe starts the handshake; any other record
+ * is dispatched.
+ */
+static enum xprt_stat
+svc_vc_recv_offer(SVCXPRT *xprt, struct xdr_ioq *xioq)
+{
+	struct svc_vc_xprt *xd = VC_DR(REC_XPRT(xprt));
+
+	/* only the first record may ask */
+	xd->sx_tls = SVC_VC_TLS_NONE;
+	if (rpc_tls_svc_starttls(xprt, xioq)) {
+		xdr_ioq_destroy(xioq, xioq->ioq_s.qsize);
+		if (!(xprt->xp_flags & SVC_XPRT_FLAG_DESTROYED)
+		 && unlikely(svc_rqst_rearm_events(xprt))) {
+			__warnx(TIRPC_DEBUG_FLAG_ERROR,
+				"%s: %p fd %d svc_rqst_rearm_events failed (will set dead)",
+				__func__, xprt, xprt->xp_fd);
+			SVC_DESTROY(xprt);
+		}
+		return SVC_STAT(xprt);
+	}
+
+	if (unlikely(svc_rqst_rearm_events(xprt))) {
+		__warnx(TIRPC_DEBUG_FLAG_ERROR,
+			"%s: %p fd %d svc_rqst_rearm_events failed (will set dead)",
+			__func__, xprt, xprt->xp_fd);
+		xdr_ioq_destroy(xioq, xioq->ioq_s.qsize);
+		SVC_DESTROY(xprt);
+		return SVC_STAT(xprt);
+	}
 	return (__svc_params->request_cb(xprt, xioq->xdrs));
 }
+#endif
+
+static enum xprt_stat
+svc_vc_recv(SVCXPRT *xprt)
+{
+	struct rpc_dplx_rec *rec = REC_XPRT(xprt);
+	enum xprt_stat stat;
+	XDR *xdrs = NULL;
+	bool destroy = false;
+
+#ifdef USE_TLS
+	if (unlikely(VC_DR(rec)->sx_tls == SVC_VC_TLS_HANDSHAKE))
+		return (rpc_tls_svc_handshake(xprt));
+#endif
+
+	mutex_lock(&rec->ioq.ioq_uv.uvqh.qmutex);
+	stat = svc_vc_recv_it(xprt, &xdrs, &destroy);
+	mutex_unlock(&rec->ioq.ioq_uv.uvqh.qmutex);
+
+	if (destroy) {
+		/* its callbacks run without the queue lock */
+		SVC_DESTROY(xprt);
+		stat = SVC_STAT(xprt);
+	}
+
+#ifdef USE_TLS
+	if (unlikely(xdrs && VC_DR(rec)->sx_tls == SVC_VC_TLS_OFFER))
+		return (svc_vc_recv_offer(xprt, XIOQ(xdrs)));
+#endif
+	if (xdrs)
+		return (__svc_params->request_cb(xprt, xdrs));
+	return (stat);
+}
 
 static enum xprt_stat
 svc_vc_decode(struct svc_req *req)
@@ -799,6 +1464,7 @@ svc_vc_decode(struct svc_req *req)
 	 */
 	xdrs->x_op = XDR_DECODE;
 	rpc_msg_init(&req->rq_msg);
+	req->rq_drc = NULL;	/* until svc_drc_start() */
 
 	if (!xdr_dplx_decode(xdrs, &req->rq_msg)) {
 		/* stream is unsynchronized beyond recovery */
@@ -832,14 +1498,18 @@ svc_vc_decode(struct svc_req *req)
 static void
 svc_vc_checksum(struct svc_req *req, void *data, size_t length)
 {
-	req->rq_cksum =
-#if 1
-	/* CithHash64 is -substantially- faster than crc32c from FreeBSD
-	 * SCTP, so prefer it until fast crc32c bests it */
-		CityHash64WithSeed(data, MIN(256, length), 103);
-#else
-		calculate_crc32c(0, data, MIN(256, length));
-#endif
+	if (req->rq_xprt->xp_cksum & RPC_CKSUM_FULL) {
+		struct xdr_ioq *xioq = XIOQ(req->rq_xdrs);
+
+		/* summed as received, or these (unwrapped) arguments */
+		req->rq_cksum = (xioq->ioq_cksum_args > 0)
+			? xioq->ioq_cksum
+			: rpc_cksum_update(req->rq_xprt->xp_cksum, 0,
+					   data, length);
+		return;
+	}
+	req->rq_cksum = rpc_cksum(RPC_CKSUM_TYPE(req->rq_xprt->xp_cksum),
+				  data, MIN(256, length));
 }
 
 static enum xprt_stat
@@ -852,14 +1522,15 @@ svc_vc_reply(struct svc_req *req)
 	 * iov equivalents, replies with RPCSEC_GSS security must be
 	 * encoded in a contiguous buffer.
 	 *
-	 * Nb, we should probably use getpagesize() on Unix.  Need
-	 * an equivalent for Windows.
+	 * The first buffer is sized from earlier replies to this procedure.
 	 */
-	xioq = xdr_ioq_create(RPC_MAXDATA_DEFAULT,
-			      __svc_params->ioq.send_max + RPC_MAXDATA_DEFAULT,
-			      (req->rq_msg.cb_cred.oa_flavor == RPCSEC_GSS)
-			      ? UIO_FLAG_REALLOC | UIO_FLAG_FREE
-			      : UIO_FLAG_FREE);
+	xioq = xdr_ioq_size_create(req->rq_msg.cb_prog, req->rq_msg.cb_vers,
+				   req->rq_msg.cb_proc, XDR_IOQ_SIZE_REPLY,
+				   __svc_params->ioq.send_max
+				   + RPC_MAXDATA_DEFAULT,
+				   (req->rq_msg.cb_cred.oa_flavor == RPCSEC_GSS)
+				   ? UIO_FLAG_REALLOC | UIO_FLAG_FREE
+				   : UIO_FLAG_FREE);
 
 	if (!xdr_reply_encode(xioq->xdrs, &req->rq_msg)) {
 		__warnx(TIRPC_DEBUG_FLAG_ERROR,
@@ -879,6 +1550,11 @@ svc_vc_reply(struct svc_req *req)
 		return (XPRT_DIED);
 	}
 	xdr_tail_update(xioq->xdrs);
+	xdr_ioq_size_update(xioq, req->rq_msg.cb_prog, req->rq_msg.cb_vers,
+			    req->rq_msg.cb_proc, XDR_IOQ_SIZE_REPLY);
+
+	if (req->rq_drc)
+		xioq = svc_drc_retain(req, xioq);
 
 	xioq->xdrs[0].x_lib[1] = (void *)req->rq_xprt;
 	svc_ioq_write_now(req->rq_xprt, xioq);
@@ -904,9 +1580,12 @@ svc_vc_override_ops(SVCXPRT *xprt, SVCXPRT *rendezvous)
 		ops.xp_destroy = svc_vc_destroy;
 		ops.xp_control = svc_vc_control;
 		ops.xp_free_user_data = NULL;	/* no default */
+		ops.xp_destroying = svc_vc_destroying;
 	}
 	svc_override_ops(&ops, rendezvous);
 	xprt->xp_ops = &ops;
+	if (rendezvous)
+		xprt->xp_cksum = rendezvous->xp_cksum;
 	mutex_unlock(&ops_lock);
 }
 
@@ -30,6 +30,7 @@
 #include <sys/types.h>
 #include <sys/poll.h>
 #include <stdint.h>
+#include <stddef.h>
 #include <assert.h>
 #include <err.h>
 #include <errno.h>
@@ -62,6 +63,32 @@
 
 #define SVC_XPRT_PARTITIONS 193
 
+/* Layout, see struct svc_xprt and struct rpc_dplx_rec.  Fields read on
+ * every event stay off the cache lines written by other threads.
+ */
+_Static_assert(offsetof(struct svc_xprt, xp_refs) % CACHE_LINE_SIZE == 0,
+	       "xp_refs shares a cache line with read-mostly fields");
+_Static_assert(offsetof(struct svc_xprt, xp_refs)
+	       <= 2 * CACHE_LINE_SIZE,
+	       "svc_xprt read-mostly fields exceed two cache lines");
+_Static_assert(offsetof(struct svc_xprt, xp_lock) + sizeof(mutex_t)
+	       <= offsetof(struct svc_xprt, xp_refs) + CACHE_LINE_SIZE,
+	       "xp_refs, xp_flags and xp_lock exceed one cache line");
+_Static_assert(offsetof(struct svc_xprt, xp_local) % CACHE_LINE_SIZE == 0,
+	       "xp_local shares a cache line with xp_refs");
+
+_Static_assert(offsetof(struct rpc_dplx_rec, ev_p) % CACHE_LINE_SIZE == 0,
+	       "rpc_dplx_rec shares a cache line with its svc_xprt");
+_Static_assert(offsetof(struct rpc_dplx_rec, recv)
+	       - offsetof(struct rpc_dplx_rec, ev_p) <= CACHE_LINE_SIZE,
+	       "rpc_dplx_rec read-mostly fields exceed one cache line");
+_Static_assert(offsetof(struct rpc_dplx_rec, recv) % CACHE_LINE_SIZE == 0,
+	       "rpc_dplx_rec recv shares a cache line");
+_Static_assert(offsetof(struct rpc_dplx_rec, send) % CACHE_LINE_SIZE == 0,
+	       "rpc_dplx_rec send shares a cache line");
+_Static_assert(offsetof(struct rpc_dplx_rec, ioq) % CACHE_LINE_SIZE == 0,
+	       "rpc_dplx_rec ioq shares a cache line");
+
 static bool initialized;
 
 struct svc_xprt_fd {
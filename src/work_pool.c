@@ -61,6 +61,12 @@
 #define WORK_POOL_STACK_SIZE MAX(1 * 1024 * 1024, PTHREAD_STACK_MIN)
 #define WORK_POOL_TIMEOUT_MS (31 /* seconds (prime) */ * 1000)
 
+/* Layout, see struct work_pool_thread */
+_Static_assert(offsetof(struct work_pool_thread, pqe) == 0,
+	       "work_pool_thread pqe is not first");
+_Static_assert(sizeof(struct work_pool_thread) % CACHE_LINE_SIZE == 0,
+	       "work_pool_thread shares a cache line with its neighbor");
+
 /* forward declaration in lieu of moving code, was inline */
 
 static int work_pool_spawn(struct work_pool *pool);
@@ -74,6 +80,8 @@ work_pool_init(struct work_pool *pool, const char *name,
 	memset(pool, 0, sizeof(*pool));
 	poolq_head_setup(&pool->pqh);
 	TAILQ_INIT(&pool->wptqh);
+	poolq_head_setup(&pool->delayed);
+	pthread_cond_init(&pool->delayed_cond, NULL);
 
 	pool->timeout_ms = WORK_POOL_TIMEOUT_MS;
 
@@ -246,7 +254,8 @@ static int
 work_pool_spawn(struct work_pool *pool)
 {
 	int rc;
-	struct work_pool_thread *wpt = mem_zalloc(sizeof(*wpt));
+	struct work_pool_thread *wpt = mem_zalloc_aligned(CACHE_LINE_SIZE,
+							  sizeof(*wpt));
 
 	wpt->pool = pool;
 
@@ -294,6 +303,121 @@ work_pool_submit(struct work_pool *pool, struct work_pool_entry *work)
 	return rc;
 }
 
+/**
+ * @brief The timer thread
+ *
+ * Started by the first delayed entry.  Submits each entry when due.
+ *
+ * @param[in] arg 	the pool
+ */
+
+static void *
+work_pool_delayed_thread(void *arg)
+{
+	struct work_pool *pool = arg;
+	struct work_pool_entry *work;
+	struct timespec now;
+	char name[16];
+
+	snprintf(name, sizeof(name), "%.5stimer", pool->name);
+	__ntirpc_pkg_params.thread_name_(name);
+
+	pthread_mutex_lock(&pool->delayed.qmutex);
+	while (!pool->delayed_shutdown) {
+		work = (struct work_pool_entry *)
+			TAILQ_FIRST(&pool->delayed.qh);
+		if (!work) {
+			pthread_cond_wait(&pool->delayed_cond,
+					  &pool->delayed.qmutex);
+			continue;
+		}
+
+		clock_gettime(CLOCK_REALTIME, &now);
+		if (timespeccmp(&work->due, &now, >)) {
+			pthread_cond_timedwait(&pool->delayed_cond,
+					       &pool->delayed.qmutex,
+					       &work->due);
+			continue;
+		}
+
+		TAILQ_REMOVE(&pool->delayed.qh, &work->pqe, q);
+		(pool->delayed.qcount)--;
+		pthread_mutex_unlock(&pool->delayed.qmutex);
+
+		work_pool_submit(pool, work);
+		pthread_mutex_lock(&pool->delayed.qmutex);
+	}
+	pthread_mutex_unlock(&pool->delayed.qmutex);
+	return (NULL);
+}
+
+/**
+ * @brief Submit work after a delay
+ *
+ * In lieu of sleeping on a worker.  Entries are held in order of their
+ * due time by one timer thread for the pool, then submitted.  The clock
+ * is precise (not _FAST), as delays may be shorter than its tick.
+ *
+ * @param[in] pool	the pool
+ * @param[in] work	the entry, not otherwise queued
+ * @param[in] usec	delay in microseconds
+ */
+
+int
+work_pool_submit_delayed(struct work_pool *pool, struct work_pool_entry *work,
+			 uint32_t usec)
+{
+	struct poolq_entry *have;
+	int rc = 0;
+
+	if (unlikely(!pool->params.thrd_max)) {
+		/* queue is draining */
+		return (0);
+	}
+	if (!usec)
+		return work_pool_submit(pool, work);
+
+	clock_gettime(CLOCK_REALTIME, &work->due);
+	work->due.tv_sec += usec / 1000000;
+	work->due.tv_nsec += (usec % 1000000) * 1000;
+	if (work->due.tv_nsec >= 1000000000) {
+		work->due.tv_sec++;
+		work->due.tv_nsec -= 1000000000;
+	}
+
+	pthread_mutex_lock(&pool->delayed.qmutex);
+	if (!pool->delayed_started) {
+		rc = pthread_create(&pool->delayed_pt, NULL,
+				    work_pool_delayed_thread, pool);
+		if (rc) {
+			pthread_mutex_unlock(&pool->delayed.qmutex);
+			__warnx(TIRPC_DEBUG_FLAG_ERROR,
+				"%s() pthread_create failed (%d)\n",
+				__func__, rc);
+			/* late is better than never */
+			return work_pool_submit(pool, work);
+		}
+		pool->delayed_started = true;
+	}
+
+	/* usually few, and usually due last */
+	TAILQ_FOREACH_REVERSE(have, &pool->delayed.qh, poolq_head_s, q) {
+		if (!timespeccmp(&((struct work_pool_entry *)have)->due,
+				 &work->due, >))
+			break;
+	}
+	if (have)
+		TAILQ_INSERT_AFTER(&pool->delayed.qh, have, &work->pqe, q);
+	else
+		TAILQ_INSERT_HEAD(&pool->delayed.qh, &work->pqe, q);
+	(pool->delayed.qcount)++;
+
+	if (TAILQ_FIRST(&pool->delayed.qh) == &work->pqe)
+		pthread_cond_signal(&pool->delayed_cond);
+	pthread_mutex_unlock(&pool->delayed.qmutex);
+	return (rc);
+}
+
 int
 work_pool_shutdown(struct work_pool *pool)
 {
@@ -303,6 +427,14 @@ work_pool_shutdown(struct work_pool *pool)
 		.tv_nsec = 3000,
 	};
 
+	/* entries not yet due are dropped, as after draining */
+	pthread_mutex_lock(&pool->delayed.qmutex);
+	pool->delayed_shutdown = true;
+	pthread_cond_signal(&pool->delayed_cond);
+	pthread_mutex_unlock(&pool->delayed.qmutex);
+	if (pool->delayed_started)
+		pthread_join(pool->delayed_pt, NULL);
+
 	pthread_mutex_lock(&pool->pqh.qmutex);
 	pool->timeout_ms = 1;
 	pool->params.thrd_max =
@@ -326,6 +458,8 @@ work_pool_shutdown(struct work_pool *pool)
 
 	mem_free(pool->name, 0);
 	poolq_head_destroy(&pool->pqh);
+	poolq_head_destroy(&pool->delayed);
+	cond_destroy(&pool->delayed_cond);
 
 	return (0);
 }
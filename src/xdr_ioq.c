@@ -55,6 +55,14 @@
 
 static bool xdr_ioq_noop(void) __attribute__ ((unused));
 
+/* Layout, see struct xdr_ioq */
+_Static_assert(offsetof(struct xdr_ioq, ioq_wpe) % CACHE_LINE_SIZE == 0,
+	       "ioq_wpe shares a cache line with xdrs");
+_Static_assert(sizeof(struct work_pool_entry) <= CACHE_LINE_SIZE,
+	       "ioq_wpe exceeds one cache line");
+_Static_assert(offsetof(struct xdr_ioq, ioq_uv) % CACHE_LINE_SIZE == 0,
+	       "ioq_uv shares a cache line with ioq_wpe");
+
 #define VREC_MAXBUFS 24
 
 static uint64_t next_id;
@@ -262,6 +270,48 @@ xdr_ioq_reset(struct xdr_ioq *xioq, u_int wh_pos)
 		__func__, xioq, uv->v.vio_head, wh_pos);
 }
 
+/*
+ * Discard output after pos, backing out a partially encoded item.
+ */
+void
+xdr_ioq_truncate(struct xdr_ioq *xioq, u_int pos)
+{
+	struct poolq_entry *have;
+	struct poolq_entry *next;
+	struct xdr_ioq_uv *uv = NULL;
+	size_t plength = 0;
+	u_int pcount = 0;
+
+	/* update the most recent data length, just in case */
+	xdr_tail_update(xioq->xdrs);
+
+	TAILQ_FOREACH(have, &xioq->ioq_uv.uvqh.qh, q) {
+		uv = IOQ_(have);
+		if (pos <= plength + ioquv_length(uv))
+			break;
+		plength += ioquv_length(uv);
+		pcount++;
+	}
+	if (!have) {
+		__warnx(TIRPC_DEBUG_FLAG_ERROR,
+			"%s() xioq %p pos %u beyond end, ignored!\n",
+			__func__, xioq, pos);
+		return;
+	}
+
+	while ((next = TAILQ_NEXT(have, q))) {
+		TAILQ_REMOVE(&xioq->ioq_uv.uvqh.qh, next, q);
+		(xioq->ioq_uv.uvqh.qcount)--;
+		xdr_ioq_uv_release(IOQ_(next));
+	}
+	uv->v.vio_tail = uv->v.vio_head + (pos - plength);
+
+	xioq->ioq_uv.plength = plength;
+	xioq->ioq_uv.pcount = pcount;
+	xdr_ioq_uv_reset(xioq, uv);
+	xioq->xdrs[0].x_data = uv->v.vio_tail;
+}
+
 void
 xdr_ioq_setup(struct xdr_ioq *xioq)
 {
@@ -290,7 +340,8 @@ xdr_ioq_setup(struct xdr_ioq *xioq)
 struct xdr_ioq *
 xdr_ioq_create(size_t min_bsize, size_t max_bsize, u_int uio_flags)
 {
-	struct xdr_ioq *xioq = mem_zalloc(sizeof(struct xdr_ioq));
+	struct xdr_ioq *xioq = mem_zalloc_aligned(CACHE_LINE_SIZE,
+						   sizeof(struct xdr_ioq));
 
 	xdr_ioq_setup(xioq);
 	xioq->xdrs[0].x_flags |= XDR_FLAG_FREE;
@@ -391,7 +442,46 @@ xdr_ioq_uv_append(struct xdr_ioq *xioq, u_int ioq_flags)
 	return (uv);
 }
 
-static bool
+/* in glibc 2.14+ x86_64, memcpy no longer tries to handle overlapping areas,
+ * see Fedora Bug 691336 (NOTABUG); we dont permit overlapping segments,
+ * so memcpy may be a small win over memmove.
+ */
+
+/*
+ * Copy out len bytes, crossing buffers as needed.
+ * Returns the number of bytes that were not available.
+ */
+static inline u_int
+xdr_ioq_gather(XDR *xdrs, char *addr, u_int len)
+{
+	struct xdr_ioq_uv *uv;
+	ssize_t delta;
+
+	while (len > 0
+		&& XIOQ(xdrs)->ioq_uv.pcount < XIOQ(xdrs)->ioq_uv.uvqh.qcount) {
+		delta = (uintptr_t)xdrs->x_v.vio_tail
+			- (uintptr_t)xdrs->x_data;
+
+		if (unlikely(delta > len)) {
+			delta = len;
+		} else if (unlikely(!delta)) {
+			/* advance fill pointer */
+			uv = xdr_ioq_uv_advance(XIOQ(xdrs));
+			if (!uv) {
+				break;
+			}
+			xdr_ioq_uv_update(XIOQ(xdrs), uv);
+			continue;
+		}
+		memcpy(addr, xdrs->x_data, delta);
+		xdrs->x_data += delta;
+		addr += delta;
+		len -= delta;
+	}
+	return (len);
+}
+
+bool
 xdr_ioq_getunit(XDR *xdrs, uint32_t *p)
 {
 	struct xdr_ioq_uv *uv;
@@ -399,11 +489,19 @@ xdr_ioq_getunit(XDR *xdrs, uint32_t *p)
 
 	while (future > xdrs->x_v.vio_tail) {
 		if (unlikely(xdrs->x_data != xdrs->x_v.vio_tail)) {
-			/* FIXME: insufficient data or unaligned? stop! */
-			__warnx(TIRPC_DEBUG_FLAG_ERROR,
-				"%s() x_data != x_v.vio_tail\n",
-				__func__);
-			return (false);
+			/* unit straddles buffers (e.g., a header split
+			 * at an unaligned offset): gather it.
+			 */
+			uint32_t u;
+
+			if (xdr_ioq_gather(xdrs, (char *)&u, sizeof(u))) {
+				__warnx(TIRPC_DEBUG_FLAG_ERROR,
+					"%s() insufficient data\n",
+					__func__);
+				return (false);
+			}
+			*p = (uint32_t)ntohl(u);
+			return (true);
 		}
 
 		uv = xdr_ioq_uv_advance(XIOQ(xdrs));
@@ -420,7 +518,7 @@ xdr_ioq_getunit(XDR *xdrs, uint32_t *p)
 	return (true);
 }
 
-static bool
+bool
 xdr_ioq_putunit(XDR *xdrs, const uint32_t v)
 {
 	struct xdr_ioq_uv *uv;
@@ -443,44 +541,19 @@ xdr_ioq_putunit(XDR *xdrs, const uint32_t v)
 	return (true);
 }
 
-/* in glibc 2.14+ x86_64, memcpy no longer tries to handle overlapping areas,
- * see Fedora Bug 691336 (NOTABUG); we dont permit overlapping segments,
- * so memcpy may be a small win over memmove.
- */
-
-static bool
+bool
 xdr_ioq_getbytes(XDR *xdrs, char *addr, u_int len)
 {
-	struct xdr_ioq_uv *uv;
-	ssize_t delta;
-
-	while (len > 0
-		&& XIOQ(xdrs)->ioq_uv.pcount < XIOQ(xdrs)->ioq_uv.uvqh.qcount) {
-		delta = (uintptr_t)xdrs->x_v.vio_tail
-			- (uintptr_t)xdrs->x_data;
-
-		if (unlikely(delta > len)) {
-			delta = len;
-		} else if (unlikely(!delta)) {
-			/* advance fill pointer */
-			uv = xdr_ioq_uv_advance(XIOQ(xdrs));
-			if (!uv) {
-				return (false);
-			}
-			xdr_ioq_uv_update(XIOQ(xdrs), uv);
-			continue;
-		}
-		memcpy(addr, xdrs->x_data, delta);
-		xdrs->x_data += delta;
-		addr += delta;
-		len -= delta;
+	if (xdr_ioq_gather(xdrs, addr, len)) {
+		__warnx(TIRPC_DEBUG_FLAG_ERROR,
+			"%s() insufficient data\n",
+			__func__);
+		return (false);
 	}
-
-	/* assert(len == 0); */
 	return (true);
 }
 
-static bool
+bool
 xdr_ioq_putbytes(XDR *xdrs, const char *addr, u_int len)
 {
 	struct xdr_ioq_uv *uv;
@@ -511,58 +584,91 @@ xdr_ioq_putbytes(XDR *xdrs, const char *addr, u_int len)
 	return (true);
 }
 
-/* Get buffers from the queue. */
-static bool
-xdr_ioq_getbufs(XDR *xdrs, xdr_uio *uio, u_int flags)
+/* Release buffers referenced with getbufs. */
+static void
+xdr_ioq_uio_release(struct xdr_uio *uio, u_int flags)
 {
-    /* XXX finalize */
-#if 0
+	struct xdr_ioq_uv **uvs = uio->uio_p1;
+	int ix;
 
+	if (--(uio->uio_references))
+		return;
+
+	for (ix = 0; ix < uio->uio_count; ++ix)
+		xdr_ioq_uv_release(uvs[ix]);
+
+	mem_free(uvs, 0);
+	uio->uio_p1 = NULL;
+	uio->uio_count = 0;
+}
+
+/*
+ * Get buffers from the queue.
+ *
+ * References the next len bytes of the stream in place, without copying.
+ * On entry, uio_count is the number of uio_vio[] slots provided; on return,
+ * the number filled.  Each referenced xdr_ioq_uv holds an added reference
+ * until (*uio_release)() is called.  Any XDR padding is left in the stream.
+ */
+static bool
+xdr_ioq_getbufs(XDR *xdrs, xdr_uio *uio, u_int len, u_int flags)
+{
+	struct xdr_ioq_uv **uvs;
 	struct xdr_ioq_uv *uv;
+	size_t slots = uio->uio_count;
 	ssize_t delta;
-	int ix;
+	int ix = 0;
 
-	/* allocate sufficient slots to empty the queue, else MAX */
-	uio->xbs_cnt = XIOQ(xdrs)->ioq_uv.uvqh.qsize - XIOQ(xdrs)->ioq_uv.pcount;
-	if (uio->xbs_cnt > VREC_MAXBUFS) {
-		uio->xbs_cnt = VREC_MAXBUFS;
-	}
-
-	/* fail if no segments available */
-	if (unlikely(! uio->xbs_cnt))
-		return (FALSE);
+	/* fail if no slots available */
+	if (unlikely(!slots))
+		return (false);
 
-	uio->xbs_buf = mem_alloc(uio->xbs_cnt);
-	uio->xbs_resid = 0;
-	ix = 0;
+	uvs = mem_alloc(slots * sizeof(struct xdr_ioq_uv *));
 
-	/* re-consuming bytes in a stream (after SETPOS/rewind) */
-	while (len > 0
-		&& XIOQ(xdrs)->ioq_uv.pcount < XIOQ(xdrs)->ioq_uv.uvqh.qcount) {
-		delta = (uintptr_t)XDR_VIO(xioq->xdrs)->vio_tail
+	while (len > 0) {
+		delta = (uintptr_t)xdrs->x_v.vio_tail
 			- (uintptr_t)xdrs->x_data;
 
-		if (unlikely(delta > len)) {
-			delta = len;
-		} else if (unlikely(!delta)) {
+		if (unlikely(!delta)) {
+			/* advance fill pointer */
 			uv = xdr_ioq_uv_advance(XIOQ(xdrs));
 			if (!uv)
-				return (false);
+				goto fail;
 
 			xdr_ioq_uv_update(XIOQ(xdrs), uv);
 			continue;
 		}
-		(uio->xbs_buf[ix]).xb_p1 = uv;
-		uv->u.uio_references)++;
-		(uio->xbs_buf[ix]).xb_base = xdrs->x_data;
-		XIOQ(xdrs)->ioq_uv.plength += delta;
+		if (unlikely(ix >= slots))
+			goto fail;
+		if (delta > len)
+			delta = len;
+
+		uv = IOQV(xdrs->x_base);
+		(uv->u.uio_references)++;
+		uvs[ix] = uv;
+
+		uio->uio_vio[ix].vio_base = uv->v.vio_base;
+		uio->uio_vio[ix].vio_head = xdrs->x_data;
+		uio->uio_vio[ix].vio_tail =
+		uio->uio_vio[ix].vio_wrap = xdrs->x_data + delta;
+		ix++;
+
 		xdrs->x_data += delta;
 		len -= delta;
 	}
-#endif /* 0 */
 
-	/* assert(len == 0); */
-	return (TRUE);
+	uio->uio_release = xdr_ioq_uio_release;
+	uio->uio_p1 = uvs;
+	uio->uio_count = ix;
+	uio->uio_flags = UIO_FLAG_NONE;
+	uio->uio_references = 1;
+	return (true);
+
+fail:
+	while (ix--)
+		xdr_ioq_uv_release(uvs[ix]);
+	mem_free(uvs, slots * sizeof(struct xdr_ioq_uv *));
+	return (false);
 }
 
 /* Post buffers on the queue, or, if indicated in flags, return buffers
@@ -752,6 +858,133 @@ xdr_ioq_destroy_pool(struct poolq_head *ioqh)
 	poolq_head_destroy(ioqh);
 }
 
+/*
+ * Encoded size estimates.
+ *
+ * Direct mapped, indexed by a hash of (prog, vers, proc).  Updates are
+ * racy by design: a lost or mismatched sample only affects the size of
+ * one first buffer, which is clamped and grown as before.
+ */
+#define XDR_IOQ_SIZE_BITS	10
+#define XDR_IOQ_SIZE_SLOTS	(1 << XDR_IOQ_SIZE_BITS)
+#define XDR_IOQ_SIZE_SHIFT	3	/* EWMA weight 1/8 */
+#define XDR_IOQ_SIZE_ALIGN	256
+#define XDR_IOQ_SIZE_MIN	512
+
+struct xdr_ioq_size_slot {
+	uint64_t tag;
+	uint32_t scaled;	/* estimate << XDR_IOQ_SIZE_SHIFT */
+};
+
+static struct xdr_ioq_size_slot xdr_ioq_sizes[2][XDR_IOQ_SIZE_SLOTS];
+static struct xdr_ioq_size_stats xdr_ioq_size_st[2];
+
+static inline uint64_t
+xdr_ioq_size_tag(rpcprog_t prog, rpcvers_t vers, rpcproc_t proc)
+{
+	return (((uint64_t)prog << 32)
+		| ((uint64_t)(vers & 0xff) << 24)
+		| (proc & 0xffffff));
+}
+
+static inline struct xdr_ioq_size_slot *
+xdr_ioq_size_slot(uint64_t tag, u_int dir)
+{
+	return (&xdr_ioq_sizes[dir & 1][(tag * 0x9e3779b97f4a7c15ULL)
+					>> (64 - XDR_IOQ_SIZE_BITS)]);
+}
+
+/*
+ * Estimated encoded length, 0 when there is no history.
+ */
+u_int
+xdr_ioq_size_estimate(rpcprog_t prog, rpcvers_t vers, rpcproc_t proc,
+		      u_int dir)
+{
+	uint64_t tag = xdr_ioq_size_tag(prog, vers, proc);
+	struct xdr_ioq_size_slot *slot = xdr_ioq_size_slot(tag, dir);
+
+	if (atomic_fetch_uint64_t(&slot->tag) != tag)
+		return (0);
+	return (atomic_fetch_uint32_t(&slot->scaled) >> XDR_IOQ_SIZE_SHIFT);
+}
+
+/*
+ * Create an output stream with a first buffer sized from the estimate,
+ * leaving room for variation.  Any further buffers are the usual
+ * RPC_MAXDATA_DEFAULT.
+ */
+struct xdr_ioq *
+xdr_ioq_size_create(rpcprog_t prog, rpcvers_t vers, rpcproc_t proc,
+		    u_int dir, size_t max_bsize, u_int uio_flags)
+{
+	struct xdr_ioq *xioq;
+	size_t size = xdr_ioq_size_estimate(prog, vers, proc, dir);
+
+	if (!size) {
+		size = RPC_MAXDATA_DEFAULT;
+	} else {
+		size += size >> 2;
+		size = (size + XDR_IOQ_SIZE_ALIGN - 1)
+			& ~(XDR_IOQ_SIZE_ALIGN - 1);
+		if (size < XDR_IOQ_SIZE_MIN)
+			size = XDR_IOQ_SIZE_MIN;
+		if (size > max_bsize)
+			size = max_bsize;
+	}
+
+	xioq = xdr_ioq_create(size, max_bsize, uio_flags);
+	xioq->ioq_uv.min_bsize = RPC_MAXDATA_DEFAULT;
+	return (xioq);
+}
+
+/*
+ * Account a completely encoded output stream.
+ */
+void
+xdr_ioq_size_update(struct xdr_ioq *xioq, rpcprog_t prog, rpcvers_t vers,
+		    rpcproc_t proc, u_int dir)
+{
+	uint64_t tag = xdr_ioq_size_tag(prog, vers, proc);
+	struct xdr_ioq_size_slot *slot = xdr_ioq_size_slot(tag, dir);
+	struct xdr_ioq_size_stats *st = &xdr_ioq_size_st[dir & 1];
+	struct poolq_entry *have;
+	uint32_t scaled;
+	size_t allocated = 0;
+	u_int len = XDR_GETPOS(xioq->xdrs);
+
+	TAILQ_FOREACH(have, &xioq->ioq_uv.uvqh.qh, q) {
+		allocated += ioquv_size(IOQ_(have));
+	}
+
+	atomic_inc_uint64_t(&st->count);
+	atomic_add_uint64_t(&st->allocated, allocated);
+	atomic_add_uint64_t(&st->encoded, len);
+	if (xioq->ioq_uv.uvqh.qcount > 1)
+		atomic_inc_uint64_t(&st->appended);
+
+	if (atomic_fetch_uint64_t(&slot->tag) != tag) {
+		atomic_store_uint32_t(&slot->scaled,
+				      len << XDR_IOQ_SIZE_SHIFT);
+		atomic_store_uint64_t(&slot->tag, tag);
+		return;
+	}
+	scaled = atomic_fetch_uint32_t(&slot->scaled);
+	scaled += len - (scaled >> XDR_IOQ_SIZE_SHIFT);
+	atomic_store_uint32_t(&slot->scaled, scaled);
+}
+
+void
+xdr_ioq_size_stats(struct xdr_ioq_size_stats *stats, u_int dir)
+{
+	struct xdr_ioq_size_stats *st = &xdr_ioq_size_st[dir & 1];
+
+	stats->count = atomic_fetch_uint64_t(&st->count);
+	stats->allocated = atomic_fetch_uint64_t(&st->allocated);
+	stats->encoded = atomic_fetch_uint64_t(&st->encoded);
+	stats->appended = atomic_fetch_uint64_t(&st->appended);
+}
+
 static bool
 xdr_ioq_control(XDR *xdrs, /* const */ int rq, void *in)
 {
@@ -55,7 +55,7 @@
 #include "un-namespace.h"
 
 typedef bool (*dummyfunc3)(XDR *, int, void *);
-typedef bool (*dummy_getbufs)(XDR *, xdr_uio *, u_int);
+typedef bool (*dummy_getbufs)(XDR *, xdr_uio *, u_int, u_int);
 typedef bool (*dummy_putbufs)(XDR *, xdr_uio *, u_int);
 
 static const struct xdr_ops xdrmem_ops_aligned;
@@ -111,34 +111,7 @@ xdrmem_putunit(XDR *xdrs, const uint32_t v)
 	return (false);
 }
 
-/* in glibc 2.14+ x86_64, memcpy no longer tries to handle overlapping areas,
- * see Fedora Bug 691336 (NOTABUG); we dont permit overlapping segments,
- * so memcpy may be a small win over memmove.
- */
-
-static bool
-xdrmem_getbytes(XDR *xdrs, char *addr, u_int len)
-{
-	uint8_t *future = xdrs->x_data + len;
-
-	if (future > xdrs->x_v.vio_tail)
-		return (false);
-	memcpy(addr, xdrs->x_data, len);
-	xdrs->x_data = future;
-	return (true);
-}
-
-static bool
-xdrmem_putbytes(XDR *xdrs, const char *addr, u_int len)
-{
-	uint8_t *future = xdrs->x_data + len;
-
-	if (future > xdrs->x_v.vio_wrap)
-		return (false);
-	memcpy(xdrs->x_data, addr, len);
-	xdrs->x_data = future;
-	return (true);
-}
+/* xdrmem_getbytes() and xdrmem_putbytes() are inline in xdr.h */
 
 static u_int
 xdrmem_getpos(XDR *xdrs)
@@ -0,0 +1,300 @@
+/*
+ * This code is released into the "public domain" by its author(s).
+ * Anybody may use, alter, and distribute the code without restriction.
+ * The author(s) make no guarantees, and take no liability of any kind
+ * for use of this code.
+ */
+
+/**
+ * @file clnt_dg_rexmit_test.c
+ * @brief Datagram retransmit test
+ *
+ * @section DESCRIPTION
+ *
+ * A UDP responder thread that drops the first datagram of each call,
+ * and answers the ones that follow with the same xid.  Checks that a
+ * datagram call is sent once per attempt until CLSET_RTT turns the
+ * retransmit estimator on, that it is then retransmitted well before
+ * its timeout, and that a call answered at once gives an RTT sample.
+ */
+
+#include <errno.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <rpc/rpc.h>
+
+#define TEST_PROG 0x20000099
+#define TEST_VERS 1
+#define TEST_PROC 1
+
+static pthread_mutex_t test_mtx = PTHREAD_MUTEX_INITIALIZER;
+static uint32_t last_xid;
+static u_int received;	/* datagrams, all calls */
+static bool lossy;	/* drop the first datagram of each xid */
+static bool stopping;
+static int failures;
+
+#define CHECK(cond, ...)						\
+	do {								\
+		if (!(cond)) {						\
+			fprintf(stderr, "FAIL %s:%d: ", __func__, __LINE__); \
+			fprintf(stderr, __VA_ARGS__);			\
+			fprintf(stderr, "\n");				\
+			failures++;					\
+		}							\
+	} while (0)
+
+/* replies to our calls are dispatched as requests */
+static enum xprt_stat
+decode_request(SVCXPRT *xprt, XDR *xdrs)
+{
+	struct svc_req *req = calloc(1, sizeof(*req));
+	enum xprt_stat stat;
+
+	SVC_REF(xprt, SVC_REF_FLAG_NONE);
+	req->rq_xprt = xprt;
+	req->rq_xdrs = xdrs;
+	req->rq_refs = 1;
+	stat = SVC_DECODE(req);
+	XDR_DESTROY(req->rq_xdrs);
+	SVC_RELEASE(xprt, SVC_RELEASE_FLAG_NONE);
+	free(req);
+	return (stat);
+}
+
+static void *
+responder(void *arg)
+{
+	int fd = *(int *)arg;
+	struct pollfd pfd = { fd, POLLIN, 0 };
+	struct sockaddr_storage from;
+	socklen_t fromlen;
+	uint32_t buf[64];
+	uint32_t reply[6];
+	bool drop;
+	ssize_t n;
+
+	for (;;) {
+		pthread_mutex_lock(&test_mtx);
+		if (stopping) {
+			pthread_mutex_unlock(&test_mtx);
+			return (NULL);
+		}
+		pthread_mutex_unlock(&test_mtx);
+
+		if (poll(&pfd, 1, 100) <= 0)
+			continue;
+		fromlen = sizeof(from);
+		n = recvfrom(fd, buf, sizeof(buf), 0,
+			     (struct sockaddr *)&from, &fromlen);
+		if (n < 2 * sizeof(uint32_t))
+			continue;
+
+		pthread_mutex_lock(&test_mtx);
+		received++;
+		drop = lossy && buf[0] != last_xid;
+		last_xid = buf[0];
+		pthread_mutex_unlock(&test_mtx);
+		if (drop)
+			continue;
+
+		/* accepted, AUTH_NONE verifier, SUCCESS, void results */
+		reply[0] = buf[0];
+		reply[1] = htonl(REPLY);
+		reply[2] = htonl(MSG_ACCEPTED);
+		reply[3] = htonl(AUTH_NONE);
+		reply[4] = 0;
+		reply[5] = htonl(SUCCESS);
+		(void)sendto(fd, reply, sizeof(reply), 0,
+			     (struct sockaddr *)&from, fromlen);
+	}
+}
+
+static void
+set_lossy(bool value)
+{
+	pthread_mutex_lock(&test_mtx);
+	lossy = value;
+	received = 0;
+	pthread_mutex_unlock(&test_mtx);
+}
+
+static u_int
+datagrams(void)
+{
+	u_int n;
+
+	pthread_mutex_lock(&test_mtx);
+	n = received;
+	pthread_mutex_unlock(&test_mtx);
+	return (n);
+}
+
+/* returns the call status, and its duration in ms */
+static enum clnt_stat
+call(CLIENT *clnt, int timeout_ms, long *elapsed_ms)
+{
+	struct clnt_req *cc = mem_zalloc(sizeof(*cc));
+	struct timespec to = { timeout_ms / 1000,
+			       (timeout_ms % 1000) * 1000000 };
+	struct timespec start, end;
+	enum clnt_stat stat;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	clnt_req_fill(cc, clnt, authnone_ncreate(), TEST_PROC,
+		      (xdrproc_t) xdr_void, NULL,
+		      (xdrproc_t) xdr_void, NULL);
+	stat = clnt_req_setup(cc, to);
+	if (stat == RPC_SUCCESS)
+		stat = CLNT_CALL_WAIT(cc);
+	clnt_req_release(cc);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	*elapsed_ms = (end.tv_sec - start.tv_sec) * 1000
+		    + (end.tv_nsec - start.tv_nsec) / 1000000;
+	return (stat);
+}
+
+static void
+test_off(CLIENT *clnt)
+{
+	struct clnt_rtt rtt;
+	enum clnt_stat stat;
+	long ms;
+
+	CHECK(CLNT_CONTROL(clnt, CLGET_RTT, &rtt), "no CLGET_RTT");
+	CHECK(rtt.rto == 0, "retransmit on by default (rto %" PRIu32 ")",
+	      rtt.rto);
+
+	/* the second attempt, after the whole timeout, is answered */
+	set_lossy(true);
+	stat = call(clnt, 300, &ms);
+	CHECK(stat == RPC_SUCCESS, "status %d", stat);
+	CHECK(ms >= 250, "answered in %ld ms", ms);	/* coarse clock */
+	CHECK(datagrams() == 2, "%u datagrams", datagrams());
+
+	CHECK(CLNT_CONTROL(clnt, CLGET_RTT, &rtt), "no CLGET_RTT");
+	CHECK(rtt.retransmits == 0, "retransmits %" PRIu32, rtt.retransmits);
+}
+
+static void
+test_on(CLIENT *clnt)
+{
+	struct clnt_rtt rtt;
+	enum clnt_stat stat;
+	long ms;
+
+	/* 20 ms */
+	memset(&rtt, 0, sizeof(rtt));
+	rtt.srtt = 10000;
+	rtt.rttvar = 2500;
+	rtt.rto_min = 20000;
+	rtt.rto_max = 1000000;
+	CHECK(CLNT_CONTROL(clnt, CLSET_RTT, &rtt), "no CLSET_RTT");
+	CHECK(CLNT_CONTROL(clnt, CLGET_RTT, &rtt), "no CLGET_RTT");
+	CHECK(rtt.rto == 20000, "rto %" PRIu32, rtt.rto);
+
+	set_lossy(true);
+	stat = call(clnt, 5000, &ms);
+	CHECK(stat == RPC_SUCCESS, "status %d", stat);
+	CHECK(ms < 1000, "answered in %ld ms", ms);
+	CHECK(datagrams() == 2, "%u datagrams", datagrams());
+
+	CHECK(CLNT_CONTROL(clnt, CLGET_RTT, &rtt), "no CLGET_RTT");
+	CHECK(rtt.retransmits == 1, "retransmits %" PRIu32, rtt.retransmits);
+	CHECK(rtt.samples == 1, "samples %" PRIu32, rtt.samples);
+
+	/* sent once, so a sample (Karn) */
+	set_lossy(false);
+	stat = call(clnt, 5000, &ms);
+	CHECK(stat == RPC_SUCCESS, "status %d", stat);
+	CHECK(datagrams() == 1, "%u datagrams", datagrams());
+
+	CHECK(CLNT_CONTROL(clnt, CLGET_RTT, &rtt), "no CLGET_RTT");
+	CHECK(rtt.samples == 2, "samples %" PRIu32, rtt.samples);
+
+	/* off again */
+	memset(&rtt, 0, sizeof(rtt));
+	CHECK(CLNT_CONTROL(clnt, CLSET_RTT, &rtt), "no CLSET_RTT");
+	CHECK(CLNT_CONTROL(clnt, CLGET_RTT, &rtt), "no CLGET_RTT");
+	CHECK(rtt.rto == 0, "rto %" PRIu32, rtt.rto);
+}
+
+int
+main(int argc, char *argv[])
+{
+	svc_init_params svc_params;
+	struct sockaddr_in sin;
+	socklen_t len = sizeof(sin);
+	struct netbuf raddr;
+	pthread_t thread;
+	CLIENT *clnt;
+	int sfd;
+	int cfd;
+
+	memset(&svc_params, 0, sizeof(svc_params));
+	svc_params.request_cb = decode_request;
+	svc_params.flags = SVC_INIT_EPOLL;
+	svc_params.max_events = 512;
+	svc_params.ioq_thrd_max = 8;
+	if (!svc_init(&svc_params)) {
+		fprintf(stderr, "svc_init failed\n");
+		return (1);
+	}
+
+	memset(&sin, 0, sizeof(sin));
+	sin.sin_family = AF_INET;
+	sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	sfd = socket(AF_INET, SOCK_DGRAM, 0);
+	if (sfd < 0 || bind(sfd, (struct sockaddr *)&sin, sizeof(sin))
+	 || getsockname(sfd, (struct sockaddr *)&sin, &len)) {
+		perror("responder socket");
+		return (1);
+	}
+	if (pthread_create(&thread, NULL, responder, &sfd)) {
+		fprintf(stderr, "pthread_create failed\n");
+		return (1);
+	}
+
+	cfd = socket(AF_INET, SOCK_DGRAM, 0);
+	if (cfd < 0) {
+		perror("client socket");
+		return (1);
+	}
+	raddr.buf = &sin;
+	raddr.len = raddr.maxlen = sizeof(sin);
+	clnt = clnt_dg_ncreatef(cfd, &raddr, TEST_PROG, TEST_VERS, 0, 0,
+				CLNT_CREATE_FLAG_CLOSE
+				| CLNT_CREATE_FLAG_XPRT_NOREG);
+	if (CLNT_FAILURE(clnt)) {
+		fprintf(stderr, "clnt_dg_ncreatef failed\n");
+		return (1);
+	}
+
+	test_off(clnt);
+	test_on(clnt);
+
+	CLNT_DESTROY(clnt);
+	pthread_mutex_lock(&test_mtx);
+	stopping = true;
+	pthread_mutex_unlock(&test_mtx);
+	pthread_join(thread, NULL);
+	close(sfd);
+	(void)svc_shutdown(SVC_SHUTDOWN_FLAG_NONE);
+
+	if (failures) {
+		fprintf(stderr, "clnt_dg_rexmit_test: %d failed\n", failures);
+		return (1);
+	}
+	printf("clnt_dg_rexmit_test: passed\n");
+	return (0);
+}
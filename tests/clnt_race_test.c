@@ -0,0 +1,293 @@
+/*
+ * This code is released into the "public domain" by its author(s).
+ * Anybody may use, alter, and distribute the code without restriction.
+ * The author(s) make no guarantees, and take no liability of any kind
+ * for use of this code.
+ */
+
+/**
+ * @file clnt_race_test.c
+ * @brief Netid race test
+ *
+ * @section DESCRIPTION
+ *
+ * An rpcbind stand-in in this process.  The inet family is black-holed:
+ * on the loopback rpcbind port, a TCP listener whose accept queue is
+ * full, and a UDP socket never read.  An AF_LOCAL service on the rpcbind
+ * socket answers GETADDR with its own address.  With NETPATH naming
+ * both, checks that clnt_ncreate_timed() returns within
+ * its timeout when every attempt is black-holed, and that the AF_LOCAL
+ * attempt wins soon after it starts otherwise.
+ *
+ * Needs the rpcbind port and socket, so it is skipped (77) when they
+ * cannot be bound, or when rpcbind is running.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <time.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <rpc/rpc.h>
+#include <rpc/pmap_prot.h>
+#include <rpc/svc_auth.h>
+
+#define TEST_PROG 0x20000099
+#define TEST_VERS 1
+
+#define TEST_SKIP 77
+
+#define TEST_FDS 5		/* UDP, and connects queued, unaccepted */
+
+#define TEST_TIMEOUT_MS 1000
+
+static int failures;
+
+#define CHECK(cond, ...)						\
+	do {								\
+		if (!(cond)) {						\
+			fprintf(stderr, "FAIL %s:%d: ", __func__, __LINE__); \
+			fprintf(stderr, __VA_ARGS__);			\
+			fprintf(stderr, "\n");				\
+			failures++;					\
+		}							\
+	} while (0)
+
+/* replies to our calls are dispatched as requests too */
+static enum xprt_stat
+decode_request(SVCXPRT *xprt, XDR *xdrs)
+{
+	struct svc_req *req = calloc(1, sizeof(*req));
+	enum xprt_stat stat;
+
+	SVC_REF(xprt, SVC_REF_FLAG_NONE);
+	req->rq_xprt = xprt;
+	req->rq_xdrs = xdrs;
+	req->rq_refs = 1;
+	stat = SVC_DECODE(req);
+	if (req->rq_auth)
+		SVCAUTH_RELEASE(req);
+	XDR_DESTROY(req->rq_xdrs);
+	SVC_RELEASE(xprt, SVC_RELEASE_FLAG_NONE);
+	free(req);
+	return stat;
+}
+
+/* GETADDR of any program is this socket */
+static enum xprt_stat
+process_request(struct svc_req *req)
+{
+	char *ua = _PATH_RPCBINDSOCK;
+	enum auth_stat why;
+	bool no_dispatch = false;
+
+	why = svc_auth_authenticate(req, &no_dispatch);
+	if (why != AUTH_OK)
+		return svcerr_auth(req, why);
+	if (no_dispatch)
+		return (XPRT_IDLE);
+
+	if (req->rq_msg.cb_proc != RPCBPROC_GETADDR)
+		return svcerr_noproc(req);
+
+	req->rq_msg.RPCM_ack.ar_results.where = &ua;
+	req->rq_msg.RPCM_ack.ar_results.proc = (xdrproc_t) xdr_wrapstring;
+	return svc_sendreply(req);
+}
+
+static enum xprt_stat
+rendezvous_request(SVCXPRT *xprt)
+{
+	xprt->xp_dispatch.process_cb = process_request;
+	return (XPRT_IDLE);
+}
+
+/*
+ * A TCP listener with its accept queue full, fds[1] on the connects
+ * filling it, and in fds[0] a UDP socket never read (the portmapper is
+ * asked over UDP first, when built with PORTMAP).  Returns the listener,
+ * or -1.
+ */
+static int
+black_hole(int *fds)
+{
+	struct sockaddr_in sin;
+	int one = 1;
+	int fd;
+	int i;
+
+	memset(&sin, 0, sizeof(sin));
+	sin.sin_family = AF_INET;
+	sin.sin_port = htons(PMAPPORT);
+	sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+	fds[0] = socket(AF_INET, SOCK_DGRAM, 0);
+	if (fds[0] < 0)
+		return (-1);
+	if (bind(fds[0], (struct sockaddr *)&sin, sizeof(sin))) {
+		close(fds[0]);
+		return (-1);
+	}
+
+	fd = socket(AF_INET, SOCK_STREAM, 0);
+	if (fd < 0) {
+		close(fds[0]);
+		return (-1);
+	}
+	(void)setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+	if (bind(fd, (struct sockaddr *)&sin, sizeof(sin))
+	 || listen(fd, 0)) {
+		close(fd);
+		close(fds[0]);
+		return (-1);
+	}
+
+	for (i = 1; i < TEST_FDS; i++) {
+		fds[i] = socket(AF_INET, SOCK_STREAM, 0);
+		(void)fcntl(fds[i], F_SETFL, O_NONBLOCK);
+		(void)connect(fds[i], (struct sockaddr *)&sin, sizeof(sin));
+	}
+	sleep(1);
+	return (fd);
+}
+
+/* returns the handle, and the time taken in ms */
+static CLIENT *
+create(const char *netpath, int timeout_ms, long *elapsed_ms)
+{
+	struct timeval tv = { timeout_ms / 1000,
+			      (timeout_ms % 1000) * 1000 };
+	struct timespec start, end;
+	CLIENT *clnt;
+
+	setenv("NETPATH", netpath, 1);
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	clnt = clnt_ncreate_timed("localhost", TEST_PROG, TEST_VERS,
+				  "netpath", &tv);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	*elapsed_ms = (end.tv_sec - start.tv_sec) * 1000
+		    + (end.tv_nsec - start.tv_nsec) / 1000000;
+	return (clnt);
+}
+
+static void
+test_bounded(void)
+{
+	CLIENT *clnt;
+	long ms;
+
+	/* both attempts black-holed */
+	clnt = create("tcp:tcp", TEST_TIMEOUT_MS, &ms);
+	CHECK(CLNT_FAILURE(clnt), "created");
+	CHECK(clnt->cl_error.re_status == RPC_TIMEDOUT, "status %d",
+	      clnt->cl_error.re_status);
+	CHECK(ms < TEST_TIMEOUT_MS + 1000, "returned in %ld ms", ms);
+	CLNT_DESTROY(clnt);
+}
+
+static void
+test_fallback(void)
+{
+	CLIENT *clnt;
+	long ms;
+
+	/* the second starts when the first has not connected */
+	clnt = create("tcp:unix", TEST_TIMEOUT_MS, &ms);
+	CHECK(CLNT_SUCCESS(clnt), "status %d", clnt->cl_error.re_status);
+	CHECK(clnt->cl_netid && !strcmp(clnt->cl_netid, "unix"),
+	      "netid %s", clnt->cl_netid ? clnt->cl_netid : "(none)");
+	CHECK(ms < TEST_TIMEOUT_MS / 2, "created in %ld ms", ms);
+	CLNT_DESTROY(clnt);
+}
+
+int
+main(int argc, char *argv[])
+{
+	svc_init_params svc_params;
+	struct sockaddr_un sun;
+	struct netconfig *nconf;
+	SVCXPRT *xprt;
+	int fds[TEST_FDS];
+	int lfd;
+	int sfd;
+	int i;
+
+	nconf = getnetconfigent("unix");
+	if (!nconf || !getservbyname("sunrpc", "tcp")) {
+		fprintf(stderr, "clnt_race_test: no unix netid or sunrpc service, skipped\n");
+		return (TEST_SKIP);
+	}
+	freenetconfigent(nconf);
+
+	memset(&sun, 0, sizeof(sun));
+	sun.sun_family = AF_LOCAL;
+	strcpy(sun.sun_path, _PATH_RPCBINDSOCK);
+	sfd = socket(AF_LOCAL, SOCK_STREAM, 0);
+	if (sfd < 0
+	 || !connect(sfd, (struct sockaddr *)&sun, SUN_LEN(&sun))) {
+		fprintf(stderr, "clnt_race_test: rpcbind running, skipped\n");
+		return (TEST_SKIP);
+	}
+	close(sfd);
+
+	lfd = black_hole(fds);
+	if (lfd < 0) {
+		fprintf(stderr, "clnt_race_test: no rpcbind port (%d), skipped\n",
+			errno);
+		return (TEST_SKIP);
+	}
+
+	memset(&svc_params, 0, sizeof(svc_params));
+	svc_params.request_cb = decode_request;
+	svc_params.flags = SVC_INIT_EPOLL;
+	svc_params.max_events = 512;
+	svc_params.ioq_thrd_max = 8;
+	if (!svc_init(&svc_params)) {
+		fprintf(stderr, "svc_init failed\n");
+		return (1);
+	}
+
+	(void)unlink(_PATH_RPCBINDSOCK);
+	sfd = socket(AF_LOCAL, SOCK_STREAM, 0);
+	if (sfd < 0 || bind(sfd, (struct sockaddr *)&sun, SUN_LEN(&sun))) {
+		fprintf(stderr, "clnt_race_test: no rpcbind socket (%d), skipped\n",
+			errno);
+		return (TEST_SKIP);
+	}
+	xprt = svc_vc_ncreatef(sfd, 0, 0,
+			       SVC_CREATE_FLAG_LISTEN | SVC_CREATE_FLAG_CLOSE);
+	if (!xprt) {
+		fprintf(stderr, "svc_vc_ncreatef failed\n");
+		return (1);
+	}
+	xprt->xp_dispatch.rendezvous_cb = rendezvous_request;
+
+	test_bounded();
+	test_fallback();
+
+	/* refuses the attempts left behind, or they time out (each call
+	 * tried thrice), before their transports are shut down
+	 */
+	close(lfd);
+	for (i = 0; i < TEST_FDS; i++)
+		close(fds[i]);
+	sleep(3 * TEST_TIMEOUT_MS / 1000 + 1);
+	SVC_DESTROY(xprt);
+	(void)unlink(_PATH_RPCBINDSOCK);
+	(void)svc_shutdown(SVC_SHUTDOWN_FLAG_NONE);
+
+	if (failures) {
+		fprintf(stderr, "clnt_race_test: %d failed\n", failures);
+		return (1);
+	}
+	printf("clnt_race_test: passed\n");
+	return (0);
+}
@@ -22,15 +22,26 @@
  * Simple RPC ping test.
  *
  */
+#include <inttypes.h>
 #include <stdio.h>
+#include <string.h>
 #include <unistd.h>
+#include <malloc.h>
+#include <sys/resource.h>
 #include <sys/times.h>
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/poll.h>
+#include <arpa/inet.h>
 #include <netdb.h>
 #include <pthread.h>
+#include <signal.h>
 #include <getopt.h>
 #include <rpc/rpc.h>
+#include <rpc/rpc_cksum.h>
+#include <rpc/xdr_inline.h>
+#include <rpc/xdr_ioq.h>
 #include <rpc/svc_auth.h>
 
 static pthread_mutex_t rpcping_mutex = PTHREAD_MUTEX_INITIALIZER;
@@ -46,11 +57,21 @@ struct state {
 	struct timespec starting;
 	struct timespec stopping;
 	int count;
+	int prog;
+	int vers;
 	int proc;
 	int id;
+	int batch;
 	uint32_t failures;
 	uint32_t responses;
 	uint32_t timeouts;
+	uint64_t *latency;	/* --sync, ns per call */
+};
+
+/* --shared threads call through one handle, so the caller rides along */
+struct ping_req {
+	struct clnt_req pr_cc;
+	struct state *pr_s;
 };
 
 static uint64_t timespec_elapsed(const struct timespec *starting,
@@ -120,11 +141,35 @@ done:
 	return fd;
 }
 
+/* shm: host is the AF_LOCAL path of the svc_shm_ncreatef() listener */
+static int
+get_shm_fd(const char *path)
+{
+	struct sockaddr_un sun;
+	int fd;
+
+	if (strlen(path) >= sizeof(sun.sun_path))
+		return 0;
+
+	memset(&sun, 0, sizeof(sun));
+	sun.sun_family = AF_LOCAL;
+	strcpy(sun.sun_path, path);
+
+	fd = socket(AF_LOCAL, SOCK_STREAM, 0);
+	if (fd <= 0)
+		return 0;
+
+	if (connect(fd, (struct sockaddr *)&sun, sizeof(sun))) {
+		close(fd);
+		return 0;
+	}
+	return fd;
+}
+
 static void
 worker_cb(struct clnt_req *cc)
 {
-	CLIENT *clnt = cc->cc_clnt;
-	struct state *s = clnt->cl_u1;
+	struct state *s = opr_containerof(cc, struct ping_req, pr_cc)->pr_s;
 
 	if (cc->cc_error.re_status != RPC_SUCCESS) {
 		if (cc->cc_error.re_status == RPC_TIMEDOUT) {
@@ -139,14 +184,18 @@ worker_cb(struct clnt_req *cc)
 		return;
 	}
 
+	pthread_mutex_lock(&s->s_mutex);
 	pthread_cond_broadcast(&s->s_cond);
+	pthread_mutex_unlock(&s->s_mutex);
 }
 
 static void *
 worker(void *arg)
 {
 	struct state *s = arg;
+	struct ping_req *pr;
 	struct clnt_req *cc;
+	enum clnt_stat stat;
 	int i;
 
 	pthread_cond_init(&s->s_cond, NULL);
@@ -154,7 +203,9 @@ worker(void *arg)
 
 	clock_gettime(CLOCK_MONOTONIC, &s->starting);
 	for (i = 0; i < s->count; i++) {
-		cc = calloc(1, sizeof(*cc));
+		pr = calloc(1, sizeof(*pr));
+		pr->pr_s = s;
+		cc = &pr->pr_cc;
 		clnt_req_fill(cc, s->handle, authnone_ncreate(), s->proc,
 			      (xdrproc_t) xdr_void, NULL,
 			      (xdrproc_t) xdr_void, NULL);
@@ -168,8 +219,10 @@ worker(void *arg)
 		cc->cc_refreshes = 1;
 		cc->cc_process_cb = worker_cb;
 
-		cc->cc_error.re_status = CLNT_CALL_BACK(cc);
-		if (cc->cc_error.re_status != RPC_SUCCESS) {
+		/* the reply may release cc before this returns */
+		stat = CLNT_CALL_BACK(cc);
+		if (stat != RPC_SUCCESS) {
+			cc->cc_error.re_status = stat;
 			rpc_perror(&cc->cc_error, "CLNT_CALL_BACK failed");
 			s->count = i;
 			clnt_req_release(cc);
@@ -177,16 +230,177 @@ worker(void *arg)
 		}
 	}
 
+	/* replies may all be in before waiting */
 	pthread_mutex_lock(&s->s_mutex);
-	pthread_cond_wait(&s->s_cond, &s->s_mutex);
+	while (atomic_fetch_uint32_t(&s->responses) < s->count)
+		pthread_cond_wait(&s->s_cond, &s->s_mutex);
 	pthread_mutex_unlock(&s->s_mutex);
 	clock_gettime(CLOCK_MONOTONIC, &s->stopping);
 
-	if (atomic_dec_uint32_t(&rpcping_threads) > 0) {
-		return NULL;
+	pthread_mutex_lock(&rpcping_mutex);
+	if (atomic_dec_uint32_t(&rpcping_threads) == 0)
+		pthread_cond_broadcast(&rpcping_cond);
+	pthread_mutex_unlock(&rpcping_mutex);
+	return NULL;
+}
+
+/*
+ * --sync: one call at a time, each waited for by this thread
+ * (CLNT_CALL_WAIT), to measure round trip latency.
+ */
+static void *
+sync_worker(void *arg)
+{
+	struct state *s = arg;
+	struct clnt_req *cc;
+	struct timespec starting;
+	struct timespec stopping;
+	enum clnt_stat stat;
+	int i;
+
+	s->latency = calloc(s->count, sizeof(*s->latency));
+
+	clock_gettime(CLOCK_MONOTONIC, &s->starting);
+	for (i = 0; i < s->count; i++) {
+		cc = calloc(1, sizeof(*cc));
+		clnt_req_fill(cc, s->handle, authnone_ncreate(), s->proc,
+			      (xdrproc_t) xdr_void, NULL,
+			      (xdrproc_t) xdr_void, NULL);
+
+		clock_gettime(CLOCK_MONOTONIC, &starting);
+		stat = clnt_req_setup(cc, to);
+		if (stat == RPC_SUCCESS)
+			stat = CLNT_CALL_WAIT(cc);
+		clock_gettime(CLOCK_MONOTONIC, &stopping);
+
+		if (stat == RPC_TIMEDOUT)
+			s->timeouts++;
+		else if (stat != RPC_SUCCESS)
+			s->failures++;
+		clnt_req_release(cc);
+		s->latency[s->responses++] = timespec_elapsed(&starting,
+							      &stopping);
+	}
+	clock_gettime(CLOCK_MONOTONIC, &s->stopping);
+
+	pthread_mutex_lock(&rpcping_mutex);
+	if (atomic_dec_uint32_t(&rpcping_threads) == 0)
+		pthread_cond_broadcast(&rpcping_cond);
+	pthread_mutex_unlock(&rpcping_mutex);
+	return NULL;
+}
+
+static int
+latency_cmp(const void *a, const void *b)
+{
+	uint64_t l = *(const uint64_t *)a;
+	uint64_t r = *(const uint64_t *)b;
+
+	return (l < r) ? -1 : (l > r);
+}
+
+/* percentiles over all threads, in microseconds */
+static void
+latency_report(struct state *states, int nthreads, uint32_t cflags)
+{
+	uint64_t *all;
+	uint64_t sum = 0;
+	uint32_t n = 0;
+	uint32_t i;
+	int t;
+
+	for (t = 0; t < nthreads; t++)
+		n += states[t].responses;
+	if (!n)
+		return;
+
+	all = calloc(n, sizeof(*all));
+	n = 0;
+	for (t = 0; t < nthreads; t++) {
+		for (i = 0; i < states[t].responses; i++) {
+			all[n] = states[t].latency[i];
+			sum += all[n++];
+		}
+		free(states[t].latency);
+	}
+	qsort(all, n, sizeof(*all), latency_cmp);
+
+	fprintf(stdout, "rpcping sync direct=%d: latency mean %2.1lf p50 %2.1lf p99 %2.1lf max %2.1lf us\n",
+		!!(cflags & CLNT_CREATE_FLAG_DIRECT),
+		sum / 1000.0 / n, all[n / 2] / 1000.0,
+		all[(uint64_t)n * 99 / 100] / 1000.0, all[n - 1] / 1000.0);
+	free(all);
+}
+
+/*
+ * --batch: submit requests in vectors, and take their completions from a
+ * queue polled by this thread rather than by callback.
+ */
+static void *
+batch_worker(void *arg)
+{
+	struct state *s = arg;
+	struct clnt_req **ccv = calloc(s->batch, sizeof(*ccv));
+	struct clnt_cq *cq = clnt_cq_create();
+	struct clnt_req *cc;
+	struct pollfd pfd;
+	int sent = 0;
+	int n;
+	int i;
+
+	pfd.fd = clnt_cq_fd(cq);
+	pfd.events = POLLIN;
+
+	clock_gettime(CLOCK_MONOTONIC, &s->starting);
+	while (s->responses < s->count) {
+		if (sent < s->count) {
+			n = s->count - sent;
+			if (n > s->batch)
+				n = s->batch;
+			for (i = 0; i < n; i++) {
+				cc = calloc(1, sizeof(*cc));
+				clnt_req_fill(cc, s->handle, authnone_ncreate(),
+					      s->proc,
+					      (xdrproc_t) xdr_void, NULL,
+					      (xdrproc_t) xdr_void, NULL);
+				if (clnt_req_setup(cc, to) != RPC_SUCCESS) {
+					rpc_perror(&cc->cc_error,
+						   "clnt_req_setup failed");
+					clnt_req_release(cc);
+					s->count = sent + i;
+					break;
+				}
+				ccv[i] = cc;
+			}
+			/* each is completed on the queue, sent or not */
+			(void)clnt_req_submit(cq, ccv, i);
+			sent += i;
+		} else if (poll(&pfd, 1, -1) < 0) {
+			perror("poll failed");
+			break;
+		}
+
+		while ((n = clnt_cq_dequeue(cq, ccv, s->batch)) > 0) {
+			for (i = 0; i < n; i++) {
+				cc = ccv[i];
+				if (cc->cc_error.re_status == RPC_TIMEDOUT)
+					s->timeouts++;
+				else if (cc->cc_error.re_status != RPC_SUCCESS)
+					s->failures++;
+				clnt_req_release(cc);
+			}
+			s->responses += n;
+		}
 	}
+	clock_gettime(CLOCK_MONOTONIC, &s->stopping);
+
+	clnt_cq_destroy(cq);
+	free(ccv);
 
-	pthread_cond_broadcast(&rpcping_cond);
+	pthread_mutex_lock(&rpcping_mutex);
+	if (atomic_dec_uint32_t(&rpcping_threads) == 0)
+		pthread_cond_broadcast(&rpcping_cond);
+	pthread_mutex_unlock(&rpcping_mutex);
 	return NULL;
 }
 
@@ -212,9 +426,624 @@ decode_request(SVCXPRT *xprt, XDR *xdrs)
 	return stat;
 }
 
+/*
+ * codec: decode a call header and encode its reply in memory, without any
+ * transport, to measure the header codec alone.
+ */
+static void *
+codec_worker(void *arg)
+{
+	struct state *s = arg;
+	struct rpc_msg *msg = calloc(1, sizeof(*msg));
+	char callbuf[512];
+	char replybuf[512];
+	XDR xdrs[1];
+	u_int calllen;
+	int i;
+
+	/* typical AUTH_UNIX sized credential */
+	msg->rm_xid = s->id;
+	msg->rm_direction = CALL;
+	msg->rm_call.cb_rpcvers = RPC_MSG_VERSION;
+	msg->cb_prog = s->prog;
+	msg->cb_vers = s->vers;
+	msg->cb_proc = s->proc;
+	msg->cb_cred.oa_flavor = AUTH_UNIX;
+	msg->cb_cred.oa_length = 64;
+	memset(msg->cb_cred.oa_body, 0x5a, msg->cb_cred.oa_length);
+	msg->cb_verf.oa_flavor = AUTH_NONE;
+	msg->cb_verf.oa_length = 0;
+
+	xdrmem_ncreate(xdrs, callbuf, sizeof(callbuf), XDR_ENCODE);
+	if (!xdr_dplx_msg(xdrs, msg)) {
+		s->failures = s->count;
+		free(msg);
+		return NULL;
+	}
+	calllen = XDR_GETPOS(xdrs);
+	XDR_DESTROY(xdrs);
+
+	clock_gettime(CLOCK_MONOTONIC, &s->starting);
+	for (i = 0; i < s->count; i++) {
+		xdrmem_ncreate(xdrs, callbuf, calllen, XDR_DECODE);
+		if (!xdr_dplx_msg(xdrs, msg)) {
+			s->failures++;
+			continue;
+		}
+		XDR_DESTROY(xdrs);
+
+		msg->rm_direction = REPLY;
+		msg->rm_reply.rp_stat = MSG_ACCEPTED;
+		msg->RPCM_ack.ar_verf.oa_flavor = AUTH_NONE;
+		msg->RPCM_ack.ar_verf.oa_length = 0;
+		msg->RPCM_ack.ar_stat = SUCCESS;
+
+		xdrmem_ncreate(xdrs, replybuf, sizeof(replybuf), XDR_ENCODE);
+		if (!xdr_dplx_msg(xdrs, msg)) {
+			s->failures++;
+			continue;
+		}
+		XDR_DESTROY(xdrs);
+		s->responses++;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &s->stopping);
+
+	free(msg);
+	return NULL;
+}
+
+static void
+codec_run(struct state *states, int nthreads, int count, int prog, int vers,
+	  int proc)
+{
+	pthread_t *threads = calloc(nthreads, sizeof(pthread_t));
+	struct state *s;
+	unsigned int failures = 0;
+	double total = 0.0;
+	double elapsed_ns = 0.0;
+	int i;
+
+	for (i = 0; i < nthreads; i++) {
+		s = &states[i];
+		s->id = i;
+		s->count = count;
+		s->prog = prog;
+		s->vers = vers;
+		s->proc = proc;
+		pthread_create(&threads[i], NULL, codec_worker, s);
+	}
+
+	for (i = 0; i < nthreads; i++) {
+		s = &states[i];
+		pthread_join(threads[i], NULL);
+		failures += s->failures;
+		total += s->responses;
+		elapsed_ns += timespec_elapsed(&s->starting, &s->stopping);
+	}
+	free(threads);
+
+	fprintf(stdout, "rpcping codec count=%d threads=%d (program=%d version=%d procedure=%d): failures %u mean %2.4lf ns/call, total %2.4lf calls/s\n",
+		count, nthreads, prog, vers, proc, failures,
+		total ? elapsed_ns / total : 0.0,
+		elapsed_ns ? total * 1000000000.0 * nthreads / elapsed_ns
+			   : 0.0);
+	fflush(stdout);
+}
+
+/*
+ * decode: decode an argument list of the shape common to NFS reads and
+ * writes (handle, offset, count, verifier), from a flat xdrmem buffer and
+ * from an xdr_ioq of small buffers that splits items across boundaries.
+ */
+#define DECODE_ITEMS 16
+#define DECODE_FH 28		/* not a multiple of BYTES_PER_XDR_UNIT */
+#define DECODE_BSIZE 100	/* xdr_ioq buffer size */
+
+struct decode_item {
+	char fh[DECODE_FH];
+	uint64_t offset;
+	uint32_t count;
+	char verf[8];
+};
+
+static bool
+xdr_decode_item(XDR *xdrs, struct decode_item *item)
+{
+	return (xdr_opaque(xdrs, item->fh, DECODE_FH)
+	     && xdr_uint64_t(xdrs, &item->offset)
+	     && xdr_uint32_t(xdrs, &item->count)
+	     && xdr_opaque(xdrs, item->verf, sizeof(item->verf)));
+}
+
+static bool
+xdr_decode_items(XDR *xdrs, struct decode_item *items)
+{
+	int i;
+
+	for (i = 0; i < DECODE_ITEMS; i++) {
+		if (!xdr_decode_item(xdrs, &items[i]))
+			return (false);
+	}
+	return (true);
+}
+
+static void
+decode_run(int count)
+{
+	struct decode_item items[DECODE_ITEMS];
+	struct decode_item out[DECODE_ITEMS];
+	struct timespec starting;
+	struct timespec stopping;
+	struct xdr_ioq *xioq;
+	char buf[DECODE_ITEMS * sizeof(struct decode_item) * 2];
+	double elapsed_ns;
+	unsigned int failures = 0;
+	u_int len;
+	XDR xdrs[1];
+	int i;
+
+	/* compared whole, padding included */
+	memset(items, 0, sizeof(items));
+	memset(out, 0, sizeof(out));
+	for (i = 0; i < DECODE_ITEMS; i++) {
+		memset(items[i].fh, i, DECODE_FH);
+		items[i].offset = (uint64_t)i << 40 | i;
+		items[i].count = 1048576;
+		memset(items[i].verf, ~i, sizeof(items[i].verf));
+	}
+
+	xdrmem_ncreate(xdrs, buf, sizeof(buf), XDR_ENCODE);
+	if (!xdr_decode_items(xdrs, items)) {
+		fprintf(stderr, "rpcping decode: xdrmem encode failed\n");
+		return;
+	}
+	len = XDR_GETPOS(xdrs);
+	XDR_DESTROY(xdrs);
+
+	clock_gettime(CLOCK_MONOTONIC, &starting);
+	for (i = 0; i < count; i++) {
+		xdrmem_ncreate(xdrs, buf, len, XDR_DECODE);
+		if (!xdr_decode_items(xdrs, out))
+			failures++;
+		XDR_DESTROY(xdrs);
+	}
+	clock_gettime(CLOCK_MONOTONIC, &stopping);
+	if (memcmp(items, out, sizeof(items)))
+		failures++;
+
+	elapsed_ns = timespec_elapsed(&starting, &stopping);
+	fprintf(stdout, "rpcping decode xdrmem count=%d items=%d bytes=%u: failures %u mean %2.4lf ns/call\n",
+		count, DECODE_ITEMS, len, failures,
+		count ? elapsed_ns / count : 0.0);
+
+	xioq = xdr_ioq_create(DECODE_BSIZE, DECODE_BSIZE, UIO_FLAG_FREE);
+	xioq->xdrs[0].x_op = XDR_ENCODE;
+	if (!xdr_decode_items(xioq->xdrs, items)) {
+		fprintf(stderr, "rpcping decode: xdr_ioq encode failed\n");
+		XDR_DESTROY(xioq->xdrs);
+		return;
+	}
+	len = XDR_GETPOS(xioq->xdrs);
+	failures = 0;
+	memset(out, 0, sizeof(out));
+
+	clock_gettime(CLOCK_MONOTONIC, &starting);
+	for (i = 0; i < count; i++) {
+		xioq->xdrs[0].x_op = XDR_DECODE;
+		xdr_ioq_reset(xioq, 0);
+		if (!xdr_decode_items(xioq->xdrs, out))
+			failures++;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &stopping);
+	if (memcmp(items, out, sizeof(items)))
+		failures++;
+
+	/* one more byte than was encoded must fail, not return short */
+	xdr_ioq_reset(xioq, 0);
+	if (!xdr_getbytes(xioq->xdrs, buf, len)
+	 || xdr_getbytes(xioq->xdrs, buf, 1))
+		failures++;
+
+	elapsed_ns = timespec_elapsed(&starting, &stopping);
+	fprintf(stdout, "rpcping decode xdr_ioq count=%d items=%d bytes=%u buffers=%d: failures %u mean %2.4lf ns/call\n",
+		count, DECODE_ITEMS, len, xioq->ioq_uv.uvqh.qcount, failures,
+		count ? elapsed_ns / count : 0.0);
+	fflush(stdout);
+	XDR_DESTROY(xioq->xdrs);
+}
+
+/*
+ * cksum: request checksum algorithms over 64 B to 1 MB buffers, each
+ * summing count * 64 KiB.
+ */
+static void
+cksum_run(int count)
+{
+	static const struct {
+		enum rpc_cksum_type type;
+		const char *name;
+	} algs[] = {
+		{ RPC_CKSUM_CITYHASH, "cityhash64" },
+		{ RPC_CKSUM_CRC32C_SW, "crc32c-sw" },
+		{ RPC_CKSUM_CRC32C, "crc32c" },
+	};
+	size_t max = 1024 * 1024;
+	unsigned char *buf = malloc(max);
+	struct timespec starting;
+	struct timespec stopping;
+	volatile uint64_t sink = 0;
+	size_t size;
+	size_t i;
+	int a;
+
+	for (i = 0; i < max; i++)
+		buf[i] = random();
+
+	fprintf(stdout, "rpcping cksum crc32c=%s\n", rpc_crc32c_impl());
+
+	for (size = 64; size <= max; size <<= 2) {
+		uint64_t n = MAX(1, (uint64_t)count * 65536 / size);
+
+		for (a = 0; a < sizeof(algs) / sizeof(algs[0]); a++) {
+			double elapsed_ns;
+			uint64_t j;
+
+			clock_gettime(CLOCK_MONOTONIC, &starting);
+			for (j = 0; j < n; j++)
+				sink += rpc_cksum(algs[a].type, buf, size);
+			clock_gettime(CLOCK_MONOTONIC, &stopping);
+
+			elapsed_ns = timespec_elapsed(&starting, &stopping);
+			fprintf(stdout, "rpcping cksum size=%zu %s: mean %2.4lf ns/op, total %2.4lf MB/s\n",
+				size, algs[a].name, elapsed_ns / n,
+				elapsed_ns ? (double)size * n * 1000.0
+					     / elapsed_ns
+					   : 0.0);
+		}
+	}
+	fflush(stdout);
+	free(buf);
+}
+
+/*
+ * idle: count loopback connections to a listener in this process, idle,
+ * then each holding a partially received record, then after
+ * svc_init_params.idle_quiesce.  Reports allocated heap and resident
+ * memory per connection; resident pages freed within the heap may not
+ * be returned by the allocator.
+ */
+#define IDLE_QUIESCE 2		/* seconds */
+#define IDLE_FRAGMENT 65536
+#define IDLE_PARTIAL 1024
+
+struct idle_sample {
+	size_t heap;
+	size_t rss;
+};
+
+static void
+idle_sample(struct idle_sample *is)
+{
+	FILE *f = fopen("/proc/self/statm", "r");
+	unsigned long size = 0;
+	unsigned long resident = 0;
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || __GLIBC_MINOR__ >= 33)
+	struct mallinfo2 mi;
+#else
+	struct mallinfo mi;
+#endif
+
+	(void)malloc_trim(0);
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || __GLIBC_MINOR__ >= 33)
+	mi = mallinfo2();
+#else
+	mi = mallinfo();
+#endif
+	is->heap = (size_t)mi.uordblks + mi.hblkhd;
+
+	if (f) {
+		if (fscanf(f, "%lu %lu", &size, &resident) != 2)
+			resident = 0;
+		fclose(f);
+	}
+	is->rss = resident * sysconf(_SC_PAGESIZE);
+}
+
+/* until the listener has caught up */
+static void
+idle_settle(struct idle_sample *is)
+{
+	size_t prev;
+	int i;
+
+	idle_sample(is);
+	for (i = 0; i < 50; i++) {
+		usleep(100000);
+		prev = is->heap;
+		idle_sample(is);
+		if (is->heap == prev)
+			break;
+	}
+}
+
+static enum xprt_stat
+idle_rendezvous(SVCXPRT *xprt)
+{
+	xprt->xp_dispatch.process_cb = svcerr_noproc;
+	return (XPRT_IDLE);
+}
+
+static void
+idle_report(const char *phase, struct idle_sample *is,
+	    struct idle_sample *base, int count)
+{
+	fprintf(stdout, "rpcping idle %s count=%d: heap %2.1lf rss %2.1lf bytes/connection\n",
+		phase, count,
+		is->heap > base->heap
+			? (double)(is->heap - base->heap) / count : 0.0,
+		is->rss > base->rss
+			? (double)(is->rss - base->rss) / count : 0.0);
+}
+
+static void
+idle_run(const char *host, int count)
+{
+	struct sockaddr_in sin;
+	socklen_t len = sizeof(sin);
+	struct idle_sample base;
+	struct idle_sample is;
+	struct rlimit rl;
+	SVCXPRT *xprt;
+	char *partial = calloc(1, BYTES_PER_XDR_UNIT + IDLE_PARTIAL);
+	int *fds = calloc(count, sizeof(int));
+	int lfd;
+	int i;
+
+	/* both ends of each connection are in this process */
+	if (!getrlimit(RLIMIT_NOFILE, &rl)) {
+		rl.rlim_cur = rl.rlim_max;
+		(void)setrlimit(RLIMIT_NOFILE, &rl);
+		if (count > (rl.rlim_cur - 64) / 2)
+			count = (rl.rlim_cur - 64) / 2;
+	}
+
+	memset(&sin, 0, sizeof(sin));
+	sin.sin_family = AF_INET;
+	if (inet_pton(AF_INET, host, &sin.sin_addr) != 1)
+		sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+	lfd = socket(AF_INET, SOCK_STREAM, 0);
+	if (lfd < 0 || bind(lfd, (struct sockaddr *)&sin, sizeof(sin))
+	 || getsockname(lfd, (struct sockaddr *)&sin, &len)) {
+		perror("idle listener failed");
+		exit(3);
+	}
+	xprt = svc_vc_ncreatef(lfd, 0, 0, SVC_CREATE_FLAG_LISTEN
+					  | SVC_CREATE_FLAG_CLOSE);
+	if (!xprt) {
+		perror("svc_vc_ncreatef failed");
+		exit(4);
+	}
+	xprt->xp_dispatch.rendezvous_cb = idle_rendezvous;
+
+	idle_sample(&base);
+	for (i = 0; i < count; i++) {
+		fds[i] = socket(AF_INET, SOCK_STREAM, 0);
+		if (fds[i] < 0
+		 || connect(fds[i], (struct sockaddr *)&sin, sizeof(sin))) {
+			perror("idle connect failed");
+			count = i;
+			break;
+		}
+	}
+	if (!count)
+		exit(3);
+	idle_settle(&is);
+	idle_report("connected", &is, &base, count);
+
+	/* record marker for a fragment that never completes */
+	*(uint32_t *)partial = htonl(0x80000000 | IDLE_FRAGMENT);
+	for (i = 0; i < count; i++)
+		(void)send(fds[i], partial, BYTES_PER_XDR_UNIT + IDLE_PARTIAL,
+			   MSG_NOSIGNAL);
+	idle_settle(&is);
+	idle_report("partial", &is, &base, count);
+
+	sleep(IDLE_QUIESCE * 2 + 1);
+	idle_sample(&is);
+	idle_report("quiesced", &is, &base, count);
+	fflush(stdout);
+
+	for (i = 0; i < count; i++)
+		close(fds[i]);
+	free(fds);
+	free(partial);
+}
+
+/*
+ * share: --threads writers and as many readers on one transport.  Each
+ * writer takes and releases count * 1000 references; each reader reads
+ * the read-mostly fields of every event, until the writers are done.
+ * Readers slow down when these share cache lines with the references.
+ */
+struct share_state {
+	SVCXPRT *xprt;
+	struct timespec starting;
+	struct timespec stopping;
+	uint64_t ops;
+	uintptr_t sink;
+	int count;
+	bool writer;
+};
+
+static uint32_t share_writers;
+
+static void *
+share_worker(void *arg)
+{
+	struct share_state *ss = arg;
+	const volatile SVCXPRT *vx = ss->xprt;
+	uint64_t n = 0;
+	uintptr_t sink = 0;
+
+	clock_gettime(CLOCK_MONOTONIC, &ss->starting);
+	if (ss->writer) {
+		for (n = 0; n < (uint64_t)ss->count * 1000; n++) {
+			SVC_REF(ss->xprt, SVC_REF_FLAG_NONE);
+			SVC_RELEASE(ss->xprt, SVC_RELEASE_FLAG_NONE);
+		}
+		atomic_dec_uint32_t(&share_writers);
+	} else {
+		while (atomic_fetch_uint32_t(&share_writers)) {
+			sink += (uintptr_t)vx->xp_ops;
+			sink += (uintptr_t)vx->xp_dispatch.process_cb;
+			sink += (uintptr_t)vx->xp_p1;
+			sink += (uintptr_t)vx->xp_u1;
+			sink += vx->xp_fd + vx->xp_type;
+			n++;
+		}
+	}
+	clock_gettime(CLOCK_MONOTONIC, &ss->stopping);
+	ss->ops = n;
+	ss->sink = sink;
+	return NULL;
+}
+
+static void
+share_run(int nthreads, int count)
+{
+	pthread_t *threads = calloc(2 * nthreads, sizeof(pthread_t));
+	struct share_state *ss = calloc(2 * nthreads, sizeof(*ss));
+	double ops[2] = {0.0, 0.0};
+	double elapsed_ns[2] = {0.0, 0.0};
+	SVCXPRT *xprt;
+	int sv[2];
+	int i;
+
+	if (socketpair(AF_LOCAL, SOCK_STREAM, 0, sv)) {
+		perror("socketpair failed");
+		exit(3);
+	}
+	xprt = svc_vc_ncreatef(sv[0], 0, 0, SVC_CREATE_FLAG_CLOSE);
+	if (!xprt) {
+		perror("svc_vc_ncreatef failed");
+		exit(4);
+	}
+
+	share_writers = nthreads;
+	for (i = 0; i < 2 * nthreads; i++) {
+		ss[i].xprt = xprt;
+		ss[i].count = count;
+		ss[i].writer = (i < nthreads);
+		pthread_create(&threads[i], NULL, share_worker, &ss[i]);
+	}
+	for (i = 0; i < 2 * nthreads; i++) {
+		pthread_join(threads[i], NULL);
+		ops[ss[i].writer] += ss[i].ops;
+		elapsed_ns[ss[i].writer] += timespec_elapsed(&ss[i].starting,
+							     &ss[i].stopping);
+	}
+
+	fprintf(stdout, "rpcping share count=%d threads=%d: ref+release %2.4lf ns/op, read %2.4lf ns/op\n",
+		count, nthreads,
+		ops[1] ? elapsed_ns[1] / ops[1] : 0.0,
+		ops[0] ? elapsed_ns[0] / ops[0] : 0.0);
+	fflush(stdout);
+
+	SVC_DESTROY(xprt);
+	close(sv[1]);
+	free(threads);
+	free(ss);
+}
+
+/*
+ * simple: each thread makes count rpc_call()s, taking the hosts of a
+ * comma-separated list in turn.  Handles are cached by rpc_call().
+ */
+struct simple_state {
+	char **hosts;
+	int nhosts;
+	struct timespec starting;
+	struct timespec stopping;
+	int count;
+	int prog;
+	int vers;
+	int proc;
+	uint32_t failures;
+};
+
+static void *
+simple_worker(void *arg)
+{
+	struct simple_state *ss = arg;
+	enum clnt_stat stat;
+	int i;
+
+	clock_gettime(CLOCK_MONOTONIC, &ss->starting);
+	for (i = 0; i < ss->count; i++) {
+		stat = rpc_call(ss->hosts[i % ss->nhosts], ss->prog, ss->vers,
+				ss->proc, (xdrproc_t) xdr_void, NULL,
+				(xdrproc_t) xdr_void, NULL, "tcp");
+		if (stat != RPC_SUCCESS)
+			ss->failures++;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &ss->stopping);
+	return NULL;
+}
+
+static void
+simple_run(char *host, int nthreads, int count, int prog, int vers, int proc)
+{
+	pthread_t *threads = calloc(nthreads, sizeof(pthread_t));
+	struct simple_state *ss = calloc(nthreads, sizeof(*ss));
+	struct rpcb_cache_stats rcs;
+	char *hosts[32];
+	char *saveptr = NULL;
+	char *h;
+	double elapsed_ns = 0.0;
+	double mean;
+	uint32_t failures = 0;
+	int nhosts = 0;
+	int i;
+
+	for (h = strtok_r(host, ",", &saveptr); h && nhosts < 32;
+	     h = strtok_r(NULL, ",", &saveptr))
+		hosts[nhosts++] = h;
+
+	for (i = 0; i < nthreads; i++) {
+		ss[i].hosts = hosts;
+		ss[i].nhosts = nhosts;
+		ss[i].count = count;
+		ss[i].prog = prog;
+		ss[i].vers = vers;
+		ss[i].proc = proc;
+		pthread_create(&threads[i], NULL, simple_worker, &ss[i]);
+	}
+	for (i = 0; i < nthreads; i++) {
+		pthread_join(threads[i], NULL);
+		failures += ss[i].failures;
+		elapsed_ns += timespec_elapsed(&ss[i].starting,
+					       &ss[i].stopping);
+	}
+
+	mean = elapsed_ns ? (double)count * nthreads * 1000000000.0 / elapsed_ns
+			  : 0.0;
+	fprintf(stdout, "rpcping simple hosts=%d count=%d threads=%d (program=%d version=%d procedure=%d): failures %u mean %2.4lf, total %2.4lf\n",
+		nhosts, count, nthreads, prog, vers, proc, failures,
+		mean, mean * nthreads);
+	rpcb_cache_stats(&rcs);
+	fprintf(stdout, "rpcbind cache: hits %" PRIu64 " negative %" PRIu64 " misses %" PRIu64 " refreshes %" PRIu64 " expired %" PRIu64 " evicted %" PRIu64 " entries %" PRIu64 "\n",
+		rcs.hits, rcs.negative_hits, rcs.misses, rcs.refreshes,
+		rcs.expired, rcs.evicted, rcs.entries);
+	fflush(stdout);
+
+	free(threads);
+	free(ss);
+}
+
 static void usage()
 {
-	printf("Usage: rpcping <raw|rdma|tcp|udp> <host> [--rpcbind] [--count=<n>] [--threads=<n>] [--workers=<n>] [--port=<n>] [--program=<n>] [--version=<n>] [--procedure=<n>]\n");
+	printf("Usage: rpcping <cksum|codec|decode|idle|raw|rdma|share|shm|simple|tcp|udp> <host> [--rpcbind] [--count=<n>] [--threads=<n>] [--workers=<n>] [--batch=<n>] [--nconnect=<n>] [--shared] [--slots=<n>] [--reconnect] [--sync] [--direct] [--port=<n>] [--program=<n>] [--version=<n>] [--procedure=<n>]\n");
 }
 
 static struct option long_options[] =
@@ -222,6 +1051,13 @@ static struct option long_options[] =
 	{"count", required_argument, NULL, 'c'},
 	{"threads", required_argument, NULL, 't'},
 	{"workers", required_argument, NULL, 'w'},
+	{"batch", required_argument, NULL, 'B'},
+	{"nconnect", required_argument, NULL, 'n'},
+	{"shared", no_argument, NULL, 's'},
+	{"slots", required_argument, NULL, 'S'},
+	{"reconnect", no_argument, NULL, 'r'},
+	{"sync", no_argument, NULL, 'y'},
+	{"direct", no_argument, NULL, 'd'},
 	{"port", required_argument, NULL, 'p'},
 	{"program", required_argument, NULL, 'm'},
 	{"version", required_argument, NULL, 'v'},
@@ -245,6 +1081,9 @@ int main(int argc, char *argv[])
 	int count = 500; /* minimal concurrent requests */
 	int nthreads = 1;
 	int nworkers = 5;
+	int batch = 0;
+	int nconnect = 0;
+	int slots = 0; /* unlimited */
 	int port = 2049;
 	int prog = 100003; /* nfs */
 	int vers = 3; /* allow raw, rdma, tcp, udp by default */
@@ -253,7 +1092,11 @@ int main(int argc, char *argv[])
 	int recv_sz = 8192;
 	unsigned int failures = 0;
 	unsigned int timeouts = 0;
+	struct clnt_slots cs = {0};
 	bool rpcbind = false;
+	bool shared = false;
+	bool sync = false;
+	uint32_t cflags = CLNT_CREATE_FLAG_NONE;
 
 	/* protocol and host/dest positional */
 	if (argc < 3) {
@@ -265,7 +1108,7 @@ int main(int argc, char *argv[])
 	host = argv[2];
 
 	optind = 3;
-	while ((opt = getopt_long(argc, argv, "bc:m:p:t:v:w:x:",
+	while ((opt = getopt_long(argc, argv, "bB:c:dm:n:p:rsS:t:v:w:x:y",
 				  long_options, NULL)) != -1) {
 		switch (opt)
 		{
@@ -278,6 +1121,29 @@ int main(int argc, char *argv[])
 		case 'w':
 			nworkers = atoi(optarg);
 			break;
+		case 'B':
+			batch = atoi(optarg);
+			break;
+		case 'n':
+			nconnect = atoi(optarg);
+			break;
+		case 's':
+			shared = true;
+			break;
+		case 'S':
+			slots = atoi(optarg);
+			break;
+		case 'r':
+			cflags |= CLNT_CREATE_FLAG_RECONNECT;
+			/* writes to a dropped connection fail, not kill */
+			signal(SIGPIPE, SIG_IGN);
+			break;
+		case 'y':
+			sync = true;
+			break;
+		case 'd':
+			cflags |= CLNT_CREATE_FLAG_DIRECT;
+			break;
 		case 'p':
 			port = atoi(optarg);
 			break;
@@ -306,28 +1172,98 @@ int main(int argc, char *argv[])
 		exit(1);
 	}
 
+	if (!strcmp(proto, "cksum")) {
+		/* no transport, host is ignored */
+		cksum_run(count);
+		free(states);
+		return (0);
+	}
+
+	if (!strcmp(proto, "decode")) {
+		/* no transport, host is ignored */
+		decode_run(count);
+		free(states);
+		return (0);
+	}
+
+	if (!strcmp(proto, "codec")) {
+		/* no transport, host is ignored */
+		codec_run(states, nthreads, count, prog, vers, proc);
+		free(states);
+		return (0);
+	}
+
 	memset(&svc_params, 0, sizeof(svc_params));
 	svc_params.request_cb = decode_request;
 	svc_params.flags = SVC_INIT_EPOLL | SVC_INIT_NOREG_XPRTS;
 	svc_params.max_events = 512;
 	svc_params.ioq_thrd_max = nworkers;
+	svc_params.clnt_slots_min = slots;
+	svc_params.clnt_slots_max = slots;
+	if (!strcmp(proto, "idle")) {
+		/* registers its listener */
+		svc_params.flags = SVC_INIT_EPOLL;
+		svc_params.max_connections = count + 16;
+		svc_params.idle_quiesce = IDLE_QUIESCE;
+	}
 
 	if (!svc_init(&svc_params)) {
 		perror("svc_init failed");
 		exit(1);
 	}
 
+	if (!strcmp(proto, "share")) {
+		/* transport in this process, host is ignored */
+		share_run(nthreads, count);
+		free(states);
+		(void)svc_shutdown(SVC_SHUTDOWN_FLAG_NONE);
+		return (0);
+	}
+
+	if (!strcmp(proto, "simple")) {
+		/* host is a comma-separated list, found with rpcbind */
+		simple_run(host, nthreads, count, prog, vers, proc);
+		free(states);
+		(void)svc_shutdown(SVC_SHUTDOWN_FLAG_NONE);
+		return (0);
+	}
+
+	if (!strcmp(proto, "idle")) {
+		/* listener in this process, host is its address */
+		idle_run(host, count);
+		free(states);
+		(void)svc_shutdown(SVC_SHUTDOWN_FLAG_NONE);
+		return (0);
+	}
+
 	rpcping_threads = nthreads;
 	for (i = 0; i < nthreads; i++) {
 		pthread_t t;
 
-		if (rpcbind) {
+		if (shared && i > 0) {
+			/* many threads, one CLIENT */
+			clnt = states[0].handle;
+		} else if (rpcbind) {
 			clnt = clnt_ncreate(host, prog, vers, proto);
 			if (CLNT_FAILURE(clnt)) {
 				rpc_perror(&clnt->cl_error,
 					   "clnt_ncreate failed");
 				exit(2);
 			}
+		} else if (!strcmp(proto, "shm")) {
+			int fd = get_shm_fd(host);
+
+			if (fd <= 0) {
+				perror("get_shm_fd failed");
+				exit(3);
+			}
+			clnt = clnt_shm_ncreatef(fd, prog, vers, 0, 0,
+						 CLNT_CREATE_FLAG_CLOSE);
+			if (CLNT_FAILURE(clnt)) {
+				rpc_perror(&clnt->cl_error,
+					   "clnt_shm_ncreatef failed");
+				exit(4);
+			}
 		} else {
 			/* connect to host:port */
 			struct sockaddr_storage ss;
@@ -335,16 +1271,28 @@ int main(int argc, char *argv[])
 				.buf = &ss,
 				.len = sizeof(ss)
 			};
+			socklen_t slen = sizeof(ss);
 			int fd = get_conn_fd(host, port);
 
 			if (fd <= 0) {
 				perror("get_conn_fd failed");
 				exit(3);
 			}
-			clnt = clnt_vc_ncreatef(fd, &raddr, prog, vers,
-						send_sz,
-						recv_sz,
-						CLNT_CREATE_FLAG_CLOSE);
+			/* reconnects to the address just found */
+			getpeername(fd, (struct sockaddr *)&ss, &slen);
+			raddr.len = slen;
+			if (nconnect > 0) {
+				close(fd);
+				clnt = clnt_nconn_ncreatef(&raddr, prog, vers,
+							   send_sz, recv_sz,
+							   nconnect, cflags);
+			} else {
+				clnt = clnt_vc_ncreatef(fd, &raddr, prog, vers,
+							send_sz,
+							recv_sz,
+							CLNT_CREATE_FLAG_CLOSE
+							| cflags);
+			}
 			if (CLNT_FAILURE(clnt)) {
 				rpc_perror(&clnt->cl_error,
 					   "clnt_ncreate failed");
@@ -352,17 +1300,18 @@ int main(int argc, char *argv[])
 			}
 		}
 		s = &states[i];
-		clnt->cl_u1 = s;
-
 		s->handle = clnt;
 		s->id = i;
 		s->count = count;
 		s->proc = proc;
-		pthread_create(&t, NULL, worker, s);
+		s->batch = batch;
+		pthread_create(&t, NULL, sync ? sync_worker
+				       : batch > 0 ? batch_worker : worker, s);
 	}
 
 	pthread_mutex_lock(&rpcping_mutex);
-	pthread_cond_wait(&rpcping_cond, &rpcping_mutex);
+	while (atomic_fetch_uint32_t(&rpcping_threads) > 0)
+		pthread_cond_wait(&rpcping_cond, &rpcping_mutex);
 	pthread_mutex_unlock(&rpcping_mutex);
 
 	total = 0.0;
@@ -373,14 +1322,19 @@ int main(int argc, char *argv[])
 		timeouts += s->timeouts;
 		total += s->responses;
 		elapsed_ns += timespec_elapsed(&s->starting, &s->stopping);
-		CLNT_DESTROY(s->handle);
+		if (i == 0)
+			(void)CLNT_CONTROL(s->handle, CLGET_SLOTS, &cs);
+		if (!shared || i == 0)
+			CLNT_DESTROY(s->handle);
 	}
 	total *= 1000000000.0;
 	total /= elapsed_ns;
 
-	fprintf(stdout, "rpcping %s %s count=%d threads=%d workers=%d (port=%d program=%d version=%d procedure=%d): failures %u timeouts %u mean %2.4lf, total %2.4lf\n",
-		proto, host, count, nthreads, nworkers, port, prog, vers, proc,
-		failures, timeouts, total / nthreads, total);
+	fprintf(stdout, "rpcping %s %s count=%d threads=%d workers=%d batch=%d nconnect=%d shared=%d slots=%u (port=%d program=%d version=%d procedure=%d): failures %u timeouts %u mean %2.4lf, total %2.4lf\n",
+		proto, host, count, nthreads, nworkers, batch, nconnect,
+		shared, cs.limit, port, prog, vers, proc, failures, timeouts, total / nthreads, total);
+	if (sync)
+		latency_report(states, nthreads, cflags);
 	fflush(stdout);
 
 	(void)svc_shutdown(SVC_SHUTDOWN_FLAG_NONE);
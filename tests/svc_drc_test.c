@@ -0,0 +1,406 @@
+/*
+ * Copyright (c) 2018 Red Hat, Inc.
+ *
+ * This code is released into the "public domain" by its author(s).
+ * Anybody may use, alter, and distribute the code without restriction.
+ * The author(s) make no guarantees, and take no liability of any kind
+ * for use of this code.
+ */
+
+/**
+ * @file svc_drc_test.c
+ * @brief Duplicate request cache test
+ *
+ * @section DESCRIPTION
+ *
+ * A UDP service in this process, with the cache in one small shard, and
+ * a client that sends hand built calls so that it chooses the xids.
+ * Checks a miss, a hit, eviction over max_bytes, a retransmission
+ * dropped while the original is in progress, the same retransmission
+ * executed again after in_progress_ttl, and RPC_CKSUM_FULL.
+ */
+
+#include <errno.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <time.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <rpc/rpc.h>
+#include <rpc/rpc_cksum.h>
+#include <rpc/svc_auth.h>
+#include <rpc/svc_drc.h>
+#include <rpc/xdr_inline.h>
+
+#define TEST_PROG 0x20000099
+#define TEST_VERS 1
+#define TEST_PROC_FAST 1
+#define TEST_PROC_SLOW 2	/* waits for release_slow() */
+
+#define TEST_IN_PROGRESS_TTL 1	/* seconds */
+#define TEST_MAX_BYTES 8192	/* about 10 void replies, with their entries */
+#define TEST_MAX_ENTRIES 16
+
+static pthread_mutex_t test_mtx = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t test_cv = PTHREAD_COND_INITIALIZER;
+static u_int executed[3];
+static u_int slow_waiting;
+static bool slow_released;
+static int failures;
+
+#define CHECK(cond, ...)						\
+	do {								\
+		if (!(cond)) {						\
+			fprintf(stderr, "FAIL %s:%d: ", __func__, __LINE__); \
+			fprintf(stderr, __VA_ARGS__);			\
+			fprintf(stderr, "\n");				\
+			failures++;					\
+		}							\
+	} while (0)
+
+static enum xprt_stat
+decode_request(SVCXPRT *xprt, XDR *xdrs)
+{
+	struct svc_req *req = calloc(1, sizeof(*req));
+	enum xprt_stat stat;
+
+	SVC_REF(xprt, SVC_REF_FLAG_NONE);
+	req->rq_xprt = xprt;
+	req->rq_xdrs = xdrs;
+	req->rq_refs = 1;
+	stat = SVC_DECODE(req);
+	svc_drc_release(req);
+	if (req->rq_auth)
+		SVCAUTH_RELEASE(req);
+	XDR_DESTROY(req->rq_xdrs);
+	SVC_RELEASE(xprt, SVC_RELEASE_FLAG_NONE);
+	free(req);
+	return stat;
+}
+
+static enum xprt_stat
+process_request(struct svc_req *req)
+{
+	u_int proc = req->rq_msg.cb_proc;
+	enum auth_stat why;
+	bool no_dispatch = false;
+	uint32_t arg;
+
+	why = svc_auth_authenticate(req, &no_dispatch);
+	if (why != AUTH_OK)
+		return svcerr_auth(req, why);
+	if (no_dispatch)
+		return (XPRT_IDLE);
+
+	/* sums the arguments for the cache */
+	req->rq_msg.rm_xdr.where = &arg;
+	req->rq_msg.rm_xdr.proc = (xdrproc_t) xdr_uint32_t;
+	if (!SVCAUTH_CHECKSUM(req))
+		return svcerr_decode(req);
+
+	if (svc_drc_start(req) != SVC_DRC_NEW)
+		return (XPRT_IDLE);
+
+	pthread_mutex_lock(&test_mtx);
+	executed[proc % 3]++;
+	if (proc == TEST_PROC_SLOW) {
+		slow_waiting++;
+		pthread_cond_broadcast(&test_cv);
+		while (!slow_released)
+			pthread_cond_wait(&test_cv, &test_mtx);
+		slow_waiting--;
+	}
+	pthread_mutex_unlock(&test_mtx);
+
+	req->rq_msg.RPCM_ack.ar_results.where = NULL;
+	req->rq_msg.RPCM_ack.ar_results.proc = (xdrproc_t) xdr_void;
+	return svc_sendreply(req);
+}
+
+static enum xprt_stat
+rendezvous_request(SVCXPRT *xprt)
+{
+	xprt->xp_dispatch.process_cb = process_request;
+	return SVC_RECV(xprt);
+}
+
+static u_int
+executions(u_int proc)
+{
+	u_int n;
+
+	pthread_mutex_lock(&test_mtx);
+	n = executed[proc];
+	pthread_mutex_unlock(&test_mtx);
+	return (n);
+}
+
+/*
+ * Returns true when n slow calls are executing, within 5 seconds.
+ */
+static bool
+wait_slow(u_int n)
+{
+	struct timespec ts;
+	bool result;
+
+	clock_gettime(CLOCK_REALTIME, &ts);
+	ts.tv_sec += 5;
+
+	pthread_mutex_lock(&test_mtx);
+	while (slow_waiting < n) {
+		if (pthread_cond_timedwait(&test_cv, &test_mtx, &ts)
+		    == ETIMEDOUT)
+			break;
+	}
+	result = (slow_waiting >= n);
+	pthread_mutex_unlock(&test_mtx);
+	return (result);
+}
+
+static void
+release_slow(bool released)
+{
+	pthread_mutex_lock(&test_mtx);
+	slow_released = released;
+	pthread_cond_broadcast(&test_cv);
+	pthread_mutex_unlock(&test_mtx);
+}
+
+/*
+ * Send a call, and wait for its reply.  With a stamp, the credential is
+ * AUTH_SYS, else AUTH_NONE; arg is its one argument.
+ * Returns true when a reply with the xid arrived within timeout_ms.
+ */
+static bool
+call_arg(int fd, uint32_t xid, uint32_t proc, uint32_t stamp, uint32_t arg,
+	 int timeout_ms)
+{
+	uint32_t msg[16];
+	uint32_t reply[16];
+	struct timeval tv;
+	ssize_t n;
+	int i = 0;
+
+	msg[i++] = htonl(xid);
+	msg[i++] = htonl(CALL);
+	msg[i++] = htonl(RPC_MSG_VERSION);
+	msg[i++] = htonl(TEST_PROG);
+	msg[i++] = htonl(TEST_VERS);
+	msg[i++] = htonl(proc);
+	if (stamp) {
+		msg[i++] = htonl(AUTH_SYS);
+		msg[i++] = htonl(5 * BYTES_PER_XDR_UNIT);
+		msg[i++] = htonl(stamp);
+		msg[i++] = 0;	/* machine name */
+		msg[i++] = 0;	/* uid */
+		msg[i++] = 0;	/* gid */
+		msg[i++] = 0;	/* gids */
+	} else {
+		msg[i++] = htonl(AUTH_NONE);
+		msg[i++] = 0;
+	}
+	msg[i++] = htonl(AUTH_NONE);
+	msg[i++] = 0;
+	msg[i++] = htonl(arg);
+	if (send(fd, msg, i * sizeof(uint32_t), 0) != i * sizeof(uint32_t)) {
+		perror("send");
+		return (false);
+	}
+
+	tv.tv_sec = timeout_ms / 1000;
+	tv.tv_usec = (timeout_ms % 1000) * 1000;
+	(void)setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+	for (;;) {
+		n = recv(fd, reply, sizeof(reply), 0);
+		if (n < 0)
+			return (false);
+		if (n >= sizeof(uint32_t) && ntohl(reply[0]) == xid)
+			return (true);
+		/* a late reply to an earlier call */
+	}
+}
+
+static bool
+call(int fd, uint32_t xid, uint32_t proc, int timeout_ms)
+{
+	return call_arg(fd, xid, proc, 0, 0, timeout_ms);
+}
+
+static void
+test_miss_hit(int fd)
+{
+	struct svc_drc_stats st;
+
+	CHECK(call(fd, 1, TEST_PROC_FAST, 2000), "no reply to a new call");
+	CHECK(executions(TEST_PROC_FAST) == 1, "executed %u times",
+	      executions(TEST_PROC_FAST));
+
+	CHECK(call(fd, 1, TEST_PROC_FAST, 2000), "no reply to a retransmit");
+	CHECK(executions(TEST_PROC_FAST) == 1,
+	      "retransmit executed again (%u times)",
+	      executions(TEST_PROC_FAST));
+
+	svc_drc_stats(&st);
+	CHECK(st.misses == 1, "misses %" PRIu64, st.misses);
+	CHECK(st.hits == 1, "hits %" PRIu64, st.hits);
+}
+
+static void
+test_eviction(int fd)
+{
+	struct svc_drc_stats st;
+	u_int before = executions(TEST_PROC_FAST);
+	uint32_t xid;
+
+	for (xid = 100; xid < 140; xid++)
+		CHECK(call(fd, xid, TEST_PROC_FAST, 2000), "no reply to %u",
+		      xid);
+
+	svc_drc_stats(&st);
+	CHECK(st.evicted > 0, "nothing evicted");
+	CHECK(st.bytes <= TEST_MAX_BYTES, "bytes %" PRIu64, st.bytes);
+	CHECK(st.entries <= TEST_MAX_ENTRIES, "entries %" PRIu64, st.entries);
+
+	/* the oldest is gone, the newest replayed */
+	CHECK(call(fd, 100, TEST_PROC_FAST, 2000), "no reply to 100");
+	CHECK(executions(TEST_PROC_FAST) == before + 41,
+	      "evicted call not executed again");
+	CHECK(call(fd, 139, TEST_PROC_FAST, 2000), "no reply to 139");
+	CHECK(executions(TEST_PROC_FAST) == before + 41,
+	      "recent call executed again");
+}
+
+static void
+test_in_progress(int fd)
+{
+	struct svc_drc_stats st;
+
+	release_slow(false);
+
+	/* the original waits; the retransmission is dropped */
+	CHECK(!call(fd, 200, TEST_PROC_SLOW, 100), "reply while waiting");
+	CHECK(wait_slow(1), "not executing");
+	CHECK(!call(fd, 200, TEST_PROC_SLOW, 300),
+	      "reply to a retransmit in progress");
+	CHECK(executions(TEST_PROC_SLOW) == 1, "executed %u times",
+	      executions(TEST_PROC_SLOW));
+	svc_drc_stats(&st);
+	CHECK(st.in_progress == 1, "in_progress %" PRIu64, st.in_progress);
+
+	/* after in_progress_ttl, the retransmission executes */
+	sleep(TEST_IN_PROGRESS_TTL + 2);
+	CHECK(!call(fd, 200, TEST_PROC_SLOW, 100), "reply while waiting");
+	CHECK(wait_slow(2), "aged retransmit not executing");
+	CHECK(executions(TEST_PROC_SLOW) == 2,
+	      "aged retransmit executed %u times",
+	      executions(TEST_PROC_SLOW));
+	svc_drc_stats(&st);
+	CHECK(st.aged == 1, "aged %" PRIu64, st.aged);
+
+	/* both reply, to the same xid */
+	release_slow(true);
+	CHECK(call(fd, 201, TEST_PROC_FAST, 2000), "no reply after release");
+}
+
+/*
+ * RPC_CKSUM_FULL sums the arguments, not the credential: a retransmission
+ * with a new AUTH_SYS stamp is a hit, the same xid with another argument
+ * is not.
+ */
+static void
+test_full_cksum(int fd, SVCXPRT *xprt)
+{
+	u_int type = RPC_CKSUM_CRC32C | RPC_CKSUM_FULL;
+	u_int before = executions(TEST_PROC_FAST);
+
+	CHECK(SVC_CONTROL(xprt, SVCSET_XP_CHECKSUM, &type), "no control");
+
+	CHECK(call_arg(fd, 300, TEST_PROC_FAST, 1, 7, 2000), "no reply");
+	CHECK(call_arg(fd, 300, TEST_PROC_FAST, 2, 7, 2000),
+	      "no reply to a retransmit");
+	CHECK(executions(TEST_PROC_FAST) == before + 1,
+	      "retransmit with another credential executed again");
+
+	CHECK(call_arg(fd, 300, TEST_PROC_FAST, 1, 8, 2000),
+	      "no reply to another argument");
+	CHECK(executions(TEST_PROC_FAST) == before + 2,
+	      "another argument not executed");
+}
+
+int
+main(int argc, char *argv[])
+{
+	svc_init_params svc_params;
+	svc_drc_params drc_params;
+	struct sockaddr_in sin;
+	socklen_t len = sizeof(sin);
+	SVCXPRT *xprt;
+	int sfd;
+	int cfd;
+
+	memset(&svc_params, 0, sizeof(svc_params));
+	svc_params.request_cb = decode_request;
+	svc_params.flags = SVC_INIT_EPOLL;
+	svc_params.max_events = 512;
+	svc_params.ioq_thrd_max = 8;
+	if (!svc_init(&svc_params)) {
+		fprintf(stderr, "svc_init failed\n");
+		return (1);
+	}
+
+	memset(&drc_params, 0, sizeof(drc_params));
+	drc_params.shards = 1;
+	drc_params.max_bytes = TEST_MAX_BYTES;
+	drc_params.max_entries = TEST_MAX_ENTRIES;
+	drc_params.in_progress_ttl = TEST_IN_PROGRESS_TTL;
+	if (!svc_drc_init(&drc_params)) {
+		fprintf(stderr, "svc_drc_init failed\n");
+		return (1);
+	}
+
+	memset(&sin, 0, sizeof(sin));
+	sin.sin_family = AF_INET;
+	sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	sfd = socket(AF_INET, SOCK_DGRAM, 0);
+	if (sfd < 0 || bind(sfd, (struct sockaddr *)&sin, sizeof(sin))
+	 || getsockname(sfd, (struct sockaddr *)&sin, &len)) {
+		perror("server socket");
+		return (1);
+	}
+	xprt = svc_dg_ncreatef(sfd, 0, 0, SVC_CREATE_FLAG_CLOSE);
+	if (!xprt) {
+		fprintf(stderr, "svc_dg_ncreatef failed\n");
+		return (1);
+	}
+	xprt->xp_dispatch.rendezvous_cb = rendezvous_request;
+
+	cfd = socket(AF_INET, SOCK_DGRAM, 0);
+	if (cfd < 0 || connect(cfd, (struct sockaddr *)&sin, sizeof(sin))) {
+		perror("client socket");
+		return (1);
+	}
+
+	test_miss_hit(cfd);
+	test_eviction(cfd);
+	test_in_progress(cfd);
+	test_full_cksum(cfd, xprt);
+
+	close(cfd);
+	SVC_DESTROY(xprt);
+	svc_drc_shutdown();
+	(void)svc_shutdown(SVC_SHUTDOWN_FLAG_NONE);
+
+	if (failures) {
+		fprintf(stderr, "svc_drc_test: %d failed\n", failures);
+		return (1);
+	}
+	printf("svc_drc_test: passed\n");
+	return (0);
+}